@@ -0,0 +1,56 @@
+/**
+ * \file FakeMmal.h
+ * MMAL without the hardware, for running the node on a development machine
+ *
+ * Description
+ *
+ * Built instead of the Broadcom libraries with the CMake option
+ * RASPICAM_FAKE_MMAL. The camera, video splitter and video encoder
+ * components are emulated: the camera renders a synthetic moving scene in
+ * the format of its video port at the frame rate of that port, the splitter
+ * copies it to each of its outputs and the encoder turns it into a JPEG
+ * shaped payload of a fixed size. Every callback comes from one worker
+ * thread per camera, as with the real MMAL, and a frame arriving at an
+ * output port with no buffer queued is dropped for that port.
+ *
+ * The configuration injects the timing faults and failures the node has to
+ * cope with. With probe set, the camera writes a RaspiProbe.h probe of its
+ * frame number and the time into each frame, and the encoder makes a real,
+ * DC only, JPEG of the luma in place of the fixed size payload, so the
+ * probe can be read back from both the raw and the compressed outputs. The
+ * configuration is read from the FAKE_MMAL_* environment variables of the
+ * same names when the first component is created, unless a program sets it
+ * before that.
+ */
+
+#ifndef FAKEMMAL_H_
+#define FAKEMMAL_H_
+
+#include <stdint.h>
+
+#include "interface/mmal/mmal.h"
+
+typedef struct {
+   int jitter_us;              /// Random extra delay before each frame, up to this
+   int stall_after;            /// Frames between stalls of the camera, 0 for none
+   int stall_us;               /// Length of a stall, 0 to stall until capture is set again
+   int fragments;              /// Buffers an encoded frame is split into
+   int fail_every;             /// Every n-th encoded frame fails, 0 for none
+   int encoded_bytes;          /// Size of an encoded frame, 0 for a twentieth of the pixels
+   char fail_create[64];       /// Component whose creation fails, empty for none
+   int probe;                  /// Write a probe into each frame, encode real JPEGs
+} FAKEMMAL_CONFIG;
+
+typedef struct {
+   uint32_t frames;            /// Frames rendered by the camera
+   uint32_t delivered;         /// Buffers handed to callbacks
+   uint32_t dropped;           /// Buffers not delivered for want of a queued buffer
+   uint32_t encoded;           /// Frames through the encoder
+   uint32_t stalls;            /// Stalls injected
+} FAKEMMAL_STATS;
+
+void fakemmal_default_config(FAKEMMAL_CONFIG* config);
+void fakemmal_configure(const FAKEMMAL_CONFIG* config);
+void fakemmal_stats(FAKEMMAL_STATS* stats, int reset);
+
+#endif /* FAKEMMAL_H_ */
@@ -0,0 +1,20 @@
+/**
+ * \file bcm_host.h
+ * Host interface of the fake MMAL, see FakeMmal.h
+ */
+
+#ifndef FAKEMMAL_BCM_HOST_H_
+#define FAKEMMAL_BCM_HOST_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void bcm_host_init(void);
+void bcm_host_deinit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FAKEMMAL_BCM_HOST_H_ */
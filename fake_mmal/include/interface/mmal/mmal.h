@@ -0,0 +1,414 @@
+/**
+ * \file mmal.h
+ * Types and calls of the fake MMAL, see FakeMmal.h
+ *
+ * Description
+ *
+ * The subset of the MMAL API used by the node, with the same names, fields
+ * and meaning, so the node builds unchanged against either. Parameter ids
+ * only have to be distinct here, they are not the firmware's values.
+ */
+
+#ifndef FAKEMMAL_MMAL_H_
+#define FAKEMMAL_MMAL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "interface/vcos/vcos.h"
+#include "interface/mmal/mmal_encodings.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+   MMAL_SUCCESS = 0,
+   MMAL_ENOMEM,
+   MMAL_ENOSPC,
+   MMAL_EINVAL,
+   MMAL_ENOSYS,
+   MMAL_ENOENT,
+   MMAL_ENXIO,
+   MMAL_EIO,
+   MMAL_ESPIPE,
+   MMAL_ECORRUPT,
+   MMAL_ENOTREADY,
+   MMAL_ECONFIG,
+   MMAL_EISCONN,
+   MMAL_ENOTCONN,
+   MMAL_EAGAIN,
+   MMAL_EFAULT,
+   MMAL_STATUS_MAX = 0x7FFFFFFF
+} MMAL_STATUS_T;
+
+typedef int32_t MMAL_BOOL_T;
+
+typedef struct {
+   int32_t num, den;
+} MMAL_RATIONAL_T;
+
+typedef struct {
+   int32_t x, y;
+   int32_t width, height;
+} MMAL_RECT_T;
+
+typedef struct {
+   uint32_t width, height;
+   MMAL_RECT_T crop;
+   MMAL_RATIONAL_T frame_rate;
+   MMAL_RATIONAL_T par;
+   uint32_t color_space;
+} MMAL_VIDEO_FORMAT_T;
+
+typedef union {
+   MMAL_VIDEO_FORMAT_T video;
+} MMAL_ES_SPECIFIC_FORMAT_T;
+
+typedef struct {
+   uint32_t type;
+   uint32_t encoding;
+   uint32_t encoding_variant;
+   MMAL_ES_SPECIFIC_FORMAT_T* es;
+   uint32_t bitrate;
+   uint32_t flags;
+   uint32_t extradata_size;
+   uint8_t* extradata;
+} MMAL_ES_FORMAT_T;
+
+/// Buffer flags
+#define MMAL_BUFFER_HEADER_FLAG_EOS                  (1 << 0)
+#define MMAL_BUFFER_HEADER_FLAG_FRAME_START          (1 << 1)
+#define MMAL_BUFFER_HEADER_FLAG_FRAME_END            (1 << 2)
+#define MMAL_BUFFER_HEADER_FLAG_FRAME                (MMAL_BUFFER_HEADER_FLAG_FRAME_START | \
+                                                      MMAL_BUFFER_HEADER_FLAG_FRAME_END)
+#define MMAL_BUFFER_HEADER_FLAG_KEYFRAME             (1 << 3)
+#define MMAL_BUFFER_HEADER_FLAG_TRANSMISSION_FAILED  (1 << 9)
+
+#define MMAL_TIME_UNKNOWN (INT64_C(1) << 63)
+
+struct MMAL_POOL_T;
+
+typedef struct MMAL_BUFFER_HEADER_T {
+   struct MMAL_BUFFER_HEADER_T* next;
+   struct MMAL_POOL_T* pool;   /// Where the header goes back once released
+   int refcount;
+   uint32_t cmd;
+   uint8_t* data;
+   uint32_t alloc_size;
+   uint32_t length;
+   uint32_t offset;
+   uint32_t flags;
+   int64_t pts;
+   int64_t dts;
+   void* user_data;
+} MMAL_BUFFER_HEADER_T;
+
+struct FAKEMMAL_QUEUE;
+typedef struct FAKEMMAL_QUEUE MMAL_QUEUE_T;
+
+typedef struct MMAL_POOL_T {
+   MMAL_QUEUE_T* queue;        /// Headers not in use
+   uint32_t headers_num;
+   MMAL_BUFFER_HEADER_T** header;
+} MMAL_POOL_T;
+
+typedef enum {
+   MMAL_PORT_TYPE_UNKNOWN = 0,
+   MMAL_PORT_TYPE_CONTROL,
+   MMAL_PORT_TYPE_INPUT,
+   MMAL_PORT_TYPE_OUTPUT,
+   MMAL_PORT_TYPE_CLOCK
+} MMAL_PORT_TYPE_T;
+
+struct MMAL_PORT_T;
+struct MMAL_COMPONENT_T;
+struct MMAL_PORT_USERDATA_T;
+struct FAKEMMAL_PORT;
+
+typedef void (*MMAL_PORT_BH_CB_T)(struct MMAL_PORT_T* port,
+                                  MMAL_BUFFER_HEADER_T* buffer);
+
+typedef struct MMAL_PORT_T {
+   struct FAKEMMAL_PORT* priv;
+   const char* name;
+   MMAL_PORT_TYPE_T type;
+   uint16_t index;
+   uint16_t index_all;
+   uint32_t is_enabled;
+   MMAL_ES_FORMAT_T* format;
+   uint32_t buffer_num_min;
+   uint32_t buffer_size_min;
+   uint32_t buffer_alignment_min;
+   uint32_t buffer_num_recommended;
+   uint32_t buffer_size_recommended;
+   uint32_t buffer_num;
+   uint32_t buffer_size;
+   struct MMAL_COMPONENT_T* component;
+   struct MMAL_PORT_USERDATA_T* userdata;
+   uint32_t capabilities;
+} MMAL_PORT_T;
+
+struct FAKEMMAL_COMPONENT;
+
+typedef struct MMAL_COMPONENT_T {
+   struct FAKEMMAL_COMPONENT* priv;
+   void* userdata;
+   const char* name;
+   uint32_t is_enabled;
+   MMAL_PORT_T* control;
+   uint32_t input_num;
+   MMAL_PORT_T** input;
+   uint32_t output_num;
+   MMAL_PORT_T** output;
+   uint32_t port_num;
+   MMAL_PORT_T** port;
+   uint32_t id;
+} MMAL_COMPONENT_T;
+
+#define MMAL_COMPONENT_DEFAULT_CAMERA         "vc.ril.camera"
+#define MMAL_COMPONENT_DEFAULT_VIDEO_SPLITTER "vc.ril.video_splitter"
+#define MMAL_COMPONENT_DEFAULT_VIDEO_ENCODER  "vc.ril.video_encode"
+
+#define MMAL_CAMERA_PREVIEW_PORT 0
+#define MMAL_CAMERA_VIDEO_PORT   1
+#define MMAL_CAMERA_CAPTURE_PORT 2
+
+#define MMAL_CONNECTION_FLAG_TUNNELLING          0x1
+#define MMAL_CONNECTION_FLAG_ALLOCATION_ON_INPUT 0x2
+
+typedef struct MMAL_CONNECTION_T {
+   void* user_data;
+   uint32_t flags;
+   MMAL_PORT_T* in;
+   MMAL_PORT_T* out;
+   uint32_t is_enabled;
+   const char* name;
+} MMAL_CONNECTION_T;
+
+/// Parameters
+typedef struct {
+   uint32_t id;
+   uint32_t size;
+} MMAL_PARAMETER_HEADER_T;
+
+enum {
+   MMAL_PARAMETER_CAMERA_CONFIG = 0x10000,
+   MMAL_PARAMETER_CAPTURE,
+   MMAL_PARAMETER_ROTATION,
+   MMAL_PARAMETER_MIRROR,
+   MMAL_PARAMETER_INPUT_CROP,
+   MMAL_PARAMETER_SATURATION,
+   MMAL_PARAMETER_SHARPNESS,
+   MMAL_PARAMETER_CONTRAST,
+   MMAL_PARAMETER_BRIGHTNESS,
+   MMAL_PARAMETER_ISO,
+   MMAL_PARAMETER_EXP_METERING_MODE,
+   MMAL_PARAMETER_VIDEO_STABILISATION,
+   MMAL_PARAMETER_EXPOSURE_COMP,
+   MMAL_PARAMETER_EXPOSURE_MODE,
+   MMAL_PARAMETER_AWB_MODE,
+   MMAL_PARAMETER_IMAGE_EFFECT,
+   MMAL_PARAMETER_IMAGE_EFFECT_PARAMETERS,
+   MMAL_PARAMETER_COLOUR_EFFECT,
+   MMAL_PARAMETER_VIDEO_BIT_RATE,
+   MMAL_PARAMETER_JPEG_Q_FACTOR,
+   MMAL_PARAMETER_JPEG_RESTART_INTERVAL,
+   MMAL_PARAMETER_SYSTEM_TIME
+};
+
+typedef enum {
+   MMAL_PARAM_EXPOSUREMODE_OFF,
+   MMAL_PARAM_EXPOSUREMODE_AUTO,
+   MMAL_PARAM_EXPOSUREMODE_NIGHT,
+   MMAL_PARAM_EXPOSUREMODE_NIGHTPREVIEW,
+   MMAL_PARAM_EXPOSUREMODE_BACKLIGHT,
+   MMAL_PARAM_EXPOSUREMODE_SPOTLIGHT,
+   MMAL_PARAM_EXPOSUREMODE_SPORTS,
+   MMAL_PARAM_EXPOSUREMODE_SNOW,
+   MMAL_PARAM_EXPOSUREMODE_BEACH,
+   MMAL_PARAM_EXPOSUREMODE_VERYLONG,
+   MMAL_PARAM_EXPOSUREMODE_FIXEDFPS,
+   MMAL_PARAM_EXPOSUREMODE_ANTISHAKE,
+   MMAL_PARAM_EXPOSUREMODE_FIREWORKS,
+   MMAL_PARAM_EXPOSUREMODE_MAX = 0x7fffffff
+} MMAL_PARAM_EXPOSUREMODE_T;
+
+typedef struct {
+   MMAL_PARAMETER_HEADER_T hdr;
+   MMAL_PARAM_EXPOSUREMODE_T value;
+} MMAL_PARAMETER_EXPOSUREMODE_T;
+
+typedef enum {
+   MMAL_PARAM_EXPOSUREMETERINGMODE_AVERAGE,
+   MMAL_PARAM_EXPOSUREMETERINGMODE_SPOT,
+   MMAL_PARAM_EXPOSUREMETERINGMODE_BACKLIT,
+   MMAL_PARAM_EXPOSUREMETERINGMODE_MATRIX,
+   MMAL_PARAM_EXPOSUREMETERINGMODE_MAX = 0x7fffffff
+} MMAL_PARAM_EXPOSUREMETERINGMODE_T;
+
+typedef struct {
+   MMAL_PARAMETER_HEADER_T hdr;
+   MMAL_PARAM_EXPOSUREMETERINGMODE_T value;
+} MMAL_PARAMETER_EXPOSUREMETERINGMODE_T;
+
+typedef enum {
+   MMAL_PARAM_AWBMODE_OFF,
+   MMAL_PARAM_AWBMODE_AUTO,
+   MMAL_PARAM_AWBMODE_SUNLIGHT,
+   MMAL_PARAM_AWBMODE_CLOUDY,
+   MMAL_PARAM_AWBMODE_SHADE,
+   MMAL_PARAM_AWBMODE_TUNGSTEN,
+   MMAL_PARAM_AWBMODE_FLUORESCENT,
+   MMAL_PARAM_AWBMODE_INCANDESCENT,
+   MMAL_PARAM_AWBMODE_FLASH,
+   MMAL_PARAM_AWBMODE_HORIZON,
+   MMAL_PARAM_AWBMODE_MAX = 0x7fffffff
+} MMAL_PARAM_AWBMODE_T;
+
+typedef struct {
+   MMAL_PARAMETER_HEADER_T hdr;
+   MMAL_PARAM_AWBMODE_T value;
+} MMAL_PARAMETER_AWBMODE_T;
+
+typedef enum {
+   MMAL_PARAM_IMAGEFX_NONE,
+   MMAL_PARAM_IMAGEFX_NEGATIVE,
+   MMAL_PARAM_IMAGEFX_SOLARIZE,
+   MMAL_PARAM_IMAGEFX_POSTERIZE,
+   MMAL_PARAM_IMAGEFX_WHITEBOARD,
+   MMAL_PARAM_IMAGEFX_BLACKBOARD,
+   MMAL_PARAM_IMAGEFX_SKETCH,
+   MMAL_PARAM_IMAGEFX_DENOISE,
+   MMAL_PARAM_IMAGEFX_EMBOSS,
+   MMAL_PARAM_IMAGEFX_OILPAINT,
+   MMAL_PARAM_IMAGEFX_HATCH,
+   MMAL_PARAM_IMAGEFX_GPEN,
+   MMAL_PARAM_IMAGEFX_PASTEL,
+   MMAL_PARAM_IMAGEFX_WATERCOLOUR,
+   MMAL_PARAM_IMAGEFX_FILM,
+   MMAL_PARAM_IMAGEFX_BLUR,
+   MMAL_PARAM_IMAGEFX_SATURATION,
+   MMAL_PARAM_IMAGEFX_COLOURSWAP,
+   MMAL_PARAM_IMAGEFX_WASHEDOUT,
+   MMAL_PARAM_IMAGEFX_POSTERISE,
+   MMAL_PARAM_IMAGEFX_COLOURPOINT,
+   MMAL_PARAM_IMAGEFX_COLOURBALANCE,
+   MMAL_PARAM_IMAGEFX_CARTOON,
+   MMAL_PARAM_IMAGEFX_MAX = 0x7fffffff
+} MMAL_PARAM_IMAGEFX_T;
+
+typedef struct {
+   MMAL_PARAMETER_HEADER_T hdr;
+   MMAL_PARAM_IMAGEFX_T value;
+} MMAL_PARAMETER_IMAGEFX_T;
+
+#define MMAL_MAX_IMAGEFX_PARAMETERS 6
+
+typedef struct {
+   MMAL_PARAMETER_HEADER_T hdr;
+   MMAL_PARAM_IMAGEFX_T effect;
+   uint32_t num_effect_params;
+   uint32_t effect_parameter[MMAL_MAX_IMAGEFX_PARAMETERS];
+} MMAL_PARAMETER_IMAGEFX_PARAMETERS_T;
+
+typedef struct {
+   MMAL_PARAMETER_HEADER_T hdr;
+   MMAL_BOOL_T enable;
+   uint32_t u;
+   uint32_t v;
+} MMAL_PARAMETER_COLOURFX_T;
+
+typedef enum {
+   MMAL_PARAM_MIRROR_NONE,
+   MMAL_PARAM_MIRROR_VERTICAL,
+   MMAL_PARAM_MIRROR_HORIZONTAL,
+   MMAL_PARAM_MIRROR_BOTH
+} MMAL_PARAM_MIRROR_T;
+
+typedef struct {
+   MMAL_PARAMETER_HEADER_T hdr;
+   MMAL_PARAM_MIRROR_T value;
+} MMAL_PARAMETER_MIRROR_T;
+
+typedef struct {
+   MMAL_PARAMETER_HEADER_T hdr;
+   MMAL_RECT_T rect;
+} MMAL_PARAMETER_INPUT_CROP_T;
+
+typedef enum {
+   MMAL_PARAM_TIMESTAMP_MODE_ZERO,
+   MMAL_PARAM_TIMESTAMP_MODE_RAW_STC,
+   MMAL_PARAM_TIMESTAMP_MODE_RESET_STC
+} MMAL_CAMERA_STC_MODE_T;
+
+typedef struct {
+   MMAL_PARAMETER_HEADER_T hdr;
+   uint32_t max_stills_w;
+   uint32_t max_stills_h;
+   uint32_t stills_yuv422;
+   uint32_t one_shot_stills;
+   uint32_t max_preview_video_w;
+   uint32_t max_preview_video_h;
+   uint32_t num_preview_video_frames;
+   uint32_t stills_capture_circular_buffer_height;
+   uint32_t fast_preview_resume;
+   MMAL_CAMERA_STC_MODE_T use_stc_timestamp;
+} MMAL_PARAMETER_CAMERA_CONFIG_T;
+
+/// Components and ports
+MMAL_STATUS_T mmal_component_create(const char* name, MMAL_COMPONENT_T** component);
+MMAL_STATUS_T mmal_component_destroy(MMAL_COMPONENT_T* component);
+MMAL_STATUS_T mmal_component_enable(MMAL_COMPONENT_T* component);
+MMAL_STATUS_T mmal_component_disable(MMAL_COMPONENT_T* component);
+
+MMAL_STATUS_T mmal_port_format_commit(MMAL_PORT_T* port);
+void mmal_format_copy(MMAL_ES_FORMAT_T* format_dest, MMAL_ES_FORMAT_T* format_src);
+MMAL_STATUS_T mmal_port_enable(MMAL_PORT_T* port, MMAL_PORT_BH_CB_T cb);
+MMAL_STATUS_T mmal_port_disable(MMAL_PORT_T* port);
+MMAL_STATUS_T mmal_port_send_buffer(MMAL_PORT_T* port, MMAL_BUFFER_HEADER_T* buffer);
+
+MMAL_STATUS_T mmal_port_parameter_set(MMAL_PORT_T* port,
+                                      const MMAL_PARAMETER_HEADER_T* param);
+MMAL_STATUS_T mmal_port_parameter_set_boolean(MMAL_PORT_T* port, uint32_t id,
+                                              MMAL_BOOL_T value);
+MMAL_STATUS_T mmal_port_parameter_set_uint32(MMAL_PORT_T* port, uint32_t id,
+                                             uint32_t value);
+MMAL_STATUS_T mmal_port_parameter_set_int32(MMAL_PORT_T* port, uint32_t id,
+                                            int32_t value);
+MMAL_STATUS_T mmal_port_parameter_set_rational(MMAL_PORT_T* port, uint32_t id,
+                                               MMAL_RATIONAL_T value);
+MMAL_STATUS_T mmal_port_parameter_get_uint64(MMAL_PORT_T* port, uint32_t id,
+                                             uint64_t* value);
+
+/// Connections
+MMAL_STATUS_T mmal_connection_create(MMAL_CONNECTION_T** connection, MMAL_PORT_T* out,
+                                     MMAL_PORT_T* in, uint32_t flags);
+MMAL_STATUS_T mmal_connection_enable(MMAL_CONNECTION_T* connection);
+MMAL_STATUS_T mmal_connection_disable(MMAL_CONNECTION_T* connection);
+MMAL_STATUS_T mmal_connection_destroy(MMAL_CONNECTION_T* connection);
+
+/// Pools, queues and buffers
+MMAL_POOL_T* mmal_pool_create(unsigned int headers, uint32_t payload_size);
+void mmal_pool_destroy(MMAL_POOL_T* pool);
+MMAL_POOL_T* mmal_port_pool_create(MMAL_PORT_T* port, unsigned int headers,
+                                   uint32_t payload_size);
+void mmal_port_pool_destroy(MMAL_PORT_T* port, MMAL_POOL_T* pool);
+
+MMAL_BUFFER_HEADER_T* mmal_queue_get(MMAL_QUEUE_T* queue);
+void mmal_queue_put(MMAL_QUEUE_T* queue, MMAL_BUFFER_HEADER_T* buffer);
+unsigned int mmal_queue_length(MMAL_QUEUE_T* queue);
+
+void mmal_buffer_header_acquire(MMAL_BUFFER_HEADER_T* header);
+void mmal_buffer_header_release(MMAL_BUFFER_HEADER_T* header);
+void mmal_buffer_header_reset(MMAL_BUFFER_HEADER_T* header);
+MMAL_STATUS_T mmal_buffer_header_mem_lock(MMAL_BUFFER_HEADER_T* header);
+void mmal_buffer_header_mem_unlock(MMAL_BUFFER_HEADER_T* header);
+
+const char* mmal_status_to_string(MMAL_STATUS_T status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FAKEMMAL_MMAL_H_ */
@@ -0,0 +1,6 @@
+/**
+ * \file mmal_buffer.h
+ * Everything of the fake MMAL is declared in mmal.h
+ */
+
+#include "interface/mmal/mmal.h"
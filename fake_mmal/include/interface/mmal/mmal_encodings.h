@@ -0,0 +1,20 @@
+/**
+ * \file mmal_encodings.h
+ * Encodings known to the fake MMAL, with the values of the real ones
+ */
+
+#ifndef FAKEMMAL_MMAL_ENCODINGS_H_
+#define FAKEMMAL_MMAL_ENCODINGS_H_
+
+#define MMAL_FOURCC(a, b, c, d) \
+   ((a) | ((b) << 8) | ((c) << 16) | ((uint32_t)(d) << 24))
+
+#define MMAL_ENCODING_I420      MMAL_FOURCC('I', '4', '2', '0')
+#define MMAL_ENCODING_RGB24     MMAL_FOURCC('R', 'G', 'B', '3')
+#define MMAL_ENCODING_BGR16     MMAL_FOURCC('B', 'G', 'R', '2')
+#define MMAL_ENCODING_OPAQUE    MMAL_FOURCC('O', 'P', 'Q', 'V')
+#define MMAL_ENCODING_MJPEG     MMAL_FOURCC('M', 'J', 'P', 'G')
+#define MMAL_ENCODING_JPEG      MMAL_FOURCC('J', 'P', 'E', 'G')
+#define MMAL_ENCODING_UNKNOWN   0
+
+#endif /* FAKEMMAL_MMAL_ENCODINGS_H_ */
@@ -0,0 +1,33 @@
+/**
+ * \file vcos.h
+ * The part of VCOS used with the fake MMAL, see FakeMmal.h
+ *
+ * Description
+ *
+ * Logging goes to stderr, and there is only the one log category.
+ */
+
+#ifndef FAKEMMAL_VCOS_H_
+#define FAKEMMAL_VCOS_H_
+
+#include <stdio.h>
+#include <assert.h>
+
+#define VCOS_ALIGN_UP(p, n) (((p) + (n) - 1) & ~((n) - 1))
+#define VCOS_ALIGN_DOWN(p, n) ((p) & ~((n) - 1))
+
+#define vcos_assert(cond) assert(cond)
+
+typedef struct {
+   const char* name;
+} VCOS_LOG_CAT_T;
+
+#define VCOS_LOG_CATEGORY (&fakemmal_log_category)
+extern VCOS_LOG_CAT_T fakemmal_log_category;
+
+#define vcos_log_register(module, category) ((category)->name = (module))
+#define vcos_log_error(...) \
+   (fprintf(stderr, "%s: ", fakemmal_log_category.name ? fakemmal_log_category.name : "vcos"), \
+    fprintf(stderr, __VA_ARGS__), fputc('\n', stderr))
+
+#endif /* FAKEMMAL_VCOS_H_ */
@@ -0,0 +1,24 @@
+/**
+ * \file vc_vchi_gencmd.h
+ * General commands of the fake MMAL, see FakeMmal.h
+ *
+ * Description
+ *
+ * There is no firmware to ask: every command fails.
+ */
+
+#ifndef FAKEMMAL_VC_VCHI_GENCMD_H_
+#define FAKEMMAL_VC_VCHI_GENCMD_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int vc_gencmd(char* response, int maxlen, const char* format, ...);
+int vc_gencmd_number_property(char* text, const char* property, int* number);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FAKEMMAL_VC_VCHI_GENCMD_H_ */
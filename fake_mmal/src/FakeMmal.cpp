@@ -0,0 +1,957 @@
+/**
+ * \file FakeMmal.cpp
+ * MMAL without the hardware, for running the node on a development machine
+ *
+ * Description
+ *
+ * One lock covers the state of every component and port. The camera worker
+ * holds it while it moves a frame through the tunnels, and drops it around
+ * each callback so the callback can send buffers back and the node can
+ * disable ports meanwhile; disabling a port waits for a callback still
+ * running on it. Queues have a lock of their own, as pools are used from
+ * the callbacks and from the node's threads alike.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <condition_variable>
+
+#include "FakeMmal.h"
+#include "RaspiProbe.h"
+#include "bcm_host.h"
+#include "interface/vmcs_host/vc_vchi_gencmd.h"
+
+VCOS_LOG_CAT_T fakemmal_log_category;
+
+#define FAKEMMAL_MAX_INPUTS  1
+#define FAKEMMAL_MAX_OUTPUTS 4
+
+/// Kinds of component
+#define FAKEMMAL_CAMERA   0
+#define FAKEMMAL_SPLITTER 1
+#define FAKEMMAL_ENCODER  2
+
+struct FAKEMMAL_QUEUE {
+   std::mutex lock;
+   MMAL_BUFFER_HEADER_T* head;
+   MMAL_BUFFER_HEADER_T* tail;
+   unsigned int length;
+};
+
+struct FAKEMMAL_COMPONENT;
+
+struct FAKEMMAL_PORT {
+   MMAL_PORT_T port;
+   MMAL_ES_FORMAT_T format;
+   MMAL_ES_SPECIFIC_FORMAT_T es;
+   std::string name;
+   FAKEMMAL_COMPONENT* owner;
+   MMAL_PORT_BH_CB_T cb;
+   MMAL_QUEUE_T queue;         /// Buffers sent by the client
+   MMAL_CONNECTION_T* connection;  /// Tunnel from this output, if any
+   int busy;                   /// Callbacks running on the port
+};
+
+struct FAKEMMAL_COMPONENT {
+   MMAL_COMPONENT_T component;
+   int kind;
+   std::string name;
+   FAKEMMAL_PORT control;
+   FAKEMMAL_PORT inputs[FAKEMMAL_MAX_INPUTS];
+   FAKEMMAL_PORT outputs[FAKEMMAL_MAX_OUTPUTS];
+   MMAL_PORT_T* input_ports[FAKEMMAL_MAX_INPUTS];
+   MMAL_PORT_T* output_ports[FAKEMMAL_MAX_OUTPUTS];
+   MMAL_PORT_T* all_ports[1 + FAKEMMAL_MAX_INPUTS + FAKEMMAL_MAX_OUTPUTS];
+   std::thread worker;         /// Camera only
+   int running;
+   int capture;                /// Set through MMAL_PARAMETER_CAPTURE on the video port
+   int stalled;                /// Stalled until capture is set again
+   std::vector<uint8_t> pixels;    /// Frame being delivered
+   std::vector<uint8_t> encoded;   /// Encoder output being delivered
+};
+
+static std::mutex lock;
+static std::condition_variable changed;    /// Capture, running or busy changed
+static FAKEMMAL_CONFIG config;
+static int configured;
+static FAKEMMAL_STATS stats;
+static __thread int in_callback;
+/// Time the buffer pts count from, the start of the last capture
+static std::chrono::steady_clock::time_point stc_start;
+
+/**
+ * Read the configuration from the FAKE_MMAL_* environment variables
+ *
+ * @param config Filled with the configuration, defaults for unset variables
+ */
+void fakemmal_default_config(FAKEMMAL_CONFIG* config) {
+   const char* value;
+
+   memset(config, 0, sizeof(FAKEMMAL_CONFIG));
+   config->fragments = 1;
+   if ((value = getenv("FAKE_MMAL_JITTER_US")))
+      config->jitter_us = atoi(value);
+   if ((value = getenv("FAKE_MMAL_STALL_AFTER")))
+      config->stall_after = atoi(value);
+   if ((value = getenv("FAKE_MMAL_STALL_US")))
+      config->stall_us = atoi(value);
+   if ((value = getenv("FAKE_MMAL_FRAGMENTS")))
+      config->fragments = atoi(value) > 0 ? atoi(value) : 1;
+   if ((value = getenv("FAKE_MMAL_FAIL_EVERY")))
+      config->fail_every = atoi(value);
+   if ((value = getenv("FAKE_MMAL_ENCODED_BYTES")))
+      config->encoded_bytes = atoi(value);
+   if ((value = getenv("FAKE_MMAL_FAIL_CREATE")))
+      strncpy(config->fail_create, value, sizeof(config->fail_create) - 1);
+   if ((value = getenv("FAKE_MMAL_PROBE")))
+      config->probe = atoi(value);
+}
+
+/**
+ * Replace the configuration, takes effect from the next frame
+ *
+ * @param new_config Configuration to use
+ */
+void fakemmal_configure(const FAKEMMAL_CONFIG* new_config) {
+   std::lock_guard<std::mutex> guard(lock);
+   config = *new_config;
+   if (config.fragments < 1)
+      config.fragments = 1;
+   configured = 1;
+}
+
+/**
+ * Read the counters
+ *
+ * @param out Filled with the counters
+ * @param reset Set to start counting again from zero
+ */
+void fakemmal_stats(FAKEMMAL_STATS* out, int reset) {
+   std::lock_guard<std::mutex> guard(lock);
+   *out = stats;
+   if (reset)
+      memset(&stats, 0, sizeof(FAKEMMAL_STATS));
+}
+
+void bcm_host_init(void) {
+}
+
+void bcm_host_deinit(void) {
+}
+
+int vc_gencmd(char* response, int maxlen, const char* format, ...) {
+   if (maxlen > 0)
+      response[0] = 0;
+   return -1;
+}
+
+int vc_gencmd_number_property(char* text, const char* property, int* number) {
+   return 0;
+}
+
+const char* mmal_status_to_string(MMAL_STATUS_T status) {
+   static const char* names[] = {
+      "SUCCESS", "ENOMEM", "ENOSPC", "EINVAL", "ENOSYS", "ENOENT", "ENXIO", "EIO",
+      "ESPIPE", "ECORRUPT", "ENOTREADY", "ECONFIG", "EISCONN", "ENOTCONN", "EAGAIN",
+      "EFAULT"
+   };
+   if ((unsigned int)status < sizeof(names) / sizeof(names[0]))
+      return names[status];
+   return "UNKNOWN";
+}
+
+/*
+ * Queues and buffers
+ */
+
+static void queue_init(MMAL_QUEUE_T* queue) {
+   queue->head = queue->tail = NULL;
+   queue->length = 0;
+}
+
+void mmal_queue_put(MMAL_QUEUE_T* queue, MMAL_BUFFER_HEADER_T* buffer) {
+   std::lock_guard<std::mutex> guard(queue->lock);
+   buffer->next = NULL;
+   if (queue->tail)
+      queue->tail->next = buffer;
+   else
+      queue->head = buffer;
+   queue->tail = buffer;
+   queue->length++;
+}
+
+MMAL_BUFFER_HEADER_T* mmal_queue_get(MMAL_QUEUE_T* queue) {
+   std::lock_guard<std::mutex> guard(queue->lock);
+   MMAL_BUFFER_HEADER_T* buffer = queue->head;
+
+   if (!buffer)
+      return NULL;
+   queue->head = buffer->next;
+   if (!queue->head)
+      queue->tail = NULL;
+   queue->length--;
+   buffer->next = NULL;
+   buffer->refcount = 1;
+   return buffer;
+}
+
+unsigned int mmal_queue_length(MMAL_QUEUE_T* queue) {
+   std::lock_guard<std::mutex> guard(queue->lock);
+   return queue->length;
+}
+
+void mmal_buffer_header_reset(MMAL_BUFFER_HEADER_T* header) {
+   header->length = 0;
+   header->offset = 0;
+   header->flags = 0;
+   header->pts = header->dts = MMAL_TIME_UNKNOWN;
+}
+
+void mmal_buffer_header_acquire(MMAL_BUFFER_HEADER_T* header) {
+   __sync_fetch_and_add(&header->refcount, 1);
+}
+
+void mmal_buffer_header_release(MMAL_BUFFER_HEADER_T* header) {
+   if (__sync_sub_and_fetch(&header->refcount, 1) > 0)
+      return;
+   mmal_buffer_header_reset(header);
+   if (header->pool)
+      mmal_queue_put(header->pool->queue, header);
+}
+
+MMAL_STATUS_T mmal_buffer_header_mem_lock(MMAL_BUFFER_HEADER_T* header) {
+   return MMAL_SUCCESS;
+}
+
+void mmal_buffer_header_mem_unlock(MMAL_BUFFER_HEADER_T* header) {
+}
+
+MMAL_POOL_T* mmal_pool_create(unsigned int headers, uint32_t payload_size) {
+   MMAL_POOL_T* pool = new MMAL_POOL_T;
+
+   pool->queue = new MMAL_QUEUE_T;
+   queue_init(pool->queue);
+   pool->headers_num = headers;
+   pool->header = new MMAL_BUFFER_HEADER_T*[headers];
+   for (unsigned int i = 0; i < headers; i++) {
+      MMAL_BUFFER_HEADER_T* header = new MMAL_BUFFER_HEADER_T();
+      header->pool = pool;
+      header->data = payload_size ? (uint8_t*)malloc(payload_size) : NULL;
+      header->alloc_size = payload_size;
+      mmal_buffer_header_reset(header);
+      pool->header[i] = header;
+      mmal_queue_put(pool->queue, header);
+   }
+   return pool;
+}
+
+void mmal_pool_destroy(MMAL_POOL_T* pool) {
+   if (!pool)
+      return;
+   for (unsigned int i = 0; i < pool->headers_num; i++) {
+      free(pool->header[i]->data);
+      delete pool->header[i];
+   }
+   delete[] pool->header;
+   delete pool->queue;
+   delete pool;
+}
+
+MMAL_POOL_T* mmal_port_pool_create(MMAL_PORT_T* port, unsigned int headers,
+                                   uint32_t payload_size) {
+   return mmal_pool_create(headers, payload_size);
+}
+
+void mmal_port_pool_destroy(MMAL_PORT_T* port, MMAL_POOL_T* pool) {
+   mmal_pool_destroy(pool);
+}
+
+/*
+ * Formats
+ */
+
+/**
+ * Bytes of a frame in a format, padded as the camera pads it
+ */
+static uint32_t frame_size(const MMAL_ES_FORMAT_T* format) {
+   const uint32_t width = VCOS_ALIGN_UP(format->es->video.width, 32);
+   const uint32_t height = VCOS_ALIGN_UP(format->es->video.height, 16);
+
+   switch (format->encoding) {
+   case MMAL_ENCODING_I420:
+      return width * height * 3 / 2;
+   case MMAL_ENCODING_RGB24:
+      return width * 3 * height;
+   case MMAL_ENCODING_BGR16:
+      return width * 2 * height;
+   case MMAL_ENCODING_OPAQUE:
+      return 128;
+   default:
+      return 0;
+   }
+}
+
+void mmal_format_copy(MMAL_ES_FORMAT_T* format_dest, MMAL_ES_FORMAT_T* format_src) {
+   MMAL_ES_SPECIFIC_FORMAT_T* es = format_dest->es;
+
+   *format_dest = *format_src;
+   *es = *format_src->es;
+   format_dest->es = es;
+}
+
+static MMAL_STATUS_T commit_locked(MMAL_PORT_T* port) {
+   const MMAL_ES_FORMAT_T* format = port->format;
+
+   if (port->type == MMAL_PORT_TYPE_CONTROL)
+      return MMAL_EINVAL;
+   if (format->encoding == MMAL_ENCODING_MJPEG || format->encoding == MMAL_ENCODING_JPEG) {
+      port->buffer_size_min = 16 << 10;
+      port->buffer_size_recommended = 64 << 10;
+   } else {
+      // An encoder output not set up yet, or a raw port
+      port->buffer_size_min = port->buffer_size_recommended = frame_size(format);
+      if (!port->buffer_size_min && port->type == MMAL_PORT_TYPE_OUTPUT &&
+          port->component->priv->kind != FAKEMMAL_ENCODER)
+         return MMAL_EINVAL;
+   }
+   port->buffer_num_min = 1;
+   port->buffer_num_recommended = 3;
+   if (port->buffer_num < port->buffer_num_min)
+      port->buffer_num = port->buffer_num_min;
+   if (port->buffer_size < port->buffer_size_min)
+      port->buffer_size = port->buffer_size_min;
+   return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_port_format_commit(MMAL_PORT_T* port) {
+   std::lock_guard<std::mutex> guard(lock);
+   return commit_locked(port);
+}
+
+/*
+ * Components
+ */
+
+static void port_init(FAKEMMAL_COMPONENT* owner, FAKEMMAL_PORT* p, MMAL_PORT_TYPE_T type,
+                      int index, const char* kind) {
+   MMAL_PORT_T* port = &p->port;
+
+   memset(port, 0, sizeof(MMAL_PORT_T));
+   memset(&p->format, 0, sizeof(MMAL_ES_FORMAT_T));
+   memset(&p->es, 0, sizeof(MMAL_ES_SPECIFIC_FORMAT_T));
+   p->name = owner->name + ":" + kind + ":" + std::to_string(index);
+   p->owner = owner;
+   p->cb = NULL;
+   p->connection = NULL;
+   p->busy = 0;
+   queue_init(&p->queue);
+   p->format.es = &p->es;
+   p->format.encoding = MMAL_ENCODING_I420;
+   p->es.video.width = p->es.video.crop.width = 640;
+   p->es.video.height = p->es.video.crop.height = 480;
+   p->es.video.frame_rate.num = 30;
+   p->es.video.frame_rate.den = 1;
+   port->priv = p;
+   port->name = p->name.c_str();
+   port->type = type;
+   port->index = index;
+   port->format = &p->format;
+   port->component = &owner->component;
+   port->buffer_num_min = port->buffer_num_recommended = 3;
+   port->buffer_num = 3;
+}
+
+static void camera_loop(FAKEMMAL_COMPONENT* camera);
+
+MMAL_STATUS_T mmal_component_create(const char* name, MMAL_COMPONENT_T** component) {
+   std::lock_guard<std::mutex> guard(lock);
+   int kind, inputs, outputs;
+
+   if (!configured) {
+      fakemmal_default_config(&config);
+      configured = 1;
+   }
+   if (strcmp(name, MMAL_COMPONENT_DEFAULT_CAMERA) == 0) {
+      kind = FAKEMMAL_CAMERA;
+      inputs = 0;
+      outputs = 3;
+   } else if (strcmp(name, MMAL_COMPONENT_DEFAULT_VIDEO_SPLITTER) == 0) {
+      kind = FAKEMMAL_SPLITTER;
+      inputs = 1;
+      outputs = 4;
+   } else if (strcmp(name, MMAL_COMPONENT_DEFAULT_VIDEO_ENCODER) == 0) {
+      kind = FAKEMMAL_ENCODER;
+      inputs = 1;
+      outputs = 1;
+   } else {
+      return MMAL_ENOENT;
+   }
+   if (strcmp(name, config.fail_create) == 0)
+      return MMAL_ENOMEM;
+
+   FAKEMMAL_COMPONENT* c = new FAKEMMAL_COMPONENT;
+   MMAL_COMPONENT_T* comp = &c->component;
+   memset(comp, 0, sizeof(MMAL_COMPONENT_T));
+   c->kind = kind;
+   c->name = name;
+   c->running = 0;
+   c->capture = 0;
+   c->stalled = 0;
+   comp->priv = c;
+   comp->name = c->name.c_str();
+   port_init(c, &c->control, MMAL_PORT_TYPE_CONTROL, 0, "control");
+   comp->control = &c->control.port;
+   c->all_ports[0] = comp->control;
+   for (int i = 0; i < inputs; i++) {
+      port_init(c, &c->inputs[i], MMAL_PORT_TYPE_INPUT, i, "in");
+      c->input_ports[i] = &c->inputs[i].port;
+      c->all_ports[1 + i] = c->input_ports[i];
+   }
+   for (int i = 0; i < outputs; i++) {
+      port_init(c, &c->outputs[i], MMAL_PORT_TYPE_OUTPUT, i, "out");
+      c->output_ports[i] = &c->outputs[i].port;
+      c->all_ports[1 + inputs + i] = c->output_ports[i];
+   }
+   if (kind == FAKEMMAL_CAMERA)
+      c->outputs[MMAL_CAMERA_CAPTURE_PORT].format.encoding = MMAL_ENCODING_OPAQUE;
+   if (kind == FAKEMMAL_ENCODER)
+      c->outputs[0].format.encoding = MMAL_ENCODING_UNKNOWN;
+   comp->input_num = inputs;
+   comp->input = c->input_ports;
+   comp->output_num = outputs;
+   comp->output = c->output_ports;
+   comp->port_num = 1 + inputs + outputs;
+   comp->port = c->all_ports;
+   if (kind == FAKEMMAL_CAMERA) {
+      c->running = 1;
+      c->worker = std::thread(camera_loop, c);
+   }
+   *component = comp;
+   return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_component_destroy(MMAL_COMPONENT_T* component) {
+   FAKEMMAL_COMPONENT* c = component->priv;
+
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      c->running = 0;
+      changed.notify_all();
+   }
+   if (c->worker.joinable())
+      c->worker.join();
+   delete c;
+   return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_component_enable(MMAL_COMPONENT_T* component) {
+   std::lock_guard<std::mutex> guard(lock);
+   component->is_enabled = 1;
+   return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_component_disable(MMAL_COMPONENT_T* component) {
+   std::lock_guard<std::mutex> guard(lock);
+   component->is_enabled = 0;
+   component->priv->capture = 0;
+   changed.notify_all();
+   return MMAL_SUCCESS;
+}
+
+/*
+ * Ports
+ */
+
+MMAL_STATUS_T mmal_port_enable(MMAL_PORT_T* port, MMAL_PORT_BH_CB_T cb) {
+   std::lock_guard<std::mutex> guard(lock);
+
+   if (port->is_enabled)
+      return MMAL_EINVAL;
+   // Only an output feeding a tunnel goes without a callback
+   if (!cb && !(port->type == MMAL_PORT_TYPE_OUTPUT && port->priv->connection))
+      return MMAL_EINVAL;
+   port->priv->cb = cb;
+   port->is_enabled = 1;
+   return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_port_disable(MMAL_PORT_T* port) {
+   FAKEMMAL_PORT* p = port->priv;
+   std::unique_lock<std::mutex> guard(lock);
+   MMAL_BUFFER_HEADER_T* buffer;
+
+   if (!port->is_enabled)
+      return MMAL_EINVAL;
+   port->is_enabled = 0;
+   // No callback once this returns, unless it is called from the callback
+   if (!in_callback)
+      changed.wait(guard, [p] { return p->busy == 0; });
+   p->cb = NULL;
+   // Buffers the port still had go back to their pools
+   while ((buffer = mmal_queue_get(&p->queue)))
+      mmal_buffer_header_release(buffer);
+   return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_port_send_buffer(MMAL_PORT_T* port, MMAL_BUFFER_HEADER_T* buffer) {
+   std::lock_guard<std::mutex> guard(lock);
+
+   if (!buffer)
+      return MMAL_EINVAL;
+   if (!port->is_enabled)
+      return MMAL_EINVAL;
+   mmal_queue_put(&port->priv->queue, buffer);
+   return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_port_parameter_set_boolean(MMAL_PORT_T* port, uint32_t id,
+                                              MMAL_BOOL_T value) {
+   std::lock_guard<std::mutex> guard(lock);
+   FAKEMMAL_COMPONENT* c = port->component->priv;
+
+   if (id == MMAL_PARAMETER_CAPTURE) {
+      if (c->kind != FAKEMMAL_CAMERA || port == c->component.control)
+         return MMAL_EINVAL;
+      // Setting it again also ends a stall
+      c->capture = value;
+      c->stalled = 0;
+      changed.notify_all();
+   }
+   return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_port_parameter_set(MMAL_PORT_T* port,
+                                      const MMAL_PARAMETER_HEADER_T* param) {
+   if (param->id == MMAL_PARAMETER_CAPTURE)
+      return mmal_port_parameter_set_boolean(port, param->id,
+                                             *(const MMAL_BOOL_T*)(param + 1));
+   return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_port_parameter_set_uint32(MMAL_PORT_T* port, uint32_t id,
+                                             uint32_t value) {
+   return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_port_parameter_set_int32(MMAL_PORT_T* port, uint32_t id,
+                                            int32_t value) {
+   return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_port_parameter_set_rational(MMAL_PORT_T* port, uint32_t id,
+                                               MMAL_RATIONAL_T value) {
+   return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_port_parameter_get_uint64(MMAL_PORT_T* port, uint32_t id,
+                                             uint64_t* value) {
+   std::lock_guard<std::mutex> guard(lock);
+
+   if (id != MMAL_PARAMETER_SYSTEM_TIME)
+      return MMAL_ENOSYS;
+   *value = std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - stc_start).count();
+   return MMAL_SUCCESS;
+}
+
+/*
+ * Connections
+ */
+
+MMAL_STATUS_T mmal_connection_create(MMAL_CONNECTION_T** connection, MMAL_PORT_T* out,
+                                     MMAL_PORT_T* in, uint32_t flags) {
+   std::lock_guard<std::mutex> guard(lock);
+
+   if (out->type != MMAL_PORT_TYPE_OUTPUT || in->type != MMAL_PORT_TYPE_INPUT)
+      return MMAL_EINVAL;
+   if (out->priv->connection)
+      return MMAL_EISCONN;
+   // The input takes the format of the output it is tunnelled from
+   mmal_format_copy(in->format, out->format);
+   commit_locked(in);
+
+   MMAL_CONNECTION_T* c = new MMAL_CONNECTION_T();
+   c->flags = flags;
+   c->out = out;
+   c->in = in;
+   c->name = out->name;
+   out->priv->connection = c;
+   *connection = c;
+   return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_connection_enable(MMAL_CONNECTION_T* connection) {
+   std::lock_guard<std::mutex> guard(lock);
+
+   if (connection->is_enabled)
+      return MMAL_SUCCESS;
+   connection->is_enabled = 1;
+   connection->out->is_enabled = 1;
+   connection->in->is_enabled = 1;
+   return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_connection_disable(MMAL_CONNECTION_T* connection) {
+   std::lock_guard<std::mutex> guard(lock);
+
+   connection->is_enabled = 0;
+   connection->out->is_enabled = 0;
+   connection->in->is_enabled = 0;
+   return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_connection_destroy(MMAL_CONNECTION_T* connection) {
+   if (!connection)
+      return MMAL_EINVAL;
+   mmal_connection_disable(connection);
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      connection->out->priv->connection = NULL;
+   }
+   delete connection;
+   return MMAL_SUCCESS;
+}
+
+/*
+ * Camera worker
+ */
+
+/**
+ * Render the synthetic scene: a diagonal gradient scrolling with the frame
+ * number, and a red square crossing the frame
+ */
+static void render(std::vector<uint8_t>& pixels, const MMAL_ES_FORMAT_T* format,
+                   uint32_t frame) {
+   const int width = format->es->video.width, height = format->es->video.height;
+   const int side = height / 8 > 0 ? height / 8 : 1;
+   const int sx = (frame * 4) % (width > side ? width - side : 1), sy = height / 2 - side / 2;
+
+   pixels.resize(frame_size(format));
+   if (format->encoding == MMAL_ENCODING_RGB24) {
+      const int stride = VCOS_ALIGN_UP(width, 32) * 3;
+      for (int y = 0; y < height; y++) {
+         uint8_t* row = &pixels[(size_t)y * stride];
+         for (int x = 0; x < width; x++) {
+            const int inside = x >= sx && x < sx + side && y >= sy && y < sy + side;
+            const uint8_t v = (uint8_t)(x + y + frame * 2);
+            row[x * 3] = inside ? 220 : v;
+            row[x * 3 + 1] = inside ? 30 : v;
+            row[x * 3 + 2] = inside ? 30 : v;
+         }
+      }
+      return;
+   }
+   if (format->encoding != MMAL_ENCODING_I420)
+      return;
+   const int stride = VCOS_ALIGN_UP(width, 32), rows = VCOS_ALIGN_UP(height, 16);
+   uint8_t* u = &pixels[(size_t)stride * rows];
+   uint8_t* v = u + (size_t)(stride / 2) * (rows / 2);
+   for (int y = 0; y < height; y++) {
+      uint8_t* row = &pixels[(size_t)y * stride];
+      for (int x = 0; x < width; x++) {
+         const int inside = x >= sx && x < sx + side && y >= sy && y < sy + side;
+         row[x] = inside ? 82 : (uint8_t)(x + y + frame * 2);
+      }
+   }
+   for (int y = 0; y < height / 2; y++) {
+      for (int x = 0; x < width / 2; x++) {
+         const int inside = x * 2 >= sx && x * 2 < sx + side && y * 2 >= sy && y * 2 < sy + side;
+         u[y * (stride / 2) + x] = inside ? 90 : 128;
+         v[y * (stride / 2) + x] = inside ? 240 : 128;
+      }
+   }
+}
+
+/**
+ * Write the probe of a frame into its luma, or into every channel of RGB
+ */
+static void stamp(std::vector<uint8_t>& pixels, const MMAL_ES_FORMAT_T* format,
+                  uint32_t frame) {
+   const int width = format->es->video.width, height = format->es->video.height;
+   RASPIPROBE_STAMP probe;
+
+   probe.counter = frame;
+   probe.time_us = raspiprobe_now_us();
+   if (format->encoding == MMAL_ENCODING_RGB24)
+      raspiprobe_stamp(&pixels[0], VCOS_ALIGN_UP(width, 32) * 3, 3, width, height, &probe);
+   else if (format->encoding == MMAL_ENCODING_I420)
+      raspiprobe_stamp(&pixels[0], VCOS_ALIGN_UP(width, 32), 1, width, height, &probe);
+}
+
+/*
+ * Encoder
+ */
+
+/// Bits of a JPEG entropy coded segment, with the 0xFF stuffing
+typedef struct {
+   std::vector<uint8_t>* out;
+   uint32_t bits;
+   int count;
+} FAKEMMAL_BITS;
+
+static void put_bits(FAKEMMAL_BITS* b, uint32_t value, int length) {
+   for (int i = length - 1; i >= 0; i--) {
+      b->bits = (b->bits << 1) | ((value >> i) & 1);
+      if (++b->count == 8) {
+         b->out->push_back((uint8_t)b->bits);
+         if ((uint8_t)b->bits == 0xFF)
+            b->out->push_back(0);
+         b->bits = 0;
+         b->count = 0;
+      }
+   }
+}
+
+static void put_marker(std::vector<uint8_t>& out, uint8_t marker, int length) {
+   out.push_back(0xFF);
+   out.push_back(marker);
+   out.push_back((uint8_t)((length + 2) >> 8));
+   out.push_back((uint8_t)(length + 2));
+}
+
+/**
+ * Encode a plane as a baseline greyscale JPEG keeping only the mean of
+ * each 8x8 block: quantiser 1, the standard luminance DC table and an AC
+ * table holding nothing but end of block. The result decodes with any
+ * JPEG decoder to the blocks' means, which is exact for the cells of a
+ * probe.
+ */
+static void encode_jpeg(std::vector<uint8_t>& out, const uint8_t* plane, int stride,
+                        int bytes_per_pixel, int width, int height) {
+   static const uint8_t dc_bits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+   uint16_t dc_code[12];
+   uint8_t dc_length[12];
+   FAKEMMAL_BITS bits = {&out, 0, 0};
+   int previous = 0;
+
+   // Canonical Huffman codes of the DC table, symbols 0 to 11 in order
+   for (int length = 1, code = 0, symbol = 0; length <= 16; length++, code <<= 1) {
+      for (int i = 0; i < dc_bits[length - 1]; i++, code++, symbol++) {
+         dc_code[symbol] = code;
+         dc_length[symbol] = length;
+      }
+   }
+
+   out.clear();
+   out.push_back(0xFF);
+   out.push_back(0xD8);
+   put_marker(out, 0xDB, 65);
+   out.push_back(0);
+   out.insert(out.end(), 64, 1);
+   put_marker(out, 0xC0, 9);
+   out.push_back(8);
+   out.push_back((uint8_t)(height >> 8));
+   out.push_back((uint8_t)height);
+   out.push_back((uint8_t)(width >> 8));
+   out.push_back((uint8_t)width);
+   out.push_back(1);
+   out.push_back(1);
+   out.push_back(0x11);
+   out.push_back(0);
+   put_marker(out, 0xC4, 1 + 16 + 12 + 1 + 16 + 1);
+   out.push_back(0x00);
+   out.insert(out.end(), dc_bits, dc_bits + 16);
+   for (int i = 0; i < 12; i++)
+      out.push_back(i);
+   out.push_back(0x10);
+   out.push_back(1);
+   out.insert(out.end(), 15, 0);
+   out.push_back(0x00);
+   put_marker(out, 0xDA, 6);
+   out.push_back(1);
+   out.push_back(1);
+   out.push_back(0x00);
+   out.push_back(0);
+   out.push_back(63);
+   out.push_back(0);
+
+   for (int by = 0; by < height; by += 8) {
+      for (int bx = 0; bx < width; bx += 8) {
+         int sum = 0;
+         // Edge blocks repeat the last row and column
+         for (int y = by; y < by + 8; y++) {
+            const uint8_t* row = plane + (size_t)(y < height ? y : height - 1) * stride;
+            for (int x = bx; x < bx + 8; x++)
+               sum += row[(x < width ? x : width - 1) * bytes_per_pixel];
+         }
+         // DC of the level shifted block, the DCT scales the mean by 8
+         const int dc = (sum - 64 * 128 + 4) >> 3;
+         const int diff = dc - previous;
+         const int magnitude = diff < 0 ? -diff : diff;
+         int size = 0;
+         while ((magnitude >> size) != 0)
+            size++;
+         put_bits(&bits, dc_code[size], dc_length[size]);
+         if (size)
+            put_bits(&bits, diff < 0 ? diff - 1 : diff, size);
+         put_bits(&bits, 0, 1);
+         previous = dc;
+      }
+   }
+   if (bits.count)
+      put_bits(&bits, 0x7F, 8 - bits.count);
+   out.push_back(0xFF);
+   out.push_back(0xD9);
+}
+
+static void deliver(std::unique_lock<std::mutex>& guard, FAKEMMAL_PORT* out,
+                    const uint8_t* data, uint32_t length, uint32_t flags, int64_t pts);
+
+/**
+ * Encode a frame arriving at the encoder input into a JPEG shaped payload,
+ * or a real JPEG when probing, and deliver it to the output in fragments
+ */
+static void encode(std::unique_lock<std::mutex>& guard, FAKEMMAL_COMPONENT* encoder,
+                   const uint8_t* data, uint32_t length, int64_t pts) {
+   const MMAL_VIDEO_FORMAT_T& video = encoder->inputs[0].format.es->video;
+   FAKEMMAL_PORT* out = &encoder->outputs[0];
+   uint32_t size = config.encoded_bytes > 0 ? config.encoded_bytes
+                   : video.width * video.height / 20;
+   const uint32_t number = stats.encoded++;
+
+   if (config.probe) {
+      const MMAL_ES_FORMAT_T* format = &encoder->inputs[0].format;
+      const int rgb = format->encoding == MMAL_ENCODING_RGB24;
+      // The green channel stands in for the luma of RGB
+      encode_jpeg(encoder->encoded, data + rgb, VCOS_ALIGN_UP(video.width, 32) * (rgb ? 3 : 1),
+                  rgb ? 3 : 1, video.width, video.height);
+      size = encoder->encoded.size();
+   } else {
+      if (size < 8)
+         size = 8;
+      encoder->encoded.resize(size);
+      uint8_t* e = &encoder->encoded[0];
+      for (uint32_t i = 0; i < size; i++)
+         e[i] = (uint8_t)(data[(i * 31) % length] + i);
+      e[0] = 0xFF;
+      e[1] = 0xD8;
+      memcpy(e + 2, &number, 4);
+      e[size - 2] = 0xFF;
+      e[size - 1] = 0xD9;
+   }
+
+   const int failed = config.fail_every > 0 && (number + 1) % config.fail_every == 0;
+   uint32_t piece = (size + config.fragments - 1) / config.fragments;
+   if (out->port.buffer_size && piece > out->port.buffer_size)
+      piece = out->port.buffer_size;
+   for (uint32_t offset = 0; offset < size; offset += piece) {
+      const uint32_t n = (size - offset < piece) ? size - offset : piece;
+      uint32_t flags = 0;
+      if (offset + n == size)
+         flags = MMAL_BUFFER_HEADER_FLAG_FRAME_END |
+                 (failed ? MMAL_BUFFER_HEADER_FLAG_TRANSMISSION_FAILED : 0);
+      deliver(guard, out, &encoder->encoded[offset], n, flags, pts);
+   }
+}
+
+/**
+ * Move data arriving at an output port on: through its tunnel, or to the
+ * client's callback in the next buffer it queued
+ */
+static void deliver(std::unique_lock<std::mutex>& guard, FAKEMMAL_PORT* out,
+                    const uint8_t* data, uint32_t length, uint32_t flags, int64_t pts) {
+   if (!out->port.is_enabled)
+      return;
+   if (out->connection) {
+      if (!out->connection->is_enabled)
+         return;
+      FAKEMMAL_COMPONENT* next = out->connection->in->priv->owner;
+      if (next->kind == FAKEMMAL_SPLITTER) {
+         for (uint32_t i = 0; i < next->component.output_num; i++)
+            deliver(guard, &next->outputs[i], data, length, flags, pts);
+      } else if (next->kind == FAKEMMAL_ENCODER) {
+         encode(guard, next, data, length, pts);
+      }
+      return;
+   }
+   if (!out->cb)
+      return;
+   MMAL_BUFFER_HEADER_T* buffer = mmal_queue_get(&out->queue);
+   if (!buffer) {
+      stats.dropped++;
+      return;
+   }
+   buffer->length = length < buffer->alloc_size ? length : buffer->alloc_size;
+   memcpy(buffer->data, data, buffer->length);
+   buffer->offset = 0;
+   buffer->flags = flags;
+   buffer->pts = buffer->dts = pts;
+
+   MMAL_PORT_BH_CB_T cb = out->cb;
+   out->busy++;
+   stats.delivered++;
+   guard.unlock();
+   in_callback = 1;
+   cb(&out->port, buffer);
+   in_callback = 0;
+   guard.lock();
+   out->busy--;
+   changed.notify_all();
+}
+
+/**
+ * Thread of a camera, renders and delivers frames at the video port's rate
+ * while capture is set
+ */
+static void camera_loop(FAKEMMAL_COMPONENT* camera) {
+   std::unique_lock<std::mutex> guard(lock);
+   std::minstd_rand random(1);
+   FAKEMMAL_PORT* video = &camera->outputs[MMAL_CAMERA_VIDEO_PORT];
+   std::chrono::steady_clock::time_point start, next;
+   uint32_t frame = 0, next_stall = 0;
+   int capturing = 0;
+
+   while (camera->running) {
+      if (!camera->capture || camera->stalled) {
+         capturing = 0;
+         changed.wait(guard);
+         continue;
+      }
+      const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if (!capturing) {
+         capturing = 1;
+         start = next = now;
+         stc_start = start;
+         next_stall = frame + config.stall_after;
+      }
+      if (now < next) {
+         changed.wait_until(guard, next);
+         continue;
+      }
+
+      const MMAL_RATIONAL_T rate = video->format.es->video.frame_rate;
+      const int64_t period_us = (rate.num > 0 && rate.den > 0) ?
+                                (int64_t)1000000 * rate.den / rate.num : 33333;
+      next += std::chrono::microseconds(period_us);
+      if (config.jitter_us > 0)
+         next += std::chrono::microseconds(random() % config.jitter_us);
+      // A camera left behind skips frames rather than bursting
+      if (next < now)
+         next = now + std::chrono::microseconds(period_us);
+
+      if (config.stall_after > 0 && frame >= next_stall) {
+         next_stall = frame + config.stall_after;
+         stats.stalls++;
+         if (config.stall_us > 0)
+            next += std::chrono::microseconds(config.stall_us);
+         else
+            camera->stalled = 1;
+         continue;
+      }
+
+      render(camera->pixels, &video->format, frame);
+      if (config.probe)
+         stamp(camera->pixels, &video->format, frame);
+      stats.frames++;
+      const int64_t pts = std::chrono::duration_cast<std::chrono::microseconds>(
+                             now - start).count();
+      deliver(guard, video, camera->pixels.data(), camera->pixels.size(),
+              MMAL_BUFFER_HEADER_FLAG_FRAME_END, pts);
+      frame++;
+   }
+}
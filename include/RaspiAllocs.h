@@ -0,0 +1,23 @@
+/**
+ * \file RaspiAllocs.h
+ * Count of the heap allocations made by the calling thread
+ *
+ * Description
+ *
+ * Built only with RASPI_COUNT_ALLOCATIONS defined (the CMake option
+ * RASPICAM_COUNT_ALLOCATIONS), in which case RaspiAllocs.cpp replaces
+ * malloc, calloc and realloc, and with them operator new. The node reads
+ * the count around its frame callbacks to check that the steady state
+ * makes no allocation.
+ */
+
+#ifndef RASPIALLOCS_H_
+#define RASPIALLOCS_H_
+
+#include <stdint.h>
+
+#if defined(RASPI_COUNT_ALLOCATIONS)
+uint32_t raspiallocs_count();
+#endif
+
+#endif /* RASPIALLOCS_H_ */
@@ -0,0 +1,68 @@
+/**
+ * \file RaspiBlobs.h
+ * Colour blob tracking on YUV ranges
+ *
+ * Description
+ *
+ * Pixels are classified against up to RASPIBLOBS_MAX_COLORS boxes in YUV
+ * space at chroma resolution (one sample per 2x2 block), then runs of the
+ * same colour are merged into 4-connected blobs. Blob positions and areas
+ * are reported in full resolution pixels. When several colours match a
+ * pixel, the first one in the list wins.
+ */
+
+#ifndef RASPIBLOBS_H_
+#define RASPIBLOBS_H_
+
+#include <stdint.h>
+#include <vector>
+
+#define RASPIBLOBS_MAX_COLORS 8
+
+/// Inclusive YUV box of one colour
+typedef struct {
+   uint8_t y_min, y_max;
+   uint8_t u_min, u_max;
+   uint8_t v_min, v_max;
+} RASPIBLOBS_RANGE;
+
+typedef struct {
+   int color;          /// Index of the matching range
+   uint32_t area;      /// Pixels, at full resolution
+   float x;            /// Centroid column
+   float y;            /// Centroid row
+   int x_min, y_min;   /// Bounding box, inclusive
+   int x_max, y_max;
+} RASPIBLOBS_BLOB;
+
+/// Horizontal run of one colour, at chroma resolution
+typedef struct {
+   uint16_t x0, x1;    /// First and last column
+   uint16_t y;
+   uint8_t color;
+   int parent;         /// Union-find link to the run representing the blob
+} RASPIBLOBS_RUN;
+
+typedef struct {
+   int width;          /// Classification width (half the frame width)
+   int height;         /// Classification height (half the frame height)
+   int num_colors;
+   RASPIBLOBS_RANGE ranges[RASPIBLOBS_MAX_COLORS];
+   uint32_t min_area;  /// Smaller blobs are not reported, in full resolution pixels
+   std::vector<uint8_t> labels;   /// Colour index + 1 per sample, 0 for none
+   std::vector<uint8_t> scratch;  /// One row each of Y, U and V samples
+   std::vector<RASPIBLOBS_RUN> runs;
+   std::vector<int> row_start;    /// Index of the first run of each row
+   std::vector<int> blob_index;   /// Blob of each root run, -1 for non-roots
+} RASPIBLOBS_STATE;
+
+int raspiblobs_init(RASPIBLOBS_STATE* state, int width, int height,
+                    const RASPIBLOBS_RANGE* ranges, int num_colors, int min_area);
+void raspiblobs_classify_i420(RASPIBLOBS_STATE* state, const uint8_t* y,
+                              int y_stride, const uint8_t* u, const uint8_t* v,
+                              int uv_stride);
+void raspiblobs_classify_rgb(RASPIBLOBS_STATE* state, const uint8_t* rgb,
+                             int stride);
+int raspiblobs_find(RASPIBLOBS_STATE* state, std::vector<RASPIBLOBS_BLOB>& blobs);
+
+#endif /* RASPIBLOBS_H_ */
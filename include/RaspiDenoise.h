@@ -0,0 +1,33 @@
+/**
+ * \file RaspiDenoise.h
+ * Motion-adaptive recursive temporal filter
+ *
+ * Description
+ *
+ * Each byte is blended with the previous filtered frame,
+ * out = prev + (cur - prev) * strength / 128, unless it differs from it by
+ * more than the motion threshold, in which case it is passed through so that
+ * moving objects are not smeared.
+ */
+
+#ifndef RASPIDENOISE_H_
+#define RASPIDENOISE_H_
+
+#include <stdint.h>
+
+typedef struct {
+   int width;              /// Frame width in pixels
+   int height;             /// Frame height in pixels
+   int bpp;                /// Bytes per pixel
+   int strength;           /// Weight of the new frame in 1/128, lower filters harder
+   int motion_threshold;   /// Differences above this are treated as motion
+   int primed;             /// previous holds a frame
+   uint8_t* previous;      /// Last filtered frame, packed
+} RASPIDENOISE_STATE;
+
+int raspidenoise_init(RASPIDENOISE_STATE* state, int width, int height, int bpp,
+                      int strength, int motion_threshold);
+void raspidenoise_destroy(RASPIDENOISE_STATE* state);
+void raspidenoise_apply(RASPIDENOISE_STATE* state, uint8_t* frame, int stride);
+
+#endif /* RASPIDENOISE_H_ */
@@ -0,0 +1,56 @@
+/**
+ * \file RaspiFeatures.h
+ * FAST corners with grid non-max suppression and steered BRIEF descriptors
+ *
+ * Description
+ *
+ * Corners are FAST-9 on the Y plane. Only the strongest corner of each grid
+ * cell is kept, then the strongest max_features overall. Descriptors are 256
+ * bit rBRIEF (ORB style: intensity centroid orientation, steered pattern)
+ * over a 31x31 patch. The sampling pattern is generated at start-up, so the
+ * descriptors match between frames of this node but not OpenCV's ORB.
+ */
+
+#ifndef RASPIFEATURES_H_
+#define RASPIFEATURES_H_
+
+#include <stdint.h>
+#include <vector>
+
+/// Bytes per descriptor
+#define RASPIFEATURES_DESCRIPTOR_SIZE 32
+/// Keypoints closer than this to the border have no descriptor patch
+#define RASPIFEATURES_PATCH_BORDER 16
+
+typedef struct {
+   float x;          /// Column in pixels
+   float y;          /// Row in pixels
+   float score;      /// Corner strength, larger is stronger
+   float angle;      /// Orientation in radians, only set by raspifeatures_describe()
+} RASPIFEATURES_KEYPOINT;
+
+typedef struct {
+   int width;              /// Frame width in pixels
+   int height;             /// Frame height in pixels
+   int threshold;          /// FAST intensity threshold
+   int cell_size;          /// Edge of the non-max suppression cells in pixels
+   int max_features;       /// Upper bound on the keypoints returned per frame
+   int cells_x;
+   int cells_y;
+   std::vector<RASPIFEATURES_KEYPOINT> cells;  /// Best corner of each cell
+   std::vector<int8_t> pattern;                /// 256 pairs of (x, y) sample offsets
+} RASPIFEATURES_STATE;
+
+int raspifeatures_init(RASPIFEATURES_STATE* state, int width, int height,
+                       int threshold, int cell_size, int max_features);
+
+int raspifeatures_detect(RASPIFEATURES_STATE* state, const uint8_t* y, int stride,
+                         int border, std::vector<RASPIFEATURES_KEYPOINT>& keypoints);
+void raspifeatures_describe(const RASPIFEATURES_STATE* state, const uint8_t* y,
+                            int stride, std::vector<RASPIFEATURES_KEYPOINT>& keypoints,
+                            uint8_t* descriptors);
+void raspifeatures_undistort(const double* K, const double* D, int num_d,
+                             const double* R, const double* P, float x, float y,
+                             float* ux, float* uy);
+
+#endif /* RASPIFEATURES_H_ */
@@ -0,0 +1,112 @@
+/**
+ * \file RaspiFormat.h
+ * Traits of the formats the camera is captured in
+ *
+ * Description
+ *
+ * A format is a traits struct: the MMAL encoding the camera port is set to,
+ * the layout of the planes in a camera buffer, and the ROS encoding and
+ * bytes per pixel of the published frame. Per-frame code is written as a
+ * template on the traits and instantiated once per format; the instance is
+ * picked when the pipeline is built, so the frame path never looks at the
+ * format again. Setup code works from the RASPIFORMAT descriptor of the
+ * same traits. A new format is a new traits struct plus the line selecting
+ * it in the node.
+ */
+
+#ifndef RASPIFORMAT_H_
+#define RASPIFORMAT_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "interface/vcos/vcos.h"
+#include "interface/mmal/mmal_encodings.h"
+#include "sensor_msgs/image_encodings.h"
+
+/// Planes of a camera buffer, unused ones are NULL
+typedef struct {
+   const uint8_t* plane[3];    /// Packed pixels or Y, then U and V
+   int stride[3];              /// Bytes between the starts of two rows
+} RASPIFORMAT_PLANES;
+
+/// Runtime view of a traits struct, for setup code
+typedef struct {
+   uint32_t mmal_encoding;
+   int bytes_per_pixel;
+   int is_luma;
+   int has_chroma;
+   const std::string* encoding;
+} RASPIFORMAT;
+
+/**
+ * I420 capture, published as its Y plane
+ *
+ * The camera pads rows to 32 bytes and the Y plane height to 16 rows; a
+ * buffer too short for that is taken as unpadded.
+ */
+struct RaspiFormatMono8 {
+   static const uint32_t mmal_encoding = MMAL_ENCODING_I420;
+   static const int bytes_per_pixel = 1;   /// Of the published frame
+   static const int is_luma = 1;           /// The published frame is the Y plane
+   static const int has_chroma = 1;        /// The buffer also holds U and V planes
+
+   static const std::string& encoding() {
+      return sensor_msgs::image_encodings::MONO8;
+   }
+
+   static void planes(const uint8_t* data, uint32_t length, int width, int height,
+                      RASPIFORMAT_PLANES* planes) {
+      int stride = VCOS_ALIGN_UP(width, 32);
+      int rows = VCOS_ALIGN_UP(height, 16);
+
+      if (length < (uint32_t)(stride * rows * 3 / 2)) {
+         stride = width;
+         rows = height;
+      }
+      planes->plane[0] = data;
+      planes->plane[1] = data + stride * rows;
+      planes->plane[2] = planes->plane[1] + (stride / 2) * (rows / 2);
+      planes->stride[0] = stride;
+      planes->stride[1] = planes->stride[2] = stride / 2;
+   }
+};
+
+/**
+ * Packed RGB capture, padded like I420
+ */
+struct RaspiFormatRgb8 {
+   static const uint32_t mmal_encoding = MMAL_ENCODING_RGB24;
+   static const int bytes_per_pixel = 3;
+   static const int is_luma = 0;
+   static const int has_chroma = 0;
+
+   static const std::string& encoding() {
+      return sensor_msgs::image_encodings::RGB8;
+   }
+
+   static void planes(const uint8_t* data, uint32_t length, int width, int height,
+                      RASPIFORMAT_PLANES* planes) {
+      int stride = VCOS_ALIGN_UP(width, 32) * 3;
+
+      if (length < (uint32_t)(stride * VCOS_ALIGN_UP(height, 16)))
+         stride = width * 3;
+      planes->plane[0] = data;
+      planes->plane[1] = planes->plane[2] = NULL;
+      planes->stride[0] = stride;
+      planes->stride[1] = planes->stride[2] = 0;
+   }
+};
+
+/**
+ * Descriptor of a format for setup code
+ */
+template <class Format> const RASPIFORMAT* raspiformat_describe() {
+   static const RASPIFORMAT format = {
+      Format::mmal_encoding, Format::bytes_per_pixel, Format::is_luma,
+      Format::has_chroma, &Format::encoding()
+   };
+   return &format;
+}
+
+#endif /* RASPIFORMAT_H_ */
@@ -0,0 +1,40 @@
+/**
+ * \file RaspiGovernor.h
+ * CPU budget governor
+ *
+ * Description
+ *
+ * Compares the CPU time used by the node (all of its threads) over a period
+ * with a budget given in percent of one core, and moves a level along a
+ * degradation ladder: one step down when over budget, one step back up when
+ * the saving measured for that step says the node would still fit in the
+ * budget with some headroom. Measuring the saving of each step keeps the
+ * governor from bouncing between two levels.
+ */
+
+#ifndef RASPIGOVERNOR_H_
+#define RASPIGOVERNOR_H_
+
+#include <stdint.h>
+#include <vector>
+
+/// Fraction of the budget the node has to fit in before a step is undone
+#define RASPIGOVERNOR_HEADROOM 0.9
+
+typedef struct {
+   double budget;              /// Percent of one core
+   int levels;                 /// Steps in the ladder
+   int level;                  /// Steps applied
+   double usage;               /// Percent of one core used over the last period
+   int64_t last_cpu_us;
+   int64_t last_wall_us;
+   int measuring;              /// Step whose saving the next period measures, -1 for none
+   double before_step;         /// Usage in the period that triggered that step
+   std::vector<double> saved;  /// Measured saving of each step, percent of one core
+} RASPIGOVERNOR_STATE;
+
+int64_t raspigovernor_cpu_us();
+void raspigovernor_init(RASPIGOVERNOR_STATE* state, double budget, int levels);
+int raspigovernor_update(RASPIGOVERNOR_STATE* state, int64_t cpu_us, int64_t wall_us);
+
+#endif /* RASPIGOVERNOR_H_ */
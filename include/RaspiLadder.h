@@ -0,0 +1,46 @@
+/**
+ * \file RaspiLadder.h
+ * Ordered steps for lowering the node's load
+ *
+ * Description
+ *
+ * A ladder is a list of steps, each written as a string in the parameters:
+ * "fps N" processes at most N frames per second, "stage NAME" skips the
+ * processing stage NAME and "resolution N" captures at 1/N of the
+ * configured width and height. Being at level k of a ladder applies its
+ * first k steps. Several ladders can be merged into one set of knobs, the
+ * strictest setting of each knob winning.
+ */
+
+#ifndef RASPILADDER_H_
+#define RASPILADDER_H_
+
+#include <string>
+#include <vector>
+
+#define RASPILADDER_FPS        0
+#define RASPILADDER_STAGE      1
+#define RASPILADDER_RESOLUTION 2
+
+typedef struct {
+   int type;                   /// RASPILADDER_*
+   int value;                  /// Frame rate or resolution divider
+   std::string stage;          /// Name of the skipped stage
+} RASPILADDER_STEP;
+
+/// Settings resulting from the applied steps
+typedef struct {
+   int fps;                    /// Highest processed frame rate, 0 for no limit
+   int resolution_divider;     /// 1 for the configured resolution
+   std::vector<std::string> skipped_stages;
+} RASPILADDER_KNOBS;
+
+int raspiladder_parse(const std::vector<std::string>& specs,
+                      std::vector<RASPILADDER_STEP>& steps);
+void raspiladder_reset(RASPILADDER_KNOBS* knobs);
+void raspiladder_apply(const std::vector<RASPILADDER_STEP>& steps, int level,
+                       RASPILADDER_KNOBS* knobs);
+int raspiladder_skips(const RASPILADDER_KNOBS* knobs, const char* stage);
+std::string raspiladder_describe(const RASPILADDER_KNOBS* knobs);
+
+#endif /* RASPILADDER_H_ */
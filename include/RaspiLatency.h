@@ -0,0 +1,44 @@
+/**
+ * \file RaspiLatency.h
+ * Latency histogram with percentiles
+ *
+ * Description
+ *
+ * Latencies are counted in buckets four to an octave of microseconds, so a
+ * percentile is known to within a quarter of its value whatever the range,
+ * and recording one is an atomic increment: any thread may add while
+ * another takes the counts out. Percentiles are read from a snapshot taken
+ * out of the histogram, and snapshots merge, so a long run keeps both the
+ * counts of the last period and of the whole run for the cost of two
+ * arrays.
+ */
+
+#ifndef RASPILATENCY_H_
+#define RASPILATENCY_H_
+
+#include <stdint.h>
+#include <atomic>
+
+/// Covers up to about 30 s, longer latencies count in the last bucket
+#define RASPILATENCY_BUCKETS 96
+
+typedef struct {
+   std::atomic<uint32_t> count[RASPILATENCY_BUCKETS];
+} RASPILATENCY_HISTOGRAM;
+
+typedef struct {
+   uint32_t count[RASPILATENCY_BUCKETS];
+   uint32_t total;             /// Sum of count
+} RASPILATENCY_SNAPSHOT;
+
+void raspilatency_reset(RASPILATENCY_HISTOGRAM* histogram);
+void raspilatency_add(RASPILATENCY_HISTOGRAM* histogram, int64_t latency_us);
+void raspilatency_take(RASPILATENCY_HISTOGRAM* histogram,
+                       RASPILATENCY_SNAPSHOT* snapshot);
+void raspilatency_clear(RASPILATENCY_SNAPSHOT* snapshot);
+void raspilatency_merge(RASPILATENCY_SNAPSHOT* into,
+                        const RASPILATENCY_SNAPSHOT* from);
+int64_t raspilatency_percentile(const RASPILATENCY_SNAPSHOT* snapshot,
+                                double percent);
+
+#endif /* RASPILATENCY_H_ */
@@ -0,0 +1,43 @@
+/**
+ * \file RaspiLines.h
+ * Scanline line detector for line following
+ *
+ * Description
+ *
+ * A few rows of the Y plane are box filtered and thresholded halfway
+ * between their darkest and brightest values. The widest run on the line's
+ * side of the threshold is taken as the line, and the line angle is fitted
+ * through the positions found on all rows.
+ */
+
+#ifndef RASPILINES_H_
+#define RASPILINES_H_
+
+#include <stdint.h>
+#include <vector>
+
+typedef struct {
+   int found;          /// A line was found on this row
+   float position;     /// Column of the line centre, edges interpolated
+   float width;        /// Distance between the two edges in pixels
+   int contrast;       /// Difference between the brightest and darkest filtered values
+} RASPILINES_HIT;
+
+typedef struct {
+   int width;          /// Row length in pixels
+   int dark;           /// 1 for a dark line on a bright floor, 0 for the opposite
+   int min_contrast;   /// Rows with less contrast than this report no line
+   int min_width;      /// Narrower runs are ignored, in pixels
+   int max_width;      /// Wider runs are ignored, in pixels
+   std::vector<uint8_t> row;      /// Luma of an rgb row
+   std::vector<uint8_t> filtered; /// Box filtered row
+} RASPILINES_STATE;
+
+int raspilines_init(RASPILINES_STATE* state, int width, int dark, int min_contrast,
+                    int min_width, int max_width);
+void raspilines_scan_row(RASPILINES_STATE* state, const uint8_t* row, int bpp,
+                         RASPILINES_HIT* hit);
+int raspilines_angle(const float* rows, const RASPILINES_HIT* hits, int n,
+                     float* angle);
+
+#endif /* RASPILINES_H_ */
@@ -0,0 +1,19 @@
+/**
+ * \file RaspiLuma.h
+ * Y plane of the raw frame for the analysis stages
+ *
+ * Description
+ *
+ * Mono frames are already a Y plane. For rgb frames the BT.601 luma is
+ * computed once per frame into a buffer shared by all stages that need it.
+ */
+
+#ifndef RASPILUMA_H_
+#define RASPILUMA_H_
+
+#include <stdint.h>
+
+void raspiluma_from_rgb(const uint8_t* rgb, int width, int height, int stride,
+                        uint8_t* y, int y_stride);
+
+#endif /* RASPILUMA_H_ */
@@ -0,0 +1,62 @@
+/**
+ * \file RaspiProbe.h
+ * Frame counter and timestamp written into the pixels of a frame
+ *
+ * Description
+ *
+ * A probe is 96 bits in the top left corner of a frame, one bit per 8x8
+ * cell black or white, 16 cells across and 6 down: a 32 bit frame counter,
+ * the low 48 bits of the CLOCK_MONOTONIC time in microseconds when the
+ * frame was made, and a CRC-16 of both. The cells line up with the 8x8
+ * blocks of a JPEG encoder, so the probe reads back from a decoded
+ * compressed frame as well as from a raw one, and a frame whose corner was
+ * changed on the way fails the CRC rather than giving a wrong reading.
+ *
+ * Reading the probes of a stream back gives the latency from the frame
+ * source to the reader, without trusting the header stamps, as long as
+ * both run on the same machine. The tracker sorts the counters read into
+ * new, duplicated and out of order frames, and counts the frames skipped.
+ */
+
+#ifndef RASPIPROBE_H_
+#define RASPIPROBE_H_
+
+#include <stdint.h>
+
+#define RASPIPROBE_CELL    8
+#define RASPIPROBE_COLUMNS 16
+#define RASPIPROBE_ROWS    6
+#define RASPIPROBE_WIDTH   (RASPIPROBE_CELL * RASPIPROBE_COLUMNS)
+#define RASPIPROBE_HEIGHT  (RASPIPROBE_CELL * RASPIPROBE_ROWS)
+/// Wrap of the probe time
+#define RASPIPROBE_TIME_MASK ((((int64_t)1) << 48) - 1)
+
+#define RASPIPROBE_NEW        0
+#define RASPIPROBE_DUPLICATE  1
+#define RASPIPROBE_REORDERED  2
+
+typedef struct {
+   uint32_t counter;
+   int64_t time_us;            /// Low 48 bits of the CLOCK_MONOTONIC time
+} RASPIPROBE_STAMP;
+
+typedef struct {
+   int started;
+   uint32_t highest;           /// Highest counter read
+   uint64_t seen;              /// Bit n set if highest - n was read
+   uint32_t received;          /// Probes read
+   uint32_t duplicated;
+   uint32_t reordered;
+   uint32_t skipped;           /// Counters jumped over, less those read late
+} RASPIPROBE_TRACKER;
+
+int64_t raspiprobe_now_us();
+int raspiprobe_stamp(uint8_t* pixels, int stride, int bytes_per_pixel, int width,
+                     int height, const RASPIPROBE_STAMP* stamp);
+int raspiprobe_read(const uint8_t* pixels, int stride, int bytes_per_pixel, int width,
+                    int height, RASPIPROBE_STAMP* stamp);
+int64_t raspiprobe_age_us(const RASPIPROBE_STAMP* stamp, int64_t now_us);
+void raspiprobe_track_init(RASPIPROBE_TRACKER* tracker);
+int raspiprobe_track(RASPIPROBE_TRACKER* tracker, uint32_t counter);
+
+#endif /* RASPIPROBE_H_ */
@@ -0,0 +1,38 @@
+/**
+ * \file RaspiPyramid.h
+ * Box filtered image pyramid of the Y plane
+ *
+ * Description
+ *
+ * Level 0 is the Y plane itself, every further level halves both dimensions
+ * by averaging 2x2 blocks. All levels are stored in one buffer; rows are
+ * padded to a multiple of RASPIPYRAMID_ALIGN bytes.
+ */
+
+#ifndef RASPIPYRAMID_H_
+#define RASPIPYRAMID_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RASPIPYRAMID_MAX_LEVELS 6
+#define RASPIPYRAMID_ALIGN 16
+
+/// Where each level lives in the pyramid buffer
+typedef struct {
+   int levels;
+   uint32_t width[RASPIPYRAMID_MAX_LEVELS];
+   uint32_t height[RASPIPYRAMID_MAX_LEVELS];
+   uint32_t step[RASPIPYRAMID_MAX_LEVELS];
+   uint32_t offset[RASPIPYRAMID_MAX_LEVELS];
+   size_t size;   /// Total bytes of the buffer
+} RASPIPYRAMID_LAYOUT;
+
+int raspipyramid_layout(RASPIPYRAMID_LAYOUT* layout, int width, int height,
+                        int levels);
+void raspipyramid_downsample(const uint8_t* src, int width, int height,
+                             int src_stride, uint8_t* dst, int dst_stride);
+void raspipyramid_build(const RASPIPYRAMID_LAYOUT* layout, const uint8_t* y,
+                        int y_stride, uint8_t* buffer);
+
+#endif /* RASPIPYRAMID_H_ */
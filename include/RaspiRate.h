@@ -0,0 +1,40 @@
+/**
+ * \file RaspiRate.h
+ * Per-client rate tiers for the compressed stream
+ *
+ * Description
+ *
+ * Each client acknowledges the sequence number of the frames it receives.
+ * Frames sent and not yet acknowledged are the client's backlog: a client
+ * falling behind moves down a tier (every 2nd, then every 4th frame) and
+ * is sent nothing while its backlog is too long; a client keeping up for
+ * long enough moves back up. Every client is paced on its own, so a slow
+ * link only costs that client frames.
+ */
+
+#ifndef RASPIRATE_H_
+#define RASPIRATE_H_
+
+#include <stdint.h>
+#include <deque>
+
+/// Tiers send one frame in 1 << tier
+#define RASPIRATE_FULL       0
+#define RASPIRATE_HALF       1
+#define RASPIRATE_QUARTER    2
+#define RASPIRATE_TIERS      3
+
+typedef struct {
+   int tier;                   /// RASPIRATE_*
+   int good_frames;            /// Frames offered in a row with a short backlog
+   int hold;                   /// Offers left before the tier may drop again
+   int64_t last_ack_us;        /// Time of the last acknowledgement
+   std::deque<uint32_t> in_flight;    /// Sent and not acknowledged, oldest first
+} RASPIRATE_CLIENT;
+
+void raspirate_init(RASPIRATE_CLIENT* client, int64_t now_us);
+void raspirate_ack(RASPIRATE_CLIENT* client, uint32_t seq, int64_t now_us);
+int raspirate_offer(RASPIRATE_CLIENT* client, uint32_t seq, int max_backlog,
+                    int upgrade_frames);
+
+#endif /* RASPIRATE_H_ */
@@ -0,0 +1,48 @@
+/**
+ * \file RaspiRoi.h
+ * Named regions of interest cropped from the raw frame
+ *
+ * Description
+ *
+ * Each region is written as a string in the parameters, "NAME X Y WIDTH
+ * HEIGHT" in pixels of the configured resolution. The table of regions is
+ * read by the frame path and moved by the ROS thread, so the rectangles are
+ * only accessed under the table's lock and copied out for each frame. A
+ * rectangle is clamped to the frame it is cropped from, never when it is
+ * set, so a region survives a change of resolution; at a lowered resolution
+ * it covers the same part of the scene.
+ */
+
+#ifndef RASPIROI_H_
+#define RASPIROI_H_
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+typedef struct {
+   int x;
+   int y;
+   int width;
+   int height;
+} RASPIROI_RECT;
+
+typedef struct {
+   std::string name;           /// Letters, digits and _, used in the topic name
+   RASPIROI_RECT rect;         /// As requested, unclamped
+} RASPIROI_REGION;
+
+typedef struct {
+   std::mutex lock;
+   std::vector<RASPIROI_REGION> regions;   /// Fixed once the outputs are set up
+} RASPIROI_TABLE;
+
+int raspiroi_parse(const std::vector<std::string>& specs,
+                   std::vector<RASPIROI_REGION>& regions);
+int raspiroi_find(RASPIROI_TABLE* table, const char* name);
+void raspiroi_get(RASPIROI_TABLE* table, int index, RASPIROI_RECT* rect);
+void raspiroi_set(RASPIROI_TABLE* table, int index, const RASPIROI_RECT* rect);
+int raspiroi_clamp(const RASPIROI_RECT* rect, int divider, int width, int height,
+                   RASPIROI_RECT* crop);
+
+#endif /* RASPIROI_H_ */
@@ -0,0 +1,62 @@
+/**
+ * \file RaspiShading.h
+ * Lens shading and vignetting correction of the raw frame
+ *
+ * Description
+ *
+ * The correction is stored as a coarse grid of gains per channel, sampled at
+ * the centres of grid cells and independent of the capture resolution. At
+ * start-up the grid is bilinearly upsampled into a per-byte Q8.8 LUT that is
+ * applied to the frame in place. The grid is calibrated by averaging frames
+ * of a flat, evenly lit target.
+ */
+
+#ifndef RASPISHADING_H_
+#define RASPISHADING_H_
+
+#include <stdint.h>
+
+/// Gain grid, as stored in calibrations/shading.yaml
+typedef struct {
+   int grid_width;    /// Number of cell columns
+   int grid_height;   /// Number of cell rows
+   int channels;      /// 1 for mono, 3 for rgb
+   float* gains;      /// grid_height * grid_width * channels gains, row-major
+} RASPISHADING_GRID;
+
+/// Per-byte gain table for one frame geometry
+typedef struct {
+   int width;         /// Frame width in pixels
+   int height;        /// Frame height in pixels
+   int bpp;           /// Bytes per pixel
+   uint16_t* lut;     /// Q8.8 gain per byte, width * bpp per row
+} RASPISHADING_LUT;
+
+/// Flat-field accumulator used to calibrate a grid
+typedef struct {
+   int width;
+   int height;
+   int bpp;
+   int grid_width;
+   int grid_height;
+   int frames;        /// Frames accumulated so far
+   uint64_t* sums;    /// Per cell and channel sum of all samples
+   uint64_t* counts;  /// Per cell number of pixels accumulated
+} RASPISHADING_CALIB;
+
+int raspishading_load(RASPISHADING_GRID* grid, const char* path);
+int raspishading_save(const RASPISHADING_GRID* grid, const char* path);
+void raspishading_free_grid(RASPISHADING_GRID* grid);
+
+int raspishading_build_lut(RASPISHADING_LUT* lut, const RASPISHADING_GRID* grid,
+                           int width, int height, int bpp);
+void raspishading_free_lut(RASPISHADING_LUT* lut);
+void raspishading_apply(const RASPISHADING_LUT* lut, uint8_t* frame, int stride);
+
+int raspishading_calib_init(RASPISHADING_CALIB* calib, int width, int height,
+                            int bpp, int grid_width, int grid_height);
+void raspishading_calib_add(RASPISHADING_CALIB* calib, const uint8_t* frame,
+                            int stride);
+int raspishading_calib_finish(RASPISHADING_CALIB* calib, RASPISHADING_GRID* grid);
+
+#endif /* RASPISHADING_H_ */
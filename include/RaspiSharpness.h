@@ -0,0 +1,37 @@
+/**
+ * \file RaspiSharpness.h
+ * Per-frame focus/blur score and the gate that rejects blurred frames
+ *
+ * Description
+ *
+ * The score is the mean gradient energy (dx^2 + dy^2) over a subset of the
+ * rows of the frame. It is only meaningful relative to other frames of the
+ * same scene and camera settings.
+ */
+
+#ifndef RASPISHARPNESS_H_
+#define RASPISHARPNESS_H_
+
+#include <stdint.h>
+
+/// Gate decisions, see raspisharpness_gate()
+#define RASPISHARPNESS_KEEP     1   /// Frame replaces the held candidate
+#define RASPISHARPNESS_RELEASE  2   /// Held candidate must be published now
+
+/// Blur rejection state
+typedef struct {
+   float threshold;   /// Minimum score to forward a frame, 0 to disable
+   int best_of;       /// Forward only the sharpest of each group of frames, 1 to disable
+   int count;         /// Frames seen in the current group
+   int held;          /// A candidate is held for the current group
+   float best_score;  /// Score of the held candidate
+} RASPISHARPNESS_GATE;
+
+float raspisharpness_score(const uint8_t* plane, int width, int height,
+                           int stride, int bpp, int row_step);
+
+void raspisharpness_gate_init(RASPISHARPNESS_GATE* gate, float threshold,
+                              int best_of);
+int raspisharpness_gate(RASPISHARPNESS_GATE* gate, float score);
+
+#endif /* RASPISHARPNESS_H_ */
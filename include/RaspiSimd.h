@@ -0,0 +1,73 @@
+/**
+ * \file RaspiSimd.h
+ * Instruction set selection for the per-pixel kernels
+ *
+ * Description
+ *
+ * The kernels used on the raw path have a NEON path (Raspberry Pi 2 and
+ * later), an SSE2 path (x86 development machines) and a scalar fallback.
+ * Exactly one of RASPI_SIMD_NEON / RASPI_SIMD_SSE2 is defined when a vector
+ * path is available. Defining RASPI_SIMD_DISABLE forces the scalar path,
+ * which is useful to compare results and timings.
+ */
+
+#ifndef RASPISIMD_H_
+#define RASPISIMD_H_
+
+#include <stdint.h>
+
+#if !defined(RASPI_SIMD_DISABLE)
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define RASPI_SIMD_NEON 1
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#define RASPI_SIMD_SSE2 1
+#include <emmintrin.h>
+#endif
+#endif
+
+#if defined(RASPI_SIMD_NEON)
+#define RASPI_SIMD_NAME "neon"
+#elif defined(RASPI_SIMD_SSE2)
+#define RASPI_SIMD_NAME "sse2"
+#else
+#define RASPI_SIMD_NAME "scalar"
+#endif
+
+/**
+ * Sum of absolute differences between two byte rows
+ *
+ * @param a First row
+ * @param b Second row
+ * @param n Number of bytes to compare
+ *
+ * @return sum of |a[i] - b[i]|
+ */
+static inline uint32_t raspisimd_sad_u8(const uint8_t* a, const uint8_t* b,
+                                        int n) {
+   uint32_t sum = 0;
+   int i = 0;
+#if defined(RASPI_SIMD_NEON)
+   uint32x4_t acc = vdupq_n_u32(0);
+   for (; i + 16 <= n; i += 16) {
+      uint8x16_t d = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+      acc = vpadalq_u16(acc, vpaddlq_u8(d));
+   }
+   uint64x2_t s = vpaddlq_u32(acc);
+   sum = (uint32_t)(vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1));
+#elif defined(RASPI_SIMD_SSE2)
+   __m128i acc = _mm_setzero_si128();
+   for (; i + 16 <= n; i += 16) {
+      __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+      __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+      acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+   }
+   sum = (uint32_t)(_mm_cvtsi128_si32(acc) +
+                    _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+#endif
+   for (; i < n; i++)
+      sum += (a[i] > b[i]) ? (a[i] - b[i]) : (b[i] - a[i]);
+   return sum;
+}
+
+#endif /* RASPISIMD_H_ */
@@ -0,0 +1,70 @@
+/**
+ * \file RaspiSoak.h
+ * Long running checks of memory, drops and latency
+ *
+ * Description
+ *
+ * A soak samples the process once a period: resident memory, occupancy of
+ * the frame pools, frames published and dropped, and latency percentiles
+ * over the period. At the end the samples are checked against limits on
+ * the trends a short run does not show: memory growing at a steady rate,
+ * latency creeping up from the start of the run to its end, drops and
+ * frames allocated outside the pools. Samples taken during the warm-up are
+ * reported but left out of the trends.
+ */
+
+#ifndef RASPISOAK_H_
+#define RASPISOAK_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include "RaspiLatency.h"
+
+/// Limits a soak can exceed
+#define RASPISOAK_RSS_GROWTH      1
+#define RASPISOAK_DROPS           2
+#define RASPISOAK_LATENCY         4
+#define RASPISOAK_LATENCY_GROWTH  8
+#define RASPISOAK_POOL_OVERFLOWS  16
+
+typedef struct {
+   double minutes;             /// Since the start of the soak
+   long rss_kb;                /// Resident memory of the process
+   int pool_kept;              /// Frames held by the frame pools
+   int pool_in_use;            /// Frames among them in use
+   uint32_t pool_overflows;    /// Frames allocated outside the pools since the start
+   uint32_t published;         /// Frames published over the period
+   uint32_t dropped;           /// Frames dropped over the period
+   int64_t p50_us;             /// Latency percentiles over the period
+   int64_t p99_us;
+   int64_t p999_us;
+} RASPISOAK_SAMPLE;
+
+typedef struct {
+   double warmup_minutes;      /// Samples before this are not part of the trends
+   double max_rss_growth_kb;   /// Resident memory growth per hour
+   double max_drop_percent;    /// Share of the frames dropped over the run
+   double max_p99_ms;          /// 99th percentile latency over the run
+   double max_p99_growth;      /// Ratio of the 99th percentile of the last quarter to the first
+   uint32_t max_pool_overflows;    /// Frames allocated outside the pools over the run
+} RASPISOAK_LIMITS;
+
+typedef struct {
+   double rss_growth_kb;       /// Fitted resident memory growth per hour
+   double drop_percent;
+   double p99_ms;
+   double p99_growth;
+   uint32_t pool_overflows;
+   int trend_samples;          /// Samples after the warm-up
+   int failed;                 /// RASPISOAK_* bits of the limits exceeded
+} RASPISOAK_RESULT;
+
+int raspisoak_read_rss(const char* path, long* rss_kb);
+void raspisoak_evaluate(const std::vector<RASPISOAK_SAMPLE>& samples,
+                        const RASPILATENCY_SNAPSHOT* run,
+                        const RASPISOAK_LIMITS* limits, RASPISOAK_RESULT* result);
+int raspisoak_report(const char* path, const std::vector<RASPISOAK_SAMPLE>& samples,
+                     const RASPISOAK_LIMITS* limits, const RASPISOAK_RESULT* result);
+
+#endif /* RASPISOAK_H_ */
@@ -0,0 +1,146 @@
+/**
+ * \file RaspiStages.h
+ * Graph of processing stages fed by the camera callback
+ *
+ * Description
+ *
+ * Every stage runs on its own thread and takes frames from a bounded queue,
+ * so per-frame work never holds up the camera callback or the return of the
+ * MMAL buffer. Stages form a tree rooted at the camera and encoder: a stage
+ * sees a frame after its parent is done with it, and only frames holding at
+ * least one of its inputs are queued on it. Frames are reference counted
+ * and shared between the stages holding them; a stage that writes to the
+ * frame (any output) cannot have a sibling taking the same kind of frames,
+ * so nothing else can be reading the frame at the same time. A full queue
+ * drops either its oldest or the incoming frame, and the frame then skips
+ * the stage and everything below it. A disabled stage passes frames on to
+ * its children untouched. A stage with a maximum age drops the frames that
+ * were captured longer ago than that by the time it gets to them.
+ *
+ * Once running, moving frames through the graph does not touch the heap:
+ * the queues are rings sized when the stage is added, and the callbacks
+ * take their frames from a pool that recycles the frames no stage holds
+ * any more, storage included.
+ */
+
+#ifndef RASPISTAGES_H_
+#define RASPISTAGES_H_
+
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+
+#include "sensor_msgs/Image.h"
+
+#include "RaspiLines.h"
+
+#define RASPISTAGES_MAX_STAGES 16
+
+/// What a stage reads from or writes to a frame
+#define RASPISTAGES_RAW        1   /// Pixels of the raw frame
+#define RASPISTAGES_ENCODED    2   /// Output of the video encoder
+#define RASPISTAGES_METADATA   4   /// Planes and values derived from the raw frame
+#define RASPISTAGES_LINES      8   /// Line positions, scanned by the camera callback
+
+/// What to do with a frame arriving at a full queue
+#define RASPISTAGES_DROP_OLDEST 0  /// Make room by dropping the longest waiting frame
+#define RASPISTAGES_DROP_NEWEST 1  /// Drop the arriving frame
+
+typedef struct {
+   int frame;                  /// Capture frame number
+   int contents;               /// RASPISTAGES_* bits of the parts that are filled
+   int64_t captured_us;        /// Monotonic time the frame was captured, or handed to the graph
+   sensor_msgs::Image image;   /// Raw frame
+   std::vector<uint8_t> encoded;   /// Encoded frame
+   std::vector<uint8_t> luma;  /// Y plane of an rgb frame, width bytes per row
+   std::vector<uint8_t> chroma;    /// U then V plane of an I420 capture, width / 2 bytes per row
+   std::vector<RASPILINES_HIT> line_hits;  /// Per sampled row
+   int line_angle_valid;       /// The line was found on at least two rows
+   float line_angle;
+} RASPISTAGES_FRAME;
+
+typedef std::shared_ptr<RASPISTAGES_FRAME> RASPISTAGES_FRAME_PTR;
+
+/// Work done by a stage on each frame, may keep a reference to the frame
+typedef void (*RASPISTAGES_PROCESS)(const RASPISTAGES_FRAME_PTR& frame,
+                                    void* userdata);
+
+/// Counters of a stage, accumulated since they were last reset
+typedef struct {
+   uint32_t processed;         /// Frames processed
+   uint32_t dropped;           /// Frames dropped by the queue
+   uint32_t queued;            /// Frames waiting now
+   uint32_t stale;             /// Frames dropped for being older than the maximum age
+   int64_t busy_us;            /// Time spent processing
+   int64_t max_us;             /// Longest processing time of a frame
+   int64_t latency_us;         /// Sum over processed frames of capture to end of processing
+} RASPISTAGES_STATS;
+
+typedef struct {
+   char name[16];
+   int parent;                 /// Index of the parent stage, -1 for the callbacks
+   int children[RASPISTAGES_MAX_STAGES];
+   int num_children;
+   int inputs;                 /// Frames with none of these bypass the stage, frames
+                               /// without all of them pass through unprocessed
+   int outputs;                /// Parts of the frame the stage writes
+   RASPISTAGES_PROCESS process;
+   void* userdata;
+   int capacity;               /// Queue length
+   int policy;                 /// RASPISTAGES_DROP_*
+   int cpu;                    /// Core the thread is pinned to, -1 to leave it to the scheduler
+   int enabled;                /// Cleared to pass frames on without processing them
+   int64_t max_age_us;         /// Older frames are dropped, 0 for no limit
+   std::vector<RASPISTAGES_FRAME_PTR> queue;   /// Ring of capacity frames
+   int head;                   /// Slot of the longest waiting frame
+   int count;                  /// Frames waiting
+   std::condition_variable ready;
+   std::thread thread;
+   RASPISTAGES_STATS stats;
+} RASPISTAGES_STAGE;
+
+typedef struct {
+   int num_stages;
+   int running;
+   int roots[RASPISTAGES_MAX_STAGES];   /// Stages fed by the camera
+   int num_roots;
+   std::mutex lock;            /// Protects the queues, counters and running
+   RASPISTAGES_STAGE stages[RASPISTAGES_MAX_STAGES];
+} RASPISTAGES_GRAPH;
+
+/// Frames of one callback, reused once the graph is done with them
+typedef struct {
+   std::vector<RASPISTAGES_FRAME_PTR> frames;
+   int max_frames;             /// Frames kept, more are allocated and freed as usual
+   std::atomic<int> kept;      /// Size of frames, for other threads
+   std::atomic<uint32_t> overflows;    /// Frames allocated with the pool full and in use
+} RASPISTAGES_POOL;
+
+int64_t raspistages_now_us();
+void raspistages_init(RASPISTAGES_GRAPH* graph);
+int raspistages_add(RASPISTAGES_GRAPH* graph, const char* name, int parent,
+                    int inputs, int outputs, RASPISTAGES_PROCESS process,
+                    void* userdata, int capacity, int policy, int cpu);
+int raspistages_start(RASPISTAGES_GRAPH* graph);
+void raspistages_stop(RASPISTAGES_GRAPH* graph);
+int raspistages_find(RASPISTAGES_GRAPH* graph, const char* name);
+void raspistages_enable(RASPISTAGES_GRAPH* graph, int stage, int enabled);
+void raspistages_set_max_age(RASPISTAGES_GRAPH* graph, int stage, int64_t max_age_us);
+int raspistages_fresh(RASPISTAGES_GRAPH* graph, int stage,
+                      const RASPISTAGES_FRAME_PTR& frame);
+void raspistages_submit(RASPISTAGES_GRAPH* graph, const RASPISTAGES_FRAME_PTR& frame,
+                        int64_t captured_us);
+void raspistages_stats(RASPISTAGES_GRAPH* graph, int stage, RASPISTAGES_STATS* stats,
+                       int reset);
+int raspistages_capacity(RASPISTAGES_GRAPH* graph);
+
+void raspistages_pool_init(RASPISTAGES_POOL* pool, int max_frames);
+RASPISTAGES_FRAME_PTR raspistages_acquire(RASPISTAGES_POOL* pool);
+void raspistages_pool_stats(RASPISTAGES_POOL* pool, int* kept, int* in_use,
+                            uint32_t* overflows);
+
+#endif /* RASPISTAGES_H_ */
@@ -0,0 +1,36 @@
+/**
+ * \file RaspiThermal.h
+ * SoC temperature and throttle monitoring
+ *
+ * Description
+ *
+ * Reads the SoC temperature and the firmware throttle flags from sysfs
+ * (any file holding the same format will do, which is how the monitor is
+ * tested away from a Pi) and moves a level up and down a degradation
+ * ladder with hysteresis: one step down when hot or throttled, one step up
+ * once the temperature is back under the low mark.
+ */
+
+#ifndef RASPITHERMAL_H_
+#define RASPITHERMAL_H_
+
+/// Throttle flags that mean the SoC is slowed down right now
+#define RASPITHERMAL_FREQ_CAPPED   0x2
+#define RASPITHERMAL_THROTTLED     0x4
+#define RASPITHERMAL_SOFT_LIMIT    0x8
+#define RASPITHERMAL_ACTIVE (RASPITHERMAL_FREQ_CAPPED | RASPITHERMAL_THROTTLED | \
+                             RASPITHERMAL_SOFT_LIMIT)
+
+typedef struct {
+   double high;        /// Step down at or above this temperature (degrees C)
+   double low;         /// Step up below this temperature (degrees C)
+   int levels;         /// Steps in the ladder
+   int level;          /// Steps applied
+} RASPITHERMAL_STATE;
+
+int raspithermal_read_temperature(const char* path, double* celsius);
+int raspithermal_read_throttled(const char* path, unsigned int* flags);
+void raspithermal_init(RASPITHERMAL_STATE* state, double high, double low, int levels);
+int raspithermal_update(RASPITHERMAL_STATE* state, double celsius, unsigned int flags);
+
+#endif /* RASPITHERMAL_H_ */
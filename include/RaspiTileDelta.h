@@ -0,0 +1,47 @@
+/**
+ * \file RaspiTileDelta.h
+ * Tile based delta coding of raw frames
+ *
+ * Description
+ *
+ * The frame is cut into square tiles. A tile is sent when its mean absolute
+ * difference against the last copy sent exceeds a threshold, or when a full
+ * refresh is due. The encoder keeps the receiver's view of the frame so small
+ * changes cannot accumulate into drift between the two sides.
+ */
+
+#ifndef RASPITILEDELTA_H_
+#define RASPITILEDELTA_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/// Encoder state, one per raw output
+typedef struct {
+   int width;               /// Frame width in pixels
+   int height;              /// Frame height in pixels
+   int bpp;                 /// Bytes per pixel of the packed frame
+   int tile_size;           /// Tile edge in pixels
+   int tiles_x;             /// Number of tile columns
+   int tiles_y;             /// Number of tile rows
+   int threshold;           /// Mean absolute difference per byte that marks a tile as changed
+   int refresh_interval;    /// Frames between full refreshes, 0 to refresh only on request
+   int frames_since_refresh;
+   int force_refresh;       /// Set to send every tile on the next frame
+   uint8_t* reference;      /// Receiver's view of the frame (packed, width * bpp per row)
+} RASPITILEDELTA_STATE;
+
+int raspitiledelta_init(RASPITILEDELTA_STATE* state, int width, int height,
+                        int bpp, int tile_size, int threshold, int refresh_interval);
+void raspitiledelta_destroy(RASPITILEDELTA_STATE* state);
+
+int raspitiledelta_encode(RASPITILEDELTA_STATE* state, const uint8_t* frame,
+                          int stride, std::vector<uint32_t>& tile_indices,
+                          std::vector<uint8_t>& payload, int* keyframe);
+
+int raspitiledelta_apply(uint8_t* image, int width, int height, int bpp,
+                         int tile_size, const uint32_t* tile_indices, int num_tiles,
+                         const uint8_t* payload, size_t payload_size);
+
+#endif /* RASPITILEDELTA_H_ */
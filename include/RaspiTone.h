@@ -0,0 +1,33 @@
+/**
+ * \file RaspiTone.h
+ * Fused tone LUT and colour correction matrix for the raw frame
+ *
+ * Description
+ *
+ * Each byte first goes through a 256 entry LUT built from a gamma and an
+ * optional piecewise linear tone curve, then rgb pixels are multiplied by a
+ * 3x3 colour correction matrix in Q12 fixed point. Both steps are done in one
+ * pass over the frame. Mono frames only use the LUT.
+ */
+
+#ifndef RASPITONE_H_
+#define RASPITONE_H_
+
+#include <stdint.h>
+
+/// Fixed point precision of the matrix coefficients
+#define RASPITONE_MATRIX_SHIFT 12
+
+typedef struct {
+   int use_lut;         /// LUT differs from identity
+   int use_matrix;      /// Matrix differs from identity
+   uint8_t lut[256];    /// Tone LUT, applied to every byte
+   int16_t matrix[9];   /// Row-major Q12 matrix, out = M * (r, g, b)
+} RASPITONE_CONFIG;
+
+int raspitone_build(RASPITONE_CONFIG* config, double gamma, const double* curve,
+                    int curve_values, const double* matrix);
+void raspitone_apply(const RASPITONE_CONFIG* config, uint8_t* frame, int width,
+                     int height, int stride, int bpp);
+
+#endif /* RASPITONE_H_ */
@@ -0,0 +1,135 @@
+/**
+ * \file RaspiUdp.h
+ * Encoded frames over UDP, fragmented to the MTU, with optional parity
+ *
+ * Description
+ *
+ * Each encoded frame is cut into fragments that fit a datagram of the MTU,
+ * each sent with a header carrying the frame id, the index of the fragment
+ * and the capture time. With parity on, every group of fragments is followed
+ * by a fragment holding their XOR, from which the receiver rebuilds one
+ * fragment lost from the group. Nothing is ever sent again: the receiver
+ * hands over a frame as soon as it is complete and drops the older ones
+ * still missing fragments, so a lost datagram costs at most its own frame
+ * instead of stalling the stream behind it as a TCP connection does.
+ *
+ * Datagrams usually go to a multicast group, a unicast address works too.
+ * Multicast is looped back to the sending machine, so a receiver there sees
+ * the stream as a remote one would.
+ *
+ * All the fields of the header are big endian
+ *
+ *    offset  bytes
+ *         0      2  magic, 'R' 'U'
+ *         2      1  version, 1
+ *         3      1  data fragments per parity fragment, 0 for no parity
+ *         4      4  frame id
+ *         8      8  capture time in ns
+ *        16      4  bytes of the frame
+ *        20      2  index of the fragment, the parity fragments follow the
+ *                   data fragments
+ *        22      2  data fragments of the frame
+ *        24      2  bytes of a full fragment, the last data fragment is
+ *                   shorter, parity fragments are always full
+ *        26      2  session, drawn by the sender when it opens
+ *
+ * and the fragment follows. A sender opened again, by a restart of the
+ * node, numbers its frames from wherever it starts, the receiver tells by
+ * the session and drops what it had of the previous one.
+ */
+
+#ifndef RASPIUDP_H_
+#define RASPIUDP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+#include <vector>
+
+#define RASPIUDP_HEADER_BYTES  28
+#define RASPIUDP_MAGIC         0x5255
+#define RASPIUDP_VERSION       1
+/// IPv4 and UDP headers, taken off the MTU along with ours
+#define RASPIUDP_IP_UDP_BYTES  28
+/// Frames reassembled at once, an older one is dropped to start another
+#define RASPIUDP_SLOTS         4
+/// Largest frame a receiver takes by default, a header claiming more is
+/// not understood rather than sizing a slot from it
+#define RASPIUDP_MAX_FRAME_BYTES  (8 * 1024 * 1024)
+
+typedef struct {
+   uint32_t frame_id;
+   uint64_t stamp_ns;
+   uint32_t frame_bytes;
+   uint16_t index;
+   uint16_t fragments;         /// Data fragments of the frame
+   uint16_t fragment_bytes;    /// Bytes of a full fragment
+   uint8_t group;              /// Data fragments per parity fragment, 0 for none
+   uint16_t session;           /// Of the sender
+} RASPIUDP_HEADER;
+
+typedef struct {
+   int fd;
+   struct sockaddr_in destination;
+   int fragment_bytes;         /// Largest fragment fitting the MTU
+   int group;                  /// Data fragments per parity fragment, 0 for none
+   uint16_t session;
+   std::vector<uint8_t> datagram;
+   uint32_t frames;
+   uint32_t datagrams;
+   uint32_t errors;            /// Datagrams the socket refused
+} RASPIUDP_SENDER;
+
+typedef struct {
+   uint32_t frame_id;
+   uint64_t stamp_ns;
+   std::vector<uint8_t> data;
+} RASPIUDP_FRAME;
+
+/// Frame being reassembled
+typedef struct {
+   int used;
+   RASPIUDP_HEADER header;     /// Of the first datagram, index aside
+   int received;               /// Data fragments in data
+   std::vector<uint8_t> have;  /// Per data fragment, then per parity fragment
+   std::vector<uint8_t> data;  /// Data fragments at fragment_bytes apart
+   std::vector<uint8_t> parity;
+} RASPIUDP_SLOT;
+
+typedef struct {
+   int fd;
+   RASPIUDP_SLOT slots[RASPIUDP_SLOTS];
+   int delivered;              /// Set once a frame was handed over
+   uint32_t last_frame_id;     /// Of the frame handed over last
+   uint16_t session;           /// Of the sender the frames in progress come from
+   uint32_t max_frame_bytes;   /// Largest frame taken, larger ones are invalid
+   double loss;                /// Share of the datagrams discarded on arrival, to try losses
+   unsigned int seed;
+   std::vector<uint8_t> datagram;
+   uint32_t frames;            /// Frames handed over
+   uint32_t rebuilt;           /// Fragments rebuilt from parity
+   uint32_t dropped;           /// Frames dropped with fragments missing
+   uint32_t late;              /// Datagrams of frames already handed over or dropped
+   uint32_t invalid;           /// Datagrams not understood
+   uint32_t discarded;         /// Datagrams thrown away by loss
+   uint32_t restarts;          /// Sessions started after a frame was handed over
+} RASPIUDP_RECEIVER;
+
+void raspiudp_write_header(const RASPIUDP_HEADER* header, uint8_t* datagram);
+int raspiudp_read_header(const uint8_t* datagram, size_t bytes, RASPIUDP_HEADER* header);
+
+int raspiudp_sender_open(RASPIUDP_SENDER* sender, const char* address, int port,
+                         const char* interface, int ttl, int mtu, int group);
+int raspiudp_send(RASPIUDP_SENDER* sender, uint32_t frame_id, uint64_t stamp_ns,
+                  const uint8_t* data, size_t bytes);
+void raspiudp_sender_close(RASPIUDP_SENDER* sender);
+
+void raspiudp_receiver_init(RASPIUDP_RECEIVER* receiver);
+int raspiudp_receiver_open(RASPIUDP_RECEIVER* receiver, const char* address, int port,
+                           const char* interface);
+int raspiudp_push(RASPIUDP_RECEIVER* receiver, const uint8_t* datagram, size_t bytes,
+                  RASPIUDP_FRAME* frame);
+int raspiudp_receive(RASPIUDP_RECEIVER* receiver, int timeout_ms, RASPIUDP_FRAME* frame);
+void raspiudp_receiver_close(RASPIUDP_RECEIVER* receiver);
+
+#endif /* RASPIUDP_H_ */
@@ -0,0 +1,49 @@
+/**
+ * \file RaspiWatchdog.h
+ * Detection of and recovery from a stalled capture
+ *
+ * Description
+ *
+ * The watchdog is given the time of the last camera callback and declares
+ * a stall when there has been none for longer than the stall time. It then
+ * asks for the recovery steps in order of cost, moving to the next one
+ * when a step is followed by another stall time without a callback: send
+ * the free pool buffers to the ports again, then clear and set the capture
+ * bit of the camera, then rebuild the whole pipeline, which is repeated
+ * until the callbacks come back. The first callback after a stall ends it
+ * and records the step that worked and the time taken.
+ */
+
+#ifndef RASPIWATCHDOG_H_
+#define RASPIWATCHDOG_H_
+
+#include <stdint.h>
+
+#define RASPIWATCHDOG_RECOVERED -1  /// A stall just ended, see recovered_by
+#define RASPIWATCHDOG_NONE      0   /// Nothing to do
+#define RASPIWATCHDOG_REFILL    1   /// Send the free pool buffers to the ports again
+#define RASPIWATCHDOG_RECAPTURE 2   /// Clear and set the capture bit of the camera
+#define RASPIWATCHDOG_REBUILD   3   /// Close and rebuild the pipeline
+#define RASPIWATCHDOG_STEPS     4
+
+typedef struct {
+   int64_t stall_us;           /// Time without a callback taken as a stall
+   int step;                   /// Last step asked for in the current stall, NONE if running
+   int64_t last_callback_us;   /// Before the current stall
+   int64_t detected_us;        /// When the current stall was declared
+   int64_t step_us;            /// When the last step was carried out
+   uint32_t stalls;            /// Stalls declared
+   uint32_t recovered[RASPIWATCHDOG_STEPS];   /// Stalls ended after each step
+   // Of the last stall that ended
+   int recovered_by;           /// Last step asked for before it ended
+   int64_t outage_us;          /// From the last callback before it to the first after
+   int64_t recover_us;         /// From its detection to the first callback after
+} RASPIWATCHDOG_STATE;
+
+void raspiwatchdog_init(RASPIWATCHDOG_STATE* state, int64_t stall_us, int64_t now_us);
+int raspiwatchdog_check(RASPIWATCHDOG_STATE* state, int64_t last_callback_us,
+                        int64_t now_us);
+void raspiwatchdog_done(RASPIWATCHDOG_STATE* state, int64_t now_us);
+const char* raspiwatchdog_step_name(int step);
+
+#endif /* RASPIWATCHDOG_H_ */
@@ -0,0 +1,42 @@
+/**
+ * \file RaspiAllocs.cpp
+ * Count of the heap allocations made by the calling thread
+ *
+ * Description
+ *
+ * The replacements count, then hand over to the glibc allocator. The count
+ * is a plain thread local, which needs no allocation of its own.
+ */
+#include <stddef.h>
+
+#include "RaspiAllocs.h"
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+}
+
+static __thread uint32_t allocations;
+
+extern "C" void* malloc(size_t size) {
+   allocations++;
+   return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+   allocations++;
+   return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+   allocations++;
+   return __libc_realloc(ptr, size);
+}
+
+/**
+ * Heap allocations made so far by the calling thread
+ */
+uint32_t raspiallocs_count() {
+   return allocations;
+}
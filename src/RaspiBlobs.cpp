@@ -0,0 +1,273 @@
+/**
+ * \file RaspiBlobs.cpp
+ * Colour blob tracking on YUV ranges
+ *
+ * Description
+ *
+ * I420 frames are classified straight from their planes. rgb frames have no
+ * YUV data, so the top left pixel of each 2x2 block is converted first;
+ * that is a quarter of the pixels and stays cheap.
+ */
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+
+#include "RaspiSimd.h"
+#include "RaspiBlobs.h"
+
+static bool larger(const RASPIBLOBS_BLOB& a, const RASPIBLOBS_BLOB& b) {
+   return a.area > b.area;
+}
+
+/**
+ * Set up the tracker
+ *
+ * @param state Tracker state to initialise
+ * @param width Frame width in pixels
+ * @param height Frame height in pixels
+ * @param ranges YUV boxes, in priority order
+ * @param num_colors Number of ranges (at most RASPIBLOBS_MAX_COLORS)
+ * @param min_area Smallest blob reported, in pixels
+ *
+ * @return 0 if successful, -1 otherwise
+ */
+int raspiblobs_init(RASPIBLOBS_STATE* state, int width, int height,
+                    const RASPIBLOBS_RANGE* ranges, int num_colors, int min_area) {
+   if (width < 2 || height < 2 || num_colors < 1 ||
+       num_colors > RASPIBLOBS_MAX_COLORS || width / 2 > 65535)
+      return -1;
+
+   state->width = width / 2;
+   state->height = height / 2;
+   state->num_colors = num_colors;
+   memcpy(state->ranges, ranges, num_colors * sizeof(RASPIBLOBS_RANGE));
+   state->min_area = (min_area > 0) ? min_area : 0;
+   state->labels.resize((size_t)state->width * state->height);
+   state->scratch.resize(3 * state->width);
+   state->row_start.resize(state->height + 1);
+   state->runs.reserve(state->width * 4);
+   return 0;
+}
+
+/**
+ * Label one row of planar Y, U, V samples
+ */
+static void classify_row(const RASPIBLOBS_STATE* state, const uint8_t* ys,
+                         const uint8_t* us, const uint8_t* vs, uint8_t* labels) {
+   const int n = state->width;
+   int x = 0;
+#if defined(RASPI_SIMD_NEON)
+   for (; x + 16 <= n; x += 16) {
+      uint8x16_t vy = vld1q_u8(ys + x), vu = vld1q_u8(us + x), vv = vld1q_u8(vs + x);
+      uint8x16_t label = vdupq_n_u8(0);
+      // Last colour first, so that the first matching one is left in label
+      for (int c = state->num_colors - 1; c >= 0; c--) {
+         const RASPIBLOBS_RANGE* r = &state->ranges[c];
+         uint8x16_t in = vandq_u8(vcgeq_u8(vy, vdupq_n_u8(r->y_min)),
+                                  vcleq_u8(vy, vdupq_n_u8(r->y_max)));
+         in = vandq_u8(in, vandq_u8(vcgeq_u8(vu, vdupq_n_u8(r->u_min)),
+                                    vcleq_u8(vu, vdupq_n_u8(r->u_max))));
+         in = vandq_u8(in, vandq_u8(vcgeq_u8(vv, vdupq_n_u8(r->v_min)),
+                                    vcleq_u8(vv, vdupq_n_u8(r->v_max))));
+         label = vbslq_u8(in, vdupq_n_u8(c + 1), label);
+      }
+      vst1q_u8(labels + x, label);
+   }
+#elif defined(RASPI_SIMD_SSE2)
+   for (; x + 16 <= n; x += 16) {
+      __m128i vy = _mm_loadu_si128((const __m128i*)(ys + x));
+      __m128i vu = _mm_loadu_si128((const __m128i*)(us + x));
+      __m128i vv = _mm_loadu_si128((const __m128i*)(vs + x));
+      __m128i label = _mm_setzero_si128();
+      for (int c = state->num_colors - 1; c >= 0; c--) {
+         const RASPIBLOBS_RANGE* r = &state->ranges[c];
+         // lo <= x <= hi  <=>  max(x, lo) == x && min(x, hi) == x
+         __m128i in = _mm_and_si128(
+                         _mm_cmpeq_epi8(_mm_max_epu8(vy, _mm_set1_epi8((char)r->y_min)), vy),
+                         _mm_cmpeq_epi8(_mm_min_epu8(vy, _mm_set1_epi8((char)r->y_max)), vy));
+         in = _mm_and_si128(in, _mm_and_si128(
+                               _mm_cmpeq_epi8(_mm_max_epu8(vu, _mm_set1_epi8((char)r->u_min)), vu),
+                               _mm_cmpeq_epi8(_mm_min_epu8(vu, _mm_set1_epi8((char)r->u_max)), vu)));
+         in = _mm_and_si128(in, _mm_and_si128(
+                               _mm_cmpeq_epi8(_mm_max_epu8(vv, _mm_set1_epi8((char)r->v_min)), vv),
+                               _mm_cmpeq_epi8(_mm_min_epu8(vv, _mm_set1_epi8((char)r->v_max)), vv)));
+         label = _mm_or_si128(_mm_and_si128(in, _mm_set1_epi8((char)(c + 1))),
+                              _mm_andnot_si128(in, label));
+      }
+      _mm_storeu_si128((__m128i*)(labels + x), label);
+   }
+#endif
+   for (; x < n; x++) {
+      labels[x] = 0;
+      for (int c = state->num_colors - 1; c >= 0; c--) {
+         const RASPIBLOBS_RANGE* r = &state->ranges[c];
+         if (ys[x] >= r->y_min && ys[x] <= r->y_max &&
+             us[x] >= r->u_min && us[x] <= r->u_max &&
+             vs[x] >= r->v_min && vs[x] <= r->v_max)
+            labels[x] = c + 1;
+      }
+   }
+}
+
+/**
+ * Classify an I420 frame
+ *
+ * @param state Tracker state
+ * @param y Y plane
+ * @param y_stride Bytes between two Y rows
+ * @param u U plane (half resolution)
+ * @param v V plane (half resolution)
+ * @param uv_stride Bytes between two U or V rows
+ */
+void raspiblobs_classify_i420(RASPIBLOBS_STATE* state, const uint8_t* y,
+                              int y_stride, const uint8_t* u, const uint8_t* v,
+                              int uv_stride) {
+   uint8_t* ys = &state->scratch[0];
+
+   for (int r = 0; r < state->height; r++) {
+      const uint8_t* yrow = y + (size_t)(2 * r) * y_stride;
+      int x = 0;
+      // Every other Y sample of every other row lines up with the chroma samples
+#if defined(RASPI_SIMD_NEON)
+      for (; x + 16 <= state->width; x += 16)
+         vst1q_u8(ys + x, vld2q_u8(yrow + 2 * x).val[0]);
+#elif defined(RASPI_SIMD_SSE2)
+      const __m128i even = _mm_set1_epi16(0x00ff);
+      for (; x + 16 <= state->width; x += 16) {
+         __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)(yrow + 2 * x)), even);
+         __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*)(yrow + 2 * x + 16)), even);
+         _mm_storeu_si128((__m128i*)(ys + x), _mm_packus_epi16(a, b));
+      }
+#endif
+      for (; x < state->width; x++)
+         ys[x] = yrow[2 * x];
+      classify_row(state, ys, u + (size_t)r * uv_stride, v + (size_t)r * uv_stride,
+                   &state->labels[(size_t)r * state->width]);
+   }
+}
+
+/**
+ * Classify a packed rgb frame
+ *
+ * @param state Tracker state
+ * @param rgb First byte of the frame
+ * @param stride Bytes between two rows
+ */
+void raspiblobs_classify_rgb(RASPIBLOBS_STATE* state, const uint8_t* rgb,
+                             int stride) {
+   uint8_t* ys = &state->scratch[0];
+   uint8_t* us = ys + state->width;
+   uint8_t* vs = us + state->width;
+
+   for (int r = 0; r < state->height; r++) {
+      const uint8_t* row = rgb + (size_t)(2 * r) * stride;
+      for (int x = 0; x < state->width; x++) {
+         const int R = row[6 * x], G = row[6 * x + 1], B = row[6 * x + 2];
+         ys[x] = (uint8_t)((77 * R + 150 * G + 29 * B + 128) >> 8);
+         us[x] = (uint8_t)(((-43 * R - 85 * G + 128 * B + 128) >> 8) + 128);
+         vs[x] = (uint8_t)(((128 * R - 107 * G - 21 * B + 128) >> 8) + 128);
+      }
+      classify_row(state, ys, us, vs, &state->labels[(size_t)r * state->width]);
+   }
+}
+
+static int find_root(std::vector<RASPIBLOBS_RUN>& runs, int i) {
+   while (runs[i].parent != i) {
+      runs[i].parent = runs[runs[i].parent].parent;
+      i = runs[i].parent;
+   }
+   return i;
+}
+
+/**
+ * Group the classified samples into blobs
+ *
+ * @param state Tracker state holding a classified frame
+ * @param blobs Filled with the blobs of at least min_area pixels, largest first
+ *
+ * @return number of blobs
+ */
+int raspiblobs_find(RASPIBLOBS_STATE* state, std::vector<RASPIBLOBS_BLOB>& blobs) {
+   std::vector<RASPIBLOBS_RUN>& runs = state->runs;
+
+   // Run-length encode every row
+   runs.clear();
+   for (int r = 0; r < state->height; r++) {
+      const uint8_t* labels = &state->labels[(size_t)r * state->width];
+      state->row_start[r] = runs.size();
+      int x = 0;
+      while (x < state->width) {
+         if (!labels[x]) {
+            x++;
+            continue;
+         }
+         RASPIBLOBS_RUN run;
+         run.x0 = x;
+         run.y = r;
+         run.color = labels[x] - 1;
+         while (x < state->width && labels[x] == run.color + 1)
+            x++;
+         run.x1 = x - 1;
+         run.parent = runs.size();
+         runs.push_back(run);
+      }
+   }
+   state->row_start[state->height] = runs.size();
+
+   // Merge overlapping runs of the same colour on consecutive rows
+   for (int r = 1; r < state->height; r++) {
+      int a = state->row_start[r - 1];
+      const int a_end = state->row_start[r];
+      for (int b = state->row_start[r]; b < state->row_start[r + 1]; b++) {
+         while (a < a_end && runs[a].x1 < runs[b].x0)
+            a++;
+         for (int k = a; k < a_end && runs[k].x0 <= runs[b].x1; k++) {
+            if (runs[k].color != runs[b].color)
+               continue;
+            int ra = find_root(runs, k), rb = find_root(runs, b);
+            if (ra != rb)
+               runs[std::max(ra, rb)].parent = std::min(ra, rb);
+         }
+      }
+   }
+
+   // Accumulate statistics on the root runs; roots always come first in scan order
+   blobs.clear();
+   std::vector<int>& index = state->blob_index;
+   index.assign(runs.size(), -1);
+   for (size_t i = 0; i < runs.size(); i++) {
+      const RASPIBLOBS_RUN& run = runs[i];
+      const int root = find_root(runs, i);
+      if (index[root] < 0) {
+         RASPIBLOBS_BLOB blob = { run.color, 0, 0.0f, 0.0f, run.x0, run.y, run.x1, run.y };
+         index[root] = blobs.size();
+         blobs.push_back(blob);
+      }
+      RASPIBLOBS_BLOB& blob = blobs[index[root]];
+      const int len = run.x1 - run.x0 + 1;
+      blob.area += len;
+      blob.x += (float)len * (run.x0 + run.x1) * 0.5f;
+      blob.y += (float)len * run.y;
+      blob.x_min = std::min(blob.x_min, (int)run.x0);
+      blob.x_max = std::max(blob.x_max, (int)run.x1);
+      blob.y_max = run.y;
+   }
+
+   // Back to full resolution: each sample is a 2x2 block
+   size_t kept = 0;
+   for (size_t i = 0; i < blobs.size(); i++) {
+      RASPIBLOBS_BLOB blob = blobs[i];
+      blob.x = 2.0f * blob.x / blob.area + 0.5f;
+      blob.y = 2.0f * blob.y / blob.area + 0.5f;
+      blob.area *= 4;
+      blob.x_min *= 2;
+      blob.y_min *= 2;
+      blob.x_max = 2 * blob.x_max + 1;
+      blob.y_max = 2 * blob.y_max + 1;
+      if (blob.area >= state->min_area)
+         blobs[kept++] = blob;
+   }
+   blobs.resize(kept);
+   std::sort(blobs.begin(), blobs.end(), larger);
+   return (int)kept;
+}
@@ -0,0 +1,148 @@
+/**
+ * \file RaspiDenoise.cpp
+ * Motion-adaptive recursive temporal filter
+ *
+ * Description
+ *
+ * The filter runs in place on the frame; the filtered result is also kept
+ * as the reference for the next frame. The weighted difference is rounded
+ * half away from zero, the same for both signs, so a still scene does not
+ * drift darker frame after frame.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "RaspiSimd.h"
+#include "RaspiDenoise.h"
+
+/**
+ * Set up the filter for frames of the given geometry
+ *
+ * @param state Filter state to initialise
+ * @param width Frame width in pixels
+ * @param height Frame height in pixels
+ * @param bpp Bytes per pixel
+ * @param strength Weight of the new frame in 1/128 (1..128, 128 disables filtering)
+ * @param motion_threshold Differences above this are passed through (0..255)
+ *
+ * @return 0 if successful, -1 otherwise
+ */
+int raspidenoise_init(RASPIDENOISE_STATE* state, int width, int height, int bpp,
+                      int strength, int motion_threshold) {
+   memset(state, 0, sizeof(RASPIDENOISE_STATE));
+   if (width <= 0 || height <= 0 || bpp <= 0)
+      return -1;
+
+   state->width = width;
+   state->height = height;
+   state->bpp = bpp;
+   state->strength = (strength < 1) ? 1 : (strength > 128) ? 128 : strength;
+   state->motion_threshold = (motion_threshold < 0) ? 0 :
+                             (motion_threshold > 255) ? 255 : motion_threshold;
+   state->previous = (uint8_t*) malloc((size_t)width * height * bpp);
+
+   return state->previous ? 0 : -1;
+}
+
+void raspidenoise_destroy(RASPIDENOISE_STATE* state) {
+   free(state->previous);
+   state->previous = NULL;
+}
+
+/**
+ * Weighted difference (d * strength) / 128, rounded half away from zero
+ */
+static inline int weigh(int d, int strength) {
+   const int m = d * strength;
+   return (m >= 0) ? (m + 64) >> 7 : -((64 - m) >> 7);
+}
+
+/**
+ * Filter one row in place and store the result as the new reference
+ */
+static void denoise_row(uint8_t* cur, uint8_t* prev, int n, int strength,
+                        int threshold) {
+   int i = 0;
+#if defined(RASPI_SIMD_NEON)
+   const uint8x16_t thr = vdupq_n_u8(threshold);
+   const int16x8_t k = vdupq_n_s16(strength);
+   const int16x8_t zero = vdupq_n_s16(0);
+   for (; i + 16 <= n; i += 16) {
+      uint8x16_t c = vld1q_u8(cur + i);
+      uint8x16_t p = vld1q_u8(prev + i);
+      uint8x16_t motion = vcgtq_u8(vabdq_u8(c, p), thr);
+      int16x8_t d0 = vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(c), vget_low_u8(p)));
+      int16x8_t d1 = vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(c), vget_high_u8(p)));
+      int16x8_t m0 = vmulq_s16(d0, k), m1 = vmulq_s16(d1, k);
+      // Rounded on the magnitude, then the sign put back
+      int16x8_t w0 = vrshrq_n_s16(vabsq_s16(m0), 7);
+      int16x8_t w1 = vrshrq_n_s16(vabsq_s16(m1), 7);
+      w0 = vbslq_s16(vcltq_s16(m0, zero), vnegq_s16(w0), w0);
+      w1 = vbslq_s16(vcltq_s16(m1, zero), vnegq_s16(w1), w1);
+      int16x8_t r0 = vaddq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(p))), w0);
+      int16x8_t r1 = vaddq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(p))), w1);
+      uint8x16_t r = vcombine_u8(vqmovun_s16(r0), vqmovun_s16(r1));
+      r = vbslq_u8(motion, c, r);
+      vst1q_u8(cur + i, r);
+      vst1q_u8(prev + i, r);
+   }
+#elif defined(RASPI_SIMD_SSE2)
+   const __m128i zero = _mm_setzero_si128();
+   const __m128i thr = _mm_set1_epi8((char)threshold);
+   const __m128i k = _mm_set1_epi16(strength);
+   const __m128i half = _mm_set1_epi16(64);
+   for (; i + 16 <= n; i += 16) {
+      __m128i c = _mm_loadu_si128((const __m128i*)(cur + i));
+      __m128i p = _mm_loadu_si128((const __m128i*)(prev + i));
+      __m128i ad = _mm_or_si128(_mm_subs_epu8(c, p), _mm_subs_epu8(p, c));
+      // Still where |c - p| <= threshold
+      __m128i still = _mm_cmpeq_epi8(_mm_subs_epu8(ad, thr), zero);
+      __m128i p0 = _mm_unpacklo_epi8(p, zero), p1 = _mm_unpackhi_epi8(p, zero);
+      __m128i d0 = _mm_sub_epi16(_mm_unpacklo_epi8(c, zero), p0);
+      __m128i d1 = _mm_sub_epi16(_mm_unpackhi_epi8(c, zero), p1);
+      __m128i m0 = _mm_mullo_epi16(d0, k), m1 = _mm_mullo_epi16(d1, k);
+      // Rounded on the magnitude, then the sign put back: (x ^ s) - s
+      // negates x where s is all ones
+      __m128i s0 = _mm_srai_epi16(m0, 15), s1 = _mm_srai_epi16(m1, 15);
+      __m128i w0 = _mm_sub_epi16(_mm_xor_si128(m0, s0), s0);
+      __m128i w1 = _mm_sub_epi16(_mm_xor_si128(m1, s1), s1);
+      w0 = _mm_srli_epi16(_mm_add_epi16(w0, half), 7);
+      w1 = _mm_srli_epi16(_mm_add_epi16(w1, half), 7);
+      w0 = _mm_sub_epi16(_mm_xor_si128(w0, s0), s0);
+      w1 = _mm_sub_epi16(_mm_xor_si128(w1, s1), s1);
+      __m128i r0 = _mm_add_epi16(p0, w0);
+      __m128i r1 = _mm_add_epi16(p1, w1);
+      __m128i r = _mm_packus_epi16(r0, r1);
+      r = _mm_or_si128(_mm_and_si128(still, r), _mm_andnot_si128(still, c));
+      _mm_storeu_si128((__m128i*)(cur + i), r);
+      _mm_storeu_si128((__m128i*)(prev + i), r);
+   }
+#endif
+   for (; i < n; i++) {
+      int d = (int)cur[i] - (int)prev[i];
+      if (d <= threshold && d >= -threshold)
+         cur[i] = (uint8_t)(prev[i] + weigh(d, strength));
+      prev[i] = cur[i];
+   }
+}
+
+/**
+ * Filter a frame in place
+ *
+ * @param state Filter state
+ * @param frame First byte of the frame
+ * @param stride Bytes between the starts of two rows
+ */
+void raspidenoise_apply(RASPIDENOISE_STATE* state, uint8_t* frame, int stride) {
+   const int n = state->width * state->bpp;
+
+   for (int y = 0; y < state->height; y++) {
+      uint8_t* row = frame + (size_t)y * stride;
+      uint8_t* prev = state->previous + (size_t)y * n;
+      if (state->primed)
+         denoise_row(row, prev, n, state->strength, state->motion_threshold);
+      else
+         memcpy(prev, row, n);
+   }
+   state->primed = 1;
+}
@@ -0,0 +1,342 @@
+/**
+ * \file RaspiFeatures.cpp
+ * FAST corners with grid non-max suppression and steered BRIEF descriptors
+ *
+ * Description
+ *
+ * The FAST pre-test (at least two of the four compass pixels brighter or
+ * darker than the centre, which any arc of nine contains) is done 16 pixels
+ * at a time with NEON/SSE2 and rejects most of the frame. The segment test
+ * and the score are only computed for the remaining candidates.
+ */
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+
+#include "RaspiSimd.h"
+#include "RaspiFeatures.h"
+
+/// Bresenham circle of radius 3, clockwise from the top
+static const int circle_x[16] = { 0, 1, 2, 3, 3, 3, 2, 1, 0, -1, -2, -3, -3, -3, -2, -1 };
+static const int circle_y[16] = { -3, -3, -2, -1, 0, 1, 2, 3, 3, 3, 2, 1, 0, -1, -2, -3 };
+
+/// Radius of the orientation patch
+#define PATCH_RADIUS 15
+/// Sample points are kept within this distance of the keypoint, so at any
+/// rotation they and their 3x3 smoothing stay within PATCH_RADIUS
+#define PATTERN_RADIUS 14
+
+static bool stronger(const RASPIFEATURES_KEYPOINT& a, const RASPIFEATURES_KEYPOINT& b) {
+   return a.score > b.score;
+}
+
+/**
+ * Set up the detector for frames of the given geometry
+ *
+ * @param state Detector state to initialise
+ * @param width Frame width in pixels
+ * @param height Frame height in pixels
+ * @param threshold FAST intensity threshold
+ * @param cell_size Edge of the non-max suppression cells in pixels
+ * @param max_features Upper bound on keypoints per frame
+ *
+ * @return 0 if successful, -1 otherwise
+ */
+int raspifeatures_init(RASPIFEATURES_STATE* state, int width, int height,
+                       int threshold, int cell_size, int max_features) {
+   uint32_t seed = 0x2545f491;
+
+   if (width < 7 || height < 7 || cell_size < 1 || max_features < 1)
+      return -1;
+
+   state->width = width;
+   state->height = height;
+   state->threshold = threshold;
+   state->cell_size = cell_size;
+   state->max_features = max_features;
+   state->cells_x = (width + cell_size - 1) / cell_size;
+   state->cells_y = (height + cell_size - 1) / cell_size;
+   state->cells.resize(state->cells_x * state->cells_y);
+
+   // Gaussian pairs as in BRIEF (sigma = patch / 5), from a fixed seed. A
+   // point is drawn again until it falls in the disc, clamping each axis
+   // would let a rotated corner point out of the patch
+   state->pattern.resize(256 * 4);
+   for (int i = 0; i < 256 * 4; i += 2) {
+      long x, y;
+      do {
+         double v[2];
+         for (int k = 0; k < 2; k++) {
+            seed = seed * 1664525u + 1013904223u;
+            const double u1 = ((seed >> 8) + 1.0) / 16777217.0;
+            seed = seed * 1664525u + 1013904223u;
+            const double u2 = (seed >> 8) / 16777216.0;
+            v[k] = sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2) * (2 * PATCH_RADIUS + 1) / 5.0;
+         }
+         x = lrint(v[0]);
+         y = lrint(v[1]);
+      } while (x * x + y * y > PATTERN_RADIUS * PATTERN_RADIUS);
+      state->pattern[i] = (int8_t)x;
+      state->pattern[i + 1] = (int8_t)y;
+   }
+   return 0;
+}
+
+/**
+ * Segment test and score of one candidate
+ *
+ * @return score if the pixel is a FAST-9 corner, 0 otherwise
+ */
+static int corner_score(const uint8_t* p, int stride, int threshold) {
+   const int c = p[0];
+   unsigned int bright = 0, dark = 0;
+   int v[16];
+
+   for (int k = 0; k < 16; k++) {
+      v[k] = p[circle_y[k] * stride + circle_x[k]];
+      if (v[k] > c + threshold)
+         bright |= 1u << k;
+      else if (v[k] < c - threshold)
+         dark |= 1u << k;
+   }
+
+   // Look for nine contiguous bits on the circle
+   unsigned int runs[2] = { bright | (bright << 16), dark | (dark << 16) };
+   for (int s = 0; s < 2; s++) {
+      unsigned int run = runs[s];
+      for (int k = 1; k < 9; k++)
+         run &= runs[s] >> k;
+      if (run) {
+         int score = 0;
+         for (int k = 0; k < 16; k++)
+            if ((s ? dark : bright) & (1u << k))
+               score += (s ? c - v[k] : v[k] - c) - threshold;
+         return score;
+      }
+   }
+   return 0;
+}
+
+/**
+ * Mark the candidates among 16 pixels starting at p
+ *
+ * @return bit i set if pixel i passed the pre-test
+ */
+static unsigned int pretest16(const uint8_t* p, int stride, int threshold) {
+   unsigned int mask = 0;
+#if defined(RASPI_SIMD_NEON)
+   const uint8x16_t t = vdupq_n_u8(threshold);
+   const uint8x16_t one = vdupq_n_u8(1);
+   uint8x16_t c = vld1q_u8(p);
+   uint8x16_t hi = vqaddq_u8(c, t), lo = vqsubq_u8(c, t);
+   uint8x16_t q[4] = { vld1q_u8(p - 3 * stride), vld1q_u8(p + 3),
+                       vld1q_u8(p + 3 * stride), vld1q_u8(p - 3) };
+   uint8x16_t nb = vdupq_n_u8(0), nd = vdupq_n_u8(0);
+   for (int k = 0; k < 4; k++) {
+      nb = vaddq_u8(nb, vandq_u8(vcgtq_u8(q[k], hi), one));
+      nd = vaddq_u8(nd, vandq_u8(vcltq_u8(q[k], lo), one));
+   }
+   uint8x16_t pass = vorrq_u8(vcgtq_u8(nb, one), vcgtq_u8(nd, one));
+   uint8_t lanes[16];
+   vst1q_u8(lanes, pass);
+   for (int i = 0; i < 16; i++)
+      if (lanes[i])
+         mask |= 1u << i;
+#elif defined(RASPI_SIMD_SSE2)
+   const __m128i zero = _mm_setzero_si128();
+   const __m128i t = _mm_set1_epi8((char)threshold);
+   const __m128i one = _mm_set1_epi8(1);
+   __m128i c = _mm_loadu_si128((const __m128i*)p);
+   __m128i hi = _mm_adds_epu8(c, t), lo = _mm_subs_epu8(c, t);
+   __m128i q[4] = { _mm_loadu_si128((const __m128i*)(p - 3 * stride)),
+                    _mm_loadu_si128((const __m128i*)(p + 3)),
+                    _mm_loadu_si128((const __m128i*)(p + 3 * stride)),
+                    _mm_loadu_si128((const __m128i*)(p - 3))
+                  };
+   __m128i nb = zero, nd = zero;
+   for (int k = 0; k < 4; k++) {
+      // x > y for unsigned bytes is (x -sat y) != 0
+      __m128i b = _mm_andnot_si128(_mm_cmpeq_epi8(_mm_subs_epu8(q[k], hi), zero), one);
+      __m128i d = _mm_andnot_si128(_mm_cmpeq_epi8(_mm_subs_epu8(lo, q[k]), zero), one);
+      nb = _mm_add_epi8(nb, b);
+      nd = _mm_add_epi8(nd, d);
+   }
+   __m128i pass = _mm_or_si128(_mm_cmpgt_epi8(nb, one), _mm_cmpgt_epi8(nd, one));
+   mask = _mm_movemask_epi8(pass);
+#else
+   for (int i = 0; i < 16; i++) {
+      const int c = p[i];
+      const int q[4] = { p[i - 3 * stride], p[i + 3], p[i + 3 * stride], p[i - 3] };
+      int nb = 0, nd = 0;
+      for (int k = 0; k < 4; k++) {
+         nb += q[k] > c + threshold;
+         nd += q[k] < c - threshold;
+      }
+      if (nb >= 2 || nd >= 2)
+         mask |= 1u << i;
+   }
+#endif
+   return mask;
+}
+
+/**
+ * Detect FAST corners and keep the strongest per grid cell
+ *
+ * @param state Detector state
+ * @param y Y plane
+ * @param stride Bytes between two rows of the Y plane
+ * @param border Corners closer than this to the frame border are ignored (at least 3)
+ * @param keypoints Filled with the kept corners, strongest first
+ *
+ * @return number of keypoints
+ */
+int raspifeatures_detect(RASPIFEATURES_STATE* state, const uint8_t* y, int stride,
+                         int border, std::vector<RASPIFEATURES_KEYPOINT>& keypoints) {
+   const RASPIFEATURES_KEYPOINT empty = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+   if (border < 3)
+      border = 3;
+   std::fill(state->cells.begin(), state->cells.end(), empty);
+
+   for (int r = border; r < state->height - border; r++) {
+      const uint8_t* row = y + (size_t)r * stride;
+      const int cell_row = (r / state->cell_size) * state->cells_x;
+      int x = border;
+      while (x < state->width - border) {
+         unsigned int candidates;
+         int n = state->width - border - x;
+         if (n >= 16) {
+            candidates = pretest16(row + x, stride, state->threshold);
+            n = 16;
+         } else {
+            candidates = (1u << n) - 1;
+         }
+         for (; candidates; candidates &= candidates - 1) {
+            const int cx = x + __builtin_ctz(candidates);
+            const int score = corner_score(row + cx, stride, state->threshold);
+            RASPIFEATURES_KEYPOINT& best = state->cells[cell_row + cx / state->cell_size];
+            if (score > best.score) {
+               best.x = cx;
+               best.y = r;
+               best.score = score;
+            }
+         }
+         x += n;
+      }
+   }
+
+   keypoints.clear();
+   for (size_t i = 0; i < state->cells.size(); i++)
+      if (state->cells[i].score > 0.0f)
+         keypoints.push_back(state->cells[i]);
+   if ((int)keypoints.size() > state->max_features) {
+      std::nth_element(keypoints.begin(), keypoints.begin() + state->max_features,
+                       keypoints.end(), stronger);
+      keypoints.resize(state->max_features);
+   }
+   std::sort(keypoints.begin(), keypoints.end(), stronger);
+   return (int)keypoints.size();
+}
+
+/**
+ * Sum of the 3x3 block centred on p
+ */
+static inline int box3(const uint8_t* p, int stride) {
+   return p[-stride - 1] + p[-stride] + p[-stride + 1] +
+          p[-1] + p[0] + p[1] +
+          p[stride - 1] + p[stride] + p[stride + 1];
+}
+
+/**
+ * Compute the orientation and descriptor of each keypoint
+ *
+ * Keypoints must be at least RASPIFEATURES_PATCH_BORDER pixels from the
+ * frame border (pass that as border to raspifeatures_detect()).
+ *
+ * @param state Detector state
+ * @param y Y plane
+ * @param stride Bytes between two rows of the Y plane
+ * @param keypoints Keypoints to describe, angle is set
+ * @param descriptors RASPIFEATURES_DESCRIPTOR_SIZE bytes per keypoint
+ */
+void raspifeatures_describe(const RASPIFEATURES_STATE* state, const uint8_t* y,
+                            int stride, std::vector<RASPIFEATURES_KEYPOINT>& keypoints,
+                            uint8_t* descriptors) {
+   for (size_t i = 0; i < keypoints.size(); i++) {
+      const uint8_t* c = y + (size_t)keypoints[i].y * stride + (int)keypoints[i].x;
+      int m01 = 0, m10 = 0;
+
+      // Intensity centroid over a disc of PATCH_RADIUS
+      for (int dy = -PATCH_RADIUS; dy <= PATCH_RADIUS; dy++) {
+         const int span = (int)sqrt((double)(PATCH_RADIUS * PATCH_RADIUS - dy * dy));
+         const uint8_t* row = c + dy * stride;
+         int sum = 0, moment = 0;
+         for (int dx = -span; dx <= span; dx++) {
+            sum += row[dx];
+            moment += dx * row[dx];
+         }
+         m10 += moment;
+         m01 += dy * sum;
+      }
+      const float angle = atan2f((float)m01, (float)m10);
+      const float ca = cosf(angle), sa = sinf(angle);
+      keypoints[i].angle = angle;
+
+      uint8_t* desc = descriptors + i * RASPIFEATURES_DESCRIPTOR_SIZE;
+      memset(desc, 0, RASPIFEATURES_DESCRIPTOR_SIZE);
+      for (int b = 0; b < 256; b++) {
+         const int8_t* pair = &state->pattern[b * 4];
+         int ax = lrintf(ca * pair[0] - sa * pair[1]);
+         int ay = lrintf(sa * pair[0] + ca * pair[1]);
+         int bx = lrintf(ca * pair[2] - sa * pair[3]);
+         int by = lrintf(sa * pair[2] + ca * pair[3]);
+         if (box3(c + ay * stride + ax, stride) < box3(c + by * stride + bx, stride))
+            desc[b >> 3] |= 1 << (b & 7);
+      }
+   }
+}
+
+/**
+ * Undistort and rectify a pixel position using camera info matrices
+ *
+ * @param K 3x3 camera matrix
+ * @param D plumb_bob distortion coefficients (k1, k2, p1, p2, k3)
+ * @param num_d Number of coefficients in D, missing ones are zero
+ * @param R 3x3 rectification matrix
+ * @param P 3x4 projection matrix, K is used if it is all zero
+ * @param x Column in the raw image
+ * @param y Row in the raw image
+ * @param ux Set to the column in the rectified image
+ * @param uy Set to the row in the rectified image
+ */
+void raspifeatures_undistort(const double* K, const double* D, int num_d,
+                             const double* R, const double* P, float x, float y,
+                             float* ux, float* uy) {
+   double k[5] = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+   for (int i = 0; i < num_d && i < 5; i++)
+      k[i] = D[i];
+
+   const double x0 = (x - K[2]) / K[0];
+   const double y0 = (y - K[5]) / K[4];
+   double xn = x0, yn = y0;
+
+   // Fixed point iteration, as in OpenCV's undistortPoints
+   for (int it = 0; it < 5; it++) {
+      const double r2 = xn * xn + yn * yn;
+      const double radial = 1.0 + ((k[4] * r2 + k[1]) * r2 + k[0]) * r2;
+      const double dx = 2.0 * k[2] * xn * yn + k[3] * (r2 + 2.0 * xn * xn);
+      const double dy = k[2] * (r2 + 2.0 * yn * yn) + 2.0 * k[3] * xn * yn;
+      xn = (x0 - dx) / radial;
+      yn = (y0 - dy) / radial;
+   }
+
+   const double X = R[0] * xn + R[1] * yn + R[2];
+   const double Y = R[3] * xn + R[4] * yn + R[5];
+   const double W = R[6] * xn + R[7] * yn + R[8];
+   const bool use_p = P[0] != 0.0 && P[5] != 0.0;
+   const double fx = use_p ? P[0] : K[0], cx = use_p ? P[2] : K[2];
+   const double fy = use_p ? P[5] : K[4], cy = use_p ? P[6] : K[5];
+   *ux = (float)(fx * X / W + cx);
+   *uy = (float)(fy * Y / W + cy);
+}
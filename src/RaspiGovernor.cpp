@@ -0,0 +1,80 @@
+/**
+ * \file RaspiGovernor.cpp
+ * CPU budget governor
+ *
+ * Description
+ *
+ * The usage of a period is the process CPU time spent in it over its wall
+ * clock length, so a node keeping two cores busy is at 200%.
+ */
+#include <time.h>
+
+#include "RaspiGovernor.h"
+
+/**
+ * CPU time used by every thread of the process, in microseconds
+ */
+int64_t raspigovernor_cpu_us() {
+   struct timespec ts;
+   clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+   return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Set up the governor at the top of the ladder (nothing applied)
+ *
+ * @param state Governor to initialise
+ * @param budget Percent of one core the node may use
+ * @param levels Steps in the ladder
+ */
+void raspigovernor_init(RASPIGOVERNOR_STATE* state, double budget, int levels) {
+   state->budget = budget;
+   state->levels = levels;
+   state->level = 0;
+   state->usage = 0.0;
+   state->last_cpu_us = 0;
+   state->last_wall_us = 0;
+   state->measuring = -1;
+   state->before_step = 0.0;
+   state->saved.assign(levels, 0.0);
+}
+
+/**
+ * Close a period and move at most one step along the ladder
+ *
+ * @param state Governor
+ * @param cpu_us Process CPU time now, from raspigovernor_cpu_us
+ * @param wall_us Monotonic time now
+ *
+ * @return the new level
+ */
+int raspigovernor_update(RASPIGOVERNOR_STATE* state, int64_t cpu_us, int64_t wall_us) {
+   const int64_t wall = wall_us - state->last_wall_us;
+   const int64_t cpu = cpu_us - state->last_cpu_us;
+   const int first = state->last_wall_us == 0;
+
+   state->last_cpu_us = cpu_us;
+   state->last_wall_us = wall_us;
+   if (first || wall <= 0)
+      return state->level;
+   state->usage = 100.0 * cpu / wall;
+
+   if (state->measuring >= 0) {
+      const double saving = state->before_step - state->usage;
+      state->saved[state->measuring] = (saving > 0.0) ? saving : 0.0;
+      state->measuring = -1;
+   }
+
+   if (state->usage > state->budget) {
+      if (state->level < state->levels) {
+         state->measuring = state->level;
+         state->before_step = state->usage;
+         state->level++;
+      }
+   } else if (state->level > 0 &&
+              state->usage + state->saved[state->level - 1] <
+              state->budget * RASPIGOVERNOR_HEADROOM) {
+      state->level--;
+   }
+   return state->level;
+}
@@ -0,0 +1,114 @@
+/**
+ * \file RaspiLadder.cpp
+ * Ordered steps for lowering the node's load
+ *
+ * Description
+ *
+ * Parsing of the ladder parameters and merging of the applied steps.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "RaspiLadder.h"
+
+/**
+ * Parse the steps of a ladder
+ *
+ * @param specs One string per step, "fps N", "stage NAME" or "resolution N"
+ * @param steps Filled with the parsed steps
+ *
+ * @return 0 if successful, -1 if a step is not understood
+ */
+int raspiladder_parse(const std::vector<std::string>& specs,
+                      std::vector<RASPILADDER_STEP>& steps) {
+   steps.clear();
+   for (size_t i = 0; i < specs.size(); i++) {
+      RASPILADDER_STEP step;
+      char name[64];
+      int value;
+
+      if (sscanf(specs[i].c_str(), "fps %d", &value) == 1 && value > 0) {
+         step.type = RASPILADDER_FPS;
+         step.value = value;
+      } else if (sscanf(specs[i].c_str(), "resolution %d", &value) == 1 && value > 0) {
+         step.type = RASPILADDER_RESOLUTION;
+         step.value = value;
+      } else if (sscanf(specs[i].c_str(), "stage %63s", name) == 1) {
+         step.type = RASPILADDER_STAGE;
+         step.value = 0;
+         step.stage = name;
+      } else {
+         return -1;
+      }
+      steps.push_back(step);
+   }
+   return 0;
+}
+
+/**
+ * Set knobs to the unrestricted settings
+ */
+void raspiladder_reset(RASPILADDER_KNOBS* knobs) {
+   knobs->fps = 0;
+   knobs->resolution_divider = 1;
+   knobs->skipped_stages.clear();
+}
+
+/**
+ * Merge the first steps of a ladder into a set of knobs
+ *
+ * @param steps Ladder
+ * @param level Number of steps to apply
+ * @param knobs Knobs to tighten
+ */
+void raspiladder_apply(const std::vector<RASPILADDER_STEP>& steps, int level,
+                       RASPILADDER_KNOBS* knobs) {
+   for (int i = 0; i < level && i < (int)steps.size(); i++) {
+      const RASPILADDER_STEP& step = steps[i];
+      switch (step.type) {
+      case RASPILADDER_FPS:
+         if (knobs->fps == 0 || step.value < knobs->fps)
+            knobs->fps = step.value;
+         break;
+      case RASPILADDER_RESOLUTION:
+         knobs->resolution_divider = std::max(knobs->resolution_divider, step.value);
+         break;
+      case RASPILADDER_STAGE:
+         if (!raspiladder_skips(knobs, step.stage.c_str()))
+            knobs->skipped_stages.push_back(step.stage);
+         break;
+      }
+   }
+}
+
+/**
+ * @return 1 if the knobs skip the named stage, 0 otherwise
+ */
+int raspiladder_skips(const RASPILADDER_KNOBS* knobs, const char* stage) {
+   return std::find(knobs->skipped_stages.begin(), knobs->skipped_stages.end(),
+                    stage) != knobs->skipped_stages.end();
+}
+
+/**
+ * Readable summary of the knobs, for the log
+ */
+std::string raspiladder_describe(const RASPILADDER_KNOBS* knobs) {
+   std::string text;
+   char buf[64];
+
+   if (knobs->fps > 0) {
+      snprintf(buf, sizeof(buf), "fps %d", knobs->fps);
+      text += buf;
+   }
+   if (knobs->resolution_divider > 1) {
+      snprintf(buf, sizeof(buf), "%sresolution 1/%d", text.empty() ? "" : ", ",
+               knobs->resolution_divider);
+      text += buf;
+   }
+   for (size_t i = 0; i < knobs->skipped_stages.size(); i++) {
+      text += text.empty() ? "skip " : ", skip ";
+      text += knobs->skipped_stages[i];
+   }
+   return text.empty() ? "none" : text;
+}
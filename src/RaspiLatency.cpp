@@ -0,0 +1,122 @@
+/**
+ * \file RaspiLatency.cpp
+ * Latency histogram with percentiles
+ *
+ * Description
+ *
+ * Latencies under 4 us have a bucket each. Above that, the octave
+ * [2^b, 2^(b+1)) is split into four buckets of 2^(b-2) us starting at
+ * bucket 4 * (b - 1).
+ */
+#include <string.h>
+
+#include "RaspiLatency.h"
+
+/**
+ * Bucket counting a latency
+ */
+static int bucket_of(int64_t latency_us) {
+   int b = 2;
+
+   if (latency_us < 4)
+      return latency_us < 0 ? 0 : (int)latency_us;
+   while (b < 62 && (latency_us >> (b + 1)) != 0)
+      b++;
+   const int bucket = 4 * (b - 1) + (int)((latency_us >> (b - 2)) & 3);
+   return bucket < RASPILATENCY_BUCKETS ? bucket : RASPILATENCY_BUCKETS - 1;
+}
+
+/**
+ * Largest latency counted in a bucket
+ */
+static int64_t bucket_limit(int bucket) {
+   if (bucket < 4)
+      return bucket;
+   const int b = bucket / 4 + 1;
+   return ((int64_t)(4 + bucket % 4 + 1) << (b - 2)) - 1;
+}
+
+/**
+ * Empty a histogram
+ *
+ * @param histogram Histogram to reset, not in use by any other thread
+ */
+void raspilatency_reset(RASPILATENCY_HISTOGRAM* histogram) {
+   for (int i = 0; i < RASPILATENCY_BUCKETS; i++)
+      histogram->count[i].store(0, std::memory_order_relaxed);
+}
+
+/**
+ * Count a latency, from any thread
+ *
+ * @param histogram Histogram to add to
+ * @param latency_us Latency in microseconds, negative values count as 0
+ */
+void raspilatency_add(RASPILATENCY_HISTOGRAM* histogram, int64_t latency_us) {
+   histogram->count[bucket_of(latency_us)].fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * Move the counts of a histogram to a snapshot, emptying the histogram
+ *
+ * A latency added while the counts are moved goes either to this snapshot
+ * or to the next one, never to both.
+ *
+ * @param histogram Histogram to empty
+ * @param snapshot Filled with the counts
+ */
+void raspilatency_take(RASPILATENCY_HISTOGRAM* histogram,
+                       RASPILATENCY_SNAPSHOT* snapshot) {
+   snapshot->total = 0;
+   for (int i = 0; i < RASPILATENCY_BUCKETS; i++) {
+      snapshot->count[i] = histogram->count[i].exchange(0, std::memory_order_relaxed);
+      snapshot->total += snapshot->count[i];
+   }
+}
+
+/**
+ * Empty a snapshot
+ *
+ * @param snapshot Snapshot to clear
+ */
+void raspilatency_clear(RASPILATENCY_SNAPSHOT* snapshot) {
+   memset(snapshot, 0, sizeof(*snapshot));
+}
+
+/**
+ * Add the counts of a snapshot to another one
+ *
+ * @param into Snapshot to add to
+ * @param from Snapshot to add
+ */
+void raspilatency_merge(RASPILATENCY_SNAPSHOT* into,
+                        const RASPILATENCY_SNAPSHOT* from) {
+   for (int i = 0; i < RASPILATENCY_BUCKETS; i++)
+      into->count[i] += from->count[i];
+   into->total += from->total;
+}
+
+/**
+ * Latency under which a given share of the counted latencies fall
+ *
+ * @param snapshot Counts to read
+ * @param percent Share in percent, 50 for the median
+ *
+ * @return the upper limit of the bucket holding the percentile in
+ * microseconds, 0 for an empty snapshot
+ */
+int64_t raspilatency_percentile(const RASPILATENCY_SNAPSHOT* snapshot,
+                                double percent) {
+   // Rank of the percentile, counted from 1
+   const double rank = snapshot->total * percent / 100.0;
+   uint64_t seen = 0;
+
+   if (snapshot->total == 0)
+      return 0;
+   for (int i = 0; i < RASPILATENCY_BUCKETS; i++) {
+      seen += snapshot->count[i];
+      if (seen >= rank && seen > 0)
+         return bucket_limit(i);
+   }
+   return bucket_limit(RASPILATENCY_BUCKETS - 1);
+}
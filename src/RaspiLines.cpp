@@ -0,0 +1,148 @@
+/**
+ * \file RaspiLines.cpp
+ * Scanline line detector for line following
+ *
+ * Description
+ *
+ * Only the configured rows are touched, so the cost is a few microseconds
+ * per row regardless of the frame size.
+ */
+#include <math.h>
+
+#include "RaspiLuma.h"
+#include "RaspiLines.h"
+
+/// Width of the box filter applied along the row
+#define LINES_BOX 4
+
+/**
+ * Set up the detector
+ *
+ * @param state Detector state to initialise
+ * @param width Row length in pixels
+ * @param dark 1 to look for a dark line, 0 for a bright one
+ * @param min_contrast Rows with a smaller brightest-darkest difference report no line
+ * @param min_width Narrowest accepted line in pixels
+ * @param max_width Widest accepted line in pixels
+ *
+ * @return 0 if successful, -1 otherwise
+ */
+int raspilines_init(RASPILINES_STATE* state, int width, int dark, int min_contrast,
+                    int min_width, int max_width) {
+   if (width <= LINES_BOX)
+      return -1;
+   state->width = width;
+   state->dark = dark;
+   state->min_contrast = min_contrast;
+   state->min_width = min_width;
+   state->max_width = max_width;
+   state->row.resize(width);
+   state->filtered.resize(width);
+   return 0;
+}
+
+/**
+ * Sub-pixel column where the filtered row crosses the threshold between i - 1 and i
+ */
+static float crossing(const uint8_t* f, int i, int threshold) {
+   const int a = f[i - 1], b = f[i];
+   return (a == b) ? (float)i : (i - 1) + (float)(threshold - a) / (float)(b - a);
+}
+
+/**
+ * Look for the line on one row
+ *
+ * @param state Detector state
+ * @param row First pixel of the row
+ * @param bpp 1 for a Y row, 3 for an rgb row
+ * @param hit Filled with the result
+ */
+void raspilines_scan_row(RASPILINES_STATE* state, const uint8_t* row, int bpp,
+                         RASPILINES_HIT* hit) {
+   const int n = state->width - LINES_BOX + 1;
+   uint8_t* f = &state->filtered[0];
+   int sum = 0, lo = 255, hi = 0;
+
+   if (bpp == 3) {
+      raspiluma_from_rgb(row, state->width, 1, 0, &state->row[0], 0);
+      row = &state->row[0];
+   }
+
+   // Running box filter, f[i] covers row[i] .. row[i + LINES_BOX - 1]
+   for (int i = 0; i < LINES_BOX; i++)
+      sum += row[i];
+   for (int i = 0; i < n; i++) {
+      f[i] = (uint8_t)(sum / LINES_BOX);
+      if (f[i] < lo) lo = f[i];
+      if (f[i] > hi) hi = f[i];
+      if (i + LINES_BOX < state->width)
+         sum += row[i + LINES_BOX] - row[i];
+   }
+
+   hit->found = 0;
+   hit->contrast = hi - lo;
+   if (hit->contrast < state->min_contrast)
+      return;
+
+   // Widest run on the line's side of the threshold
+   const int threshold = (lo + hi + 1) / 2;
+   int best_start = -1, best_end = -1, start = -1;
+   for (int i = 0; i <= n; i++) {
+      const int inside = (i < n) && (state->dark ? f[i] < threshold : f[i] >= threshold);
+      if (inside && start < 0) {
+         start = i;
+      } else if (!inside && start >= 0) {
+         const int len = i - start;
+         if (len >= state->min_width && len <= state->max_width &&
+             len > best_end - best_start) {
+            best_start = start;
+            best_end = i;
+         }
+         start = -1;
+      }
+   }
+   if (best_start < 0)
+      return;
+
+   const float left = (best_start > 0) ? crossing(f, best_start, threshold) : 0.0f;
+   const float right = (best_end < n) ? crossing(f, best_end, threshold) : (float)n;
+   hit->found = 1;
+   hit->width = right - left;
+   // Undo the shift of the box filter
+   hit->position = 0.5f * (left + right) + 0.5f * (LINES_BOX - 1);
+}
+
+/**
+ * Fit the line direction through the rows where it was found
+ *
+ * @param rows Row of each hit in pixels
+ * @param hits Results of raspilines_scan_row()
+ * @param n Number of rows
+ * @param angle Set to the angle from the image vertical in radians, positive
+ *              when the line leans right towards the top of the image
+ *
+ * @return 0 if at least two rows found the line, -1 otherwise
+ */
+int raspilines_angle(const float* rows, const RASPILINES_HIT* hits, int n,
+                     float* angle) {
+   double sy = 0.0, sx = 0.0, syy = 0.0, sxy = 0.0;
+   int count = 0;
+
+   for (int i = 0; i < n; i++) {
+      if (!hits[i].found)
+         continue;
+      sy += rows[i];
+      sx += hits[i].position;
+      syy += (double)rows[i] * rows[i];
+      sxy += (double)rows[i] * hits[i].position;
+      count++;
+   }
+   const double den = count * syy - sy * sy;
+   if (count < 2 || den == 0.0)
+      return -1;
+
+   // Least squares x = a y + b; y grows downwards, so negate for "towards the top"
+   const double a = (count * sxy - sx * sy) / den;
+   *angle = (float)atan(-a);
+   return 0;
+}
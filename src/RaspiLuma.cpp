@@ -0,0 +1,44 @@
+/**
+ * \file RaspiLuma.cpp
+ * Y plane of the raw frame for the analysis stages
+ *
+ * Description
+ *
+ * Y = (77 R + 150 G + 29 B + 128) >> 8. The NEON path deinterleaves with
+ * vld3; SSE2 has no cheap rgb24 deinterleave, so x86 uses the scalar loop.
+ */
+#include <stddef.h>
+
+#include "RaspiSimd.h"
+#include "RaspiLuma.h"
+
+/**
+ * Compute the Y plane of a packed rgb frame
+ *
+ * @param rgb First byte of the rgb frame
+ * @param width Width in pixels
+ * @param height Height in pixels
+ * @param stride Bytes between the starts of two rgb rows
+ * @param y Destination Y plane
+ * @param y_stride Bytes between the starts of two Y rows
+ */
+void raspiluma_from_rgb(const uint8_t* rgb, int width, int height, int stride,
+                        uint8_t* y, int y_stride) {
+   for (int r = 0; r < height; r++) {
+      const uint8_t* src = rgb + (size_t)r * stride;
+      uint8_t* dst = y + (size_t)r * y_stride;
+      int x = 0;
+#if defined(RASPI_SIMD_NEON)
+      for (; x + 8 <= width; x += 8) {
+         uint8x8x3_t p = vld3_u8(src + 3 * x);
+         uint16x8_t acc = vmull_u8(p.val[0], vdup_n_u8(77));
+         acc = vmlal_u8(acc, p.val[1], vdup_n_u8(150));
+         acc = vmlal_u8(acc, p.val[2], vdup_n_u8(29));
+         vst1_u8(dst + x, vrshrn_n_u16(acc, 8));
+      }
+#endif
+      for (; x < width; x++)
+         dst[x] = (uint8_t)((77 * src[3 * x] + 150 * src[3 * x + 1] +
+                             29 * src[3 * x + 2] + 128) >> 8);
+   }
+}
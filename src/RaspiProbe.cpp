@@ -0,0 +1,178 @@
+/**
+ * \file RaspiProbe.cpp
+ * Frame counter and timestamp written into the pixels of a frame
+ *
+ * Description
+ *
+ * Bits are written most significant first, row by row. A cell is read from
+ * the mean of its inner 4x4 pixels over all channels, which keeps clear of
+ * the ringing a JPEG encoder leaves along block edges.
+ */
+#include <string.h>
+#include <time.h>
+
+#include "RaspiProbe.h"
+
+#define PROBE_BYTES 12
+
+/**
+ * CRC-16/CCITT-FALSE
+ */
+static uint16_t crc16(const uint8_t* data, int length) {
+   uint16_t crc = 0xFFFF;
+
+   for (int i = 0; i < length; i++) {
+      crc ^= (uint16_t)data[i] << 8;
+      for (int bit = 0; bit < 8; bit++)
+         crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+   }
+   return crc;
+}
+
+/**
+ * Current CLOCK_MONOTONIC time in microseconds, the clock of the probes
+ */
+int64_t raspiprobe_now_us() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Write a probe into the top left corner of a frame
+ *
+ * @param pixels First row of the frame
+ * @param stride Bytes between the starts of two rows
+ * @param bytes_per_pixel 1 for a luma plane, 3 for packed RGB, every channel is written
+ * @param width Width of the frame
+ * @param height Height of the frame
+ * @param stamp Counter and time, the time is cut to 48 bits
+ *
+ * @return 0 if successful, -1 if the frame is smaller than the probe
+ */
+int raspiprobe_stamp(uint8_t* pixels, int stride, int bytes_per_pixel, int width,
+                     int height, const RASPIPROBE_STAMP* stamp) {
+   uint8_t bytes[PROBE_BYTES];
+   const uint64_t time = (uint64_t)(stamp->time_us & RASPIPROBE_TIME_MASK);
+
+   if (width < RASPIPROBE_WIDTH || height < RASPIPROBE_HEIGHT)
+      return -1;
+   for (int i = 0; i < 4; i++)
+      bytes[i] = (uint8_t)(stamp->counter >> (24 - 8 * i));
+   for (int i = 0; i < 6; i++)
+      bytes[4 + i] = (uint8_t)(time >> (40 - 8 * i));
+   const uint16_t crc = crc16(bytes, 10);
+   bytes[10] = (uint8_t)(crc >> 8);
+   bytes[11] = (uint8_t)crc;
+
+   for (int bit = 0; bit < PROBE_BYTES * 8; bit++) {
+      const uint8_t value = (bytes[bit / 8] & (0x80 >> (bit % 8))) ? 255 : 0;
+      const int x = (bit % RASPIPROBE_COLUMNS) * RASPIPROBE_CELL;
+      const int y = (bit / RASPIPROBE_COLUMNS) * RASPIPROBE_CELL;
+      for (int row = 0; row < RASPIPROBE_CELL; row++)
+         memset(pixels + (size_t)(y + row) * stride + x * bytes_per_pixel, value,
+                RASPIPROBE_CELL * bytes_per_pixel);
+   }
+   return 0;
+}
+
+/**
+ * Read the probe of a frame
+ *
+ * @param pixels First row of the frame
+ * @param stride Bytes between the starts of two rows
+ * @param bytes_per_pixel Channels of a pixel, averaged
+ * @param width Width of the frame
+ * @param height Height of the frame
+ * @param stamp Set to the counter and time of the probe
+ *
+ * @return 0 if successful, -1 if the frame holds no valid probe
+ */
+int raspiprobe_read(const uint8_t* pixels, int stride, int bytes_per_pixel, int width,
+                    int height, RASPIPROBE_STAMP* stamp) {
+   uint8_t bytes[PROBE_BYTES];
+   const int inner = RASPIPROBE_CELL / 2;
+
+   if (width < RASPIPROBE_WIDTH || height < RASPIPROBE_HEIGHT)
+      return -1;
+   memset(bytes, 0, sizeof(bytes));
+   for (int bit = 0; bit < PROBE_BYTES * 8; bit++) {
+      const int x = (bit % RASPIPROBE_COLUMNS) * RASPIPROBE_CELL + inner / 2;
+      const int y = (bit / RASPIPROBE_COLUMNS) * RASPIPROBE_CELL + inner / 2;
+      int sum = 0;
+      for (int row = 0; row < inner; row++) {
+         const uint8_t* p = pixels + (size_t)(y + row) * stride + x * bytes_per_pixel;
+         for (int i = 0; i < inner * bytes_per_pixel; i++)
+            sum += p[i];
+      }
+      if (sum >= 128 * inner * inner * bytes_per_pixel)
+         bytes[bit / 8] |= 0x80 >> (bit % 8);
+   }
+   if (crc16(bytes, 10) != (uint16_t)((bytes[10] << 8) | bytes[11]))
+      return -1;
+
+   stamp->counter = 0;
+   for (int i = 0; i < 4; i++)
+      stamp->counter = (stamp->counter << 8) | bytes[i];
+   stamp->time_us = 0;
+   for (int i = 0; i < 6; i++)
+      stamp->time_us = (stamp->time_us << 8) | bytes[4 + i];
+   return 0;
+}
+
+/**
+ * Time since a probe was written
+ *
+ * @param stamp Probe read from a frame
+ * @param now_us Current time, from raspiprobe_now_us
+ *
+ * @return Age of the probe in microseconds
+ */
+int64_t raspiprobe_age_us(const RASPIPROBE_STAMP* stamp, int64_t now_us) {
+   return (now_us - stamp->time_us) & RASPIPROBE_TIME_MASK;
+}
+
+void raspiprobe_track_init(RASPIPROBE_TRACKER* tracker) {
+   memset(tracker, 0, sizeof(RASPIPROBE_TRACKER));
+}
+
+/**
+ * Count a probe read from a stream
+ *
+ * Duplicates are told from late frames over the last 64 counters, an older
+ * counter is taken as late.
+ *
+ * @param tracker Tracker of the stream
+ * @param counter Counter of the probe
+ *
+ * @return RASPIPROBE_NEW, RASPIPROBE_DUPLICATE or RASPIPROBE_REORDERED
+ */
+int raspiprobe_track(RASPIPROBE_TRACKER* tracker, uint32_t counter) {
+   tracker->received++;
+   if (!tracker->started) {
+      tracker->started = 1;
+      tracker->highest = counter;
+      tracker->seen = 1;
+      return RASPIPROBE_NEW;
+   }
+   const int32_t ahead = (int32_t)(counter - tracker->highest);
+   if (ahead > 0) {
+      tracker->skipped += ahead - 1;
+      tracker->seen = ahead < 64 ? (tracker->seen << ahead) | 1 : 1;
+      tracker->highest = counter;
+      return RASPIPROBE_NEW;
+   }
+   const uint32_t behind = -ahead;
+   if (behind < 64) {
+      const uint64_t bit = (uint64_t)1 << behind;
+      if (tracker->seen & bit) {
+         tracker->duplicated++;
+         return RASPIPROBE_DUPLICATE;
+      }
+      tracker->seen |= bit;
+      // Counted as skipped when the counter was jumped over
+      tracker->skipped--;
+   }
+   tracker->reordered++;
+   return RASPIPROBE_REORDERED;
+}
@@ -0,0 +1,115 @@
+/**
+ * \file RaspiPyramid.cpp
+ * Box filtered image pyramid of the Y plane
+ *
+ * Description
+ *
+ * Each level is computed from the one above it in the same buffer, so the
+ * full frame is only read once.
+ */
+#include <string.h>
+
+#include "RaspiSimd.h"
+#include "RaspiPyramid.h"
+
+/**
+ * Compute the size and position of every level
+ *
+ * Levels that would be smaller than 2x2 pixels are dropped.
+ *
+ * @param layout Layout to fill
+ * @param width Width of the Y plane
+ * @param height Height of the Y plane
+ * @param levels Requested number of levels, including level 0
+ *
+ * @return number of levels in the layout
+ */
+int raspipyramid_layout(RASPIPYRAMID_LAYOUT* layout, int width, int height,
+                        int levels) {
+   size_t offset = 0;
+
+   memset(layout, 0, sizeof(RASPIPYRAMID_LAYOUT));
+   if (levels > RASPIPYRAMID_MAX_LEVELS)
+      levels = RASPIPYRAMID_MAX_LEVELS;
+
+   for (int l = 0; l < levels && width >= 2 && height >= 2; l++) {
+      layout->width[l] = width;
+      layout->height[l] = height;
+      layout->step[l] = (width + RASPIPYRAMID_ALIGN - 1) & ~(RASPIPYRAMID_ALIGN - 1);
+      layout->offset[l] = offset;
+      offset += (size_t)layout->step[l] * height;
+      layout->levels = l + 1;
+      width /= 2;
+      height /= 2;
+   }
+   layout->size = offset;
+   return layout->levels;
+}
+
+/**
+ * Halve an 8 bit plane by averaging 2x2 blocks (rounded)
+ *
+ * @param src Source plane
+ * @param width Source width, an odd last column is ignored
+ * @param height Source height, an odd last row is ignored
+ * @param src_stride Bytes between two source rows
+ * @param dst Destination plane of width / 2 x height / 2
+ * @param dst_stride Bytes between two destination rows
+ */
+void raspipyramid_downsample(const uint8_t* src, int width, int height,
+                             int src_stride, uint8_t* dst, int dst_stride) {
+   const int dw = width / 2;
+
+   for (int y = 0; y < height / 2; y++) {
+      const uint8_t* a = src + (size_t)(2 * y) * src_stride;
+      const uint8_t* b = a + src_stride;
+      uint8_t* d = dst + (size_t)y * dst_stride;
+      int x = 0;
+#if defined(RASPI_SIMD_NEON)
+      for (; x + 8 <= dw; x += 8) {
+         uint16x8_t s = vaddq_u16(vpaddlq_u8(vld1q_u8(a + 2 * x)),
+                                  vpaddlq_u8(vld1q_u8(b + 2 * x)));
+         vst1_u8(d + x, vrshrn_n_u16(s, 2));
+      }
+#elif defined(RASPI_SIMD_SSE2)
+      const __m128i even = _mm_set1_epi16(0x00ff);
+      const __m128i two = _mm_set1_epi16(2);
+      for (; x + 16 <= dw; x += 16) {
+         __m128i s[2];
+         for (int h = 0; h < 2; h++) {
+            __m128i va = _mm_loadu_si128((const __m128i*)(a + 2 * x + 16 * h));
+            __m128i vb = _mm_loadu_si128((const __m128i*)(b + 2 * x + 16 * h));
+            s[h] = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(va, even), _mm_srli_epi16(va, 8)),
+                                 _mm_add_epi16(_mm_and_si128(vb, even), _mm_srli_epi16(vb, 8)));
+            s[h] = _mm_srli_epi16(_mm_add_epi16(s[h], two), 2);
+         }
+         _mm_storeu_si128((__m128i*)(d + x), _mm_packus_epi16(s[0], s[1]));
+      }
+#endif
+      for (; x < dw; x++)
+         d[x] = (uint8_t)((a[2 * x] + a[2 * x + 1] + b[2 * x] + b[2 * x + 1] + 2) >> 2);
+   }
+}
+
+/**
+ * Fill a pyramid buffer
+ *
+ * @param layout Layout from raspipyramid_layout()
+ * @param y Y plane of the frame
+ * @param y_stride Bytes between two rows of the Y plane
+ * @param buffer Destination of layout->size bytes
+ */
+void raspipyramid_build(const RASPIPYRAMID_LAYOUT* layout, const uint8_t* y,
+                        int y_stride, uint8_t* buffer) {
+   if (layout->levels == 0)
+      return;
+
+   for (uint32_t r = 0; r < layout->height[0]; r++)
+      memcpy(buffer + layout->offset[0] + (size_t)r * layout->step[0],
+             y + (size_t)r * y_stride, layout->width[0]);
+
+   for (int l = 1; l < layout->levels; l++)
+      raspipyramid_downsample(buffer + layout->offset[l - 1], layout->width[l - 1],
+                              layout->height[l - 1], layout->step[l - 1],
+                              buffer + layout->offset[l], layout->step[l]);
+}
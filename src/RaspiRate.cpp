@@ -0,0 +1,80 @@
+/**
+ * \file RaspiRate.cpp
+ * Per-client rate tiers for the compressed stream
+ *
+ * Description
+ *
+ * Acknowledgements are cumulative: acknowledging a frame also clears the
+ * older ones, which the transport may have dropped on the way.
+ */
+#include "RaspiRate.h"
+
+/**
+ * Start a client on the full rate tier
+ *
+ * @param client Client to initialise
+ * @param now_us Current monotonic time
+ */
+void raspirate_init(RASPIRATE_CLIENT* client, int64_t now_us) {
+   client->tier = RASPIRATE_FULL;
+   client->good_frames = 0;
+   client->hold = 0;
+   client->last_ack_us = now_us;
+   client->in_flight.clear();
+}
+
+/**
+ * Record that a client received a frame
+ *
+ * @param client Client sending the acknowledgement
+ * @param seq Sequence number of the received frame
+ * @param now_us Current monotonic time
+ */
+void raspirate_ack(RASPIRATE_CLIENT* client, uint32_t seq, int64_t now_us) {
+   // Serial number comparison, the sequence may wrap
+   while (!client->in_flight.empty() &&
+          (int32_t)(seq - client->in_flight.front()) >= 0)
+      client->in_flight.pop_front();
+   client->last_ack_us = now_us;
+}
+
+/**
+ * Decide whether a frame goes to a client, and move the client between
+ * tiers according to its backlog
+ *
+ * @param client Client the frame is offered to
+ * @param seq Sequence number of the frame
+ * @param max_backlog Unacknowledged frames above which the client slows down
+ * @param upgrade_frames Offers in a row with at most half that backlog before
+ * the client speeds up again
+ *
+ * @return 1 if the frame should be sent, it is then counted as in flight
+ */
+int raspirate_offer(RASPIRATE_CLIENT* client, uint32_t seq, int max_backlog,
+                    int upgrade_frames) {
+   const int backlog = client->in_flight.size();
+
+   if (client->hold > 0)
+      client->hold--;
+   if (backlog > max_backlog) {
+      client->good_frames = 0;
+      if (client->hold == 0 && client->tier < RASPIRATE_TIERS - 1) {
+         client->tier++;
+         // Give the backlog time to drain at the new rate before judging again
+         client->hold = (max_backlog + 1) << client->tier;
+      }
+      return 0;
+   }
+   if (backlog <= max_backlog / 2) {
+      if (++client->good_frames >= upgrade_frames && client->tier > RASPIRATE_FULL) {
+         client->tier--;
+         client->good_frames = 0;
+      }
+   } else {
+      client->good_frames = 0;
+   }
+   if (seq & ((1u << client->tier) - 1))
+      return 0;
+   client->in_flight.push_back(seq);
+   return 1;
+}
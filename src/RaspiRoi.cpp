@@ -0,0 +1,108 @@
+/**
+ * \file RaspiRoi.cpp
+ * Named regions of interest cropped from the raw frame
+ *
+ * Description
+ *
+ * Parsing of the region parameters, and the locked accesses to the table
+ * shared by the frame path and the retargeting service.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+
+#include "RaspiRoi.h"
+
+/**
+ * Parse the regions of interest
+ *
+ * @param specs One string per region, "NAME X Y WIDTH HEIGHT"
+ * @param regions Filled with the parsed regions
+ *
+ * @return 0 if successful, -1 if a region is not understood, empty or its
+ * name is not a valid topic name or is used twice
+ */
+int raspiroi_parse(const std::vector<std::string>& specs,
+                   std::vector<RASPIROI_REGION>& regions) {
+   regions.clear();
+   for (size_t i = 0; i < specs.size(); i++) {
+      RASPIROI_REGION region;
+      char name[64];
+
+      if (sscanf(specs[i].c_str(), "%63s %d %d %d %d", name, &region.rect.x,
+                 &region.rect.y, &region.rect.width, &region.rect.height) != 5 ||
+          region.rect.x < 0 || region.rect.y < 0 ||
+          region.rect.width <= 0 || region.rect.height <= 0)
+         return -1;
+      if (!isalpha((unsigned char)name[0]))
+         return -1;
+      for (const char* c = name; *c; c++) {
+         if (!isalnum((unsigned char)*c) && *c != '_')
+            return -1;
+      }
+      for (size_t j = 0; j < regions.size(); j++) {
+         if (regions[j].name == name)
+            return -1;
+      }
+      region.name = name;
+      regions.push_back(region);
+   }
+   return 0;
+}
+
+/**
+ * Find a region by name
+ *
+ * @return Index of the region, -1 if there is none of that name
+ */
+int raspiroi_find(RASPIROI_TABLE* table, const char* name) {
+   for (size_t i = 0; i < table->regions.size(); i++) {
+      if (table->regions[i].name == name)
+         return i;
+   }
+   return -1;
+}
+
+/**
+ * Copy out the rectangle of a region
+ */
+void raspiroi_get(RASPIROI_TABLE* table, int index, RASPIROI_RECT* rect) {
+   std::lock_guard<std::mutex> lock(table->lock);
+   *rect = table->regions[index].rect;
+}
+
+/**
+ * Move a region, from the next frame cropped
+ */
+void raspiroi_set(RASPIROI_TABLE* table, int index, const RASPIROI_RECT* rect) {
+   std::lock_guard<std::mutex> lock(table->lock);
+   table->regions[index].rect = *rect;
+}
+
+/**
+ * Clamp a rectangle to a frame
+ *
+ * @param rect Rectangle, in pixels of the configured resolution
+ * @param divider Of the configured resolution the frame is captured at
+ * @param width Width of the frame
+ * @param height Height of the frame
+ * @param crop Set to the part of the rectangle inside the frame, in its pixels
+ *
+ * @return 0 if successful, -1 if the rectangle is outside the frame
+ */
+int raspiroi_clamp(const RASPIROI_RECT* rect, int divider, int width, int height,
+                   RASPIROI_RECT* crop) {
+   const int x0 = std::max(rect->x / divider, 0);
+   const int y0 = std::max(rect->y / divider, 0);
+   const int x1 = std::min((rect->x + rect->width) / divider, width);
+   const int y1 = std::min((rect->y + rect->height) / divider, height);
+
+   if (x1 <= x0 || y1 <= y0)
+      return -1;
+   crop->x = x0;
+   crop->y = y0;
+   crop->width = x1 - x0;
+   crop->height = y1 - y0;
+   return 0;
+}
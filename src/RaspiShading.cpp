@@ -0,0 +1,352 @@
+/**
+ * \file RaspiShading.cpp
+ * Lens shading and vignetting correction of the raw frame
+ *
+ * Description
+ *
+ * Grid file format (a YAML subset, in the style of calibrations/camera.yaml):
+ *
+ *    grid_width: 16
+ *    grid_height: 12
+ *    channels: 3
+ *    gains: [1.52, 1.49, ...]
+ *
+ * Gains are stored row by row, cell by cell, channel by channel.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RaspiSimd.h"
+#include "RaspiShading.h"
+
+/// Largest gain that keeps the Q8.8 products within a signed 16 bit lane
+#define SHADING_MAX_GAIN 127.0f
+/// Calibrated gains are clamped to this range
+#define SHADING_CALIB_MAX_GAIN 8.0f
+
+/**
+ * Find "key:" in a YAML buffer and return a pointer just after the colon
+ */
+static const char* yaml_find(const char* text, const char* key) {
+   size_t len = strlen(key);
+   const char* p = text;
+   while ((p = strstr(p, key)) != NULL) {
+      if ((p == text || p[-1] == '\n') && p[len] == ':')
+         return p + len + 1;
+      p += len;
+   }
+   return NULL;
+}
+
+/**
+ * Load a gain grid from a file
+ *
+ * @param grid Grid to fill, free with raspishading_free_grid()
+ * @param path File to read
+ *
+ * @return 0 if successful, -1 if the file is missing or malformed
+ */
+int raspishading_load(RASPISHADING_GRID* grid, const char* path) {
+   FILE* file;
+   long size;
+   char* text;
+   const char* p;
+   int n, ok = 1;
+
+   memset(grid, 0, sizeof(RASPISHADING_GRID));
+
+   file = fopen(path, "rb");
+   if (!file)
+      return -1;
+   fseek(file, 0, SEEK_END);
+   size = ftell(file);
+   fseek(file, 0, SEEK_SET);
+   text = (char*) malloc(size + 1);
+   if (!text || fread(text, 1, size, file) != (size_t)size) {
+      free(text);
+      fclose(file);
+      return -1;
+   }
+   text[size] = 0;
+   fclose(file);
+
+   ok = ok && (p = yaml_find(text, "grid_width")) && sscanf(p, "%d", &grid->grid_width) == 1;
+   ok = ok && (p = yaml_find(text, "grid_height")) && sscanf(p, "%d", &grid->grid_height) == 1;
+   ok = ok && (p = yaml_find(text, "channels")) && sscanf(p, "%d", &grid->channels) == 1;
+   ok = ok && grid->grid_width > 0 && grid->grid_height > 0 &&
+        (grid->channels == 1 || grid->channels == 3);
+   ok = ok && (p = yaml_find(text, "gains")) && (p = strchr(p, '['));
+
+   if (ok) {
+      n = grid->grid_width * grid->grid_height * grid->channels;
+      grid->gains = (float*) malloc(n * sizeof(float));
+      p++;
+      for (int i = 0; ok && i < n; i++) {
+         char* end;
+         grid->gains[i] = strtof(p, &end);
+         ok = (end != p);
+         p = end;
+         while (*p == ',' || *p == ' ' || *p == '\n' || *p == '\r')
+            p++;
+      }
+   }
+
+   free(text);
+   if (!ok) {
+      raspishading_free_grid(grid);
+      return -1;
+   }
+   return 0;
+}
+
+/**
+ * Save a gain grid to a file
+ *
+ * @param grid Grid to write
+ * @param path File to (over)write
+ *
+ * @return 0 if successful, -1 otherwise
+ */
+int raspishading_save(const RASPISHADING_GRID* grid, const char* path) {
+   const int n = grid->grid_width * grid->grid_height * grid->channels;
+   FILE* file = fopen(path, "w");
+
+   if (!file)
+      return -1;
+
+   fprintf(file, "grid_width: %d\n", grid->grid_width);
+   fprintf(file, "grid_height: %d\n", grid->grid_height);
+   fprintf(file, "channels: %d\n", grid->channels);
+   fprintf(file, "gains: [");
+   for (int i = 0; i < n; i++)
+      fprintf(file, "%s%.5f", i ? ", " : "", grid->gains[i]);
+   fprintf(file, "]\n");
+
+   return (fclose(file) == 0) ? 0 : -1;
+}
+
+void raspishading_free_grid(RASPISHADING_GRID* grid) {
+   free(grid->gains);
+   grid->gains = NULL;
+}
+
+/**
+ * Gain of a grid cell for one channel of the frame
+ */
+static float grid_gain(const RASPISHADING_GRID* grid, int gx, int gy, int c,
+                       int bpp) {
+   const float* cell = grid->gains + (gy * grid->grid_width + gx) * grid->channels;
+   if (grid->channels == bpp)
+      return cell[c];
+   if (grid->channels == 3)
+      return (cell[0] + cell[1] + cell[2]) / 3.0f;
+   return cell[0];
+}
+
+/**
+ * Upsample a grid into a per-byte LUT for the given frame geometry
+ *
+ * @param lut LUT to fill, free with raspishading_free_lut()
+ * @param grid Calibrated grid
+ * @param width Frame width in pixels
+ * @param height Frame height in pixels
+ * @param bpp Bytes per pixel
+ *
+ * @return 0 if successful, -1 otherwise
+ */
+int raspishading_build_lut(RASPISHADING_LUT* lut, const RASPISHADING_GRID* grid,
+                           int width, int height, int bpp) {
+   lut->width = width;
+   lut->height = height;
+   lut->bpp = bpp;
+   lut->lut = (uint16_t*) malloc((size_t)width * height * bpp * sizeof(uint16_t));
+   if (!lut->lut)
+      return -1;
+
+   for (int y = 0; y < height; y++) {
+      // Grid values are sampled at cell centres, clamp outside the outer centres
+      float fy = (y + 0.5f) * grid->grid_height / height - 0.5f;
+      if (fy < 0.0f) fy = 0.0f;
+      if (fy > grid->grid_height - 1) fy = grid->grid_height - 1;
+      int gy0 = (int)fy;
+      int gy1 = (gy0 + 1 < grid->grid_height) ? gy0 + 1 : gy0;
+      float wy = fy - gy0;
+
+      for (int x = 0; x < width; x++) {
+         float fx = (x + 0.5f) * grid->grid_width / width - 0.5f;
+         if (fx < 0.0f) fx = 0.0f;
+         if (fx > grid->grid_width - 1) fx = grid->grid_width - 1;
+         int gx0 = (int)fx;
+         int gx1 = (gx0 + 1 < grid->grid_width) ? gx0 + 1 : gx0;
+         float wx = fx - gx0;
+
+         for (int c = 0; c < bpp; c++) {
+            float top = grid_gain(grid, gx0, gy0, c, bpp) * (1.0f - wx) +
+                        grid_gain(grid, gx1, gy0, c, bpp) * wx;
+            float bottom = grid_gain(grid, gx0, gy1, c, bpp) * (1.0f - wx) +
+                           grid_gain(grid, gx1, gy1, c, bpp) * wx;
+            float gain = top * (1.0f - wy) + bottom * wy;
+            if (gain < 0.0f) gain = 0.0f;
+            if (gain > SHADING_MAX_GAIN) gain = SHADING_MAX_GAIN;
+            lut->lut[((size_t)y * width + x) * bpp + c] = (uint16_t)(gain * 256.0f + 0.5f);
+         }
+      }
+   }
+   return 0;
+}
+
+void raspishading_free_lut(RASPISHADING_LUT* lut) {
+   free(lut->lut);
+   lut->lut = NULL;
+}
+
+/**
+ * Apply the LUT to a frame in place
+ *
+ * @param lut LUT built for the frame geometry
+ * @param frame First byte of the frame
+ * @param stride Bytes between the starts of two rows
+ */
+void raspishading_apply(const RASPISHADING_LUT* lut, uint8_t* frame, int stride) {
+   const int n = lut->width * lut->bpp;
+
+   for (int y = 0; y < lut->height; y++) {
+      uint8_t* row = frame + (size_t)y * stride;
+      const uint16_t* gain = lut->lut + (size_t)y * n;
+      int i = 0;
+#if defined(RASPI_SIMD_NEON)
+      for (; i + 16 <= n; i += 16) {
+         uint8x16_t v = vld1q_u8(row + i);
+         uint16x8_t g0 = vld1q_u16(gain + i);
+         uint16x8_t g1 = vld1q_u16(gain + i + 8);
+         uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+         uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+         uint16x8_t r0 = vcombine_u16(
+                            vqshrn_n_u32(vmull_u16(vget_low_u16(lo), vget_low_u16(g0)), 8),
+                            vqshrn_n_u32(vmull_u16(vget_high_u16(lo), vget_high_u16(g0)), 8));
+         uint16x8_t r1 = vcombine_u16(
+                            vqshrn_n_u32(vmull_u16(vget_low_u16(hi), vget_low_u16(g1)), 8),
+                            vqshrn_n_u32(vmull_u16(vget_high_u16(hi), vget_high_u16(g1)), 8));
+         vst1q_u8(row + i, vcombine_u8(vqmovn_u16(r0), vqmovn_u16(r1)));
+      }
+#elif defined(RASPI_SIMD_SSE2)
+      const __m128i zero = _mm_setzero_si128();
+      for (; i + 16 <= n; i += 16) {
+         __m128i v = _mm_loadu_si128((const __m128i*)(row + i));
+         __m128i g0 = _mm_loadu_si128((const __m128i*)(gain + i));
+         __m128i g1 = _mm_loadu_si128((const __m128i*)(gain + i + 8));
+         // (v << 8) * g >> 16 == v * g >> 8
+         __m128i lo = _mm_mulhi_epu16(_mm_unpacklo_epi8(zero, v), g0);
+         __m128i hi = _mm_mulhi_epu16(_mm_unpackhi_epi8(zero, v), g1);
+         _mm_storeu_si128((__m128i*)(row + i), _mm_packus_epi16(lo, hi));
+      }
+#endif
+      for (; i < n; i++) {
+         uint32_t v = ((uint32_t)row[i] * gain[i]) >> 8;
+         row[i] = (v > 255) ? 255 : (uint8_t)v;
+      }
+   }
+}
+
+/**
+ * Start a flat-field calibration
+ *
+ * @param calib Accumulator to initialise
+ * @param width Frame width in pixels
+ * @param height Frame height in pixels
+ * @param bpp Bytes per pixel
+ * @param grid_width Number of cell columns of the resulting grid
+ * @param grid_height Number of cell rows of the resulting grid
+ *
+ * @return 0 if successful, -1 otherwise
+ */
+int raspishading_calib_init(RASPISHADING_CALIB* calib, int width, int height,
+                            int bpp, int grid_width, int grid_height) {
+   const int cells = grid_width * grid_height;
+
+   memset(calib, 0, sizeof(RASPISHADING_CALIB));
+   if (grid_width <= 0 || grid_height <= 0 || grid_width > width ||
+       grid_height > height)
+      return -1;
+
+   calib->width = width;
+   calib->height = height;
+   calib->bpp = bpp;
+   calib->grid_width = grid_width;
+   calib->grid_height = grid_height;
+   calib->sums = (uint64_t*) calloc(cells * bpp, sizeof(uint64_t));
+   calib->counts = (uint64_t*) calloc(cells, sizeof(uint64_t));
+
+   return (calib->sums && calib->counts) ? 0 : -1;
+}
+
+/**
+ * Accumulate one flat-field frame
+ *
+ * @param calib Accumulator
+ * @param frame First byte of the uncorrected frame
+ * @param stride Bytes between the starts of two rows
+ */
+void raspishading_calib_add(RASPISHADING_CALIB* calib, const uint8_t* frame,
+                            int stride) {
+   for (int y = 0; y < calib->height; y++) {
+      const uint8_t* row = frame + (size_t)y * stride;
+      const int cy = y * calib->grid_height / calib->height;
+      for (int x = 0; x < calib->width; x++) {
+         const int cell = cy * calib->grid_width + x * calib->grid_width / calib->width;
+         for (int c = 0; c < calib->bpp; c++)
+            calib->sums[cell * calib->bpp + c] += row[x * calib->bpp + c];
+         calib->counts[cell]++;
+      }
+   }
+   calib->frames++;
+}
+
+/**
+ * Turn the accumulated flat-field into a gain grid
+ *
+ * Each channel is normalised to its brightest cell, so the centre of the
+ * image keeps its level and colour and the corners are brought up to it.
+ * The accumulator is released.
+ *
+ * @param calib Accumulator holding at least one frame
+ * @param grid Grid to fill, free with raspishading_free_grid()
+ *
+ * @return 0 if successful, -1 otherwise
+ */
+int raspishading_calib_finish(RASPISHADING_CALIB* calib, RASPISHADING_GRID* grid) {
+   const int cells = calib->grid_width * calib->grid_height;
+   const int bpp = calib->bpp;
+   int status = -1;
+
+   memset(grid, 0, sizeof(RASPISHADING_GRID));
+   if (calib->frames > 0) {
+      grid->grid_width = calib->grid_width;
+      grid->grid_height = calib->grid_height;
+      grid->channels = bpp;
+      grid->gains = (float*) malloc(cells * bpp * sizeof(float));
+
+      for (int c = 0; c < bpp; c++) {
+         double brightest = 0.0;
+         for (int i = 0; i < cells; i++) {
+            double mean = (double)calib->sums[i * bpp + c] / calib->counts[i];
+            if (mean > brightest)
+               brightest = mean;
+         }
+         for (int i = 0; i < cells; i++) {
+            double mean = (double)calib->sums[i * bpp + c] / calib->counts[i];
+            float gain = (mean >= 1.0) ? (float)(brightest / mean) : SHADING_CALIB_MAX_GAIN;
+            grid->gains[i * bpp + c] = (gain > SHADING_CALIB_MAX_GAIN) ?
+                                       SHADING_CALIB_MAX_GAIN : gain;
+         }
+      }
+      status = 0;
+   }
+
+   free(calib->sums);
+   free(calib->counts);
+   calib->sums = NULL;
+   calib->counts = NULL;
+   return status;
+}
@@ -0,0 +1,143 @@
+/**
+ * \file RaspiSharpness.cpp
+ * Per-frame focus/blur score and the gate that rejects blurred frames
+ *
+ * Description
+ *
+ * Gradients are taken between a byte and the same channel of the next pixel
+ * (dx) and of the pixel below (dy), so the same kernel works on a Y plane
+ * and on packed RGB.
+ */
+#include <stddef.h>
+
+#include "RaspiSimd.h"
+#include "RaspiSharpness.h"
+
+/**
+ * Sum of squared differences between two byte rows
+ */
+static uint64_t ssd_u8(const uint8_t* a, const uint8_t* b, int n) {
+   uint64_t sum = 0;
+   int i = 0;
+#if defined(RASPI_SIMD_NEON)
+   uint32x4_t acc = vdupq_n_u32(0);
+   int chunk = 0;
+   for (; i + 16 <= n; i += 16) {
+      uint8x16_t d = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+      acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(d), vget_low_u8(d)));
+      acc = vpadalq_u16(acc, vmull_u8(vget_high_u8(d), vget_high_u8(d)));
+      // Each lane grows by at most 4 * 65025 per step, flush before it wraps
+      if (++chunk == 4096) {
+         uint64x2_t s = vpaddlq_u32(acc);
+         sum += vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1);
+         acc = vdupq_n_u32(0);
+         chunk = 0;
+      }
+   }
+   uint64x2_t s = vpaddlq_u32(acc);
+   sum += vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1);
+#elif defined(RASPI_SIMD_SSE2)
+   const __m128i zero = _mm_setzero_si128();
+   __m128i acc = _mm_setzero_si128();
+   for (; i + 16 <= n; i += 16) {
+      __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+      __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+      __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+      __m128i lo = _mm_unpacklo_epi8(d, zero);
+      __m128i hi = _mm_unpackhi_epi8(d, zero);
+      __m128i sq = _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+      // Widen to 64 bits so long rows cannot overflow the accumulator
+      acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+      acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+   }
+   uint64_t lanes[2];
+   _mm_storeu_si128((__m128i*)lanes, acc);
+   sum = lanes[0] + lanes[1];
+#endif
+   for (; i < n; i++) {
+      int d = (int)a[i] - (int)b[i];
+      sum += (uint64_t)(d * d);
+   }
+   return sum;
+}
+
+/**
+ * Compute the sharpness score of a frame
+ *
+ * @param plane First byte of the frame (Y plane or packed pixels)
+ * @param width Width in pixels
+ * @param height Height in pixels
+ * @param stride Bytes between the starts of two rows
+ * @param bpp Bytes per pixel
+ * @param row_step Only every row_step-th row is sampled
+ *
+ * @return mean gradient energy per sampled byte, 0 if the frame is too small
+ */
+float raspisharpness_score(const uint8_t* plane, int width, int height,
+                           int stride, int bpp, int row_step) {
+   const int n = (width - 1) * bpp;
+   uint64_t energy = 0;
+   uint64_t count = 0;
+
+   if (row_step < 1)
+      row_step = 1;
+   if (n <= 0 || height < 2)
+      return 0.0f;
+
+   for (int y = 0; y + 1 < height; y += row_step) {
+      const uint8_t* row = plane + (size_t)y * stride;
+      energy += ssd_u8(row + bpp, row, n);
+      energy += ssd_u8(row + stride, row, n);
+      count += n;
+   }
+
+   return (float)((double)energy / (double)count);
+}
+
+/**
+ * Set up the blur rejection gate
+ *
+ * @param gate Gate state to initialise
+ * @param threshold Minimum score to forward a frame, 0 to disable
+ * @param best_of Group size for sharpest-of-N selection, 1 to disable
+ */
+void raspisharpness_gate_init(RASPISHARPNESS_GATE* gate, float threshold,
+                              int best_of) {
+   gate->threshold = threshold;
+   gate->best_of = (best_of > 1) ? best_of : 1;
+   gate->count = 0;
+   gate->held = 0;
+   gate->best_score = 0.0f;
+}
+
+/**
+ * Decide what to do with a frame given its score
+ *
+ * With best_of == 1 a frame that passes the threshold is returned as
+ * KEEP | RELEASE and can be published directly. Otherwise the sharpest frame
+ * of the group is kept and released when the group is complete, which delays
+ * it by up to best_of - 1 frames.
+ *
+ * @param gate Gate state
+ * @param score Score of the current frame
+ *
+ * @return combination of RASPISHARPNESS_KEEP and RASPISHARPNESS_RELEASE, 0 to drop
+ */
+int raspisharpness_gate(RASPISHARPNESS_GATE* gate, float score) {
+   int decision = 0;
+
+   if (score >= gate->threshold && (!gate->held || score > gate->best_score)) {
+      gate->held = 1;
+      gate->best_score = score;
+      decision |= RASPISHARPNESS_KEEP;
+   }
+
+   if (++gate->count >= gate->best_of) {
+      if (gate->held)
+         decision |= RASPISHARPNESS_RELEASE;
+      gate->count = 0;
+      gate->held = 0;
+   }
+
+   return decision;
+}
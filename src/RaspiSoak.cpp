@@ -0,0 +1,165 @@
+/**
+ * \file RaspiSoak.cpp
+ * Long running checks of memory, drops and latency
+ *
+ * Description
+ *
+ * Memory growth is the least squares slope of the resident memory over the
+ * samples after the warm-up, so a single jump (a pool filling up, a
+ * subscriber connecting) weighs less than a steady climb. Latency growth
+ * compares the mean 99th percentile of the last quarter of those samples
+ * with that of the first quarter, and needs at least four of them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RaspiSoak.h"
+
+/**
+ * Read the resident memory of a process
+ *
+ * @param path Status file of the process, /proc/self/status for this one
+ * @param rss_kb Set to the resident memory in kB
+ *
+ * @return 0 if successful, -1 if the file cannot be read or has no VmRSS
+ */
+int raspisoak_read_rss(const char* path, long* rss_kb) {
+   FILE* f = fopen(path, "r");
+   char line[128];
+   int found = 0;
+
+   if (!f)
+      return -1;
+   while (!found && fgets(line, sizeof(line), f))
+      found = sscanf(line, "VmRSS: %ld", rss_kb) == 1;
+   fclose(f);
+   return found ? 0 : -1;
+}
+
+/**
+ * Check the samples of a soak against its limits
+ *
+ * @param samples Samples in the order they were taken
+ * @param run Latencies over the whole run
+ * @param limits Limits to check
+ * @param result Filled with the measured values and the limits exceeded
+ */
+void raspisoak_evaluate(const std::vector<RASPISOAK_SAMPLE>& samples,
+                        const RASPILATENCY_SNAPSHOT* run,
+                        const RASPISOAK_LIMITS* limits, RASPISOAK_RESULT* result) {
+   uint64_t published = 0, dropped = 0;
+   size_t first = 0;
+
+   memset(result, 0, sizeof(*result));
+   while (first < samples.size() && samples[first].minutes < limits->warmup_minutes)
+      first++;
+   for (size_t i = 0; i < samples.size(); i++) {
+      published += samples[i].published;
+      dropped += samples[i].dropped;
+   }
+   const int n = samples.size() - first;
+   result->trend_samples = n;
+
+   if (n >= 2) {
+      double mean_t = 0.0, mean_rss = 0.0, covariance = 0.0, variance = 0.0;
+      for (size_t i = first; i < samples.size(); i++) {
+         mean_t += samples[i].minutes / n;
+         mean_rss += (double)samples[i].rss_kb / n;
+      }
+      for (size_t i = first; i < samples.size(); i++) {
+         const double dt = samples[i].minutes - mean_t;
+         covariance += dt * (samples[i].rss_kb - mean_rss);
+         variance += dt * dt;
+      }
+      if (variance > 0.0)
+         result->rss_growth_kb = covariance / variance * 60.0;
+   }
+
+   result->p99_growth = 1.0;
+   if (n >= 4) {
+      const int quarter = n / 4;
+      double early = 0.0, late = 0.0;
+      for (int i = 0; i < quarter; i++) {
+         early += samples[first + i].p99_us;
+         late += samples[samples.size() - 1 - i].p99_us;
+      }
+      if (early > 0.0)
+         result->p99_growth = late / early;
+   }
+
+   if (published + dropped > 0)
+      result->drop_percent = 100.0 * dropped / (published + dropped);
+   result->p99_ms = raspilatency_percentile(run, 99.0) / 1000.0;
+   if (!samples.empty())
+      result->pool_overflows = samples.back().pool_overflows;
+
+   if (result->rss_growth_kb > limits->max_rss_growth_kb)
+      result->failed |= RASPISOAK_RSS_GROWTH;
+   if (result->drop_percent > limits->max_drop_percent)
+      result->failed |= RASPISOAK_DROPS;
+   if (result->p99_ms > limits->max_p99_ms)
+      result->failed |= RASPISOAK_LATENCY;
+   if (result->p99_growth > limits->max_p99_growth)
+      result->failed |= RASPISOAK_LATENCY_GROWTH;
+   if (result->pool_overflows > limits->max_pool_overflows)
+      result->failed |= RASPISOAK_POOL_OVERFLOWS;
+}
+
+/**
+ * Print one checked value of the report
+ */
+static void report_check(FILE* f, const char* name, double value, double limit,
+                         const char* unit, int failed) {
+   fprintf(f, "%-16s %12.3f %12.3f %-10s %s\n", name, value, limit, unit,
+           failed ? "FAIL" : "pass");
+}
+
+/**
+ * Write the samples and the result of a soak
+ *
+ * @param path File to write, "-" for the standard output
+ * @param samples Samples in the order they were taken
+ * @param limits Limits checked
+ * @param result Result of raspisoak_evaluate()
+ *
+ * @return 0 if successful, -1 if the file cannot be written
+ */
+int raspisoak_report(const char* path, const std::vector<RASPISOAK_SAMPLE>& samples,
+                     const RASPISOAK_LIMITS* limits, const RASPISOAK_RESULT* result) {
+   FILE* f = strcmp(path, "-") ? fopen(path, "w") : stdout;
+
+   if (!f)
+      return -1;
+   fprintf(f, "%8s %10s %6s %6s %9s %10s %8s %10s %10s %10s\n", "minutes",
+           "rss_kb", "kept", "in_use", "overflows", "published", "dropped",
+           "p50_ms", "p99_ms", "p99.9_ms");
+   for (size_t i = 0; i < samples.size(); i++) {
+      const RASPISOAK_SAMPLE& s = samples[i];
+      fprintf(f, "%8.1f %10ld %6d %6d %9u %10u %8u %10.2f %10.2f %10.2f%s\n",
+              s.minutes, s.rss_kb, s.pool_kept, s.pool_in_use, s.pool_overflows,
+              s.published, s.dropped, s.p50_us / 1000.0, s.p99_us / 1000.0,
+              s.p999_us / 1000.0,
+              s.minutes < limits->warmup_minutes ? " (warm-up)" : "");
+   }
+   fprintf(f, "\n%-16s %12s %12s %-10s %s\n", "check", "value", "limit", "unit",
+           "result");
+   report_check(f, "rss_growth", result->rss_growth_kb, limits->max_rss_growth_kb,
+                "kB/hour", result->failed & RASPISOAK_RSS_GROWTH);
+   report_check(f, "drops", result->drop_percent, limits->max_drop_percent,
+                "%", result->failed & RASPISOAK_DROPS);
+   report_check(f, "p99_latency", result->p99_ms, limits->max_p99_ms, "ms",
+                result->failed & RASPISOAK_LATENCY);
+   report_check(f, "p99_growth", result->p99_growth, limits->max_p99_growth,
+                "ratio", result->failed & RASPISOAK_LATENCY_GROWTH);
+   report_check(f, "pool_overflows", result->pool_overflows,
+                limits->max_pool_overflows, "frames",
+                result->failed & RASPISOAK_POOL_OVERFLOWS);
+   if (result->trend_samples < 4)
+      fprintf(f, "only %d samples after the warm-up, trends are not reliable\n",
+              result->trend_samples);
+   fprintf(f, "%s\n", result->failed ? "FAIL" : "PASS");
+   if (f != stdout)
+      fclose(f);
+   return 0;
+}
@@ -0,0 +1,402 @@
+/**
+ * \file RaspiStages.cpp
+ * Graph of processing stages fed by the camera callback
+ *
+ * Description
+ *
+ * One lock covers every queue of the graph; it is only held to move frame
+ * references around, never while a stage processes a frame. A stage hands
+ * a frame to its children once it has processed it, so the stages below a
+ * writer always see its result.
+ */
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+
+#include "RaspiStages.h"
+
+/**
+ * Monotonic time in microseconds
+ */
+int64_t raspistages_now_us() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Empty a graph, which must not be running
+ *
+ * @param graph Graph to initialise
+ */
+void raspistages_init(RASPISTAGES_GRAPH* graph) {
+   graph->num_stages = 0;
+   graph->num_roots = 0;
+   graph->running = 0;
+}
+
+/**
+ * Add a stage to a graph that is not running
+ *
+ * @param graph Graph to extend
+ * @param name Name of the stage, used for its thread and its counters
+ * @param parent Index of the stage feeding this one, -1 for the callbacks
+ * @param inputs RASPISTAGES_* bits a frame needs for the stage to process it
+ * @param outputs RASPISTAGES_* bits of the parts of the frame the stage writes
+ * @param process Called on the stage's thread for every frame
+ * @param userdata Passed to process
+ * @param capacity Length of the stage's queue
+ * @param policy RASPISTAGES_DROP_OLDEST or RASPISTAGES_DROP_NEWEST
+ * @param cpu Core to pin the stage's thread to, -1 for none
+ *
+ * @return index of the stage, -1 if it cannot be added
+ */
+int raspistages_add(RASPISTAGES_GRAPH* graph, const char* name, int parent,
+                    int inputs, int outputs, RASPISTAGES_PROCESS process,
+                    void* userdata, int capacity, int policy, int cpu) {
+   int* siblings;
+   int* num_siblings;
+
+   if (graph->running || graph->num_stages >= RASPISTAGES_MAX_STAGES ||
+       parent < -1 || parent >= graph->num_stages || !process || capacity < 1)
+      return -1;
+
+   if (parent < 0) {
+      siblings = graph->roots;
+      num_siblings = &graph->num_roots;
+   } else {
+      siblings = graph->stages[parent].children;
+      num_siblings = &graph->stages[parent].num_children;
+   }
+   // A writer cannot share its frames with a sibling
+   for (int i = 0; i < *num_siblings; i++) {
+      const RASPISTAGES_STAGE* sibling = &graph->stages[siblings[i]];
+      if ((outputs || sibling->outputs) && (inputs & sibling->inputs))
+         return -1;
+   }
+
+   const int index = graph->num_stages;
+   RASPISTAGES_STAGE* stage = &graph->stages[index];
+   strncpy(stage->name, name, sizeof(stage->name) - 1);
+   stage->name[sizeof(stage->name) - 1] = 0;
+   stage->parent = parent;
+   stage->num_children = 0;
+   stage->inputs = inputs;
+   stage->outputs = outputs;
+   stage->process = process;
+   stage->userdata = userdata;
+   stage->capacity = capacity;
+   stage->policy = policy;
+   stage->cpu = cpu;
+   stage->enabled = 1;
+   stage->max_age_us = 0;
+   stage->queue.assign(capacity, RASPISTAGES_FRAME_PTR());
+   stage->head = 0;
+   stage->count = 0;
+   memset(&stage->stats, 0, sizeof(RASPISTAGES_STATS));
+
+   siblings[(*num_siblings)++] = index;
+   graph->num_stages++;
+   return index;
+}
+
+/**
+ * Queue a frame on a stage, called with the graph lock held
+ */
+static void push_frame(RASPISTAGES_STAGE* stage, const RASPISTAGES_FRAME_PTR& frame) {
+   if (!(frame->contents & stage->inputs))
+      return;
+   if (stage->count >= stage->capacity) {
+      stage->stats.dropped++;
+      if (stage->policy == RASPISTAGES_DROP_NEWEST)
+         return;
+      stage->queue[stage->head].reset();
+      stage->head = (stage->head + 1) % stage->capacity;
+      stage->count--;
+   }
+   stage->queue[(stage->head + stage->count) % stage->capacity] = frame;
+   stage->count++;
+   stage->ready.notify_one();
+}
+
+/**
+ * Check a frame against the maximum age of a stage, called with the graph
+ * lock held
+ *
+ * @return 1 if the frame is recent enough, 0 if it was counted as stale
+ */
+static int check_age(RASPISTAGES_STAGE* stage, const RASPISTAGES_FRAME_PTR& frame) {
+   if (stage->max_age_us > 0 &&
+       raspistages_now_us() - frame->captured_us > stage->max_age_us) {
+      stage->stats.stale++;
+      return 0;
+   }
+   return 1;
+}
+
+/**
+ * Thread of a stage
+ */
+static void stage_loop(RASPISTAGES_GRAPH* graph, RASPISTAGES_STAGE* stage) {
+   std::unique_lock<std::mutex> lock(graph->lock);
+
+   while (graph->running) {
+      if (stage->count == 0) {
+         stage->ready.wait(lock);
+         continue;
+      }
+      RASPISTAGES_FRAME_PTR frame;
+      frame.swap(stage->queue[stage->head]);
+      stage->head = (stage->head + 1) % stage->capacity;
+      stage->count--;
+      // Stale frames go no further, the ones behind them are fresher
+      if (!check_age(stage, frame))
+         continue;
+      const int run = stage->enabled &&
+                      (frame->contents & stage->inputs) == stage->inputs;
+      lock.unlock();
+
+      int64_t start = 0, end = 0;
+      if (run) {
+         start = raspistages_now_us();
+         stage->process(frame, stage->userdata);
+         end = raspistages_now_us();
+      }
+
+      lock.lock();
+      if (run) {
+         stage->stats.processed++;
+         stage->stats.busy_us += end - start;
+         if (end - start > stage->stats.max_us)
+            stage->stats.max_us = end - start;
+         stage->stats.latency_us += end - frame->captured_us;
+      }
+      for (int i = 0; i < stage->num_children; i++)
+         push_frame(&graph->stages[stage->children[i]], frame);
+   }
+}
+
+/**
+ * Start the threads of every stage
+ *
+ * @param graph Graph to start
+ *
+ * @return 0 if successful, -1 if a thread could not be started
+ */
+int raspistages_start(RASPISTAGES_GRAPH* graph) {
+   graph->running = 1;
+   for (int i = 0; i < graph->num_stages; i++) {
+      RASPISTAGES_STAGE* stage = &graph->stages[i];
+      try {
+         stage->thread = std::thread(stage_loop, graph, stage);
+      } catch (const std::system_error&) {
+         raspistages_stop(graph);
+         return -1;
+      }
+      pthread_setname_np(stage->thread.native_handle(), stage->name);
+      if (stage->cpu >= 0) {
+         cpu_set_t cpus;
+         CPU_ZERO(&cpus);
+         CPU_SET(stage->cpu, &cpus);
+         pthread_setaffinity_np(stage->thread.native_handle(), sizeof(cpus), &cpus);
+      }
+   }
+   return 0;
+}
+
+/**
+ * Stop the threads once they are done with their current frame and drop
+ * every queued frame
+ *
+ * @param graph Graph to stop
+ */
+void raspistages_stop(RASPISTAGES_GRAPH* graph) {
+   {
+      std::lock_guard<std::mutex> lock(graph->lock);
+      graph->running = 0;
+      for (int i = 0; i < graph->num_stages; i++)
+         graph->stages[i].ready.notify_all();
+   }
+   for (int i = 0; i < graph->num_stages; i++) {
+      RASPISTAGES_STAGE* stage = &graph->stages[i];
+      if (stage->thread.joinable())
+         stage->thread.join();
+      for (int j = 0; j < stage->capacity; j++)
+         stage->queue[j].reset();
+      stage->head = 0;
+      stage->count = 0;
+   }
+}
+
+/**
+ * Look up a stage by name
+ *
+ * @return index of the stage, -1 if there is none of that name
+ */
+int raspistages_find(RASPISTAGES_GRAPH* graph, const char* name) {
+   for (int i = 0; i < graph->num_stages; i++)
+      if (strcmp(graph->stages[i].name, name) == 0)
+         return i;
+   return -1;
+}
+
+/**
+ * Turn the processing of a stage on or off, frames keep flowing to its
+ * children either way
+ *
+ * @param graph Graph holding the stage
+ * @param stage Index of the stage
+ * @param enabled 0 to skip the stage
+ */
+void raspistages_enable(RASPISTAGES_GRAPH* graph, int stage, int enabled) {
+   std::lock_guard<std::mutex> lock(graph->lock);
+   graph->stages[stage].enabled = enabled;
+}
+
+/**
+ * Set the maximum age of the frames a stage processes
+ *
+ * @param graph Graph holding the stage
+ * @param stage Index of the stage
+ * @param max_age_us Longest time from capture to the start of processing, 0 for no limit
+ */
+void raspistages_set_max_age(RASPISTAGES_GRAPH* graph, int stage, int64_t max_age_us) {
+   std::lock_guard<std::mutex> lock(graph->lock);
+   graph->stages[stage].max_age_us = max_age_us;
+}
+
+/**
+ * Check the age of a frame a stage kept from an earlier call, before
+ * publishing it
+ *
+ * @param graph Graph holding the stage
+ * @param stage Index of the stage
+ * @param frame Frame about to be published
+ *
+ * @return 1 if the frame is recent enough, 0 if it was counted as stale
+ */
+int raspistages_fresh(RASPISTAGES_GRAPH* graph, int stage,
+                      const RASPISTAGES_FRAME_PTR& frame) {
+   std::lock_guard<std::mutex> lock(graph->lock);
+   return check_age(&graph->stages[stage], frame);
+}
+
+/**
+ * Hand a frame from a callback to the graph, never blocks on a stage
+ *
+ * @param graph Graph to feed
+ * @param frame Frame to process, must not be changed by the caller afterwards
+ * @param captured_us Monotonic time the frame was captured, the deadlines
+ * count from it; -1 when unknown, for the time of the hand-off
+ */
+void raspistages_submit(RASPISTAGES_GRAPH* graph, const RASPISTAGES_FRAME_PTR& frame,
+                        int64_t captured_us) {
+   std::lock_guard<std::mutex> lock(graph->lock);
+
+   if (!graph->running)
+      return;
+   const int64_t now = raspistages_now_us();
+   frame->captured_us = (captured_us >= 0 && captured_us <= now) ? captured_us : now;
+   for (int i = 0; i < graph->num_roots; i++)
+      push_frame(&graph->stages[graph->roots[i]], frame);
+}
+
+/**
+ * Read the counters of a stage
+ *
+ * @param graph Graph holding the stage
+ * @param stage Index of the stage
+ * @param stats Filled with the counters
+ * @param reset Set to start counting again from zero
+ */
+void raspistages_stats(RASPISTAGES_GRAPH* graph, int stage, RASPISTAGES_STATS* stats,
+                       int reset) {
+   std::lock_guard<std::mutex> lock(graph->lock);
+
+   *stats = graph->stages[stage].stats;
+   stats->queued = graph->stages[stage].count;
+   if (reset)
+      memset(&graph->stages[stage].stats, 0, sizeof(RASPISTAGES_STATS));
+}
+
+/**
+ * Most frames the graph can hold at once, in its queues and being processed
+ *
+ * @param graph Graph to size a pool for
+ */
+int raspistages_capacity(RASPISTAGES_GRAPH* graph) {
+   int frames = 0;
+
+   for (int i = 0; i < graph->num_stages; i++)
+      frames += graph->stages[i].capacity + 1;
+   return frames;
+}
+
+/**
+ * Empty a pool, frames still held elsewhere are freed when released
+ *
+ * @param pool Pool to initialise
+ * @param max_frames Frames to keep for reuse
+ */
+void raspistages_pool_init(RASPISTAGES_POOL* pool, int max_frames) {
+   pool->frames.clear();
+   pool->frames.reserve(max_frames);
+   pool->max_frames = max_frames;
+   pool->kept = 0;
+   pool->overflows = 0;
+}
+
+/**
+ * Take a frame no stage holds, to fill from a callback
+ *
+ * The frame keeps the storage and contents it was last filled with. Only the
+ * thread owning the pool may call this.
+ *
+ * @param pool Pool of the calling callback
+ *
+ * @return a frame for the caller alone, a new one if every pooled frame is in use
+ */
+RASPISTAGES_FRAME_PTR raspistages_acquire(RASPISTAGES_POOL* pool) {
+   for (size_t i = 0; i < pool->frames.size(); i++) {
+      // Only the pool can hand out new references, so a frame it holds
+      // alone stays that way
+      if (pool->frames[i].use_count() == 1) {
+         // Pairs with the release of the last stage reference
+         std::atomic_thread_fence(std::memory_order_acquire);
+         return pool->frames[i];
+      }
+   }
+   RASPISTAGES_FRAME_PTR frame = std::make_shared<RASPISTAGES_FRAME>();
+   if ((int)pool->frames.size() < pool->max_frames) {
+      // Reserved, so the frames other threads may be reading do not move
+      pool->frames.push_back(frame);
+      pool->kept.store(pool->frames.size(), std::memory_order_release);
+   } else {
+      pool->overflows.fetch_add(1, std::memory_order_relaxed);
+   }
+   return frame;
+}
+
+/**
+ * Occupancy of a pool, from any thread
+ *
+ * Must not run at the same time as raspistages_pool_init() on the pool.
+ *
+ * @param pool Pool to look at
+ * @param kept Set to the frames the pool holds
+ * @param in_use Set to the frames among them held by a stage or callback
+ * @param overflows Set to the frames allocated outside the pool since it was
+ * initialised
+ */
+void raspistages_pool_stats(RASPISTAGES_POOL* pool, int* kept, int* in_use,
+                            uint32_t* overflows) {
+   *kept = pool->kept.load(std::memory_order_acquire);
+   *in_use = 0;
+   for (int i = 0; i < *kept; i++) {
+      if (pool->frames[i].use_count() > 1)
+         (*in_use)++;
+   }
+   *overflows = pool->overflows.load(std::memory_order_relaxed);
+}
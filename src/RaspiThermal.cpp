@@ -0,0 +1,106 @@
+/**
+ * \file RaspiThermal.cpp
+ * SoC temperature and throttle monitoring
+ *
+ * Description
+ *
+ * The temperature file holds millidegrees (thermal_zone format). The
+ * throttle file holds the firmware flags in hex, with or without the
+ * "throttled=" prefix printed by vcgencmd get_throttled.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RaspiThermal.h"
+
+/**
+ * Read the first line of a small text file
+ */
+static int read_line(const char* path, char* buf, int size) {
+   FILE* f = fopen(path, "r");
+   int ok;
+
+   if (!f)
+      return -1;
+   ok = fgets(buf, size, f) != NULL;
+   fclose(f);
+   return ok ? 0 : -1;
+}
+
+/**
+ * Read the SoC temperature
+ *
+ * @param path File holding the temperature in millidegrees
+ * @param celsius Set to the temperature in degrees
+ *
+ * @return 0 if successful, -1 if the file cannot be read
+ */
+int raspithermal_read_temperature(const char* path, double* celsius) {
+   char buf[32], *end;
+   long value;
+
+   if (read_line(path, buf, sizeof(buf)) != 0)
+      return -1;
+   value = strtol(buf, &end, 10);
+   if (end == buf)
+      return -1;
+   *celsius = value / 1000.0;
+   return 0;
+}
+
+/**
+ * Read the firmware throttle flags
+ *
+ * @param path File holding the flags in hex
+ * @param flags Set to the flags
+ *
+ * @return 0 if successful, -1 if the file cannot be read
+ */
+int raspithermal_read_throttled(const char* path, unsigned int* flags) {
+   char buf[64], *start, *end;
+
+   if (read_line(path, buf, sizeof(buf)) != 0)
+      return -1;
+   start = strchr(buf, '=');
+   start = start ? start + 1 : buf;
+   *flags = strtoul(start, &end, 16);
+   return (end == start) ? -1 : 0;
+}
+
+/**
+ * Set up the controller at the top of the ladder (nothing applied)
+ *
+ * @param state Controller to initialise
+ * @param high Step down at or above this temperature
+ * @param low Step up below this temperature, clamped to at most high
+ * @param levels Steps in the ladder
+ */
+void raspithermal_init(RASPITHERMAL_STATE* state, double high, double low, int levels) {
+   state->high = high;
+   state->low = (low < high) ? low : high;
+   state->levels = levels;
+   state->level = 0;
+}
+
+/**
+ * Move at most one step along the ladder
+ *
+ * Between the two marks the level stays put, so the node does not swing
+ * back and forth around a single threshold.
+ *
+ * @param state Controller
+ * @param celsius Current temperature
+ * @param flags Current throttle flags
+ *
+ * @return the new level
+ */
+int raspithermal_update(RASPITHERMAL_STATE* state, double celsius, unsigned int flags) {
+   if (celsius >= state->high || (flags & RASPITHERMAL_ACTIVE)) {
+      if (state->level < state->levels)
+         state->level++;
+   } else if (celsius < state->low && state->level > 0) {
+      state->level--;
+   }
+   return state->level;
+}
@@ -0,0 +1,179 @@
+/**
+ * \file RaspiTileDelta.cpp
+ * Tile based delta coding of raw frames
+ *
+ * Description
+ *
+ * Encoder and reassembler for the camera/image/delta output. Tiles are
+ * numbered row-major; edge tiles are clipped to the frame. The payload of a
+ * message is the concatenation of the sent tiles, each stored row by row
+ * without padding.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "RaspiSimd.h"
+#include "RaspiTileDelta.h"
+
+/**
+ * Compute the pixel rectangle covered by a tile
+ */
+static void tile_rect(int width, int height, int tile_size, int tiles_x,
+                      int index, int* x, int* y, int* w, int* h) {
+   *x = (index % tiles_x) * tile_size;
+   *y = (index / tiles_x) * tile_size;
+   *w = (*x + tile_size > width) ? width - *x : tile_size;
+   *h = (*y + tile_size > height) ? height - *y : tile_size;
+}
+
+/**
+ * Set up an encoder for frames of the given geometry
+ *
+ * @param state Encoder state to initialise
+ * @param width Frame width in pixels
+ * @param height Frame height in pixels
+ * @param bpp Bytes per pixel (1 for mono8, 3 for rgb8)
+ * @param tile_size Tile edge in pixels
+ * @param threshold Mean absolute difference per byte above which a tile is resent
+ * @param refresh_interval Frames between full refreshes, 0 to disable
+ *
+ * @return 0 if successful, -1 otherwise
+ */
+int raspitiledelta_init(RASPITILEDELTA_STATE* state, int width, int height,
+                        int bpp, int tile_size, int threshold, int refresh_interval) {
+   memset(state, 0, sizeof(RASPITILEDELTA_STATE));
+
+   if (width <= 0 || height <= 0 || bpp <= 0 || tile_size <= 0)
+      return -1;
+
+   state->width = width;
+   state->height = height;
+   state->bpp = bpp;
+   state->tile_size = tile_size;
+   state->tiles_x = (width + tile_size - 1) / tile_size;
+   state->tiles_y = (height + tile_size - 1) / tile_size;
+   state->threshold = threshold;
+   state->refresh_interval = refresh_interval;
+   state->force_refresh = 1;
+   state->reference = (uint8_t*) malloc((size_t)width * height * bpp);
+
+   return state->reference ? 0 : -1;
+}
+
+void raspitiledelta_destroy(RASPITILEDELTA_STATE* state) {
+   free(state->reference);
+   state->reference = NULL;
+}
+
+/**
+ * Encode a frame as the set of tiles that changed since they were last sent
+ *
+ * The chosen tiles are copied into the reference so that the next frame is
+ * compared against what the receiver actually holds.
+ *
+ * @param state Encoder state
+ * @param frame First byte of the frame
+ * @param stride Bytes between the starts of two rows of the frame
+ * @param tile_indices Filled with the row-major indices of the sent tiles
+ * @param payload Filled with the concatenated tile contents
+ * @param keyframe Set to 1 if every tile was sent
+ *
+ * @return number of tiles sent
+ */
+int raspitiledelta_encode(RASPITILEDELTA_STATE* state, const uint8_t* frame,
+                          int stride, std::vector<uint32_t>& tile_indices,
+                          std::vector<uint8_t>& payload, int* keyframe) {
+   const int ref_stride = state->width * state->bpp;
+   const int num_tiles = state->tiles_x * state->tiles_y;
+   int full;
+
+   full = state->force_refresh ||
+          (state->refresh_interval > 0 &&
+           state->frames_since_refresh >= state->refresh_interval);
+
+   tile_indices.clear();
+   payload.clear();
+
+   for (int t = 0; t < num_tiles; t++) {
+      int x, y, w, h;
+      tile_rect(state->width, state->height, state->tile_size, state->tiles_x, t,
+                &x, &y, &w, &h);
+      const int row_bytes = w * state->bpp;
+      const uint8_t* src = frame + (size_t)y * stride + x * state->bpp;
+      uint8_t* ref = state->reference + (size_t)y * ref_stride + x * state->bpp;
+
+      if (!full) {
+         // Stop summing as soon as the tile is known to have changed
+         const uint32_t limit = (uint32_t)state->threshold * row_bytes * h;
+         uint32_t sad = 0;
+         for (int r = 0; r < h && sad <= limit; r++)
+            sad += raspisimd_sad_u8(src + (size_t)r * stride,
+                                    ref + (size_t)r * ref_stride, row_bytes);
+         if (sad <= limit)
+            continue;
+      }
+
+      size_t offset = payload.size();
+      payload.resize(offset + (size_t)row_bytes * h);
+      for (int r = 0; r < h; r++) {
+         memcpy(&payload[offset + (size_t)r * row_bytes], src + (size_t)r * stride,
+                row_bytes);
+         memcpy(ref + (size_t)r * ref_stride, src + (size_t)r * stride, row_bytes);
+      }
+      tile_indices.push_back(t);
+   }
+
+   if (full) {
+      state->frames_since_refresh = 0;
+      state->force_refresh = 0;
+   } else {
+      state->frames_since_refresh++;
+   }
+   *keyframe = full;
+
+   return (int)tile_indices.size();
+}
+
+/**
+ * Write the tiles of a delta message into a reassembled image
+ *
+ * @param image Packed image of width * bpp bytes per row, updated in place
+ * @param width Image width in pixels
+ * @param height Image height in pixels
+ * @param bpp Bytes per pixel
+ * @param tile_size Tile edge in pixels
+ * @param tile_indices Row-major indices of the tiles in the payload
+ * @param num_tiles Number of entries in tile_indices
+ * @param payload Concatenated tile contents
+ * @param payload_size Size of payload in bytes
+ *
+ * @return 0 if the message was consistent with the geometry, -1 otherwise
+ */
+int raspitiledelta_apply(uint8_t* image, int width, int height, int bpp,
+                         int tile_size, const uint32_t* tile_indices, int num_tiles,
+                         const uint8_t* payload, size_t payload_size) {
+   if (width <= 0 || height <= 0 || bpp <= 0 || tile_size <= 0)
+      return -1;
+
+   const int tiles_x = (width + tile_size - 1) / tile_size;
+   const int tiles_y = (height + tile_size - 1) / tile_size;
+   const int stride = width * bpp;
+   size_t offset = 0;
+
+   for (int i = 0; i < num_tiles; i++) {
+      int x, y, w, h;
+      if (tile_indices[i] >= (uint32_t)(tiles_x * tiles_y))
+         return -1;
+      tile_rect(width, height, tile_size, tiles_x, tile_indices[i], &x, &y, &w, &h);
+      const int row_bytes = w * bpp;
+      if (offset + (size_t)row_bytes * h > payload_size)
+         return -1;
+      uint8_t* dst = image + (size_t)y * stride + x * bpp;
+      for (int r = 0; r < h; r++) {
+         memcpy(dst + (size_t)r * stride, payload + offset, row_bytes);
+         offset += row_bytes;
+      }
+   }
+
+   return (offset == payload_size) ? 0 : -1;
+}
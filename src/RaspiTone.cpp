@@ -0,0 +1,178 @@
+/**
+ * \file RaspiTone.cpp
+ * Fused tone LUT and colour correction matrix for the raw frame
+ *
+ * Description
+ *
+ * Rows are processed in short chunks: the LUT lookups also deinterleave the
+ * pixels into planar 16 bit lanes, the matrix is done with NEON/SSE2 on
+ * those, and the result is interleaved back into the frame. The chunk stays
+ * in L1, so the frame is only read and written once.
+ */
+#include <math.h>
+#include <stddef.h>
+
+#include "RaspiSimd.h"
+#include "RaspiTone.h"
+
+/// Pixels per chunk, a multiple of 8
+#define TONE_CHUNK 64
+
+/**
+ * Build a configuration
+ *
+ * @param config Configuration to fill
+ * @param gamma Exponent applied to normalised values, 1.0 for none
+ * @param curve Tone curve as (input, output) pairs in 0..255 with increasing
+ *              inputs, applied after the gamma, NULL for none
+ * @param curve_values Number of values in curve (twice the number of points)
+ * @param matrix Row-major 3x3 colour matrix, NULL for identity
+ *
+ * @return 0 if successful, -1 if a parameter is out of range
+ */
+int raspitone_build(RASPITONE_CONFIG* config, double gamma, const double* curve,
+                    int curve_values, const double* matrix) {
+   const int one = 1 << RASPITONE_MATRIX_SHIFT;
+
+   if (gamma <= 0.0 || (curve && (curve_values < 4 || curve_values % 2)))
+      return -1;
+   for (int i = 2; curve && i < curve_values; i += 2)
+      if (curve[i] <= curve[i - 2])
+         return -1;
+
+   config->use_lut = 0;
+   for (int v = 0; v < 256; v++) {
+      double out = 255.0 * pow(v / 255.0, gamma);
+      if (curve) {
+         if (out <= curve[0]) {
+            out = curve[1];
+         } else if (out >= curve[curve_values - 2]) {
+            out = curve[curve_values - 1];
+         } else {
+            int i = 2;
+            while (out > curve[i])
+               i += 2;
+            double t = (out - curve[i - 2]) / (curve[i] - curve[i - 2]);
+            out = curve[i - 1] + t * (curve[i + 1] - curve[i - 1]);
+         }
+      }
+      int q = (int)(out + 0.5);
+      config->lut[v] = (q < 0) ? 0 : (q > 255) ? 255 : q;
+      if (config->lut[v] != v)
+         config->use_lut = 1;
+   }
+
+   config->use_matrix = 0;
+   for (int i = 0; i < 9; i++) {
+      double m = matrix ? matrix[i] : (i % 4 == 0);
+      if (m < -7.99 || m > 7.99)
+         return -1;
+      config->matrix[i] = (int16_t)lrint(m * one);
+      if (config->matrix[i] != ((i % 4 == 0) ? one : 0))
+         config->use_matrix = 1;
+   }
+   return 0;
+}
+
+/**
+ * Multiply planar r, g, b lanes by the matrix, writing planar bytes
+ */
+static void apply_matrix(const int16_t* m, const int16_t* r, const int16_t* g,
+                         const int16_t* b, uint8_t* out[3], int n) {
+   int i = 0;
+#if defined(RASPI_SIMD_NEON)
+   for (; i + 8 <= n; i += 8) {
+      int16x8_t vr = vld1q_s16(r + i), vg = vld1q_s16(g + i), vb = vld1q_s16(b + i);
+      for (int c = 0; c < 3; c++) {
+         const int16_t* row = m + 3 * c;
+         int32x4_t lo = vmull_n_s16(vget_low_s16(vr), row[0]);
+         int32x4_t hi = vmull_n_s16(vget_high_s16(vr), row[0]);
+         lo = vmlal_n_s16(lo, vget_low_s16(vg), row[1]);
+         hi = vmlal_n_s16(hi, vget_high_s16(vg), row[1]);
+         lo = vmlal_n_s16(lo, vget_low_s16(vb), row[2]);
+         hi = vmlal_n_s16(hi, vget_high_s16(vb), row[2]);
+         int16x8_t v = vcombine_s16(vqrshrn_n_s32(lo, RASPITONE_MATRIX_SHIFT),
+                                    vqrshrn_n_s32(hi, RASPITONE_MATRIX_SHIFT));
+         vst1_u8(out[c] + i, vqmovun_s16(v));
+      }
+   }
+#elif defined(RASPI_SIMD_SSE2)
+   const __m128i round = _mm_set1_epi32(1 << (RASPITONE_MATRIX_SHIFT - 1));
+   for (; i + 8 <= n; i += 8) {
+      __m128i vr = _mm_loadu_si128((const __m128i*)(r + i));
+      __m128i vg = _mm_loadu_si128((const __m128i*)(g + i));
+      __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+      __m128i rg_lo = _mm_unpacklo_epi16(vr, vg), rg_hi = _mm_unpackhi_epi16(vr, vg);
+      __m128i b_lo = _mm_unpacklo_epi16(vb, _mm_setzero_si128());
+      __m128i b_hi = _mm_unpackhi_epi16(vb, _mm_setzero_si128());
+      for (int c = 0; c < 3; c++) {
+         const int16_t* row = m + 3 * c;
+         __m128i m01 = _mm_set1_epi32((uint16_t)row[0] | ((uint32_t)(uint16_t)row[1] << 16));
+         __m128i m2 = _mm_set1_epi32((uint16_t)row[2]);
+         __m128i lo = _mm_add_epi32(_mm_madd_epi16(rg_lo, m01), _mm_madd_epi16(b_lo, m2));
+         __m128i hi = _mm_add_epi32(_mm_madd_epi16(rg_hi, m01), _mm_madd_epi16(b_hi, m2));
+         lo = _mm_srai_epi32(_mm_add_epi32(lo, round), RASPITONE_MATRIX_SHIFT);
+         hi = _mm_srai_epi32(_mm_add_epi32(hi, round), RASPITONE_MATRIX_SHIFT);
+         __m128i v = _mm_packus_epi16(_mm_packs_epi32(lo, hi), _mm_setzero_si128());
+         _mm_storel_epi64((__m128i*)(out[c] + i), v);
+      }
+   }
+#endif
+   for (; i < n; i++) {
+      for (int c = 0; c < 3; c++) {
+         const int16_t* row = m + 3 * c;
+         int v = (row[0] * r[i] + row[1] * g[i] + row[2] * b[i] +
+                  (1 << (RASPITONE_MATRIX_SHIFT - 1))) >> RASPITONE_MATRIX_SHIFT;
+         out[c][i] = (v < 0) ? 0 : (v > 255) ? 255 : v;
+      }
+   }
+}
+
+/**
+ * Apply a configuration to a frame in place
+ *
+ * @param config Configuration from raspitone_build()
+ * @param frame First byte of the frame
+ * @param width Width in pixels
+ * @param height Height in pixels
+ * @param stride Bytes between the starts of two rows
+ * @param bpp Bytes per pixel, 1 (mono) or 3 (rgb)
+ */
+void raspitone_apply(const RASPITONE_CONFIG* config, uint8_t* frame, int width,
+                     int height, int stride, int bpp) {
+   const uint8_t* lut = config->lut;
+
+   if (bpp != 3 || !config->use_matrix) {
+      if (!config->use_lut)
+         return;
+      for (int y = 0; y < height; y++) {
+         uint8_t* row = frame + (size_t)y * stride;
+         for (int i = 0; i < width * bpp; i++)
+            row[i] = lut[row[i]];
+      }
+      return;
+   }
+
+   int16_t r[TONE_CHUNK], g[TONE_CHUNK], b[TONE_CHUNK];
+   uint8_t planes[3][TONE_CHUNK];
+   uint8_t* out[3] = { planes[0], planes[1], planes[2] };
+
+   for (int y = 0; y < height; y++) {
+      uint8_t* row = frame + (size_t)y * stride;
+      for (int x = 0; x < width; x += TONE_CHUNK) {
+         const int n = (width - x < TONE_CHUNK) ? width - x : TONE_CHUNK;
+         uint8_t* p = row + x * 3;
+         for (int i = 0; i < n; i++) {
+            r[i] = lut[p[3 * i]];
+            g[i] = lut[p[3 * i + 1]];
+            b[i] = lut[p[3 * i + 2]];
+         }
+         apply_matrix(config->matrix, r, g, b, out, n);
+         for (int i = 0; i < n; i++) {
+            p[3 * i] = planes[0][i];
+            p[3 * i + 1] = planes[1][i];
+            p[3 * i + 2] = planes[2][i];
+         }
+      }
+   }
+}
@@ -0,0 +1,592 @@
+/**
+ * \file RaspiUdp.cpp
+ * Encoded frames over UDP, fragmented to the MTU, with optional parity
+ *
+ * Description
+ *
+ * The sender cuts a frame into datagrams and the parity of each group, the
+ * receiver puts them back together in one of a few slots, rebuilding a
+ * fragment from the parity of its group when it is the only one missing.
+ * The data of a slot is kept fragment_bytes apart with zeros past the end
+ * of the frame, so a short last fragment needs no special case in the XOR.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <algorithm>
+
+#include "RaspiUdp.h"
+
+/// Asked of the kernel for the receiving socket, a burst of frames fits
+#define RASPIUDP_RECEIVE_BUFFER  (4 * 1024 * 1024)
+
+static void put16(uint8_t* p, uint16_t value) {
+   p[0] = value >> 8;
+   p[1] = value;
+}
+
+static void put32(uint8_t* p, uint32_t value) {
+   put16(p, value >> 16);
+   put16(p + 2, value);
+}
+
+static void put64(uint8_t* p, uint64_t value) {
+   put32(p, value >> 32);
+   put32(p + 4, value);
+}
+
+static uint16_t get16(const uint8_t* p) {
+   return (p[0] << 8) | p[1];
+}
+
+static uint32_t get32(const uint8_t* p) {
+   return ((uint32_t)get16(p) << 16) | get16(p + 2);
+}
+
+static uint64_t get64(const uint8_t* p) {
+   return ((uint64_t)get32(p) << 32) | get32(p + 4);
+}
+
+static int64_t now_ms() {
+   struct timespec t;
+
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return (int64_t)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+static int parity_fragments(const RASPIUDP_HEADER* header) {
+   return header->group ? (header->fragments + header->group - 1) / header->group : 0;
+}
+
+/**
+ * Bytes of a fragment of a frame, data or parity
+ */
+static size_t fragment_length(const RASPIUDP_HEADER* header, int index) {
+   if (index == header->fragments - 1)
+      return header->frame_bytes - (size_t)index * header->fragment_bytes;
+   return header->fragment_bytes;
+}
+
+static void xor_bytes(uint8_t* into, const uint8_t* from, size_t bytes) {
+   for (size_t i = 0; i < bytes; i++)
+      into[i] ^= from[i];
+}
+
+/**
+ * Fill the interface part of a multicast request
+ *
+ * @param interface Address or name of the interface, NULL or empty for the
+ * one the routes choose
+ * @param request Request to fill
+ *
+ * @return 0 if successful, -1 if there is no such interface
+ */
+static int interface_request(const char* interface, struct ip_mreqn* request) {
+   memset(request, 0, sizeof(*request));
+   request->imr_address.s_addr = htonl(INADDR_ANY);
+   if (!interface || !*interface ||
+       inet_pton(AF_INET, interface, &request->imr_address) == 1)
+      return 0;
+   request->imr_ifindex = if_nametoindex(interface);
+   return request->imr_ifindex ? 0 : -1;
+}
+
+/**
+ * Write the header of a datagram
+ *
+ * @param header Header to write
+ * @param datagram Start of the datagram, RASPIUDP_HEADER_BYTES are written
+ */
+void raspiudp_write_header(const RASPIUDP_HEADER* header, uint8_t* datagram) {
+   put16(datagram, RASPIUDP_MAGIC);
+   datagram[2] = RASPIUDP_VERSION;
+   datagram[3] = header->group;
+   put32(datagram + 4, header->frame_id);
+   put64(datagram + 8, header->stamp_ns);
+   put32(datagram + 16, header->frame_bytes);
+   put16(datagram + 20, header->index);
+   put16(datagram + 22, header->fragments);
+   put16(datagram + 24, header->fragment_bytes);
+   put16(datagram + 26, header->session);
+}
+
+/**
+ * Read and check the header of a datagram
+ *
+ * @param datagram Datagram received
+ * @param bytes Size of the datagram
+ * @param header Set to the header read
+ *
+ * @return 0 if successful, -1 if the datagram is not a fragment of a frame
+ * or its size does not match its header
+ */
+int raspiudp_read_header(const uint8_t* datagram, size_t bytes, RASPIUDP_HEADER* header) {
+   if (bytes < RASPIUDP_HEADER_BYTES || get16(datagram) != RASPIUDP_MAGIC ||
+       datagram[2] != RASPIUDP_VERSION)
+      return -1;
+   header->group = datagram[3];
+   header->frame_id = get32(datagram + 4);
+   header->stamp_ns = get64(datagram + 8);
+   header->frame_bytes = get32(datagram + 16);
+   header->index = get16(datagram + 20);
+   header->fragments = get16(datagram + 22);
+   header->fragment_bytes = get16(datagram + 24);
+   header->session = get16(datagram + 26);
+
+   if (header->frame_bytes == 0 || header->fragment_bytes == 0 ||
+       header->fragments != ((uint64_t)header->frame_bytes + header->fragment_bytes - 1) /
+                            header->fragment_bytes ||
+       header->index >= header->fragments + parity_fragments(header) ||
+       bytes - RASPIUDP_HEADER_BYTES != fragment_length(header, header->index))
+      return -1;
+   return 0;
+}
+
+/**
+ * Open a socket sending to a multicast group or a single address
+ *
+ * @param sender Sender to set up
+ * @param address IPv4 address to send to
+ * @param port UDP port to send to
+ * @param interface Address or name of the interface multicast leaves by,
+ * NULL or empty for the one the routes choose
+ * @param ttl Time to live of the datagrams, 1 to stay on the local network
+ * @param mtu Largest IP datagram sent
+ * @param group Data fragments per parity fragment, 0 for no parity
+ *
+ * @return 0 if successful, -1 with errno set if an argument is invalid or
+ * the socket cannot be set up
+ */
+int raspiudp_sender_open(RASPIUDP_SENDER* sender, const char* address, int port,
+                         const char* interface, int ttl, int mtu, int group) {
+   struct timespec t;
+
+   sender->fd = -1;
+   sender->fragment_bytes = mtu - RASPIUDP_IP_UDP_BYTES - RASPIUDP_HEADER_BYTES;
+   sender->group = group;
+   sender->frames = 0;
+   sender->datagrams = 0;
+   sender->errors = 0;
+   // Differs from the session of the node's last run, whatever its frame ids
+   clock_gettime(CLOCK_REALTIME, &t);
+   sender->session = (uint16_t)(t.tv_nsec / 1000 ^ t.tv_sec ^ getpid());
+   if (sender->fragment_bytes < 64 || mtu > 65535 || group < 0 || group > 255 ||
+       port <= 0 || port > 65535 || ttl < 1 || ttl > 255) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   memset(&sender->destination, 0, sizeof(sender->destination));
+   sender->destination.sin_family = AF_INET;
+   sender->destination.sin_port = htons(port);
+   if (inet_pton(AF_INET, address, &sender->destination.sin_addr) != 1) {
+      errno = EINVAL;
+      return -1;
+   }
+   sender->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+   if (sender->fd < 0)
+      return -1;
+
+   int ok;
+   if (IN_MULTICAST(ntohl(sender->destination.sin_addr.s_addr))) {
+      const unsigned char hops = ttl;
+      // Looped back, a receiver on this machine gets the stream too
+      const unsigned char loop = 1;
+      struct ip_mreqn request;
+      ok = interface_request(interface, &request) == 0 &&
+           setsockopt(sender->fd, IPPROTO_IP, IP_MULTICAST_IF, &request,
+                      sizeof(request)) == 0 &&
+           setsockopt(sender->fd, IPPROTO_IP, IP_MULTICAST_TTL, &hops, sizeof(hops)) == 0 &&
+           setsockopt(sender->fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) == 0;
+   } else {
+      ok = setsockopt(sender->fd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl)) == 0;
+   }
+   if (!ok) {
+      raspiudp_sender_close(sender);
+      return -1;
+   }
+   sender->datagram.resize(RASPIUDP_HEADER_BYTES + sender->fragment_bytes);
+   return 0;
+}
+
+static int send_datagram(RASPIUDP_SENDER* sender, size_t bytes) {
+   ssize_t sent;
+
+   do {
+      sent = sendto(sender->fd, &sender->datagram[0], bytes, 0,
+                    (const struct sockaddr*)&sender->destination,
+                    sizeof(sender->destination));
+   } while (sent < 0 && errno == EINTR);
+   if (sent != (ssize_t)bytes) {
+      sender->errors++;
+      return -1;
+   }
+   sender->datagrams++;
+   return 0;
+}
+
+/**
+ * Send a frame, each group of fragments followed by its parity
+ *
+ * A datagram the socket refuses is counted and the rest of the frame sent
+ * anyway, the receiver may still rebuild it.
+ *
+ * @param sender Sender opened by raspiudp_sender_open
+ * @param frame_id Id of the frame, increasing from one frame to the next
+ * @param stamp_ns Capture time of the frame
+ * @param data Encoded frame
+ * @param bytes Size of the frame
+ *
+ * @return 0 if successful, -1 with errno set if the sender is not open, the
+ * frame is empty, has too many fragments or a datagram could not be sent
+ */
+int raspiudp_send(RASPIUDP_SENDER* sender, uint32_t frame_id, uint64_t stamp_ns,
+                  const uint8_t* data, size_t bytes) {
+   const size_t size = sender->fragment_bytes;
+   uint8_t* payload = &sender->datagram[RASPIUDP_HEADER_BYTES];
+   RASPIUDP_HEADER header;
+   int failed = 0;
+
+   if (sender->fd < 0) {
+      errno = EBADF;
+      return -1;
+   }
+   if (bytes == 0 || bytes > 0xffffffffu || (bytes + size - 1) / size > 0xffff) {
+      errno = EMSGSIZE;
+      return -1;
+   }
+   header.frame_id = frame_id;
+   header.stamp_ns = stamp_ns;
+   header.frame_bytes = bytes;
+   header.fragments = (bytes + size - 1) / size;
+   header.fragment_bytes = size;
+   header.group = sender->group;
+   header.session = sender->session;
+
+   for (int i = 0; i < header.fragments; i++) {
+      const size_t length = fragment_length(&header, i);
+      header.index = i;
+      raspiudp_write_header(&header, &sender->datagram[0]);
+      memcpy(payload, data + i * size, length);
+      failed |= send_datagram(sender, RASPIUDP_HEADER_BYTES + length);
+
+      if (!sender->group || ((i + 1) % sender->group != 0 && i + 1 != header.fragments))
+         continue;
+      const int first = i - i % sender->group;
+      memset(payload, 0, size);
+      for (int j = first; j <= i; j++)
+         xor_bytes(payload, data + j * size, fragment_length(&header, j));
+      header.index = header.fragments + i / sender->group;
+      raspiudp_write_header(&header, &sender->datagram[0]);
+      failed |= send_datagram(sender, RASPIUDP_HEADER_BYTES + size);
+   }
+   sender->frames++;
+   return failed ? -1 : 0;
+}
+
+void raspiudp_sender_close(RASPIUDP_SENDER* sender) {
+   if (sender->fd >= 0)
+      close(sender->fd);
+   sender->fd = -1;
+}
+
+/**
+ * Set up a receiver without a socket, fed by raspiudp_push
+ */
+void raspiudp_receiver_init(RASPIUDP_RECEIVER* receiver) {
+   receiver->fd = -1;
+   for (int i = 0; i < RASPIUDP_SLOTS; i++)
+      receiver->slots[i].used = 0;
+   receiver->delivered = 0;
+   receiver->last_frame_id = 0;
+   receiver->session = 0;
+   receiver->max_frame_bytes = RASPIUDP_MAX_FRAME_BYTES;
+   receiver->loss = 0.0;
+   receiver->seed = 1;
+   receiver->frames = 0;
+   receiver->rebuilt = 0;
+   receiver->dropped = 0;
+   receiver->late = 0;
+   receiver->invalid = 0;
+   receiver->discarded = 0;
+   receiver->restarts = 0;
+}
+
+/**
+ * Set up a receiver listening on a port, joining a multicast group
+ *
+ * @param receiver Receiver to set up
+ * @param address Multicast group to join, or the unicast address the
+ * frames are sent to
+ * @param port UDP port to listen on
+ * @param interface Address or name of the interface to join the group on,
+ * NULL or empty for the one the routes choose
+ *
+ * @return 0 if successful, -1 with errno set if an argument is invalid or
+ * the socket cannot be set up
+ */
+int raspiudp_receiver_open(RASPIUDP_RECEIVER* receiver, const char* address, int port,
+                           const char* interface) {
+   struct sockaddr_in local;
+   struct ip_mreqn request;
+   struct in_addr group;
+   const int reuse = 1;
+   const int buffer = RASPIUDP_RECEIVE_BUFFER;
+
+   raspiudp_receiver_init(receiver);
+   if (port <= 0 || port > 65535 || inet_pton(AF_INET, address, &group) != 1 ||
+       interface_request(interface, &request) != 0) {
+      errno = EINVAL;
+      return -1;
+   }
+   receiver->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+   if (receiver->fd < 0)
+      return -1;
+
+   memset(&local, 0, sizeof(local));
+   local.sin_family = AF_INET;
+   local.sin_port = htons(port);
+   local.sin_addr.s_addr = htonl(INADDR_ANY);
+   // Several receivers of the same group may share the machine
+   int ok = setsockopt(receiver->fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == 0 &&
+            bind(receiver->fd, (const struct sockaddr*)&local, sizeof(local)) == 0;
+   if (ok && IN_MULTICAST(ntohl(group.s_addr))) {
+      request.imr_multiaddr = group;
+      ok = setsockopt(receiver->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request,
+                      sizeof(request)) == 0;
+   }
+   if (!ok) {
+      raspiudp_receiver_close(receiver);
+      return -1;
+   }
+   // Only a hint, the kernel caps it
+   setsockopt(receiver->fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+   receiver->datagram.resize(65536);
+   return 0;
+}
+
+/**
+ * Find the slot of a frame, starting it if needed
+ *
+ * @return Slot, NULL if the frame is older than all the frames in progress
+ * and no slot is free
+ */
+static RASPIUDP_SLOT* find_slot(RASPIUDP_RECEIVER* receiver, const RASPIUDP_HEADER* header) {
+   RASPIUDP_SLOT* slot = NULL;
+
+   for (int i = 0; i < RASPIUDP_SLOTS; i++) {
+      RASPIUDP_SLOT* s = &receiver->slots[i];
+      if (s->used && s->header.frame_id == header->frame_id)
+         return s;
+      if (!slot || (slot->used && (!s->used ||
+                                   (int32_t)(s->header.frame_id - slot->header.frame_id) < 0)))
+         slot = s;
+   }
+   if (slot->used) {
+      if ((int32_t)(header->frame_id - slot->header.frame_id) < 0)
+         return NULL;
+      receiver->dropped++;
+   }
+
+   const int fragments = header->fragments;
+   const size_t size = header->fragment_bytes;
+   slot->used = 1;
+   slot->header = *header;
+   slot->received = 0;
+   slot->have.assign(fragments + parity_fragments(header), 0);
+   slot->data.resize(fragments * size);
+   memset(&slot->data[0] + header->frame_bytes, 0, fragments * size - header->frame_bytes);
+   slot->parity.resize(parity_fragments(header) * size);
+   return slot;
+}
+
+/**
+ * Rebuild the fragment missing from a group, if it is the only one and the
+ * parity of the group is there
+ */
+static void rebuild(RASPIUDP_RECEIVER* receiver, RASPIUDP_SLOT* slot, int group) {
+   const RASPIUDP_HEADER* header = &slot->header;
+   const size_t size = header->fragment_bytes;
+   const int first = group * header->group;
+   const int last = std::min(first + header->group, (int)header->fragments);
+   int missing = -1;
+
+   if (!slot->have[header->fragments + group])
+      return;
+   for (int i = first; i < last; i++) {
+      if (slot->have[i])
+         continue;
+      if (missing >= 0)
+         return;
+      missing = i;
+   }
+   if (missing < 0)
+      return;
+
+   const size_t length = fragment_length(header, missing);
+   uint8_t* fragment = &slot->data[missing * size];
+   memcpy(fragment, &slot->parity[group * size], length);
+   for (int i = first; i < last; i++) {
+      if (i != missing)
+         xor_bytes(fragment, &slot->data[i * size], length);
+   }
+   slot->have[missing] = 1;
+   slot->received++;
+   receiver->rebuilt++;
+}
+
+/**
+ * Hand over a complete frame and drop the older ones still in progress
+ */
+static void deliver(RASPIUDP_RECEIVER* receiver, RASPIUDP_SLOT* slot, RASPIUDP_FRAME* frame) {
+   frame->frame_id = slot->header.frame_id;
+   frame->stamp_ns = slot->header.stamp_ns;
+   // The buffers go round between the frame and the slots
+   frame->data.swap(slot->data);
+   frame->data.resize(slot->header.frame_bytes);
+   slot->used = 0;
+
+   receiver->delivered = 1;
+   receiver->last_frame_id = frame->frame_id;
+   receiver->frames++;
+   for (int i = 0; i < RASPIUDP_SLOTS; i++) {
+      RASPIUDP_SLOT* s = &receiver->slots[i];
+      if (s->used && (int32_t)(s->header.frame_id - frame->frame_id) < 0) {
+         s->used = 0;
+         receiver->dropped++;
+      }
+   }
+}
+
+/**
+ * Add a datagram to the frames in progress
+ *
+ * @param receiver Receiver set up by raspiudp_receiver_init or
+ * raspiudp_receiver_open
+ * @param datagram Datagram received
+ * @param bytes Size of the datagram
+ * @param frame Set to the frame the datagram completed, its buffer is reused
+ *
+ * @return 1 if a frame was completed, 0 otherwise
+ */
+int raspiudp_push(RASPIUDP_RECEIVER* receiver, const uint8_t* datagram, size_t bytes,
+                  RASPIUDP_FRAME* frame) {
+   RASPIUDP_HEADER header;
+
+   if (receiver->loss > 0.0 &&
+       rand_r(&receiver->seed) < receiver->loss * ((double)RAND_MAX + 1.0)) {
+      receiver->discarded++;
+      return 0;
+   }
+   // Checked before the header can start a session or size a slot
+   if (raspiudp_read_header(datagram, bytes, &header) != 0 ||
+       header.frame_bytes > receiver->max_frame_bytes) {
+      receiver->invalid++;
+      return 0;
+   }
+   if (header.session != receiver->session) {
+      // The sender started again, numbering its frames afresh
+      if (receiver->delivered)
+         receiver->restarts++;
+      for (int i = 0; i < RASPIUDP_SLOTS; i++) {
+         if (receiver->slots[i].used) {
+            receiver->slots[i].used = 0;
+            receiver->dropped++;
+         }
+      }
+      receiver->delivered = 0;
+      receiver->session = header.session;
+   }
+   if (receiver->delivered && (int32_t)(header.frame_id - receiver->last_frame_id) <= 0) {
+      // The parity of a frame complete without it is not late
+      if (header.frame_id != receiver->last_frame_id)
+         receiver->late++;
+      return 0;
+   }
+   RASPIUDP_SLOT* slot = find_slot(receiver, &header);
+   if (!slot) {
+      receiver->late++;
+      return 0;
+   }
+   if (slot->header.frame_bytes != header.frame_bytes ||
+       slot->header.fragment_bytes != header.fragment_bytes ||
+       slot->header.group != header.group) {
+      receiver->invalid++;
+      return 0;
+   }
+   // Sent once, but the network may duplicate it, or it was rebuilt
+   if (slot->have[header.index])
+      return 0;
+
+   const size_t size = header.fragment_bytes;
+   const uint8_t* payload = datagram + RASPIUDP_HEADER_BYTES;
+   int group = -1;
+   slot->have[header.index] = 1;
+   if (header.index < header.fragments) {
+      memcpy(&slot->data[header.index * size], payload, bytes - RASPIUDP_HEADER_BYTES);
+      slot->received++;
+      if (header.group)
+         group = header.index / header.group;
+   } else {
+      group = header.index - header.fragments;
+      memcpy(&slot->parity[group * size], payload, size);
+   }
+   if (group >= 0)
+      rebuild(receiver, slot, group);
+   if (slot->received < header.fragments)
+      return 0;
+   deliver(receiver, slot, frame);
+   return 1;
+}
+
+/**
+ * Receive datagrams until a frame is complete
+ *
+ * @param receiver Receiver opened by raspiudp_receiver_open
+ * @param timeout_ms Longest wait for a frame
+ * @param frame Set to the frame completed, its buffer is reused
+ *
+ * @return 1 if a frame was completed, 0 on a timeout, -1 on a socket error
+ */
+int raspiudp_receive(RASPIUDP_RECEIVER* receiver, int timeout_ms, RASPIUDP_FRAME* frame) {
+   const int64_t end = now_ms() + timeout_ms;
+
+   for (;;) {
+      struct pollfd ready;
+      const int64_t left = end - now_ms();
+      ready.fd = receiver->fd;
+      ready.events = POLLIN;
+      ready.revents = 0;
+      const int count = poll(&ready, 1, left > 0 ? left : 0);
+      if (count < 0 && errno != EINTR)
+         return -1;
+      if (count == 0)
+         return 0;
+      if (count < 0)
+         continue;
+
+      const ssize_t bytes = recv(receiver->fd, &receiver->datagram[0],
+                                 receiver->datagram.size(), 0);
+      if (bytes < 0) {
+         if (errno == EINTR || errno == EAGAIN)
+            continue;
+         return -1;
+      }
+      if (raspiudp_push(receiver, &receiver->datagram[0], bytes, frame))
+         return 1;
+      if (left <= 0)
+         return 0;
+   }
+}
+
+void raspiudp_receiver_close(RASPIUDP_RECEIVER* receiver) {
+   if (receiver->fd >= 0)
+      close(receiver->fd);
+   receiver->fd = -1;
+}
@@ -0,0 +1,94 @@
+/**
+ * \file RaspiWatchdog.cpp
+ * Detection of and recovery from a stalled capture
+ *
+ * Description
+ *
+ * A step is given a full stall time from when it was carried out, not from
+ * when it was asked for, so a rebuild slower than the stall time is not
+ * followed straight away by another one.
+ */
+#include "RaspiWatchdog.h"
+
+/**
+ * Set up the watchdog with the capture running
+ *
+ * @param state Watchdog to initialise
+ * @param stall_us Time without a callback taken as a stall
+ * @param now_us Current time
+ */
+void raspiwatchdog_init(RASPIWATCHDOG_STATE* state, int64_t stall_us, int64_t now_us) {
+   state->stall_us = stall_us;
+   state->step = RASPIWATCHDOG_NONE;
+   state->last_callback_us = now_us;
+   state->detected_us = 0;
+   state->step_us = 0;
+   state->stalls = 0;
+   for (int i = 0; i < RASPIWATCHDOG_STEPS; i++)
+      state->recovered[i] = 0;
+   state->recovered_by = RASPIWATCHDOG_NONE;
+   state->outage_us = 0;
+   state->recover_us = 0;
+}
+
+/**
+ * Check for a stall or its end
+ *
+ * @param state Watchdog
+ * @param last_callback_us Time of the last camera callback
+ * @param now_us Current time
+ *
+ * @return Step to carry out now, followed by a call to raspiwatchdog_done,
+ * RASPIWATCHDOG_NONE, or RASPIWATCHDOG_RECOVERED when a stall has just ended
+ */
+int raspiwatchdog_check(RASPIWATCHDOG_STATE* state, int64_t last_callback_us,
+                        int64_t now_us) {
+   if (state->step == RASPIWATCHDOG_NONE) {
+      if (now_us - last_callback_us <= state->stall_us)
+         return RASPIWATCHDOG_NONE;
+      state->stalls++;
+      state->last_callback_us = last_callback_us;
+      state->detected_us = now_us;
+      state->step = RASPIWATCHDOG_REFILL;
+      return state->step;
+   }
+   if (last_callback_us > state->last_callback_us) {
+      state->recovered[state->step]++;
+      state->recovered_by = state->step;
+      state->outage_us = last_callback_us - state->last_callback_us;
+      state->recover_us = last_callback_us - state->detected_us;
+      state->step = RASPIWATCHDOG_NONE;
+      return RASPIWATCHDOG_RECOVERED;
+   }
+   if (now_us - state->step_us <= state->stall_us)
+      return RASPIWATCHDOG_NONE;
+   if (state->step < RASPIWATCHDOG_REBUILD)
+      state->step++;
+   return state->step;
+}
+
+/**
+ * Start waiting on the step just carried out
+ *
+ * @param state Watchdog
+ * @param now_us Time the step was carried out
+ */
+void raspiwatchdog_done(RASPIWATCHDOG_STATE* state, int64_t now_us) {
+   state->step_us = now_us;
+}
+
+/**
+ * Name of a recovery step, for logs
+ */
+const char* raspiwatchdog_step_name(int step) {
+   switch (step) {
+   case RASPIWATCHDOG_REFILL:
+      return "refill";
+   case RASPIWATCHDOG_RECAPTURE:
+      return "recapture";
+   case RASPIWATCHDOG_REBUILD:
+      return "rebuild";
+   default:
+      return "none";
+   }
+}
@@ -0,0 +1,684 @@
+/**
+ * \file raspicam_bench.cpp
+ * Check whether the camera holds a capture mode, without ROS
+ *
+ * Description
+ *
+ * Builds the same pipeline as raspicam_node (camera, splitter, a raw
+ * output copied out of every buffer and an MJPEG encoder on the other
+ * splitter output), captures for a fixed time after a warm-up and prints
+ * the frame rate, the frames dropped, the CPU time per frame, the encoded
+ * bytes per frame and the latency percentiles from the end of capture to
+ * the callbacks. Nothing is published and no roscore is needed.
+ *
+ * Dropped frames are found from gaps in the buffer timestamps. Latency is
+ * the difference between the timestamp of a buffer and the STC (the clock
+ * the camera stamps buffers with) when its callback runs.
+ *
+ * The exit status is 0 if the mode held (at most 1% of the frames
+ * dropped), 2 if it did not and 1 if the pipeline could not be set up.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <vector>
+#include <atomic>
+
+#include "bcm_host.h"
+#include "interface/vcos/vcos.h"
+
+#include "interface/mmal/mmal.h"
+#include "interface/mmal/mmal_logging.h"
+#include "interface/mmal/mmal_buffer.h"
+#include "interface/mmal/util/mmal_util.h"
+#include "interface/mmal/util/mmal_util_params.h"
+#include "interface/mmal/util/mmal_default_components.h"
+#include "interface/mmal/util/mmal_connection.h"
+
+#include "RaspiCamControl.h"
+#include "RaspiCLI.h"
+#include "RaspiFormat.h"
+#include "RaspiLatency.h"
+#include "RaspiGovernor.h"
+
+// Standard port setting for the camera component
+#define MMAL_CAMERA_VIDEO_PORT 1
+#define MMAL_CAMERA_CAPTURE_PORT 2
+
+/// Video render needs at least 2 buffers.
+#define VIDEO_OUTPUT_BUFFERS_NUM 3
+
+/// Share of dropped frames, in percent, above which a mode does not hold
+#define BENCH_MAX_DROP_PERCENT 1.0
+
+/** Structure containing all state information for the current run
+ */
+typedef struct {
+   int width;                          /// Requested width of image
+   int height;                         /// Requested height of image
+   int framerate;                      /// Requested frame rate (fps)
+   long int bitrate;
+   int monochrome;                     /// Capture I420 and keep the Y plane
+   double seconds;                     /// Measured capture time
+   double warmup;                      /// Capture time before measuring
+   RASPICAM_CAMERA_PARAMETERS camera_parameters;
+   const RASPIFORMAT* format;
+   void (*planes)(const uint8_t* data, uint32_t length, int width, int height,
+                  RASPIFORMAT_PLANES* planes);
+
+   MMAL_COMPONENT_T* camera_component;
+   MMAL_COMPONENT_T* splitter_component;
+   MMAL_COMPONENT_T* encoder_component;
+   MMAL_CONNECTION_T* splitter_connection;
+   MMAL_CONNECTION_T* encoder_connection;
+   MMAL_POOL_T* raw_pool;
+   MMAL_POOL_T* encoder_pool;
+
+   std::atomic<int> measuring;         /// Callbacks count frames while set
+   std::vector<uint8_t> frame;         /// Raw frame copied out of the camera buffer
+   int64_t last_pts;                   /// Of the last raw frame, MMAL_TIME_UNKNOWN for none
+   uint32_t raw_frames;
+   uint32_t dropped;
+   uint32_t encoded_frames;
+   uint32_t encode_failures;
+   uint32_t frame_bytes;               /// Of the encoded frame being received
+   uint64_t encoded_bytes;             /// Of the frames encoded successfully
+   RASPILATENCY_HISTOGRAM raw_latency;
+   RASPILATENCY_HISTOGRAM encoded_latency;
+} BENCH_STATE;
+
+enum {
+   CommandHelp,
+   CommandWidth,
+   CommandHeight,
+   CommandFramerate,
+   CommandBitrate,
+   CommandMonochrome,
+   CommandTime,
+   CommandWarmup
+};
+
+static COMMAND_LIST cmdline_commands[] = {
+   {CommandHelp,       "-help",       "?",    "This help information", 0},
+   {CommandWidth,      "-width",      "w",    "Set image width <size> (default 640)", 1},
+   {CommandHeight,     "-height",     "h",    "Set image height <size> (default 480)", 1},
+   {CommandFramerate,  "-framerate",  "fps",  "Set the frame rate (default 30)", 1},
+   {CommandBitrate,    "-bitrate",    "b",    "Set the encoder bitrate in bits/s (default 25000000)", 1},
+   {CommandMonochrome, "-monochrome", "mono", "Capture I420 and keep the Y plane instead of rgb", 0},
+   {CommandTime,       "-time",       "t",    "Seconds to measure for (default 10)", 1},
+   {CommandWarmup,     "-warmup",     "wu",   "Seconds to capture before measuring (default 2)", 1}
+};
+
+static int cmdline_commands_size = sizeof(cmdline_commands) / sizeof(
+                                      cmdline_commands[0]);
+
+BENCH_STATE state;
+volatile sig_atomic_t interrupted;
+
+static void display_help(const char* app_name) {
+   fprintf(stderr, "Usage: %s [options]\n\nCapture options\n\n", app_name);
+   raspicli_display_help(cmdline_commands, cmdline_commands_size);
+   raspicamcontrol_display_help();
+   fprintf(stderr, "\n");
+}
+
+/**
+ * Parse the command line into the state
+ *
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @param state State to fill, defaults set already
+ *
+ * @return 0 if successful, -1 on an invalid or incomplete option or for the help
+ */
+static int parse_cmdline(int argc, const char** argv, BENCH_STATE* state) {
+   for (int i = 1; i < argc; i++) {
+      int num_parameters = 0;
+      int valid = 1;
+
+      if (argv[i][0] != '-')
+         return -1;
+      const int command_id = raspicli_get_command_id(cmdline_commands,
+                                                     cmdline_commands_size,
+                                                     &argv[i][1], &num_parameters);
+      if (command_id != -1 && num_parameters > 0 && i + 1 >= argc)
+         return -1;
+
+      switch (command_id) {
+      case CommandHelp:
+         return -1;
+      case CommandWidth:
+         valid = sscanf(argv[++i], "%d", &state->width) == 1 && state->width > 0 &&
+                 state->width <= 1920;
+         break;
+      case CommandHeight:
+         valid = sscanf(argv[++i], "%d", &state->height) == 1 && state->height > 0 &&
+                 state->height <= 1080;
+         break;
+      case CommandFramerate:
+         valid = sscanf(argv[++i], "%d", &state->framerate) == 1 &&
+                 state->framerate > 0 && state->framerate <= 90;
+         break;
+      case CommandBitrate:
+         valid = sscanf(argv[++i], "%ld", &state->bitrate) == 1 && state->bitrate > 0;
+         if (state->bitrate > 25000000)
+            state->bitrate = 25000000;
+         break;
+      case CommandMonochrome:
+         state->monochrome = 1;
+         break;
+      case CommandTime:
+         valid = sscanf(argv[++i], "%lf", &state->seconds) == 1 && state->seconds > 0.0;
+         break;
+      case CommandWarmup:
+         valid = sscanf(argv[++i], "%lf", &state->warmup) == 1 && state->warmup >= 0.0;
+         break;
+      default: {
+         // Try the camera parameters
+         const int used = raspicamcontrol_parse_cmdline(&state->camera_parameters,
+                                                        &argv[i][1],
+                                                        i + 1 < argc ? argv[i + 1] : NULL);
+         if (!used)
+            valid = 0;
+         else
+            i += used - 1;
+         break;
+      }
+      }
+      if (!valid) {
+         fprintf(stderr, "Invalid command line option (%s)\n", argv[i]);
+         return -1;
+      }
+   }
+   return 0;
+}
+
+/**
+ * Latency of a buffer, from its timestamp to now on the STC
+ */
+static int64_t buffer_latency(MMAL_PORT_T* port, const MMAL_BUFFER_HEADER_T* buffer) {
+   uint64_t stc;
+
+   if (buffer->pts == MMAL_TIME_UNKNOWN ||
+       mmal_port_parameter_get_uint64(port, MMAL_PARAMETER_SYSTEM_TIME, &stc) !=
+       MMAL_SUCCESS)
+      return -1;
+   return (int64_t)stc - buffer->pts;
+}
+
+/**
+ * Send a buffer back to a port, if it is still enabled
+ */
+static void return_buffer(MMAL_PORT_T* port, MMAL_POOL_T* pool) {
+   if (port->is_enabled) {
+      MMAL_BUFFER_HEADER_T* new_buffer = mmal_queue_get(pool->queue);
+
+      if (!new_buffer || mmal_port_send_buffer(port, new_buffer) != MMAL_SUCCESS)
+         vcos_log_error("Unable to return a buffer to port %s", port->name);
+   }
+}
+
+/**
+ * Copy the raw frame out of the buffer as the node does, count drops and
+ * latency
+ */
+static void raw_buffer_callback(MMAL_PORT_T* port, MMAL_BUFFER_HEADER_T* buffer) {
+   BENCH_STATE* pstate = (BENCH_STATE*)port->userdata;
+
+   if (buffer->length) {
+      RASPIFORMAT_PLANES planes;
+      const int row = pstate->width * pstate->format->bytes_per_pixel;
+
+      mmal_buffer_header_mem_lock(buffer);
+      pstate->planes(buffer->data, buffer->length, pstate->width, pstate->height, &planes);
+      for (int r = 0; r < pstate->height; r++)
+         memcpy(&pstate->frame[(size_t)r * row], planes.plane[0] + (size_t)r * planes.stride[0],
+                row);
+      mmal_buffer_header_mem_unlock(buffer);
+
+      if (pstate->measuring) {
+         const int64_t period_us = 1000000 / pstate->framerate;
+         if (pstate->last_pts != MMAL_TIME_UNKNOWN && buffer->pts != MMAL_TIME_UNKNOWN) {
+            // Frames missing between two timestamps, to the nearest frame
+            const int64_t missing = (buffer->pts - pstate->last_pts + period_us / 2) /
+                                    period_us - 1;
+            if (missing > 0)
+               pstate->dropped += missing;
+         }
+         pstate->raw_frames++;
+         const int64_t latency = buffer_latency(port, buffer);
+         if (latency >= 0)
+            raspilatency_add(&pstate->raw_latency, latency);
+      }
+      pstate->last_pts = buffer->pts;
+   }
+   mmal_buffer_header_release(buffer);
+   return_buffer(port, pstate->raw_pool);
+}
+
+/**
+ * Count encoded frames and bytes, and the latency of the last fragment of
+ * each frame
+ */
+static void encoder_buffer_callback(MMAL_PORT_T* port, MMAL_BUFFER_HEADER_T* buffer) {
+   BENCH_STATE* pstate = (BENCH_STATE*)port->userdata;
+
+   pstate->frame_bytes += buffer->length;
+   if (buffer->flags & (MMAL_BUFFER_HEADER_FLAG_FRAME_END |
+                        MMAL_BUFFER_HEADER_FLAG_TRANSMISSION_FAILED)) {
+      if (!pstate->measuring) {
+         // A frame begun before the measurement is not counted
+      } else if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_TRANSMISSION_FAILED) {
+         pstate->encode_failures++;
+      } else {
+         pstate->encoded_frames++;
+         pstate->encoded_bytes += pstate->frame_bytes;
+         const int64_t latency = buffer_latency(port, buffer);
+         if (latency >= 0)
+            raspilatency_add(&pstate->encoded_latency, latency);
+      }
+      pstate->frame_bytes = 0;
+   }
+   mmal_buffer_header_release(buffer);
+   return_buffer(port, pstate->encoder_pool);
+}
+
+/**
+ * Create the camera component, set up its ports
+ *
+ * @param state Pointer to state control struct
+ *
+ * @return 0 if successful, -1 otherwise
+ */
+static int create_camera_component(BENCH_STATE* state) {
+   MMAL_COMPONENT_T* camera = 0;
+   MMAL_ES_FORMAT_T* format;
+   MMAL_PORT_T* video_port, *still_port;
+
+   if (mmal_component_create(MMAL_COMPONENT_DEFAULT_CAMERA, &camera) != MMAL_SUCCESS ||
+       !camera->output_num) {
+      vcos_log_error("Failed to create camera component");
+      goto error;
+   }
+   video_port = camera->output[MMAL_CAMERA_VIDEO_PORT];
+   still_port = camera->output[MMAL_CAMERA_CAPTURE_PORT];
+
+   {
+      MMAL_PARAMETER_CAMERA_CONFIG_T cam_config;
+      cam_config.hdr.id = MMAL_PARAMETER_CAMERA_CONFIG;
+      cam_config.hdr.size = sizeof(cam_config);
+      cam_config.max_stills_w = state->width;
+      cam_config.max_stills_h = state->height;
+      cam_config.stills_yuv422 = 0;
+      cam_config.one_shot_stills = 0;
+      cam_config.max_preview_video_w = state->width;
+      cam_config.max_preview_video_h = state->height;
+      cam_config.num_preview_video_frames = 3;
+      cam_config.stills_capture_circular_buffer_height = 0;
+      cam_config.fast_preview_resume = 0;
+      cam_config.use_stc_timestamp = MMAL_PARAM_TIMESTAMP_MODE_RESET_STC;
+
+      mmal_port_parameter_set(camera->control, &cam_config.hdr);
+   }
+
+   format = video_port->format;
+   format->encoding = state->format->mmal_encoding;
+   format->encoding_variant = state->format->mmal_encoding;
+   format->es->video.width = state->width;
+   format->es->video.height = state->height;
+   format->es->video.crop.x = 0;
+   format->es->video.crop.y = 0;
+   format->es->video.crop.width = state->width;
+   format->es->video.crop.height = state->height;
+   format->es->video.frame_rate.num = state->framerate;
+   format->es->video.frame_rate.den = 1;
+   if (mmal_port_format_commit(video_port) != MMAL_SUCCESS) {
+      vcos_log_error("camera video format couldn't be set");
+      goto error;
+   }
+   if (video_port->buffer_num < VIDEO_OUTPUT_BUFFERS_NUM)
+      video_port->buffer_num = VIDEO_OUTPUT_BUFFERS_NUM;
+
+   format = still_port->format;
+   format->encoding = MMAL_ENCODING_OPAQUE;
+   format->encoding_variant = MMAL_ENCODING_I420;
+   format->es->video.width = state->width;
+   format->es->video.height = state->height;
+   format->es->video.crop.x = 0;
+   format->es->video.crop.y = 0;
+   format->es->video.crop.width = state->width;
+   format->es->video.crop.height = state->height;
+   format->es->video.frame_rate.num = 1;
+   format->es->video.frame_rate.den = 1;
+   if (mmal_port_format_commit(still_port) != MMAL_SUCCESS) {
+      vcos_log_error("camera still format couldn't be set");
+      goto error;
+   }
+   if (still_port->buffer_num < VIDEO_OUTPUT_BUFFERS_NUM)
+      still_port->buffer_num = VIDEO_OUTPUT_BUFFERS_NUM;
+
+   if (mmal_component_enable(camera) != MMAL_SUCCESS) {
+      vcos_log_error("camera component couldn't be enabled");
+      goto error;
+   }
+   raspicamcontrol_set_all_parameters(camera, &state->camera_parameters);
+   state->camera_component = camera;
+   return 0;
+
+error:
+   if (camera)
+      mmal_component_destroy(camera);
+   return -1;
+}
+
+/**
+ * Create the splitter component, in the format of the camera video port
+ *
+ * @param state Pointer to state control struct
+ *
+ * @return 0 if successful, -1 otherwise
+ */
+static int create_splitter_component(BENCH_STATE* state) {
+   MMAL_COMPONENT_T* splitter = 0;
+   MMAL_PORT_T* input_port;
+
+   if (mmal_component_create(MMAL_COMPONENT_DEFAULT_VIDEO_SPLITTER, &splitter) !=
+       MMAL_SUCCESS) {
+      vcos_log_error("Failed to create splitter component");
+      goto error;
+   }
+   input_port = splitter->input[0];
+   mmal_format_copy(input_port->format,
+                    state->camera_component->output[MMAL_CAMERA_VIDEO_PORT]->format);
+   input_port->buffer_num = 3;
+   if (mmal_port_format_commit(input_port) != MMAL_SUCCESS) {
+      vcos_log_error("Couldn't set splitter input port format");
+      goto error;
+   }
+   for (unsigned int i = 0; i < splitter->output_num; i++) {
+      MMAL_PORT_T* output_port = splitter->output[i];
+      output_port->buffer_num = 3;
+      mmal_format_copy(output_port->format, input_port->format);
+      if (mmal_port_format_commit(output_port) != MMAL_SUCCESS) {
+         vcos_log_error("Couldn't set splitter output port format");
+         goto error;
+      }
+   }
+   state->splitter_component = splitter;
+   return 0;
+
+error:
+   if (splitter)
+      mmal_component_destroy(splitter);
+   return -1;
+}
+
+/**
+ * Create the MJPEG encoder component and the pool of its output buffers
+ *
+ * @param state Pointer to state control struct
+ *
+ * @return 0 if successful, -1 otherwise
+ */
+static int create_encoder_component(BENCH_STATE* state) {
+   MMAL_COMPONENT_T* encoder = 0;
+   MMAL_PORT_T* encoder_output;
+
+   if (mmal_component_create(MMAL_COMPONENT_DEFAULT_VIDEO_ENCODER, &encoder) !=
+       MMAL_SUCCESS || !encoder->input_num || !encoder->output_num) {
+      vcos_log_error("Unable to create video encoder component");
+      goto error;
+   }
+   encoder_output = encoder->output[0];
+   mmal_format_copy(encoder_output->format, encoder->input[0]->format);
+   encoder_output->format->encoding = MMAL_ENCODING_MJPEG;
+   encoder_output->buffer_size = 256 << 10;
+   if (encoder_output->buffer_size < encoder_output->buffer_size_min)
+      encoder_output->buffer_size = encoder_output->buffer_size_min;
+   encoder_output->buffer_num = encoder_output->buffer_num_recommended;
+   if (encoder_output->buffer_num < encoder_output->buffer_num_min)
+      encoder_output->buffer_num = encoder_output->buffer_num_min;
+   encoder_output->format->bitrate = state->bitrate;
+   if (mmal_port_format_commit(encoder_output) != MMAL_SUCCESS) {
+      vcos_log_error("Unable to set format on video encoder output port");
+      goto error;
+   }
+   mmal_port_parameter_set_uint32(encoder_output, MMAL_PARAMETER_VIDEO_BIT_RATE,
+                                  state->bitrate);
+   state->encoder_pool = mmal_port_pool_create(encoder_output, encoder_output->buffer_num,
+                                               encoder_output->buffer_size);
+   if (!state->encoder_pool) {
+      vcos_log_error("Failed to create buffer header pool for encoder output port %s",
+                     encoder_output->name);
+      goto error;
+   }
+   state->encoder_component = encoder;
+   return 0;
+
+error:
+   if (encoder)
+      mmal_component_destroy(encoder);
+   return -1;
+}
+
+/**
+ * Connect two ports with a tunnel
+ */
+static MMAL_STATUS_T connect_ports(MMAL_PORT_T* output_port, MMAL_PORT_T* input_port,
+                                   MMAL_CONNECTION_T** connection) {
+   MMAL_STATUS_T status;
+
+   status = mmal_connection_create(connection, output_port, input_port,
+                                   MMAL_CONNECTION_FLAG_TUNNELLING |
+                                   MMAL_CONNECTION_FLAG_ALLOCATION_ON_INPUT);
+   if (status == MMAL_SUCCESS) {
+      status = mmal_connection_enable(*connection);
+      if (status != MMAL_SUCCESS)
+         mmal_connection_destroy(*connection);
+   }
+   return status;
+}
+
+/**
+ * Queue every buffer of a pool on a port
+ */
+static void send_buffers(MMAL_PORT_T* port, MMAL_POOL_T* pool) {
+   int num = mmal_queue_length(pool->queue);
+
+   for (int q = 0; q < num; q++) {
+      MMAL_BUFFER_HEADER_T* buffer = mmal_queue_get(pool->queue);
+      if (!buffer || mmal_port_send_buffer(port, buffer) != MMAL_SUCCESS)
+         vcos_log_error("Unable to send a buffer to port %s (%d)", port->name, q);
+   }
+}
+
+/**
+ * Build the pipeline and start the capture
+ *
+ * @param state Pointer to state control struct
+ *
+ * @return 0 if successful, -1 otherwise
+ */
+static int start_pipeline(BENCH_STATE* state) {
+   MMAL_PORT_T* raw_port, *encoder_output;
+
+   if (create_camera_component(state) != 0 || create_splitter_component(state) != 0 ||
+       create_encoder_component(state) != 0)
+      return -1;
+   if (connect_ports(state->camera_component->output[MMAL_CAMERA_VIDEO_PORT],
+                     state->splitter_component->input[0],
+                     &state->splitter_connection) != MMAL_SUCCESS ||
+       connect_ports(state->splitter_component->output[1],
+                     state->encoder_component->input[0],
+                     &state->encoder_connection) != MMAL_SUCCESS) {
+      vcos_log_error("Failed to connect the camera to the splitter and encoder");
+      return -1;
+   }
+
+   raw_port = state->splitter_component->output[0];
+   state->raw_pool = mmal_port_pool_create(raw_port, raw_port->buffer_num,
+                                           raw_port->buffer_size);
+   if (!state->raw_pool) {
+      vcos_log_error("Failed to create buffer header pool for port %s", raw_port->name);
+      return -1;
+   }
+   raw_port->userdata = (struct MMAL_PORT_USERDATA_T*)state;
+   encoder_output = state->encoder_component->output[0];
+   encoder_output->userdata = (struct MMAL_PORT_USERDATA_T*)state;
+   if (mmal_port_enable(raw_port, raw_buffer_callback) != MMAL_SUCCESS ||
+       mmal_port_enable(encoder_output, encoder_buffer_callback) != MMAL_SUCCESS) {
+      vcos_log_error("Failed to enable the output ports");
+      return -1;
+   }
+   send_buffers(raw_port, state->raw_pool);
+   send_buffers(encoder_output, state->encoder_pool);
+   if (mmal_port_parameter_set_boolean(state->camera_component->output[MMAL_CAMERA_VIDEO_PORT],
+                                       MMAL_PARAMETER_CAPTURE, 1) != MMAL_SUCCESS) {
+      vcos_log_error("Failed to start the capture");
+      return -1;
+   }
+   return 0;
+}
+
+/**
+ * Stop the capture and tear the pipeline down, whatever part of it was built
+ *
+ * @param state Pointer to state control struct
+ */
+static void stop_pipeline(BENCH_STATE* state) {
+   MMAL_COMPONENT_T* camera = state->camera_component;
+   MMAL_COMPONENT_T* splitter = state->splitter_component;
+   MMAL_COMPONENT_T* encoder = state->encoder_component;
+
+   if (camera && camera->output[MMAL_CAMERA_VIDEO_PORT]->is_enabled)
+      mmal_port_disable(camera->output[MMAL_CAMERA_VIDEO_PORT]);
+   if (encoder && encoder->output[0]->is_enabled)
+      mmal_port_disable(encoder->output[0]);
+   if (splitter && splitter->output[0]->is_enabled)
+      mmal_port_disable(splitter->output[0]);
+   if (state->encoder_connection)
+      mmal_connection_destroy(state->encoder_connection);
+   if (state->splitter_connection)
+      mmal_connection_destroy(state->splitter_connection);
+   if (encoder)
+      mmal_component_disable(encoder);
+   if (camera)
+      mmal_component_disable(camera);
+   if (splitter)
+      mmal_component_disable(splitter);
+   if (state->raw_pool)
+      mmal_port_pool_destroy(splitter->output[0], state->raw_pool);
+   if (state->encoder_pool)
+      mmal_port_pool_destroy(encoder->output[0], state->encoder_pool);
+   if (encoder)
+      mmal_component_destroy(encoder);
+   if (camera)
+      mmal_component_destroy(camera);
+   if (splitter)
+      mmal_component_destroy(splitter);
+}
+
+/**
+ * Print the percentiles of a latency histogram
+ */
+static void print_latency(const char* name, RASPILATENCY_HISTOGRAM* histogram) {
+   RASPILATENCY_SNAPSHOT snapshot;
+
+   raspilatency_take(histogram, &snapshot);
+   if (!snapshot.total) {
+      printf("%-10s no timestamps\n", name);
+      return;
+   }
+   printf("%-10s p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, p99.9 %.1f ms\n", name,
+          raspilatency_percentile(&snapshot, 50.0) / 1000.0,
+          raspilatency_percentile(&snapshot, 90.0) / 1000.0,
+          raspilatency_percentile(&snapshot, 99.0) / 1000.0,
+          raspilatency_percentile(&snapshot, 99.9) / 1000.0);
+}
+
+static int64_t now_us() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Sleep for a number of seconds, or until interrupted
+ */
+static void wait_seconds(double seconds) {
+   const int64_t end = now_us() + (int64_t)(seconds * 1000000);
+
+   while (!interrupted && now_us() < end)
+      usleep(10000);
+}
+
+static void signal_handler(int signal_number) {
+   interrupted = 1;
+}
+
+int main(int argc, const char** argv) {
+   state.width = 640;
+   state.height = 480;
+   state.framerate = 30;
+   state.bitrate = 25000000;
+   state.seconds = 10.0;
+   state.warmup = 2.0;
+   state.last_pts = MMAL_TIME_UNKNOWN;
+   raspicamcontrol_set_defaults(&state.camera_parameters);
+   if (parse_cmdline(argc, argv, &state) != 0) {
+      display_help(argv[0]);
+      return 1;
+   }
+   if (state.monochrome) {
+      state.format = raspiformat_describe<RaspiFormatMono8>();
+      state.planes = RaspiFormatMono8::planes;
+   } else {
+      state.format = raspiformat_describe<RaspiFormatRgb8>();
+      state.planes = RaspiFormatRgb8::planes;
+   }
+   state.frame.resize((size_t)state.width * state.height * state.format->bytes_per_pixel);
+   raspilatency_reset(&state.raw_latency);
+   raspilatency_reset(&state.encoded_latency);
+
+   bcm_host_init();
+   vcos_log_register("RaspiBench", VCOS_LOG_CATEGORY);
+   signal(SIGINT, signal_handler);
+
+   if (start_pipeline(&state) != 0) {
+      stop_pipeline(&state);
+      return 1;
+   }
+   wait_seconds(state.warmup);
+
+   const int64_t start_cpu = raspigovernor_cpu_us();
+   const int64_t start_wall = now_us();
+   state.measuring = 1;
+   wait_seconds(state.seconds);
+   state.measuring = 0;
+   const int64_t cpu_us = raspigovernor_cpu_us() - start_cpu;
+   const double seconds = (now_us() - start_wall) / 1000000.0;
+   // No callback runs once the ports are disabled, the counters are final
+   stop_pipeline(&state);
+
+   const uint32_t frames = state.raw_frames;
+   const double drop_percent = (frames + state.dropped) ?
+                               100.0 * state.dropped / (frames + state.dropped) : 100.0;
+   printf("mode       %dx%d %s at %d fps, %.1f s measured\n", state.width, state.height,
+          state.format->encoding->c_str(), state.framerate, seconds);
+   printf("raw        %u frames, %.2f fps, %u dropped (%.2f%%)\n", frames,
+          frames / seconds, state.dropped, drop_percent);
+   printf("encoded    %u frames, %u failed, %.0f bytes/frame\n", state.encoded_frames,
+          state.encode_failures,
+          state.encoded_frames ? (double)state.encoded_bytes / state.encoded_frames : 0.0);
+   printf("cpu        %.2f ms/frame, %.1f%% of a core\n",
+          frames ? cpu_us / 1000.0 / frames : 0.0, cpu_us / 10000.0 / seconds);
+   print_latency("latency", &state.raw_latency);
+   print_latency("encoded", &state.encoded_latency);
+
+   const int held = frames > 0 && drop_percent <= BENCH_MAX_DROP_PERCENT;
+   printf("%s\n", held ? "mode held" : "mode NOT held");
+   return held ? 0 : 2;
+}
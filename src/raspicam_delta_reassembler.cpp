@@ -0,0 +1,75 @@
+/**
+ * \file raspicam_delta_reassembler.cpp
+ * Rebuild full frames from the camera/image/delta output
+ *
+ * Description
+ *
+ * Subscribes to the tile deltas published by raspicam_node and republishes
+ * complete sensor_msgs/Image frames. Nothing is published until a keyframe
+ * has been received, and a gap in the delta sequence numbers (a delta
+ * dropped by the transport) stops publication until the next keyframe, so
+ * a consumer never sees a frame built on missing tiles.
+ */
+#include <string.h>
+
+#include "ros/ros.h"
+#include <image_transport/image_transport.h>
+#include "sensor_msgs/Image.h"
+#include "sensor_msgs/image_encodings.h"
+#include "raspicam/TileDelta.h"
+
+#include "RaspiTileDelta.h"
+
+image_transport::Publisher image_pub;
+sensor_msgs::Image image_msg;
+int synced = 0;
+unsigned int last_sequence = 0;
+
+void delta_callback(const raspicam::TileDelta::ConstPtr& delta) {
+   if (image_msg.width != delta->width || image_msg.height != delta->height ||
+       image_msg.encoding != delta->encoding) {
+      if (!delta->keyframe)
+         return;
+      image_msg.width = delta->width;
+      image_msg.height = delta->height;
+      image_msg.encoding = delta->encoding;
+      image_msg.is_bigendian = 0;
+      image_msg.step = delta->width *
+                       sensor_msgs::image_encodings::numChannels(delta->encoding) *
+                       (sensor_msgs::image_encodings::bitDepth(delta->encoding) / 8);
+      image_msg.data.resize((size_t)image_msg.step * image_msg.height);
+   }
+
+   if (delta->keyframe) {
+      synced = 1;
+   } else if (synced && delta->sequence != last_sequence + 1) {
+      ROS_WARN("Delta %u lost, waiting for the next keyframe", last_sequence + 1);
+      synced = 0;
+   }
+   last_sequence = delta->sequence;
+   if (!synced)
+      return;
+
+   if (raspitiledelta_apply(&image_msg.data[0], image_msg.width, image_msg.height,
+                            image_msg.step / image_msg.width, delta->tile_size,
+                            delta->tile_indices.data(), delta->tile_indices.size(),
+                            delta->data.data(), delta->data.size()) != 0) {
+      ROS_WARN("Inconsistent delta %u, waiting for the next keyframe",
+               delta->sequence);
+      synced = 0;
+      return;
+   }
+
+   image_msg.header = delta->header;
+   image_pub.publish(image_msg);
+}
+
+int main(int argc, char** argv) {
+   ros::init(argc, argv, "raspicam_delta_reassembler");
+   ros::NodeHandle n;
+   image_transport::ImageTransport it(n);
+   image_pub = it.advertise("camera/image/reassembled", 1);
+   ros::Subscriber delta_sub = n.subscribe("camera/image/delta", 5, delta_callback);
+   ros::spin();
+   return 0;
+}
@@ -0,0 +1,401 @@
+/**
+ * \file raspicam_fanout.cpp
+ * How raspicam_node copes with more and more local subscribers
+ *
+ * Description
+ *
+ * Runs steps of 1, 2, 4, 8 and 16 subscribers (up to the maximum given) to
+ * a running raspicam_node. Every subscriber is a ROS node of its own in a
+ * child process, so each one has a link of its own to the node as a
+ * separate tool would. The subscribers go round the mix: raw fast,
+ * compressed fast, raw slow, compressed slow, where a slow subscriber
+ * spends a fixed time in its callback. For every step the rate and the
+ * latency percentiles of each subscriber and the CPU use of the node are
+ * printed; the fast subscribers should not lose rate or latency to the
+ * slow ones, nor to their number.
+ *
+ * Latency is read from the probe in the pixels of a raw frame when the
+ * node runs on the fake MMAL with FAKE_MMAL_PROBE=1 (see RaspiProbe.h),
+ * otherwise it is taken from the header stamps. The node is found by its
+ * name among the processes, unless its pid is given.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+
+#include "ros/ros.h"
+#include "std_msgs/Header.h"
+#include "sensor_msgs/Image.h"
+#include "sensor_msgs/CompressedImage.h"
+
+#include "RaspiCLI.h"
+#include "RaspiLatency.h"
+#include "RaspiProbe.h"
+
+/// Kinds of subscriber, in the order they are added
+#define FANOUT_RAW_FAST        0
+#define FANOUT_COMPRESSED_FAST 1
+#define FANOUT_RAW_SLOW        2
+#define FANOUT_COMPRESSED_SLOW 3
+#define FANOUT_KINDS           4
+
+/** Options of the run
+ */
+typedef struct {
+   int max_subscribers;
+   double seconds;                     /// Measured time of a step
+   double warmup;                      /// Time for the subscribers to connect
+   int slow_ms;                        /// Time a slow subscriber spends on a message
+   int node_pid;                       /// 0 to look the node up
+} FANOUT_OPTIONS;
+
+/** Result of a subscriber, sent to the parent through a pipe
+ */
+typedef struct {
+   int kind;
+   uint32_t received;
+   int probed;                         /// Latency from the probes rather than the stamps
+   double seconds;
+   int64_t p50_us;
+   int64_t p99_us;
+} FANOUT_RESULT;
+
+enum {
+   CommandHelp,
+   CommandSubscribers,
+   CommandTime,
+   CommandWarmup,
+   CommandSlow,
+   CommandPid
+};
+
+static COMMAND_LIST cmdline_commands[] = {
+   {CommandHelp,        "-help",        "?",  "This help information", 0},
+   {CommandSubscribers, "-subscribers", "n",  "Largest number of subscribers (default 16)", 1},
+   {CommandTime,        "-time",        "t",  "Seconds to measure each step for (default 10)", 1},
+   {CommandWarmup,      "-warmup",      "wu", "Seconds for the subscribers to connect (default 3)", 1},
+   {CommandSlow,        "-slow",        "s",  "Milliseconds a slow subscriber spends on a message (default 200)", 1},
+   {CommandPid,         "-pid",         "p",  "Pid of raspicam_node (default: found by name)", 1}
+};
+
+static int cmdline_commands_size = sizeof(cmdline_commands) / sizeof(
+                                      cmdline_commands[0]);
+
+static const char* kind_names[FANOUT_KINDS] = {
+   "raw fast", "compressed fast", "raw slow", "compressed slow"
+};
+
+// Of the subscriber in a child process
+int subscriber_kind;
+int subscriber_slow_ms;
+int measuring;
+FANOUT_RESULT result;
+RASPILATENCY_HISTOGRAM latency;
+
+static void display_help(const char* app_name) {
+   fprintf(stderr, "Usage: %s [options] [__master:=...]\n\n", app_name);
+   raspicli_display_help(cmdline_commands, cmdline_commands_size);
+   fprintf(stderr, "\n");
+}
+
+/**
+ * Parse the command line into the options, ROS remappings are left alone
+ *
+ * @return 0 if successful, -1 on an invalid or incomplete option or for the help
+ */
+static int parse_cmdline(int argc, const char** argv, FANOUT_OPTIONS* options) {
+   for (int i = 1; i < argc; i++) {
+      int num_parameters = 0;
+      int valid = 1;
+
+      if (strstr(argv[i], ":="))
+         continue;
+      if (argv[i][0] != '-')
+         return -1;
+      const int command_id = raspicli_get_command_id(cmdline_commands,
+                                                     cmdline_commands_size,
+                                                     &argv[i][1], &num_parameters);
+      if (command_id != -1 && num_parameters > 0 && i + 1 >= argc)
+         return -1;
+
+      switch (command_id) {
+      case CommandSubscribers:
+         valid = sscanf(argv[++i], "%d", &options->max_subscribers) == 1 &&
+                 options->max_subscribers > 0;
+         break;
+      case CommandTime:
+         valid = sscanf(argv[++i], "%lf", &options->seconds) == 1 && options->seconds > 0.0;
+         break;
+      case CommandWarmup:
+         valid = sscanf(argv[++i], "%lf", &options->warmup) == 1 && options->warmup >= 0.0;
+         break;
+      case CommandSlow:
+         valid = sscanf(argv[++i], "%d", &options->slow_ms) == 1 && options->slow_ms >= 0;
+         break;
+      case CommandPid:
+         valid = sscanf(argv[++i], "%d", &options->node_pid) == 1 && options->node_pid > 0;
+         break;
+      default:
+         return -1;
+      }
+      if (!valid) {
+         fprintf(stderr, "Invalid command line option (%s)\n", argv[i]);
+         return -1;
+      }
+   }
+   return 0;
+}
+
+/**
+ * Find the pid of raspicam_node among the processes
+ *
+ * @return pid, 0 if there is no such process
+ */
+static int find_node() {
+   DIR* proc = opendir("/proc");
+   struct dirent* entry;
+   int pid = 0;
+
+   if (!proc)
+      return 0;
+   while (!pid && (entry = readdir(proc)) != NULL) {
+      char path[288], cmdline[256];
+      const int candidate = atoi(entry->d_name);
+      if (candidate <= 0 || candidate == getpid())
+         continue;
+      snprintf(path, sizeof(path), "/proc/%s/cmdline", entry->d_name);
+      FILE* f = fopen(path, "r");
+      if (!f)
+         continue;
+      const size_t n = fread(cmdline, 1, sizeof(cmdline) - 1, f);
+      fclose(f);
+      cmdline[n] = 0;
+      // argv[0] ends the first string
+      const char* name = strrchr(cmdline, '/');
+      if (strcmp(name ? name + 1 : cmdline, "raspicam_node") == 0)
+         pid = candidate;
+   }
+   closedir(proc);
+   return pid;
+}
+
+/**
+ * CPU time used by a process, in microseconds
+ *
+ * @return CPU time, -1 if the process cannot be read
+ */
+static int64_t process_cpu_us(int pid) {
+   char path[64], stat[1024];
+   unsigned long utime, stime;
+
+   snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+   FILE* f = fopen(path, "r");
+   if (!f)
+      return -1;
+   const size_t n = fread(stat, 1, sizeof(stat) - 1, f);
+   fclose(f);
+   stat[n] = 0;
+   // The name may hold spaces, the fields after it are fixed
+   const char* fields = strrchr(stat, ')');
+   if (!fields || sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                         &utime, &stime) != 2)
+      return -1;
+   return (int64_t)(utime + stime) * 1000000 / sysconf(_SC_CLK_TCK);
+}
+
+/**
+ * Count a message, from its probe when it has one
+ */
+static void count_message(const std_msgs::Header& header, const uint8_t* pixels,
+                          int stride, int bytes_per_pixel, int width, int height) {
+   const int64_t arrived_us = raspiprobe_now_us();
+   const ros::Time arrived = ros::Time::now();
+   RASPIPROBE_STAMP stamp;
+
+   if (!measuring)
+      return;
+   result.received++;
+   if (pixels && raspiprobe_read(pixels, stride, bytes_per_pixel, width, height,
+                                 &stamp) == 0) {
+      result.probed = 1;
+      raspilatency_add(&latency, raspiprobe_age_us(&stamp, arrived_us));
+   } else if (!result.probed) {
+      raspilatency_add(&latency, (arrived - header.stamp).toNSec() / 1000);
+   }
+}
+
+void raw_callback(const sensor_msgs::Image::ConstPtr& image) {
+   count_message(image->header, image->data.empty() ? NULL : &image->data[0],
+                 image->step, image->width ? image->step / image->width : 1,
+                 image->width, image->height);
+   if (subscriber_kind == FANOUT_RAW_SLOW)
+      usleep(subscriber_slow_ms * 1000);
+}
+
+void compressed_callback(const sensor_msgs::CompressedImage::ConstPtr& image) {
+   count_message(image->header, NULL, 0, 0, 0, 0);
+   if (subscriber_kind == FANOUT_COMPRESSED_SLOW)
+      usleep(subscriber_slow_ms * 1000);
+}
+
+/**
+ * Body of a child process: subscribe, measure and send the result back
+ *
+ * @param argc Arguments of the program, for the ROS remappings
+ * @param argv Arguments of the program
+ * @param index Number of the subscriber in the step
+ * @param options Options of the run
+ * @param start_us When to start measuring, on the probe clock
+ * @param fd Write end of the pipe to the parent
+ *
+ * @return Exit status of the child
+ */
+static int run_subscriber(int argc, char** argv, int index, const FANOUT_OPTIONS* options,
+                          int64_t start_us, int fd) {
+   char name[64];
+
+   subscriber_kind = index % FANOUT_KINDS;
+   subscriber_slow_ms = options->slow_ms;
+   memset(&result, 0, sizeof(result));
+   result.kind = subscriber_kind;
+   raspilatency_reset(&latency);
+
+   snprintf(name, sizeof(name), "raspicam_fanout_%d", index);
+   ros::init(argc, argv, name, ros::init_options::NoSigintHandler);
+   ros::NodeHandle n;
+   ros::Subscriber sub;
+   if (subscriber_kind == FANOUT_RAW_FAST || subscriber_kind == FANOUT_RAW_SLOW)
+      sub = n.subscribe("camera/image", 1, raw_callback);
+   else
+      sub = n.subscribe("camera/mjpeg", 1, compressed_callback);
+
+   while (ros::ok() && raspiprobe_now_us() < start_us) {
+      ros::spinOnce();
+      usleep(1000);
+   }
+   const int64_t end_us = start_us + (int64_t)(options->seconds * 1000000);
+   measuring = 1;
+   while (ros::ok() && raspiprobe_now_us() < end_us) {
+      ros::spinOnce();
+      usleep(1000);
+   }
+   measuring = 0;
+
+   RASPILATENCY_SNAPSHOT snapshot;
+   raspilatency_take(&latency, &snapshot);
+   result.seconds = options->seconds;
+   result.p50_us = raspilatency_percentile(&snapshot, 50.0);
+   result.p99_us = raspilatency_percentile(&snapshot, 99.0);
+   const int sent = write(fd, &result, sizeof(result)) == (ssize_t)sizeof(result);
+   close(fd);
+   ros::shutdown();
+   return sent ? 0 : 1;
+}
+
+/**
+ * Run one step of the benchmark
+ *
+ * @param argc Arguments of the program, passed on to the subscribers
+ * @param argv Arguments of the program
+ * @param subscribers Subscribers in the step
+ * @param options Options of the run
+ *
+ * @return 0 if successful, -1 if a subscriber failed
+ */
+static int run_step(int argc, char** argv, int subscribers, const FANOUT_OPTIONS* options) {
+   std::vector<int> pids, fds;
+   const int64_t start_us = raspiprobe_now_us() + (int64_t)(options->warmup * 1000000);
+   int failed = 0;
+
+   for (int i = 0; i < subscribers; i++) {
+      int pipe_fds[2];
+      if (pipe(pipe_fds) != 0) {
+         failed = 1;
+         break;
+      }
+      fflush(stdout);
+      const int pid = fork();
+      if (pid == 0) {
+         close(pipe_fds[0]);
+         _exit(run_subscriber(argc, argv, i, options, start_us, pipe_fds[1]));
+      }
+      close(pipe_fds[1]);
+      if (pid < 0) {
+         close(pipe_fds[0]);
+         failed = 1;
+         break;
+      }
+      pids.push_back(pid);
+      fds.push_back(pipe_fds[0]);
+   }
+
+   // The node's CPU over the time the subscribers measure
+   while (raspiprobe_now_us() < start_us)
+      usleep(10000);
+   const int64_t start_cpu = process_cpu_us(options->node_pid);
+   usleep((useconds_t)(options->seconds * 1000000));
+   const int64_t end_cpu = process_cpu_us(options->node_pid);
+
+   printf("\n%d subscriber%s, node at ", subscribers, subscribers > 1 ? "s" : "");
+   if (start_cpu >= 0 && end_cpu >= 0)
+      printf("%.1f%% of a core\n", (end_cpu - start_cpu) / 10000.0 / options->seconds);
+   else
+      printf("an unknown CPU use\n");
+   printf("  #  subscriber          fps   p50 ms   p99 ms\n");
+   for (size_t i = 0; i < fds.size(); i++) {
+      FANOUT_RESULT r;
+      if (read(fds[i], &r, sizeof(r)) != (ssize_t)sizeof(r)) {
+         printf(" %2d  %-16s  failed\n", (int)i, kind_names[i % FANOUT_KINDS]);
+         failed = 1;
+      } else {
+         printf(" %2d  %-16s %5.1f  %7.1f  %7.1f%s\n", (int)i, kind_names[r.kind],
+                r.received / r.seconds, r.p50_us / 1000.0, r.p99_us / 1000.0,
+                r.probed ? "" : "  (stamps)");
+      }
+      close(fds[i]);
+   }
+   for (size_t i = 0; i < pids.size(); i++) {
+      int status;
+      if (waitpid(pids[i], &status, 0) != pids[i] || !WIFEXITED(status) ||
+          WEXITSTATUS(status) != 0)
+         failed = 1;
+   }
+   fflush(stdout);
+   return failed ? -1 : 0;
+}
+
+int main(int argc, char** argv) {
+   FANOUT_OPTIONS options;
+   int failed = 0;
+
+   options.max_subscribers = 16;
+   options.seconds = 10.0;
+   options.warmup = 3.0;
+   options.slow_ms = 200;
+   options.node_pid = 0;
+   if (parse_cmdline(argc, (const char**)argv, &options) != 0) {
+      display_help(argv[0]);
+      return 1;
+   }
+   if (!options.node_pid)
+      options.node_pid = find_node();
+   if (!options.node_pid)
+      fprintf(stderr, "raspicam_node is not running here, its CPU use is not measured\n");
+
+   // The parent stays out of ROS, the children each start it after the fork
+   for (int subscribers = 1; ; subscribers *= 2) {
+      if (subscribers > options.max_subscribers)
+         subscribers = options.max_subscribers;
+      if (run_step(argc, argv, subscribers, &options) != 0)
+         failed = 1;
+      if (subscribers == options.max_subscribers)
+         break;
+   }
+   return failed ? 1 : 0;
+}
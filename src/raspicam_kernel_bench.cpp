@@ -0,0 +1,333 @@
+/**
+ * \file raspicam_kernel_bench.cpp
+ * Throughput of the per-pixel kernels
+ *
+ * Description
+ *
+ * Runs every kernel the frame path uses on a synthetic frame at the
+ * standard capture resolutions and prints the time per pixel and the
+ * bytes of frame read per second. The kernels are compiled into this
+ * program rather than linked from the node libraries, once as they are
+ * built for the node and once with RASPI_SIMD_DISABLE, so comparing the
+ * two programs on the same machine gives the gain of the SIMD path and
+ * shows a kernel whose SIMD path stopped being used. The simd column gives
+ * the path each kernel takes in this build, scalar for the kernels without
+ * a path for its instruction set.
+ *
+ * Usage: raspicam_kernel_bench [-t seconds] [-k kernel] [-r widthxheight]
+ *
+ * -t sets the minimum time spent on each kernel and resolution (0.2 s by
+ * default), -k runs only the kernels whose name contains the argument and
+ * -r replaces the standard resolutions by the given one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "RaspiSimd.h"
+#include "RaspiFormat.h"
+#include "RaspiLuma.h"
+#include "RaspiPyramid.h"
+#include "RaspiShading.h"
+#include "RaspiTone.h"
+#include "RaspiDenoise.h"
+#include "RaspiSharpness.h"
+#include "RaspiBlobs.h"
+#include "RaspiFeatures.h"
+#include "RaspiLines.h"
+#include "RaspiTileDelta.h"
+
+/// Buffers and kernel states for one resolution
+typedef struct {
+   int width;
+   int height;
+   int frame;                         /// Iteration, to move the scene
+   std::vector<uint8_t> i420;         /// Camera buffer, padded like the camera pads it
+   std::vector<uint8_t> rgb;          /// Packed rgb frame
+   std::vector<uint8_t> y;            /// Packed Y plane
+   std::vector<uint8_t> out;          /// Destination of the kernels writing a new plane
+   RASPIFORMAT_PLANES planes;         /// Of i420
+   RASPIPYRAMID_LAYOUT pyramid;
+   RASPISHADING_LUT shading;
+   RASPITONE_CONFIG tone;
+   RASPITONE_CONFIG tone_lut;         /// Curve only, no matrix
+   RASPIDENOISE_STATE denoise;
+   RASPIBLOBS_STATE blobs;
+   RASPIFEATURES_STATE features;
+   std::vector<RASPIFEATURES_KEYPOINT> keypoints;
+   RASPILINES_STATE lines;
+   RASPITILEDELTA_STATE delta;
+   std::vector<uint32_t> tile_indices;
+   std::vector<uint8_t> payload;
+} BENCH_FRAME;
+
+/// Path of a kernel with a path for every instruction set
+#define SIMD_ANY   RASPI_SIMD_NAME
+/// Path of a kernel with a NEON path only
+#if defined(RASPI_SIMD_NEON)
+#define SIMD_NEON  "neon"
+#else
+#define SIMD_NEON  "scalar"
+#endif
+#define SIMD_NONE  "scalar"
+
+typedef struct {
+   const char* name;
+   const char* simd;                  /// Path taken in this build
+   int bytes_per_pixel;               /// Frame bytes read per pixel, for the throughput
+   void (*run)(BENCH_FRAME* frame);
+} BENCH_KERNEL;
+
+volatile float sink;                  /// Keeps the results of pure kernels alive
+
+static double now_s() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Fill a frame with a gradient, a moving bright square and some noise
+ *
+ * @param data First pixel
+ * @param width Width in pixels
+ * @param height Height in pixels
+ * @param stride Bytes between the starts of two rows
+ * @param bpp Bytes per pixel
+ * @param seed Position of the square and noise seed
+ */
+static void render(uint8_t* data, int width, int height, int stride, int bpp,
+                   int seed) {
+   unsigned int noise = 12345u + seed;
+   int x0 = (seed * 7) % (width / 2);
+   int y0 = (seed * 3) % (height / 2);
+
+   for (int r = 0; r < height; r++) {
+      uint8_t* row = data + (size_t)r * stride;
+      for (int c = 0; c < width; c++) {
+         noise = noise * 1103515245u + 12345u;
+         int v = ((c + r) * 255) / (width + height) + (int)((noise >> 16) & 7);
+         if (c >= x0 && c < x0 + width / 8 && r >= y0 && r < y0 + height / 8)
+            v = 240;
+         for (int b = 0; b < bpp; b++)
+            row[c * bpp + b] = (uint8_t)(v + b * 8 > 255 ? 255 : v + b * 8);
+      }
+   }
+}
+
+static int setup(BENCH_FRAME* f, int width, int height) {
+   f->width = width;
+   f->height = height;
+   f->frame = 0;
+
+   const int stride = VCOS_ALIGN_UP(width, 32);
+   const int rows = VCOS_ALIGN_UP(height, 16);
+   f->i420.assign((size_t)stride * rows * 3 / 2, 128);
+   RaspiFormatMono8::planes(&f->i420[0], f->i420.size(), width, height, &f->planes);
+   render(&f->i420[0], width, height, stride, 1, 0);
+
+   f->rgb.resize((size_t)width * height * 3);
+   render(&f->rgb[0], width, height, width * 3, 3, 0);
+   f->y.resize((size_t)width * height);
+   render(&f->y[0], width, height, width, 1, 0);
+   f->out.resize((size_t)width * height * 3);
+
+   if (raspipyramid_layout(&f->pyramid, width, height, 4) < 2)
+      return -1;
+   if (f->out.size() < f->pyramid.size)
+      f->out.resize(f->pyramid.size);
+
+   float gains[4 * 3 * 3];
+   for (int i = 0; i < 4 * 3 * 3; i++)
+      gains[i] = 1.0f + 0.05f * (i % 5);
+   RASPISHADING_GRID grid = { 4, 3, 3, gains };
+   memset(&f->shading, 0, sizeof(f->shading));
+   if (raspishading_build_lut(&f->shading, &grid, width, height, 3) != 0)
+      return -1;
+
+   const double curve[] = { 0, 0, 64, 48, 192, 208, 255, 255 };
+   const double matrix[] = { 1.2, -0.1, -0.1, -0.1, 1.2, -0.1, -0.1, -0.1, 1.2 };
+   if (raspitone_build(&f->tone, 0.9, curve, 8, matrix) != 0 ||
+       raspitone_build(&f->tone_lut, 0.9, curve, 8, NULL) != 0)
+      return -1;
+
+   memset(&f->denoise, 0, sizeof(f->denoise));
+   if (raspidenoise_init(&f->denoise, width, height, 3, 64, 24) != 0)
+      return -1;
+
+   RASPIBLOBS_RANGE range = { 200, 255, 100, 160, 100, 160 };
+   if (raspiblobs_init(&f->blobs, width / 2, height / 2, &range, 1, 16) != 0)
+      return -1;
+   if (raspifeatures_init(&f->features, width, height, 20, 32, 500) != 0)
+      return -1;
+   if (raspilines_init(&f->lines, width, 0, 20, 2, width / 4) != 0)
+      return -1;
+
+   memset(&f->delta, 0, sizeof(f->delta));
+   if (raspitiledelta_init(&f->delta, width, height, 3, 16, 4, 0) != 0)
+      return -1;
+   return 0;
+}
+
+static void teardown(BENCH_FRAME* f) {
+   raspishading_free_lut(&f->shading);
+   raspidenoise_destroy(&f->denoise);
+   raspitiledelta_destroy(&f->delta);
+}
+
+/// Y plane of a padded camera buffer to a packed frame, as the raw output does
+static void run_y_extract(BENCH_FRAME* f) {
+   const uint8_t* src = f->planes.plane[0];
+   uint8_t* dst = &f->out[0];
+   for (int r = 0; r < f->height; r++)
+      memcpy(dst + (size_t)r * f->width, src + (size_t)r * f->planes.stride[0], f->width);
+}
+
+static void run_luma(BENCH_FRAME* f) {
+   raspiluma_from_rgb(&f->rgb[0], f->width, f->height, f->width * 3,
+                      &f->out[0], f->width);
+}
+
+static void run_downsample(BENCH_FRAME* f) {
+   raspipyramid_downsample(&f->y[0], f->width, f->height, f->width,
+                           &f->out[0], f->width / 2);
+}
+
+static void run_pyramid(BENCH_FRAME* f) {
+   raspipyramid_build(&f->pyramid, &f->y[0], f->width, &f->out[0]);
+}
+
+static void run_shading(BENCH_FRAME* f) {
+   raspishading_apply(&f->shading, &f->rgb[0], f->width * 3);
+}
+
+static void run_tone(BENCH_FRAME* f) {
+   raspitone_apply(&f->tone, &f->rgb[0], f->width, f->height, f->width * 3, 3);
+}
+
+/// Curve alone, a table lookup per byte
+static void run_tone_lut(BENCH_FRAME* f) {
+   raspitone_apply(&f->tone_lut, &f->rgb[0], f->width, f->height, f->width * 3, 3);
+}
+
+static void run_denoise(BENCH_FRAME* f) {
+   raspidenoise_apply(&f->denoise, &f->rgb[0], f->width * 3);
+}
+
+static void run_sharpness(BENCH_FRAME* f) {
+   sink = raspisharpness_score(&f->y[0], f->width, f->height, f->width, 1, 1);
+}
+
+static void run_blobs_i420(BENCH_FRAME* f) {
+   raspiblobs_classify_i420(&f->blobs, f->planes.plane[0], f->planes.stride[0],
+                            f->planes.plane[1], f->planes.plane[2],
+                            f->planes.stride[1]);
+}
+
+static void run_blobs_rgb(BENCH_FRAME* f) {
+   raspiblobs_classify_rgb(&f->blobs, &f->rgb[0], f->width * 3);
+}
+
+static void run_features(BENCH_FRAME* f) {
+   sink = raspifeatures_detect(&f->features, &f->y[0], f->width,
+                               RASPIFEATURES_PATCH_BORDER, f->keypoints);
+}
+
+static void run_lines(BENCH_FRAME* f) {
+   RASPILINES_HIT hit;
+   for (int r = 0; r < f->height; r++)
+      raspilines_scan_row(&f->lines, &f->rgb[(size_t)r * f->width * 3], 3, &hit);
+   sink = hit.position;
+}
+
+/// Moves the scene first, so there are changed tiles to send
+static void run_tiledelta(BENCH_FRAME* f) {
+   int keyframe;
+   f->frame++;
+   const int x = (f->frame * 16) % (f->width - 32);
+   for (int r = 0; r < 32; r++)
+      memset(&f->rgb[((size_t)r * f->width + x) * 3], f->frame, 32 * 3);
+   raspitiledelta_encode(&f->delta, &f->rgb[0], f->width * 3, f->tile_indices,
+                         f->payload, &keyframe);
+}
+
+static const BENCH_KERNEL kernels[] = {
+   { "y_extract",     SIMD_NONE, 1, run_y_extract },
+   { "luma_from_rgb", SIMD_NEON, 3, run_luma },
+   { "downsample",    SIMD_ANY,  1, run_downsample },
+   { "pyramid",       SIMD_ANY,  1, run_pyramid },
+   { "shading",       SIMD_ANY,  3, run_shading },
+   // The curve is looked up per byte, the matrix is vectorised
+   { "tone",          SIMD_ANY,  3, run_tone },
+   { "tone_lut",      SIMD_NONE, 3, run_tone_lut },
+   { "denoise",       SIMD_ANY,  3, run_denoise },
+   { "sharpness",     SIMD_ANY,  1, run_sharpness },
+   { "blobs_i420",    SIMD_ANY,  1, run_blobs_i420 },
+   // Converted to YUV per pixel, then classified like i420
+   { "blobs_rgb",     SIMD_ANY,  3, run_blobs_rgb },
+   { "features",      SIMD_ANY,  1, run_features },
+   { "lines",         SIMD_NONE, 3, run_lines },
+   { "tiledelta",     SIMD_ANY,  3, run_tiledelta },
+};
+
+int main(int argc, char** argv) {
+   double min_time = 0.2;
+   const char* filter = NULL;
+   int sizes[][2] = { { 640, 480 }, { 1280, 720 }, { 1920, 1080 } };
+   int num_sizes = 3;
+
+   for (int i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "-t") && i + 1 < argc)
+         min_time = atof(argv[++i]);
+      else if (!strcmp(argv[i], "-k") && i + 1 < argc)
+         filter = argv[++i];
+      else if (!strcmp(argv[i], "-r") && i + 1 < argc &&
+               sscanf(argv[++i], "%dx%d", &sizes[0][0], &sizes[0][1]) == 2 &&
+               sizes[0][0] >= 64 && sizes[0][1] >= 64)
+         num_sizes = 1;
+      else {
+         fprintf(stderr, "Usage: %s [-t seconds] [-k kernel] [-r widthxheight]\n",
+                 argv[0]);
+         return 1;
+      }
+   }
+
+   printf("%-14s %-6s %10s %10s %10s\n", "kernel", "simd", "size",
+          "ns/pixel", "GB/s");
+   for (int s = 0; s < num_sizes; s++) {
+      BENCH_FRAME frame;
+      if (setup(&frame, sizes[s][0], sizes[s][1]) != 0) {
+         fprintf(stderr, "Cannot set up the kernels at %dx%d\n", sizes[s][0],
+                 sizes[s][1]);
+         return 1;
+      }
+
+      for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+         const BENCH_KERNEL* kernel = &kernels[k];
+         if (filter && !strstr(kernel->name, filter))
+            continue;
+
+         // One untimed run to touch the buffers and prime the kernel state
+         kernel->run(&frame);
+         int iterations = 0;
+         const double start = now_s();
+         double elapsed;
+         do {
+            kernel->run(&frame);
+            iterations++;
+            elapsed = now_s() - start;
+         } while (elapsed < min_time);
+
+         const double pixels = (double)frame.width * frame.height * iterations;
+         char size[16];
+         snprintf(size, sizeof(size), "%dx%d", frame.width, frame.height);
+         printf("%-14s %-6s %10s %10.3f %10.3f\n", kernel->name, kernel->simd,
+                size, elapsed * 1e9 / pixels,
+                pixels * kernel->bytes_per_pixel / elapsed * 1e-9);
+      }
+      teardown(&frame);
+   }
+   return 0;
+}
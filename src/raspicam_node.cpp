@@ -51,6 +51,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <ctype.h>
 #include <memory.h>
 #define VCOS_ALWAYS_WANT_LOGGING
 
@@ -72,18 +74,58 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <image_transport/image_transport.h>
 #include "sensor_msgs/Image.h"
 #include "sensor_msgs/image_encodings.h"
-#include "sensor_msgs/fill_image.h"
 #include "sensor_msgs/CompressedImage.h"
 #include "std_srvs/Empty.h"
 #include "sensor_msgs/CameraInfo.h"
 #include "sensor_msgs/SetCameraInfo.h"
 #include "camera_info_manager/camera_info_manager.h"
 
+#include "raspicam/TileDelta.h"
+#include "raspicam/Sharpness.h"
+#include "raspicam/Pyramid.h"
+#include "raspicam/Features.h"
+#include "raspicam/Blobs.h"
+#include "raspicam/Lines.h"
+#include "raspicam/Stages.h"
+#include "raspicam/Degradation.h"
+#include "raspicam/CompressedAck.h"
+#include "raspicam/SetRoi.h"
+#include "raspicam/Recovery.h"
+#include "ros/package.h"
+
 #include "RaspiCamControl.h"
 #include "RaspiCLI.h"
+#include "RaspiTileDelta.h"
+#include "RaspiSharpness.h"
+#include "RaspiShading.h"
+#include "RaspiTone.h"
+#include "RaspiDenoise.h"
+#include "RaspiLuma.h"
+#include "RaspiPyramid.h"
+#include "RaspiFeatures.h"
+#include "RaspiBlobs.h"
+#include "RaspiLines.h"
+#include "RaspiStages.h"
+#include "RaspiLadder.h"
+#include "RaspiThermal.h"
+#include "RaspiGovernor.h"
+#include "RaspiRate.h"
+#include "RaspiFormat.h"
+#include "RaspiAllocs.h"
+#include "RaspiLatency.h"
+#include "RaspiSoak.h"
+#include "RaspiRoi.h"
+#include "RaspiWatchdog.h"
+#include "RaspiUdp.h"
 
 
 #include <semaphore.h>
+#include <memory>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <boost/make_shared.hpp>
 
 /// Camera number to use - we only have one camera, indexed from 0.
 #define CAMERA_NUMBER 0
@@ -118,6 +160,58 @@ typedef struct {
    int hflip ;
    int vflip ;
    long int bitrate ;
+   int delta ;                         /// Publish changed tiles on camera/image/delta
+   int delta_tile_size ;               /// Tile edge in pixels
+   int delta_threshold ;               /// Mean absolute difference that marks a tile as changed
+   int delta_refresh ;                 /// Frames between full refreshes of the delta output
+   int sharpness ;                     /// Publish a focus score per frame on camera/sharpness
+   int sharpness_row_step ;            /// Only every n-th row is used for the score
+   double sharpness_threshold ;        /// Drop raw frames scoring below this, 0 to disable
+   int sharpness_best_of ;             /// Only forward the sharpest of every n raw frames
+   int shading ;                       /// Apply the lens shading correction to raw frames
+   int shading_grid_width ;            /// Cell columns of a newly calibrated shading grid
+   int shading_grid_height ;           /// Cell rows of a newly calibrated shading grid
+   int shading_calib_frames ;          /// Flat-field frames averaged by a calibration
+   int tone ;                          /// Apply the tone LUT and colour matrix to raw frames
+   int denoise ;                       /// Apply the temporal filter to raw frames
+   int denoise_strength ;              /// Weight of the new frame in 1/128
+   int denoise_motion_threshold ;      /// Differences above this are not filtered
+   int pyramid ;                       /// Publish a pyramid of the Y plane on camera/image/pyramid
+   int pyramid_levels ;                /// Number of levels, including the full resolution one
+   int features ;                      /// Publish FAST keypoints on camera/features
+   int features_threshold ;            /// FAST intensity threshold
+   int features_cell_size ;            /// Edge of the non-max suppression cells in pixels
+   int features_max ;                  /// Upper bound on keypoints per frame
+   int features_descriptors ;          /// Also compute steered BRIEF descriptors
+   int blobs ;                         /// Publish colour blobs on camera/blobs
+   int blob_min_area ;                 /// Smallest blob reported, in pixels
+   int blob_max ;                      /// Largest number of blobs reported per frame
+   int lines ;                         /// Publish line positions on camera/lines
+   int line_dark ;                     /// Look for a dark line on a bright floor
+   int line_min_contrast ;             /// Rows with less contrast report no line
+   int line_min_width ;                /// Narrowest accepted line in pixels
+   int line_max_width ;                /// Widest accepted line in pixels
+   int stage_queue_size ;              /// Frames waiting per stage before the oldest is dropped
+   int thermal ;                       /// Step along thermal_ladder with the SoC temperature
+   double thermal_high ;               /// Step down at or above this temperature
+   double thermal_low ;                /// Step back up below this temperature
+   double thermal_period ;             /// Seconds between temperature checks
+   double cpu_budget ;                 /// Percent of one core the node may use, 0 for no limit
+   double cpu_period ;                 /// Seconds over which the CPU use is measured
+   int compressed ;                    /// Publish the encoder output on camera/mjpeg
+   int cpu_transports ;                /// Keep the software encoding transports of camera/image, 0 to disable them
+   int compressed_max_backlog ;        /// Unacknowledged frames above which a client slows down
+   int compressed_upgrade_frames ;     /// Frames a client has to keep up for to speed up again
+   double compressed_client_timeout ;  /// Seconds without acknowledgement before a client is dropped
+   int udp ;                           /// Send the encoder output to udp_address
+   int udp_port ;                      /// UDP port the frames are sent to
+   int udp_ttl ;                       /// Time to live of the datagrams
+   int udp_mtu ;                       /// Largest IP datagram sent
+   int udp_parity ;                    /// Data fragments per parity fragment, 0 for none
+   double soak_minutes ;               /// Length of a soak run, 0 for none
+   double soak_period ;                /// Seconds between two soak samples
+   RASPISOAK_LIMITS soak_limits ;      /// Limits a soak run is checked against
+   double stall_frames ;               /// Frame periods without a frame taken as a stall, 0 for no watchdog
    RASPICAM_CAMERA_PARAMETERS camera_parameters; /// Camera setup parameters
 
    MMAL_COMPONENT_T* camera_component;    /// Pointer to the camera component
@@ -135,125 +229,1675 @@ typedef struct {
 RASPIVID_STATE state_srv;
 
 image_transport::Publisher image_pub_;
-sensor_msgs::Image raw_msg;
 ros::Publisher image_pub;
 sensor_msgs::CompressedImage compressed_msg;
 ros::Publisher compressed_pub;
 ros::Publisher camera_info_pub;
 sensor_msgs::CameraInfo c_info;
+std::vector<sensor_msgs::CameraInfoPtr> c_info_pool;   /// Published copies of c_info
 std::string tf_prefix;
+std::string camera_frame_id;           /// tf_prefix + "/camera"
+ros::Publisher delta_pub;
+raspicam::TileDelta delta_msg;
+RASPITILEDELTA_STATE delta_state;
+unsigned int delta_subscribers;
+unsigned int delta_sequence;
+ros::Publisher sharpness_pub;
+raspicam::Sharpness sharpness_msg;
+RASPISHARPNESS_GATE sharpness_gate;
+RASPISTAGES_FRAME_PTR held_frame;
+/// Copies a camera buffer into a frame, instantiated per format
+typedef void (*FRAME_FILLER)(RASPISTAGES_FRAME* frame, const uint8_t* data,
+                             uint32_t length, int width, int height, int chroma);
+const RASPIFORMAT* frame_format;       /// Format the camera is captured in
+FRAME_FILLER fill_frame;
+std::string shading_file;
+RASPISHADING_LUT shading_lut;
+RASPISHADING_CALIB shading_calib;
+volatile int shading_calib_request;
+// Replaced as a whole by camera/reload_tone while the tone stage may be using it
+std::shared_ptr<const RASPITONE_CONFIG> tone_config;
+RASPIDENOISE_STATE denoise_state;
+ros::Publisher pyramid_pub;
+raspicam::Pyramid pyramid_msg;
+RASPIPYRAMID_LAYOUT pyramid_layout;
+ros::Publisher features_pub;
+raspicam::Features features_msg;
+RASPIFEATURES_STATE features_state;
+std::vector<RASPIFEATURES_KEYPOINT> keypoints;
+ros::Publisher blobs_pub;
+raspicam::Blobs blobs_msg;
+RASPIBLOBS_STATE blobs_state;
+std::vector<RASPIBLOBS_BLOB> blobs;
+ros::Publisher lines_pub;
+raspicam::Lines lines_msg;
+RASPILINES_STATE lines_state;          /// Only used by the camera callback
+RASPISTAGES_GRAPH stages;
+int publish_stage;
+ros::Publisher stages_pub;
+raspicam::Stages stages_msg;
+// Result of the degradation ladders, only changed from the ROS thread
+RASPILADDER_KNOBS knobs;
+volatile int frame_divider = 1;        /// Camera frames per processed frame
+volatile int lines_skipped = 0;        /// Set by the ladders, lines are scanned on the camera callback
+std::string thermal_path;
+std::string throttle_path;
+RASPITHERMAL_STATE thermal_state;
+std::vector<RASPILADDER_STEP> thermal_ladder;
+RASPIGOVERNOR_STATE governor;
+std::vector<RASPILADDER_STEP> cpu_ladder;
+ros::Publisher degradation_pub;
+raspicam::Degradation degradation_msg;
+RASPISTAGES_FRAME_PTR encoded_frame;   /// Filled by the encoder callback until the frame ends
+RASPISTAGES_POOL raw_frames;           /// Frames of the camera callback
+RASPISTAGES_POOL encoded_frames;       /// Frames of the encoder callback
+size_t encoded_frame_bytes = 0;        /// Reserved in an encoded frame, its largest size
+RASPILATENCY_HISTOGRAM publish_latency;    /// Capture to publication, during a soak
+RASPILATENCY_SNAPSHOT soak_latency;    /// Publication latencies over the soak so far
+std::vector<RASPISOAK_SAMPLE> soak_samples;
+std::string soak_report;               /// File the soak report is written to
+int64_t soak_start_us;
+uint32_t soak_dropped;                 /// Frames dropped by the stages since the last sample
+uint32_t soak_overflows;               /// Frames allocated outside the pools since the start
+uint32_t pool_overflows_seen;          /// Pool counters at the last sample
+int soak_failed;                       /// RASPISOAK_* bits of the limits the soak exceeded
+#if defined(RASPI_COUNT_ALLOCATIONS)
+/// Frames a callback may allocate on while the pools fill up
+#define ALLOCATION_WARMUP_FRAMES 100
+std::atomic<uint32_t> steady_allocations;   /// Allocations on the callbacks after warm-up
+#endif
+
+/** Client of the per-client compressed stream
+ */
+typedef struct {
+   ros::Publisher pub;
+   RASPIRATE_CLIENT rate;
+} COMPRESSED_CLIENT;
+
+// Set up from the ROS thread, served from the compressed stage
+std::map<std::string, COMPRESSED_CLIENT> compressed_clients;
+std::mutex compressed_clients_lock;
+/// Messages the compressed stage publishes, reused once roscpp is done with them
+#define COMPRESSED_POOL_SIZE 8
+std::vector<sensor_msgs::CompressedImagePtr> compressed_pool;
+// Moved by camera/set_roi, cropped by the roi stage
+RASPIROI_TABLE rois;
+std::vector<ros::Publisher> roi_pubs;  /// camera/roi/<name>, one per region
+int capture_divider = 1;               /// Of the configured resolution, set by init_cam
+std::atomic<int64_t> last_callback_us; /// Last camera frame, for the watchdog
+RASPIWATCHDOG_STATE watchdog;
+int capture_stopped = 0;               /// Through camera/stop_capture, left stopped by the watchdog
+ros::Publisher recovery_pub;
+raspicam::Recovery recovery_msg;
+std::string udp_address;               /// Multicast group or address of the UDP output
+std::string udp_interface;             /// Interface multicast leaves by, empty for the routes' choice
+RASPIUDP_SENDER udp_sender;
+int udp_open = 0;                      /// Set once udp_sender is open, unlike state->udp left alone by get_status
 
 /** Struct used to pass information in encoder port userdata to callback
  */
 typedef struct {
    RASPIVID_STATE*
    pstate;              /// pointer to our state in case required in callback
-   int abort;                           /// Set to 1 in callback if an error occurs to attempt to abort the capture
+   volatile int abort;                  /// Set to 1 in callback if an error occurs, the watchdog refills the port
    int frame;
+   int first_frame;                     /// Of the pipeline built last, its pools fill from there
    int id;
 } PORT_USERDATA;
 
+// Kept over rebuilds of the pipeline, the frame numbers carry on
+PORT_USERDATA camera_userdata;
+PORT_USERDATA encoder_userdata;
+
 static void display_valid_parameters(char* app_name);
+int start_capture(RASPIVID_STATE* state);
+int close_cam(RASPIVID_STATE* state);
+
+
+/**
+ * Assign a default set of parameters to the state passed in
+ *
+ * @param state Pointer to state structure to assign defaults to
+ */
+static void get_status(RASPIVID_STATE* state) {
+   int temp;
+   double dtemp;
+   std::string str;
+   if (!state) {
+      vcos_assert(0);
+      return;
+   }
+
+   // Default everything to zero
+   memset(state, 0, sizeof(RASPIVID_STATE));
+
+   if (ros::param::get("~width", temp )) {
+      if (temp > 0 && temp <= 1920)
+         state->width = temp;
+      else  state->width = 640;
+   } else {
+      state->width = 640;
+      ros::param::set("~width", 640);
+   }
+
+   if (ros::param::get("~height", temp )) {
+      if (temp > 0 && temp <= 1080)
+         state->height = temp;
+      else  state->height = 480;
+   } else {
+      state->height = 480;
+      ros::param::set("~height", 480);
+   }
+
+   if (ros::param::get("~quality", temp )) {
+      if (temp > 0 && temp <= 100)
+         state->quality = temp;
+      else  state->quality = 70;
+   } else {
+      state->quality = 70;
+      ros::param::set("~quality", 70);
+   }
+
+   if (ros::param::get("~framerate", temp )) {
+      if (temp > 0 && temp <= 90)
+         state->framerate = temp;
+      else  state->framerate = 30;
+   } else {
+      state->framerate = 30;
+      ros::param::set("~framerate", 30);
+   }
+
+   if (ros::param::get("~monochrome", temp )) {
+      state->monochrome = (temp > 0) ? 1 : 0;
+   } else {
+      state->monochrome = 0 ;
+   }
+
+   if (ros::param::get("~bitrate", temp )) {
+      if (temp > 25000000) temp = 25000000;
+      state->bitrate = temp ;
+   } else {
+      state->bitrate = 25000000 ;
+   }
+
+   if (ros::param::get("~hflip", temp )) {
+      temp = (temp > 0) ? 1 : 0;
+      state->hflip = temp ;
+   } else {
+      state->hflip = 0 ;
+   }
+
+   if (ros::param::get("~vflip", temp )) {
+      temp = (temp > 0) ? 1 : 0;
+      state->vflip = temp ;
+   } else {
+      state->vflip = 0 ;
+   }
+
+   if (ros::param::get("~delta", temp )) {
+      state->delta = (temp > 0) ? 1 : 0;
+   } else {
+      state->delta = 0 ;
+   }
+
+   if (ros::param::get("~delta_tile_size", temp )) {
+      if (temp >= 8 && temp <= 256)
+         state->delta_tile_size = temp;
+      else  state->delta_tile_size = 32;
+   } else {
+      state->delta_tile_size = 32 ;
+   }
+
+   if (ros::param::get("~delta_threshold", temp )) {
+      if (temp >= 0 && temp <= 255)
+         state->delta_threshold = temp;
+      else  state->delta_threshold = 4;
+   } else {
+      state->delta_threshold = 4 ;
+   }
+
+   if (ros::param::get("~delta_refresh", temp )) {
+      state->delta_refresh = (temp > 0) ? temp : 0;
+   } else {
+      state->delta_refresh = 30 ;
+   }
+
+   if (ros::param::get("~sharpness", temp )) {
+      state->sharpness = (temp > 0) ? 1 : 0;
+   } else {
+      state->sharpness = 0 ;
+   }
+
+   if (ros::param::get("~sharpness_row_step", temp )) {
+      if (temp > 0 && temp <= 64)
+         state->sharpness_row_step = temp;
+      else  state->sharpness_row_step = 4;
+   } else {
+      state->sharpness_row_step = 4 ;
+   }
+
+   if (ros::param::get("~sharpness_threshold", dtemp )) {
+      state->sharpness_threshold = (dtemp > 0.0) ? dtemp : 0.0;
+   } else {
+      state->sharpness_threshold = 0.0 ;
+   }
+
+   if (ros::param::get("~sharpness_best_of", temp )) {
+      state->sharpness_best_of = (temp > 1) ? temp : 1;
+   } else {
+      state->sharpness_best_of = 1 ;
+   }
+
+   if (ros::param::get("~shading", temp )) {
+      state->shading = (temp > 0) ? 1 : 0;
+   } else {
+      state->shading = 0 ;
+   }
+
+   if (ros::param::get("~shading_file", str)) {
+      shading_file = str;
+   } else {
+      shading_file = ros::package::getPath("raspicam") + "/calibrations/shading.yaml";
+   }
+
+   if (ros::param::get("~shading_grid_width", temp )) {
+      if (temp > 0 && temp <= 64)
+         state->shading_grid_width = temp;
+      else  state->shading_grid_width = 16;
+   } else {
+      state->shading_grid_width = 16 ;
+   }
+
+   if (ros::param::get("~shading_grid_height", temp )) {
+      if (temp > 0 && temp <= 64)
+         state->shading_grid_height = temp;
+      else  state->shading_grid_height = 12;
+   } else {
+      state->shading_grid_height = 12 ;
+   }
+
+   if (ros::param::get("~shading_calib_frames", temp )) {
+      state->shading_calib_frames = (temp > 0) ? temp : 30;
+   } else {
+      state->shading_calib_frames = 30 ;
+   }
+
+   if (ros::param::get("~tone", temp )) {
+      state->tone = (temp > 0) ? 1 : 0;
+   } else {
+      state->tone = 0 ;
+   }
+
+   if (ros::param::get("~denoise", temp )) {
+      state->denoise = (temp > 0) ? 1 : 0;
+   } else {
+      state->denoise = 0 ;
+   }
+
+   if (ros::param::get("~denoise_strength", temp )) {
+      if (temp > 0 && temp <= 128)
+         state->denoise_strength = temp;
+      else  state->denoise_strength = 48;
+   } else {
+      state->denoise_strength = 48 ;
+   }
+
+   if (ros::param::get("~denoise_motion_threshold", temp )) {
+      if (temp >= 0 && temp <= 255)
+         state->denoise_motion_threshold = temp;
+      else  state->denoise_motion_threshold = 16;
+   } else {
+      state->denoise_motion_threshold = 16 ;
+   }
+
+   if (ros::param::get("~pyramid", temp )) {
+      state->pyramid = (temp > 0) ? 1 : 0;
+   } else {
+      state->pyramid = 0 ;
+   }
+
+   if (ros::param::get("~pyramid_levels", temp )) {
+      if (temp >= 2 && temp <= RASPIPYRAMID_MAX_LEVELS)
+         state->pyramid_levels = temp;
+      else  state->pyramid_levels = 4;
+   } else {
+      state->pyramid_levels = 4 ;
+   }
+
+   if (ros::param::get("~features", temp )) {
+      state->features = (temp > 0) ? 1 : 0;
+   } else {
+      state->features = 0 ;
+   }
+
+   if (ros::param::get("~features_threshold", temp )) {
+      if (temp > 0 && temp < 255)
+         state->features_threshold = temp;
+      else  state->features_threshold = 20;
+   } else {
+      state->features_threshold = 20 ;
+   }
+
+   if (ros::param::get("~features_cell_size", temp )) {
+      if (temp >= 4 && temp <= 256)
+         state->features_cell_size = temp;
+      else  state->features_cell_size = 24;
+   } else {
+      state->features_cell_size = 24 ;
+   }
+
+   if (ros::param::get("~features_max", temp )) {
+      state->features_max = (temp > 0) ? temp : 150;
+   } else {
+      state->features_max = 150 ;
+   }
+
+   if (ros::param::get("~features_descriptors", temp )) {
+      state->features_descriptors = (temp > 0) ? 1 : 0;
+   } else {
+      state->features_descriptors = 0 ;
+   }
+
+   if (ros::param::get("~blobs", temp )) {
+      state->blobs = (temp > 0) ? 1 : 0;
+   } else {
+      state->blobs = 0 ;
+   }
+
+   if (ros::param::get("~blob_min_area", temp )) {
+      state->blob_min_area = (temp > 0) ? temp : 0;
+   } else {
+      state->blob_min_area = 20 ;
+   }
+
+   if (ros::param::get("~blob_max", temp )) {
+      state->blob_max = (temp > 0) ? temp : 16;
+   } else {
+      state->blob_max = 16 ;
+   }
+
+   if (ros::param::get("~lines", temp )) {
+      state->lines = (temp > 0) ? 1 : 0;
+   } else {
+      state->lines = 0 ;
+   }
+
+   if (ros::param::get("~line_dark", temp )) {
+      state->line_dark = (temp > 0) ? 1 : 0;
+   } else {
+      state->line_dark = 1 ;
+   }
+
+   if (ros::param::get("~line_min_contrast", temp )) {
+      if (temp >= 0 && temp <= 255)
+         state->line_min_contrast = temp;
+      else  state->line_min_contrast = 40;
+   } else {
+      state->line_min_contrast = 40 ;
+   }
+
+   if (ros::param::get("~line_min_width", temp )) {
+      state->line_min_width = (temp > 0) ? temp : 3;
+   } else {
+      state->line_min_width = 3 ;
+   }
+
+   if (ros::param::get("~line_max_width", temp )) {
+      state->line_max_width = (temp > 0) ? temp : state->width / 2;
+   } else {
+      state->line_max_width = state->width / 2 ;
+   }
+
+   if (ros::param::get("~stage_queue_size", temp )) {
+      state->stage_queue_size = (temp > 0) ? temp : 2;
+   } else {
+      state->stage_queue_size = 2 ;
+   }
+
+   if (ros::param::get("~thermal", temp )) {
+      state->thermal = (temp > 0) ? 1 : 0;
+   } else {
+      state->thermal = 0 ;
+   }
+
+   if (ros::param::get("~thermal_high", dtemp )) {
+      state->thermal_high = dtemp;
+   } else {
+      state->thermal_high = 75.0 ;
+   }
+
+   if (ros::param::get("~thermal_low", dtemp )) {
+      state->thermal_low = dtemp;
+   } else {
+      state->thermal_low = 65.0 ;
+   }
+
+   if (ros::param::get("~thermal_period", dtemp )) {
+      state->thermal_period = (dtemp > 0.0) ? dtemp : 5.0;
+   } else {
+      state->thermal_period = 5.0 ;
+   }
+
+   if (ros::param::get("~thermal_path", str)) {
+      thermal_path = str;
+   } else {
+      thermal_path = "/sys/class/thermal/thermal_zone0/temp";
+   }
+
+   if (ros::param::get("~throttle_path", str)) {
+      throttle_path = str;
+   } else {
+      throttle_path = "/sys/devices/platform/soc/soc:firmware/get_throttled";
+   }
+
+   if (ros::param::get("~cpu_budget", dtemp )) {
+      state->cpu_budget = (dtemp > 0.0) ? dtemp : 0.0;
+   } else {
+      state->cpu_budget = 0.0 ;
+   }
+
+   if (ros::param::get("~cpu_period", dtemp )) {
+      state->cpu_period = (dtemp > 0.0) ? dtemp : 2.0;
+   } else {
+      state->cpu_period = 2.0 ;
+   }
+
+   if (ros::param::get("~compressed", temp )) {
+      state->compressed = (temp > 0) ? 1 : 0;
+   } else {
+      state->compressed = 0 ;
+   }
+
+   if (ros::param::get("~cpu_transports", temp )) {
+      state->cpu_transports = (temp > 0) ? 1 : 0;
+   } else {
+      state->cpu_transports = 1 ;
+   }
+
+   if (ros::param::get("~compressed_max_backlog", temp )) {
+      state->compressed_max_backlog = (temp > 0) ? temp : 3;
+   } else {
+      state->compressed_max_backlog = 3 ;
+   }
+
+   if (ros::param::get("~compressed_upgrade_frames", temp )) {
+      state->compressed_upgrade_frames = (temp > 0) ? temp : 30;
+   } else {
+      state->compressed_upgrade_frames = 30 ;
+   }
+
+   if (ros::param::get("~compressed_client_timeout", dtemp )) {
+      state->compressed_client_timeout = (dtemp > 0.0) ? dtemp : 5.0;
+   } else {
+      state->compressed_client_timeout = 5.0 ;
+   }
+
+   if (ros::param::get("~udp_address", str)) {
+      udp_address = str;
+   } else {
+      udp_address = "";
+   }
+   state->udp = !udp_address.empty();
+
+   if (ros::param::get("~udp_port", temp )) {
+      state->udp_port = (temp > 0 && temp < 65536) ? temp : 5600;
+   } else {
+      state->udp_port = 5600 ;
+   }
+
+   if (ros::param::get("~udp_interface", str)) {
+      udp_interface = str;
+   } else {
+      udp_interface = "";
+   }
+
+   if (ros::param::get("~udp_ttl", temp )) {
+      state->udp_ttl = (temp > 0 && temp < 256) ? temp : 1;
+   } else {
+      state->udp_ttl = 1 ;
+   }
+
+   if (ros::param::get("~udp_mtu", temp )) {
+      state->udp_mtu = (temp >= 576 && temp < 65536) ? temp : 1500;
+   } else {
+      state->udp_mtu = 1500 ;
+   }
+
+   if (ros::param::get("~udp_parity", temp )) {
+      state->udp_parity = (temp > 0 && temp < 256) ? temp : 0;
+   } else {
+      state->udp_parity = 0 ;
+   }
+
+   if (ros::param::get("~tf_prefix",  str)) {
+      tf_prefix = str;
+   } else {
+      tf_prefix = "";
+      ros::param::set("~tf_prefix", "");
+   }
+   camera_frame_id = tf_prefix + "/camera";
+
+   if (ros::param::get("~soak_minutes", dtemp )) {
+      state->soak_minutes = (dtemp > 0.0) ? dtemp : 0.0;
+   } else {
+      state->soak_minutes = 0.0 ;
+   }
+
+   if (ros::param::get("~soak_period", dtemp )) {
+      state->soak_period = (dtemp > 0.0) ? dtemp : 60.0;
+   } else {
+      state->soak_period = 60.0 ;
+   }
+
+   if (ros::param::get("~soak_warmup", dtemp )) {
+      state->soak_limits.warmup_minutes = (dtemp >= 0.0) ? dtemp : 5.0;
+   } else {
+      state->soak_limits.warmup_minutes = 5.0 ;
+   }
+
+   if (ros::param::get("~soak_max_rss_growth", dtemp )) {
+      state->soak_limits.max_rss_growth_kb = dtemp;
+   } else {
+      state->soak_limits.max_rss_growth_kb = 1024.0 ;
+   }
+
+   if (ros::param::get("~soak_max_drop_percent", dtemp )) {
+      state->soak_limits.max_drop_percent = dtemp;
+   } else {
+      state->soak_limits.max_drop_percent = 1.0 ;
+   }
+
+   if (ros::param::get("~soak_max_p99_ms", dtemp )) {
+      state->soak_limits.max_p99_ms = dtemp;
+   } else {
+      state->soak_limits.max_p99_ms = 200.0 ;
+   }
+
+   if (ros::param::get("~soak_max_p99_growth", dtemp )) {
+      state->soak_limits.max_p99_growth = dtemp;
+   } else {
+      state->soak_limits.max_p99_growth = 1.5 ;
+   }
+
+   if (ros::param::get("~soak_max_pool_overflows", temp )) {
+      state->soak_limits.max_pool_overflows = (temp > 0) ? temp : 0;
+   } else {
+      state->soak_limits.max_pool_overflows = 0 ;
+   }
+
+   if (ros::param::get("~soak_report", str)) {
+      soak_report = str;
+   } else {
+      soak_report = "raspicam_soak.txt";
+   }
+
+   if (ros::param::get("~stall_frames", dtemp )) {
+      state->stall_frames = (dtemp > 0.0) ? dtemp : 0.0;
+   } else {
+      state->stall_frames = 5.0 ;
+   }
+
+   state->isInit = 0;
+
+   // Setup preview window defaults
+   //raspipreview_set_defaults(&state->preview_parameters);
+
+   // Set up the camera_parameters to default
+   raspicamcontrol_set_defaults(&state->camera_parameters);
+   //set some of the parameters defined by the user
+   state->camera_parameters.hflip = state->hflip;
+   state->camera_parameters.vflip = state->vflip;
+}
+
+
+/**
+ * Publish a raw image and the camera info that goes with it
+ *
+ * @param msg Image to publish
+ */
+static void publish_raw(const sensor_msgs::Image& msg) {
+   sensor_msgs::CameraInfoPtr info;
+
+   image_pub_.publish(msg);
+   // Reuse a copy the subscribers are done with, its storage already fits
+   for (size_t i = 0; i < c_info_pool.size() && !info; i++) {
+      if (c_info_pool[i].unique()) {
+         std::atomic_thread_fence(std::memory_order_acquire);
+         info = c_info_pool[i];
+      }
+   }
+   if (!info) {
+      info.reset(new sensor_msgs::CameraInfo);
+      if (c_info_pool.size() < 4)
+         c_info_pool.push_back(info);
+   }
+   *info = c_info;
+   info->header = msg.header;
+   camera_info_pub.publish(sensor_msgs::CameraInfoConstPtr(info));
+}
+
+/**
+ * Load the shading grid and build the LUT for the current resolution
+ *
+ * @param state Pointer to state control struct
+ */
+static void setup_shading(RASPIVID_STATE* state) {
+   RASPISHADING_GRID grid;
+
+   raspishading_free_lut(&shading_lut);
+   if (raspishading_load(&grid, shading_file.c_str()) != 0) {
+      ROS_INFO("Shading file %s missing, lens shading not corrected",
+               shading_file.c_str());
+      return;
+   }
+   if (raspishading_build_lut(&shading_lut, &grid, state->width, state->height,
+                              frame_format->bytes_per_pixel) != 0)
+      raspishading_free_lut(&shading_lut);
+   raspishading_free_grid(&grid);
+}
+
+/**
+ * Compute and save the grid of a completed flat-field calibration, and
+ * start using it when shading is on
+ */
+static void finish_shading_calibration() {
+   RASPISHADING_GRID grid;
+
+   shading_calib_request = 0;
+   if (raspishading_calib_finish(&shading_calib, &grid) != 0) {
+      ROS_ERROR("Shading calibration failed");
+      return;
+   }
+   if (raspishading_save(&grid, shading_file.c_str()) != 0)
+      ROS_ERROR("Unable to save the shading calibration to %s", shading_file.c_str());
+   else
+      ROS_INFO("Shading calibration saved to %s", shading_file.c_str());
+
+   raspishading_free_lut(&shading_lut);
+   // With shading off the calibration is only saved
+   if (state_srv.shading &&
+       raspishading_build_lut(&shading_lut, &grid, shading_calib.width,
+                              shading_calib.height, shading_calib.bpp) != 0)
+      raspishading_free_lut(&shading_lut);
+   raspishading_free_grid(&grid);
+}
+
+/**
+ * Build the tone configuration from the tone_gamma, tone_curve and
+ * color_matrix parameters and make it the active one
+ *
+ * @return 0 if successful, -1 if the parameters are invalid
+ */
+static int load_tone_config() {
+   std::shared_ptr<RASPITONE_CONFIG> config(new RASPITONE_CONFIG);
+   std::vector<double> curve, matrix;
+   double gamma;
+
+   if (!ros::param::get("~tone_gamma", gamma))
+      gamma = 1.0;
+   ros::param::get("~tone_curve", curve);
+   ros::param::get("~color_matrix", matrix);
+   if (!matrix.empty() && matrix.size() != 9) {
+      ROS_ERROR("color_matrix needs 9 values, got %d", (int)matrix.size());
+      return -1;
+   }
+   if (raspitone_build(config.get(), gamma, curve.empty() ? NULL : curve.data(),
+                       curve.size(), matrix.empty() ? NULL : matrix.data()) != 0) {
+      ROS_ERROR("Invalid tone_gamma, tone_curve or color_matrix");
+      return -1;
+   }
+   std::atomic_store(&tone_config, std::shared_ptr<const RASPITONE_CONFIG>(config));
+   return 0;
+}
+
+/**
+ * Y plane of a frame, the frame itself for mono frames and the plane
+ * filled by the luma stage for rgb frames
+ *
+ * @param frame Frame holding the plane
+ * @param stride Set to the bytes between two rows of the returned plane
+ *
+ * @return first byte of the Y plane
+ */
+static const uint8_t* frame_luma(const RASPISTAGES_FRAME& frame, int* stride) {
+   if (frame_format->is_luma) {
+      *stride = frame.image.step;
+      return &frame.image.data[0];
+   }
+   *stride = frame.image.width;
+   return &frame.luma[0];
+}
+
+/**
+ * Detect, describe and undistort the keypoints of a frame
+ *
+ * @param state Pointer to state control struct
+ * @param frame Frame to extract the keypoints from
+ */
+static void extract_features(RASPIVID_STATE* state, const RASPISTAGES_FRAME& frame) {
+   const sensor_msgs::Image& image = frame.image;
+   int y_stride;
+   const uint8_t* y = frame_luma(frame, &y_stride);
+   const int n = raspifeatures_detect(&features_state, y, y_stride,
+                                      state->features_descriptors ?
+                                      RASPIFEATURES_PATCH_BORDER : 3, keypoints);
+
+   features_msg.header = image.header;
+   features_msg.x.resize(n);
+   features_msg.y.resize(n);
+   features_msg.score.resize(n);
+   for (int i = 0; i < n; i++) {
+      features_msg.x[i] = keypoints[i].x;
+      features_msg.y[i] = keypoints[i].y;
+      features_msg.score[i] = keypoints[i].score;
+   }
+
+   // The calibration only holds for the resolution it was made at
+   if (c_info.K[0] != 0.0 && c_info.width == image.width &&
+       c_info.height == image.height) {
+      features_msg.undistorted_x.resize(n);
+      features_msg.undistorted_y.resize(n);
+      for (int i = 0; i < n; i++)
+         raspifeatures_undistort(&c_info.K[0], c_info.D.data(), c_info.D.size(),
+                                 &c_info.R[0], &c_info.P[0], keypoints[i].x,
+                                 keypoints[i].y, &features_msg.undistorted_x[i],
+                                 &features_msg.undistorted_y[i]);
+   } else {
+      features_msg.undistorted_x.clear();
+      features_msg.undistorted_y.clear();
+   }
+
+   if (state->features_descriptors) {
+      features_msg.descriptors.resize((size_t)n * RASPIFEATURES_DESCRIPTOR_SIZE);
+      raspifeatures_describe(&features_state, y, y_stride, keypoints,
+                             features_msg.descriptors.data());
+      features_msg.angle.resize(n);
+      for (int i = 0; i < n; i++)
+         features_msg.angle[i] = keypoints[i].angle;
+   }
+
+   features_pub.publish(features_msg);
+}
+
+/**
+ * Set up the blob tracker from the blob_colors and blob_ranges parameters
+ *
+ * @param state Pointer to state control struct
+ *
+ * @return 0 if successful, -1 if the parameters are invalid
+ */
+static int setup_blobs(RASPIVID_STATE* state) {
+   std::vector<std::string> colors;
+   std::vector<int> limits;
+   RASPIBLOBS_RANGE ranges[RASPIBLOBS_MAX_COLORS];
+
+   ros::param::get("~blob_colors", colors);
+   ros::param::get("~blob_ranges", limits);
+   if (colors.empty() || colors.size() > RASPIBLOBS_MAX_COLORS ||
+       limits.size() != 6 * colors.size()) {
+      ROS_ERROR("blob_colors needs 1 to %d names and blob_ranges 6 values "
+                "(y_min y_max u_min u_max v_min v_max) per name",
+                RASPIBLOBS_MAX_COLORS);
+      return -1;
+   }
+   for (size_t c = 0; c < colors.size(); c++) {
+      uint8_t* range = &ranges[c].y_min;
+      for (int i = 0; i < 6; i++) {
+         int value = limits[6 * c + i];
+         range[i] = (value < 0) ? 0 : (value > 255) ? 255 : value;
+      }
+   }
+   return raspiblobs_init(&blobs_state, state->width, state->height, ranges,
+                          colors.size(), state->blob_min_area);
+}
+
+/**
+ * Publish the blobs found by the tracker
+ */
+static void publish_blobs(const std_msgs::Header& header, int max_blobs) {
+   const int n = std::min((int)blobs.size(), max_blobs);
+
+   blobs_msg.header = header;
+   blobs_msg.color.resize(n);
+   blobs_msg.area.resize(n);
+   blobs_msg.x.resize(n);
+   blobs_msg.y.resize(n);
+   blobs_msg.x_min.resize(n);
+   blobs_msg.y_min.resize(n);
+   blobs_msg.x_max.resize(n);
+   blobs_msg.y_max.resize(n);
+   for (int i = 0; i < n; i++) {
+      blobs_msg.color[i] = blobs[i].color;
+      blobs_msg.area[i] = blobs[i].area;
+      blobs_msg.x[i] = blobs[i].x;
+      blobs_msg.y[i] = blobs[i].y;
+      blobs_msg.x_min[i] = blobs[i].x_min;
+      blobs_msg.y_min[i] = blobs[i].y_min;
+      blobs_msg.x_max[i] = blobs[i].x_max;
+      blobs_msg.y_max[i] = blobs[i].y_max;
+   }
+   blobs_pub.publish(blobs_msg);
+}
+
+/**
+ * Set up the line detector and the rows it samples from the line_rows parameter
+ *
+ * @param state Pointer to state control struct
+ *
+ * @return 0 if successful, -1 if the parameters are invalid
+ */
+static int setup_lines(RASPIVID_STATE* state) {
+   std::vector<double> rows;
+
+   if (!ros::param::get("~line_rows", rows)) {
+      rows.push_back(0.5);
+      rows.push_back(0.7);
+      rows.push_back(0.9);
+   }
+   lines_msg.row.clear();
+   for (size_t i = 0; i < rows.size(); i++) {
+      if (rows[i] < 0.0 || rows[i] > 1.0) {
+         ROS_ERROR("line_rows are fractions of the height, %f is out of range", rows[i]);
+         return -1;
+      }
+      lines_msg.row.push_back((int)(rows[i] * (state->height - 1) + 0.5));
+   }
+   lines_msg.found.resize(rows.size());
+   lines_msg.position.resize(rows.size());
+   lines_msg.width.resize(rows.size());
+   return raspilines_init(&lines_state, state->width, state->line_dark,
+                          state->line_min_contrast, state->line_min_width,
+                          state->line_max_width);
+}
+
+/**
+ * Scan the configured rows of a frame into the frame, on the camera callback
+ *
+ * The hits are sized on the first use of a pooled frame and kept after.
+ */
+static void scan_lines(RASPISTAGES_FRAME* frame) {
+   const sensor_msgs::Image& image = frame->image;
+   const int bpp = image.step / image.width;
+   const size_t rows = lines_msg.row.size();
+
+   frame->line_hits.resize(rows);
+   for (size_t i = 0; i < rows; i++)
+      raspilines_scan_row(&lines_state,
+                          &image.data[(size_t)lines_msg.row[i] * image.step],
+                          bpp, &frame->line_hits[i]);
+   frame->line_angle_valid = raspilines_angle(lines_msg.row.data(),
+                                              frame->line_hits.data(), rows,
+                                              &frame->line_angle) == 0;
+   frame->contents |= RASPISTAGES_LINES;
+}
+
+/**
+ * Stage publishing the line positions the camera callback scanned
+ */
+static void stage_lines(const RASPISTAGES_FRAME_PTR& frame, void* userdata) {
+   for (size_t i = 0; i < frame->line_hits.size(); i++) {
+      lines_msg.found[i] = frame->line_hits[i].found;
+      lines_msg.position[i] = frame->line_hits[i].position;
+      lines_msg.width[i] = frame->line_hits[i].width;
+   }
+   lines_msg.angle_valid = frame->line_angle_valid;
+   lines_msg.angle = frame->line_angle;
+   lines_msg.header = frame->image.header;
+   lines_pub.publish(lines_msg);
+}
+
+/**
+ * Stage averaging flat-field frames when a calibration is requested and
+ * correcting the lens shading
+ */
+static void stage_shading(const RASPISTAGES_FRAME_PTR& frame, void* userdata) {
+   RASPIVID_STATE* state = (RASPIVID_STATE*)userdata;
+   sensor_msgs::Image& image = frame->image;
+
+   if (shading_calib_request > 0) {
+      if (!shading_calib.sums &&
+          raspishading_calib_init(&shading_calib, image.width, image.height,
+                                  image.step / image.width,
+                                  state->shading_grid_width,
+                                  state->shading_grid_height) != 0) {
+         ROS_ERROR("Unable to start the shading calibration");
+         shading_calib_request = 0;
+      } else {
+         raspishading_calib_add(&shading_calib, &image.data[0], image.step);
+         if (shading_calib.frames >= shading_calib_request)
+            finish_shading_calibration();
+      }
+   }
+   if (shading_lut.lut)
+      raspishading_apply(&shading_lut, &image.data[0], image.step);
+}
+
+/**
+ * Stage filtering the frame against the previous ones
+ */
+static void stage_denoise(const RASPISTAGES_FRAME_PTR& frame, void* userdata) {
+   raspidenoise_apply(&denoise_state, &frame->image.data[0], frame->image.step);
+}
+
+/**
+ * Stage applying the tone curve and colour matrix
+ */
+static void stage_tone(const RASPISTAGES_FRAME_PTR& frame, void* userdata) {
+   sensor_msgs::Image& image = frame->image;
+   std::shared_ptr<const RASPITONE_CONFIG> tone = std::atomic_load(&tone_config);
+
+   if (tone)
+      raspitone_apply(tone.get(), &image.data[0], image.width, image.height,
+                      image.step, image.step / image.width);
+}
+
+/**
+ * Stage computing the Y plane of an rgb frame for the stages below it
+ */
+static void stage_luma(const RASPISTAGES_FRAME_PTR& frame, void* userdata) {
+   const sensor_msgs::Image& image = frame->image;
+
+   frame->luma.resize((size_t)image.width * image.height);
+   raspiluma_from_rgb(&image.data[0], image.width, image.height, image.step,
+                      &frame->luma[0], image.width);
+   frame->contents |= RASPISTAGES_METADATA;
+}
+
+/**
+ * Stage tracking blobs, on the camera's own chroma when the frame has it
+ */
+static void stage_blobs(const RASPISTAGES_FRAME_PTR& frame, void* userdata) {
+   RASPIVID_STATE* state = (RASPIVID_STATE*)userdata;
+   const sensor_msgs::Image& image = frame->image;
+
+   if (blobs_pub.getNumSubscribers() == 0)
+      return;
+   if (frame_format->has_chroma) {
+      const int uv_stride = image.width / 2;
+      const uint8_t* u = frame->chroma.data();
+      if (frame->chroma.empty())
+         return;
+      raspiblobs_classify_i420(&blobs_state, &image.data[0], image.step, u,
+                               u + (size_t)uv_stride * (image.height / 2), uv_stride);
+   } else {
+      raspiblobs_classify_rgb(&blobs_state, &image.data[0], image.step);
+   }
+   raspiblobs_find(&blobs_state, blobs);
+   publish_blobs(image.header, state->blob_max);
+}
+
+static void stage_delta(const RASPISTAGES_FRAME_PTR& frame, void* userdata) {
+   const sensor_msgs::Image& image = frame->image;
+
+   // A new subscriber has nothing to apply deltas to, start it on a full frame
+   unsigned int subscribers = delta_pub.getNumSubscribers();
+   if (subscribers > delta_subscribers)
+      delta_state.force_refresh = 1;
+   delta_subscribers = subscribers;
+   if (subscribers > 0) {
+      int keyframe;
+      raspitiledelta_encode(&delta_state, &image.data[0], image.step,
+                            delta_msg.tile_indices, delta_msg.data, &keyframe);
+      delta_msg.header = image.header;
+      delta_msg.sequence = delta_sequence++;
+      delta_msg.height = image.height;
+      delta_msg.width = image.width;
+      delta_msg.encoding = image.encoding;
+      delta_msg.tile_size = delta_state.tile_size;
+      delta_msg.keyframe = keyframe;
+      delta_pub.publish(delta_msg);
+   }
+}
+
+static void stage_pyramid(const RASPISTAGES_FRAME_PTR& frame, void* userdata) {
+   int y_stride;
+
+   if (pyramid_pub.getNumSubscribers() == 0)
+      return;
+   const uint8_t* y = frame_luma(*frame, &y_stride);
+   pyramid_msg.data.resize(pyramid_layout.size);
+   raspipyramid_build(&pyramid_layout, y, y_stride, &pyramid_msg.data[0]);
+   pyramid_msg.header = frame->image.header;
+   pyramid_pub.publish(pyramid_msg);
+}
+
+static void stage_features(const RASPISTAGES_FRAME_PTR& frame, void* userdata) {
+   if (features_pub.getNumSubscribers() > 0)
+      extract_features((RASPIVID_STATE*)userdata, *frame);
+}
+
+/** Region of a raw frame, published as a sensor_msgs/Image
+ *
+ * ROS messages own their data, so a crop would be a copy of its rows into
+ * a new Image and another into the outgoing buffer. This type serialises
+ * as an Image straight from the rows of the shared frame, leaving the copy
+ * into the outgoing buffer as the only one: a single memcpy when the region
+ * spans whole rows, one per row otherwise.
+ */
+typedef struct {
+   const sensor_msgs::Image* frame;
+   RASPIROI_RECT crop;         /// Clamped to the frame
+} ROI_IMAGE;
+
+namespace ros {
+namespace message_traits {
+template<> struct MD5Sum<ROI_IMAGE> {
+   static const char* value() { return MD5Sum<sensor_msgs::Image>::value(); }
+   static const char* value(const ROI_IMAGE&) { return value(); }
+};
+template<> struct DataType<ROI_IMAGE> {
+   static const char* value() { return DataType<sensor_msgs::Image>::value(); }
+   static const char* value(const ROI_IMAGE&) { return value(); }
+};
+template<> struct Definition<ROI_IMAGE> {
+   static const char* value() { return Definition<sensor_msgs::Image>::value(); }
+   static const char* value(const ROI_IMAGE&) { return value(); }
+};
+} // namespace message_traits
+
+namespace serialization {
+template<> struct Serializer<ROI_IMAGE> {
+   template<typename Stream> inline static void write(Stream& stream, const ROI_IMAGE& roi) {
+      const sensor_msgs::Image& frame = *roi.frame;
+      const uint32_t row = roi.crop.width * (frame.step / frame.width);
+      const uint8_t* src = &frame.data[(size_t)roi.crop.y * frame.step +
+                                       (size_t)roi.crop.x * (frame.step / frame.width)];
+
+      stream.next(frame.header);
+      stream.next((uint32_t)roi.crop.height);
+      stream.next((uint32_t)roi.crop.width);
+      stream.next(frame.encoding);
+      stream.next(frame.is_bigendian);
+      stream.next(row);
+      stream.next((uint32_t)(row * roi.crop.height));
+      uint8_t* dst = stream.advance(row * roi.crop.height);
+      if (row == frame.step) {
+         memcpy(dst, src, (size_t)row * roi.crop.height);
+      } else {
+         for (int y = 0; y < roi.crop.height; y++, src += frame.step, dst += row)
+            memcpy(dst, src, row);
+      }
+   }
+
+   inline static uint32_t serializedLength(const ROI_IMAGE& roi) {
+      const sensor_msgs::Image& frame = *roi.frame;
+      return serializationLength(frame.header) + 4 + 4 +
+             serializationLength(frame.encoding) + 1 + 4 + 4 +
+             roi.crop.width * (frame.step / frame.width) * roi.crop.height;
+   }
+};
+} // namespace serialization
+} // namespace ros
+
+/**
+ * Stage publishing the regions of interest with subscribers
+ */
+static void stage_roi(const RASPISTAGES_FRAME_PTR& frame, void* userdata) {
+   const sensor_msgs::Image& image = frame->image;
+   ROI_IMAGE roi;
+
+   roi.frame = &image;
+   for (size_t i = 0; i < roi_pubs.size(); i++) {
+      RASPIROI_RECT rect;
+
+      if (roi_pubs[i].getNumSubscribers() == 0)
+         continue;
+      raspiroi_get(&rois, i, &rect);
+      if (raspiroi_clamp(&rect, capture_divider, image.width, image.height, &roi.crop) == 0)
+         roi_pubs[i].publish(roi);
+   }
+}
+
+/**
+ * Count the capture to publication latency of a frame during a soak
+ */
+static void soak_record(const RASPISTAGES_FRAME_PTR& frame) {
+   if (state_srv.soak_minutes > 0.0)
+      raspilatency_add(&publish_latency, raspistages_now_us() - frame->captured_us);
+}
+
+/**
+ * Stage scoring the sharpness and publishing the raw frames the gate lets through
+ */
+static void stage_publish(const RASPISTAGES_FRAME_PTR& frame, void* userdata) {
+   RASPIVID_STATE* state = (RASPIVID_STATE*)userdata;
+   const sensor_msgs::Image& image = frame->image;
+   int decision = RASPISHARPNESS_KEEP | RASPISHARPNESS_RELEASE;
+
+   if (state->sharpness) {
+      sharpness_msg.header = image.header;
+      sharpness_msg.score = raspisharpness_score(&image.data[0], image.width,
+                                                 image.height, image.step,
+                                                 image.step / image.width,
+                                                 state->sharpness_row_step);
+      sharpness_pub.publish(sharpness_msg);
+      decision = raspisharpness_gate(&sharpness_gate, sharpness_msg.score);
+   }
+   if (decision == (RASPISHARPNESS_KEEP | RASPISHARPNESS_RELEASE)) {
+      publish_raw(image);
+      soak_record(frame);
+   } else {
+      // The frame is shared, holding on to it costs no copy
+      if (decision & RASPISHARPNESS_KEEP)
+         held_frame = frame;
+      // The held frame may have aged past the deadline while the gate waited
+      if ((decision & RASPISHARPNESS_RELEASE) && held_frame &&
+          raspistages_fresh(&stages, publish_stage, held_frame)) {
+         publish_raw(held_frame->image);
+         soak_record(held_frame);
+      }
+   }
+}
+
+/**
+ * Message of the compressed stage no publisher holds any more, a new one if
+ * they are all still queued
+ *
+ * Only the compressed stage takes messages from the pool, so one it holds
+ * alone stays that way.
+ */
+static sensor_msgs::CompressedImagePtr acquire_compressed() {
+   for (size_t i = 0; i < compressed_pool.size(); i++) {
+      if (compressed_pool[i].unique()) {
+         // Pairs with the release of the last reference by roscpp
+         std::atomic_thread_fence(std::memory_order_acquire);
+         return compressed_pool[i];
+      }
+   }
+   sensor_msgs::CompressedImagePtr msg = boost::make_shared<sensor_msgs::CompressedImage>();
+   if (compressed_pool.size() < COMPRESSED_POOL_SIZE)
+      compressed_pool.push_back(msg);
+   return msg;
+}
+
+/**
+ * Copy an encoded frame into a pooled message, keeping its storage
+ */
+static sensor_msgs::CompressedImagePtr compressed_message(const RASPISTAGES_FRAME& frame) {
+   sensor_msgs::CompressedImagePtr msg = acquire_compressed();
+
+   msg->header = frame.image.header;
+   msg->format = compressed_msg.format;
+   msg->data.assign(frame.encoded.begin(), frame.encoded.end());
+   return msg;
+}
+
+/**
+ * Stage publishing the encoder output on camera/mjpeg, and to every client
+ * of the per-client stream at the rate its link keeps up with
+ *
+ * The frame is copied once into a message shared by all the topics. roscpp
+ * serialises it once per topic with subscribers, however many subscribers
+ * the topic has, and hands it over without serialising to the subscribers
+ * in the same process.
+ */
+static void stage_compressed(const RASPISTAGES_FRAME_PTR& frame, void* userdata) {
+   RASPIVID_STATE* state = (RASPIVID_STATE*)userdata;
+   const int64_t now = raspistages_now_us();
+   const int64_t timeout = state->compressed_client_timeout * 1000000;
+   sensor_msgs::CompressedImagePtr msg;
+
+   if (compressed_pub.getNumSubscribers() > 0) {
+      msg = compressed_message(*frame);
+      compressed_pub.publish(msg);
+   }
+
+   std::lock_guard<std::mutex> lock(compressed_clients_lock);
+   std::map<std::string, COMPRESSED_CLIENT>::iterator it = compressed_clients.begin();
+   while (it != compressed_clients.end()) {
+      COMPRESSED_CLIENT& client = it->second;
+      if (now - client.rate.last_ack_us > timeout) {
+         ROS_INFO("Compressed client %s stopped acknowledging, dropped", it->first.c_str());
+         compressed_clients.erase(it++);
+         continue;
+      }
+      const int tier = client.rate.tier;
+      if (raspirate_offer(&client.rate, frame->image.header.seq,
+                          state->compressed_max_backlog,
+                          state->compressed_upgrade_frames)) {
+         if (!msg)
+            msg = compressed_message(*frame);
+         client.pub.publish(msg);
+      }
+      if (client.rate.tier != tier)
+         ROS_INFO("Compressed client %s now gets 1 frame in %d", it->first.c_str(),
+                  1 << client.rate.tier);
+      ++it;
+   }
+   soak_record(frame);
+}
+
+/**
+ * Stage sending the encoder output to udp_address, fragmented to the MTU
+ *
+ * The datagrams of a frame are sent in one go, a link slower than the
+ * camera drops frames from this stage's queue and delays no other output.
+ */
+static void stage_udp(const RASPISTAGES_FRAME_PTR& frame, void* userdata) {
+   const std_msgs::Header& header = frame->image.header;
+
+   if (frame->encoded.empty())
+      return;
+   if (raspiudp_send(&udp_sender, header.seq, header.stamp.toNSec(), &frame->encoded[0],
+                     frame->encoded.size()) != 0)
+      ROS_WARN_THROTTLE(10, "Unable to send frame %u to %s:%d (%s)", header.seq,
+                        udp_address.c_str(), state_srv.udp_port, strerror(errno));
+}
+
+/**
+ * Acknowledgement from a client of the per-client compressed stream, the
+ * first one from a client sets up its camera/mjpeg/<client> topic
+ */
+static void compressed_ack(const raspicam::CompressedAck::ConstPtr& ack) {
+   const int64_t now = raspistages_now_us();
+   std::lock_guard<std::mutex> lock(compressed_clients_lock);
+   std::map<std::string, COMPRESSED_CLIENT>::iterator it =
+      compressed_clients.find(ack->client);
+
+   if (it != compressed_clients.end()) {
+      raspirate_ack(&it->second.rate, ack->seq, now);
+      return;
+   }
+   // The name becomes part of a topic name
+   int valid = !ack->client.empty() && isalpha(ack->client[0]);
+   for (size_t i = 0; i < ack->client.size(); i++)
+      valid = valid && (isalnum(ack->client[i]) || ack->client[i] == '_');
+   if (!valid) {
+      ROS_WARN("Ignoring compressed client \"%s\", names are letters, digits and _",
+               ack->client.c_str());
+      return;
+   }
+   ros::NodeHandle n;
+   COMPRESSED_CLIENT& client = compressed_clients[ack->client];
+   client.pub = n.advertise<sensor_msgs::CompressedImage>("camera/mjpeg/" + ack->client, 1);
+   raspirate_init(&client.rate, now);
+   ROS_INFO("Compressed client %s set up on camera/mjpeg/%s", ack->client.c_str(),
+            ack->client.c_str());
+}
 
+/**
+ * Add a stage of the node to the graph, pinned to the core given for it in
+ * the stage_cpus parameter
+ *
+ * @return index of the stage, -1 if it could not be added
+ */
+static int add_stage(RASPIVID_STATE* state, const std::map<std::string, int>& cpus,
+                     const char* name, int parent, int inputs, int outputs,
+                     RASPISTAGES_PROCESS process, int capacity) {
+   std::map<std::string, int>::const_iterator cpu = cpus.find(name);
+   int index = raspistages_add(&stages, name, parent, inputs, outputs, process, state,
+                               capacity, RASPISTAGES_DROP_OLDEST,
+                               (cpu == cpus.end()) ? -1 : cpu->second);
+   if (index < 0)
+      ROS_ERROR("Unable to add the %s stage", name);
+   return index;
+}
 
 /**
- * Assign a default set of parameters to the state passed in
+ * Build the stage graph for the enabled outputs
  *
- * @param state Pointer to state structure to assign defaults to
+ * Frames go through the stages changing them one after the other, then fan
+ * out to the stages that only read them.
+ *
+ * @param state Pointer to state control struct
+ *
+ * @return 0 if successful, -1 if a stage could not be added
  */
-static void get_status(RASPIVID_STATE* state) {
-   int temp;
-   std::string str;
-   if (!state) {
-      vcos_assert(0);
-      return;
+static int setup_stages(RASPIVID_STATE* state) {
+   const int q = state->stage_queue_size;
+   std::map<std::string, int> cpus;
+   int tail = -1, ok = 1;
+
+   ros::param::get("~stage_cpus", cpus);
+   raspistages_init(&stages);
+
+   // The stages correcting the frame in turn, the readers hang off the last
+   // one or off the callback when there are none. A calibration requested
+   // with shading off restarts the capture to add the shading stage.
+   if (state->shading || shading_calib_request > 0)
+      ok = (tail = add_stage(state, cpus, "shading", tail, RASPISTAGES_RAW,
+                             RASPISTAGES_RAW, stage_shading, q)) >= 0;
+   if (ok && denoise_state.previous)
+      ok = (tail = add_stage(state, cpus, "denoise", tail, RASPISTAGES_RAW,
+                             RASPISTAGES_RAW, stage_denoise, q)) >= 0;
+   if (ok && state->tone)
+      ok = (tail = add_stage(state, cpus, "tone", tail, RASPISTAGES_RAW, RASPISTAGES_RAW,
+                             stage_tone, q)) >= 0;
+   if (ok && !frame_format->is_luma && (state->pyramid || state->features))
+      ok = (tail = add_stage(state, cpus, "luma", tail, RASPISTAGES_RAW,
+                             RASPISTAGES_METADATA, stage_luma, q)) >= 0;
+   if (!ok)
+      return -1;
+   if (state->compressed)
+      ok &= add_stage(state, cpus, "compressed", -1, RASPISTAGES_ENCODED, 0,
+                      stage_compressed, q) >= 0;
+   if (udp_open)
+      ok &= add_stage(state, cpus, "udp", -1, RASPISTAGES_ENCODED, 0, stage_udp, q) >= 0;
+   // Only reads what the callback scanned, never the pixels the correction
+   // stages write, and only the freshest frame matters to line following
+   if (state->lines)
+      ok &= add_stage(state, cpus, "lines", -1, RASPISTAGES_LINES, 0, stage_lines, 1) >= 0;
+
+   const int luma = frame_format->is_luma ? 0 : RASPISTAGES_METADATA;
+   if (state->blobs)
+      ok &= add_stage(state, cpus, "blobs", tail, RASPISTAGES_RAW, 0, stage_blobs, q) >= 0;
+   publish_stage = add_stage(state, cpus, "publish", tail, RASPISTAGES_RAW, 0,
+                             stage_publish, q);
+   ok &= publish_stage >= 0;
+   if (delta_state.reference)
+      ok &= add_stage(state, cpus, "delta", tail, RASPISTAGES_RAW, 0, stage_delta, q) >= 0;
+   if (!roi_pubs.empty())
+      ok &= add_stage(state, cpus, "roi", tail, RASPISTAGES_RAW, 0, stage_roi, q) >= 0;
+   if (state->pyramid)
+      ok &= add_stage(state, cpus, "pyramid", tail, RASPISTAGES_RAW | luma, 0,
+                      stage_pyramid, q) >= 0;
+   if (state->features)
+      ok &= add_stage(state, cpus, "features", tail, RASPISTAGES_RAW | luma, 0,
+                      stage_features, q) >= 0;
+
+   if (!ok)
+      return -1;
+
+   // Deadlines, in seconds from capture, by stage name
+   std::map<std::string, double> max_age;
+   ros::param::get("~max_age", max_age);
+   for (std::map<std::string, double>::iterator it = max_age.begin();
+        it != max_age.end(); ++it) {
+      const int stage = raspistages_find(&stages, it->first.c_str());
+      if (stage < 0)
+         ROS_WARN("max_age given for %s, which is not a running stage", it->first.c_str());
+      else if (it->second > 0.0)
+         raspistages_set_max_age(&stages, stage, it->second * 1000000);
    }
+   return 0;
+}
 
-   // Default everything to zero
-   memset(state, 0, sizeof(RASPIVID_STATE));
+/**
+ * Apply the frame rate and stage knobs, the resolution is applied by init_cam
+ *
+ * @param state Pointer to state control struct
+ */
+static void apply_knobs(RASPIVID_STATE* state) {
+   if (knobs.fps > 0 && knobs.fps < state->framerate)
+      frame_divider = (state->framerate + knobs.fps - 1) / knobs.fps;
+   else
+      frame_divider = 1;
+   for (int i = 0; i < stages.num_stages; i++)
+      raspistages_enable(&stages, i, !raspiladder_skips(&knobs, stages.stages[i].name));
+   lines_skipped = raspiladder_skips(&knobs, "lines");
+}
 
-   if (ros::param::get("~width", temp )) {
-      if (temp > 0 && temp <= 1920)
-         state->width = temp;
-      else  state->width = 640;
-   } else {
-      state->width = 640;
-      ros::param::set("~width", 640);
-   }
+/**
+ * Publish the levels of the ladders and the resulting knobs
+ */
+static void publish_degradation() {
+   degradation_msg.header.stamp = ros::Time::now();
+   degradation_msg.thermal_level = thermal_state.level;
+   degradation_msg.cpu_level = governor.level;
+   degradation_msg.fps = knobs.fps;
+   degradation_msg.resolution_divider = knobs.resolution_divider;
+   degradation_msg.skipped_stages = knobs.skipped_stages;
+   degradation_pub.publish(degradation_msg);
+}
 
-   if (ros::param::get("~height", temp )) {
-      if (temp > 0 && temp <= 1080)
-         state->height = temp;
-      else  state->height = 480;
+/**
+ * Merge the levels of the degradation ladders into the knobs and apply them
+ */
+static void update_knobs() {
+   RASPILADDER_KNOBS next;
+
+   raspiladder_reset(&next);
+   raspiladder_apply(thermal_ladder, thermal_state.level, &next);
+   raspiladder_apply(cpu_ladder, governor.level, &next);
+   const int restart = next.resolution_divider != knobs.resolution_divider;
+   knobs = next;
+   ROS_INFO("Degradation: %s", raspiladder_describe(&knobs).c_str());
+   publish_degradation();
+   if (restart && state_srv.isInit) {
+      // The resolution only changes with the capture stopped
+      close_cam(&state_srv);
+      if (init_cam(&state_srv) == 0)
+         start_capture(&state_srv);
+      else
+         ROS_WARN("Unable to restart the capture at the new resolution, left to the watchdog");
    } else {
-      state->height = 480;
-      ros::param::set("~height", 480);
+      apply_knobs(&state_srv);
    }
+}
 
-   if (ros::param::get("~quality", temp )) {
-      if (temp > 0 && temp <= 100)
-         state->quality = temp;
-      else  state->quality = 70;
-   } else {
-      state->quality = 70;
-      ros::param::set("~quality", 70);
+/**
+ * Read the thermal_ladder parameter and start at its top
+ *
+ * @param state Pointer to state control struct
+ *
+ * @return 0 if successful, -1 if the ladder is invalid
+ */
+static int setup_thermal(RASPIVID_STATE* state) {
+   std::vector<std::string> specs;
+
+   if (!ros::param::get("~thermal_ladder", specs)) {
+      specs.push_back("stage features");
+      specs.push_back("stage pyramid");
+      specs.push_back("fps 15");
+      specs.push_back("resolution 2");
+      specs.push_back("fps 5");
    }
-
-   if (ros::param::get("~framerate", temp )) {
-      if (temp > 0 && temp <= 90)
-         state->framerate = temp;
-      else  state->framerate = 30;
-   } else {
-      state->framerate = 30;
-      ros::param::set("~framerate", 30);
+   if (raspiladder_parse(specs, thermal_ladder) != 0) {
+      ROS_ERROR("thermal_ladder steps are \"fps N\", \"stage NAME\" or \"resolution N\"");
+      return -1;
    }
+   raspithermal_init(&thermal_state, state->thermal_high, state->thermal_low,
+                     thermal_ladder.size());
+   return 0;
+}
 
-   if (ros::param::get("~monochrome", temp )) {
-      state->monochrome = (temp > 0) ? 1 : 0;
-   } else {
-      state->monochrome = 0 ;
+/**
+ * Check the SoC temperature and throttle flags and move along the thermal ladder
+ */
+static void thermal_check(const ros::TimerEvent& event) {
+   const int level = thermal_state.level;
+   unsigned int flags = 0;
+   double celsius;
+
+   if (!throttle_path.empty() &&
+       raspithermal_read_throttled(throttle_path.c_str(), &flags) != 0) {
+      ROS_WARN_ONCE("Unable to read the throttle flags from %s", throttle_path.c_str());
+      flags = 0;
+   }
+   if (raspithermal_read_temperature(thermal_path.c_str(), &celsius) != 0) {
+      ROS_WARN_ONCE("Unable to read the temperature from %s", thermal_path.c_str());
+      if (!(flags & RASPITHERMAL_ACTIVE))
+         return;
+      // Only the flags to go by, hold the level unless they are set
+      celsius = thermal_state.low;
    }
+   degradation_msg.temperature = celsius;
+   degradation_msg.throttled = flags;
+   if (raspithermal_update(&thermal_state, celsius, flags) != level) {
+      ROS_WARN("SoC at %.1f C, throttle flags 0x%x, thermal level %d of %d",
+               celsius, flags, thermal_state.level, thermal_state.levels);
+      update_knobs();
+   }
+}
 
-   if (ros::param::get("~bitrate", temp )) {
-      if (temp > 25000000) temp = 25000000;
-      state->bitrate = temp ;
-   } else {
-      state->bitrate = 25000000 ;
+/**
+ * Read the cpu_ladder parameter and start the governor at its top
+ *
+ * @param state Pointer to state control struct
+ *
+ * @return 0 if successful, -1 if the ladder is invalid
+ */
+static int setup_governor(RASPIVID_STATE* state) {
+   std::vector<std::string> specs;
+
+   if (!ros::param::get("~cpu_ladder", specs)) {
+      specs.push_back("stage features");
+      specs.push_back("stage pyramid");
+      specs.push_back("stage blobs");
+      specs.push_back("fps 15");
+      specs.push_back("resolution 2");
+   }
+   if (raspiladder_parse(specs, cpu_ladder) != 0) {
+      ROS_ERROR("cpu_ladder steps are \"fps N\", \"stage NAME\" or \"resolution N\"");
+      return -1;
    }
+   raspigovernor_init(&governor, state->cpu_budget, cpu_ladder.size());
+   return 0;
+}
 
-   if (ros::param::get("~hflip", temp )) {
-      temp = (temp > 0) ? 1 : 0;
-      state->hflip = temp ;
-   } else {
-      state->hflip = 0 ;
+/**
+ * Measure the CPU used by the node since the previous check and move along
+ * the CPU ladder
+ */
+static void governor_check(const ros::TimerEvent& event) {
+   const int level = governor.level;
+
+   raspigovernor_update(&governor, raspigovernor_cpu_us(), raspistages_now_us());
+   degradation_msg.cpu_percent = governor.usage;
+   if (governor.level != level) {
+      ROS_WARN("Node at %.0f%% of a core for a budget of %.0f%%, cpu level %d of %d",
+               governor.usage, governor.budget, governor.level, governor.levels);
+      update_knobs();
    }
+}
 
-   if (ros::param::get("~vflip", temp )) {
-      temp = (temp > 0) ? 1 : 0;
-      state->vflip = temp ;
-   } else {
-      state->vflip = 0 ;
+/**
+ * Publish the counters of every stage since the previous call
+ */
+static void publish_stage_stats(const ros::TimerEvent& event) {
+   const int n = stages.num_stages;
+   RASPISTAGES_STATS stats;
+
+   stages_msg.header.stamp = ros::Time::now();
+   stages_msg.name.resize(n);
+   stages_msg.processed.resize(n);
+   stages_msg.dropped.resize(n);
+   stages_msg.stale.resize(n);
+   stages_msg.queued.resize(n);
+   stages_msg.mean_ms.resize(n);
+   stages_msg.max_ms.resize(n);
+   stages_msg.latency_ms.resize(n);
+   for (int i = 0; i < n; i++) {
+      raspistages_stats(&stages, i, &stats, 1);
+      stages_msg.name[i] = stages.stages[i].name;
+      stages_msg.processed[i] = stats.processed;
+      stages_msg.dropped[i] = stats.dropped;
+      stages_msg.stale[i] = stats.stale;
+      stages_msg.queued[i] = stats.queued;
+      stages_msg.mean_ms[i] = stats.processed ? stats.busy_us / 1000.0f / stats.processed : 0.0f;
+      stages_msg.max_ms[i] = stats.max_us / 1000.0f;
+      stages_msg.latency_ms[i] = stats.processed ?
+                                 stats.latency_us / 1000.0f / stats.processed : 0.0f;
+      soak_dropped += stats.dropped + stats.stale;
    }
+   if (stages_pub.getNumSubscribers() > 0)
+      stages_pub.publish(stages_msg);
+}
 
-   if (ros::param::get("~tf_prefix",  str)) {
-      tf_prefix = str;
+/**
+ * Write the soak report and stop the node
+ */
+static void soak_finish() {
+   RASPISOAK_RESULT result;
+
+   raspisoak_evaluate(soak_samples, &soak_latency, &state_srv.soak_limits, &result);
+   if (raspisoak_report(soak_report.c_str(), soak_samples, &state_srv.soak_limits,
+                        &result) != 0)
+      ROS_ERROR("Unable to write the soak report to %s", soak_report.c_str());
+   if (result.failed) {
+      ROS_ERROR("Soak failed: rss +%.0f kB/hour, %.2f%% dropped, p99 %.1f ms growing x%.2f, "
+                "%u pool overflows, see %s", result.rss_growth_kb, result.drop_percent,
+                result.p99_ms, result.p99_growth, result.pool_overflows,
+                soak_report.c_str());
    } else {
-      tf_prefix = "";
-      ros::param::set("~tf_prefix", "");
+      ROS_INFO("Soak passed, see %s", soak_report.c_str());
    }
+   soak_failed = result.failed;
+   ros::shutdown();
+}
 
-   state->isInit = 0;
-
-   // Setup preview window defaults
-   //raspipreview_set_defaults(&state->preview_parameters);
+/**
+ * Sample memory, pools, drops and latency for the soak, and end it once
+ * it has run for soak_minutes
+ */
+static void soak_sample(const ros::TimerEvent& event) {
+   RASPISOAK_SAMPLE sample;
+   RASPILATENCY_SNAPSHOT period;
+   int kept, in_use;
+   uint32_t raw_overflows, encoded_overflows;
+
+   memset(&sample, 0, sizeof(sample));
+   sample.minutes = (raspistages_now_us() - soak_start_us) / 60000000.0;
+   if (raspisoak_read_rss("/proc/self/status", &sample.rss_kb) != 0)
+      ROS_WARN_ONCE("Unable to read the resident memory from /proc/self/status");
+   raspistages_pool_stats(&raw_frames, &kept, &in_use, &raw_overflows);
+   sample.pool_kept = kept;
+   sample.pool_in_use = in_use;
+   raspistages_pool_stats(&encoded_frames, &kept, &in_use, &encoded_overflows);
+   sample.pool_kept += kept;
+   sample.pool_in_use += in_use;
+   // The pools start counting again when the capture restarts
+   const uint32_t overflows = raw_overflows + encoded_overflows;
+   soak_overflows += (overflows >= pool_overflows_seen) ?
+                     overflows - pool_overflows_seen : overflows;
+   pool_overflows_seen = overflows;
+   sample.pool_overflows = soak_overflows;
+
+   raspilatency_take(&publish_latency, &period);
+   raspilatency_merge(&soak_latency, &period);
+   sample.published = period.total;
+   sample.dropped = soak_dropped;
+   soak_dropped = 0;
+   sample.p50_us = raspilatency_percentile(&period, 50.0);
+   sample.p99_us = raspilatency_percentile(&period, 99.0);
+   sample.p999_us = raspilatency_percentile(&period, 99.9);
+   soak_samples.push_back(sample);
+
+   ROS_INFO("Soak at %.1f min: rss %ld kB, %d of %d pooled frames in use, %u published, "
+            "%u dropped, latency p50 %.1f p99 %.1f p99.9 %.1f ms", sample.minutes,
+            sample.rss_kb, sample.pool_in_use, sample.pool_kept, sample.published,
+            sample.dropped, sample.p50_us / 1000.0, sample.p99_us / 1000.0,
+            sample.p999_us / 1000.0);
+   // Within half a period of the end counts as the end
+   if (sample.minutes + state_srv.soak_period / 120.0 >= state_srv.soak_minutes)
+      soak_finish();
+}
 
-   // Set up the camera_parameters to default
-   raspicamcontrol_set_defaults(&state->camera_parameters);
-   //set some of the parameters defined by the user
-   state->camera_parameters.hflip = state->hflip;
-   state->camera_parameters.vflip = state->vflip;
+#if defined(RASPI_COUNT_ALLOCATIONS)
+/**
+ * Report the heap allocations a frame callback made once past warm-up
+ *
+ * The warm-up starts again with every pipeline build, which sets up new
+ * pools, while the frame numbers carry on.
+ *
+ * @param callback Name of the callback
+ * @param pData Userdata of the callback
+ * @param allocations Allocations made for the frame
+ */
+static void check_allocations(const char* callback, const PORT_USERDATA* pData,
+                              uint32_t allocations) {
+   if (pData->frame - pData->first_frame < ALLOCATION_WARMUP_FRAMES || allocations == 0)
+      return;
+   steady_allocations += allocations;
+   ROS_ERROR_THROTTLE(1.0, "%u heap allocations on the %s callback for frame %d",
+                      allocations, callback, pData->frame);
 }
+#endif
+
+/**
+ * Monotonic time a buffer was captured, from its timestamp on the STC
+ *
+ * @return -1 if the buffer has no timestamp or the STC cannot be read
+ */
+static int64_t capture_time_us(MMAL_PORT_T* port, const MMAL_BUFFER_HEADER_T* buffer) {
+   uint64_t stc;
 
+   if (buffer->pts == MMAL_TIME_UNKNOWN ||
+       mmal_port_parameter_get_uint64(port, MMAL_PARAMETER_SYSTEM_TIME, &stc) !=
+       MMAL_SUCCESS)
+      return -1;
+   return raspistages_now_us() - ((int64_t)stc - buffer->pts);
+}
 
 /**
  *  buffer header callback function for encoder
@@ -273,15 +1917,22 @@ static void encoder_buffer_callback(MMAL_PORT_T* port,
 
    PORT_USERDATA* pData = (PORT_USERDATA*)port->userdata;
    if (pData && pData->pstate->isInit) {
+#if defined(RASPI_COUNT_ALLOCATIONS)
+      const uint32_t allocations = raspiallocs_count();
+#endif
       int bytes_written = buffer->length;
-      if (buffer->length) {
+      if (buffer->length && (pData->pstate->compressed || udp_open)) {
+         if (!encoded_frame) {
+            encoded_frame = raspistages_acquire(&encoded_frames);
+            // Reserved on the first use of a pooled frame, the fragments
+            // are then appended without reallocating
+            if (encoded_frame->encoded.capacity() < encoded_frame_bytes)
+               encoded_frame->encoded.reserve(encoded_frame_bytes);
+            encoded_frame->encoded.clear();
+         }
          mmal_buffer_header_mem_lock(buffer);
-         unsigned int old_msg_size = compressed_msg.data.size();
-         unsigned int new_msg_size = old_msg_size + buffer->length ;
-         compressed_msg.data.resize(new_msg_size);
-         memcpy(&(compressed_msg.data[old_msg_size]), buffer->data, buffer->length);
-         /*memcpy(&(pData->buffer[pData->frame & 1][pData->id]), buffer->data, buffer->length);
-         pData->id += bytes_written;*/
+         encoded_frame->encoded.insert(encoded_frame->encoded.end(), buffer->data,
+                                       buffer->data + buffer->length);
          mmal_buffer_header_mem_unlock(buffer);
       }
 
@@ -292,21 +1943,23 @@ static void encoder_buffer_callback(MMAL_PORT_T* port,
       }
       if (buffer->flags & (MMAL_BUFFER_HEADER_FLAG_FRAME_END |
                            MMAL_BUFFER_HEADER_FLAG_TRANSMISSION_FAILED)) {
-         //sensor_msgs::CompressedImage compressed_msg;
-         compressed_msg.header.seq = pData->frame;
-         compressed_msg.header.frame_id = tf_prefix;
-         compressed_msg.header.frame_id.append("/camera");
-         compressed_msg.header.stamp = ros::Time::now();
-         compressed_msg.format = "jpeg";
-         // compressed_pub.publish(compressed_msg);
-         c_info.header.seq = pData->frame;
-         c_info.header.stamp = compressed_msg.header.stamp;
-         c_info.header.frame_id = compressed_msg.header.frame_id;
-         // camera_info_pub.publish(c_info);
+         // A frame the encoder failed on is not worth sending
+         if (encoded_frame && !(buffer->flags & MMAL_BUFFER_HEADER_FLAG_TRANSMISSION_FAILED)) {
+            std_msgs::Header& header = encoded_frame->image.header;
+            header.seq = pData->frame;
+            header.frame_id = camera_frame_id;
+            header.stamp = ros::Time::now();
+            encoded_frame->frame = pData->frame;
+            encoded_frame->contents = RASPISTAGES_ENCODED;
+            raspistages_submit(&stages, encoded_frame, capture_time_us(port, buffer));
+         }
+         encoded_frame.reset();
          pData->frame++;
          pData->id = 0;
-         compressed_msg.data.clear();
       }
+#if defined(RASPI_COUNT_ALLOCATIONS)
+      check_allocations("encoder", pData, raspiallocs_count() - allocations);
+#endif
    }
 
    // release buffer back to the pool
@@ -321,8 +1974,10 @@ static void encoder_buffer_callback(MMAL_PORT_T* port,
       if (new_buffer)
          status = mmal_port_send_buffer(port, new_buffer);
 
-      if (!new_buffer || status != MMAL_SUCCESS)
+      if (!new_buffer || status != MMAL_SUCCESS) {
          vcos_log_error("Unable to return a buffer to the encoder port");
+         pData->abort = 1;
+      }
    }
 }
 
@@ -346,37 +2001,39 @@ static void camera_buffer_callback(MMAL_PORT_T* port,
    PORT_USERDATA* pData = (PORT_USERDATA*)port->userdata;
    if (pData && pData->pstate->isInit) {
       int bytes_written = buffer->length;
-      if (buffer->length) {
-         //sensor_msgs::Image raw_msg;
+      if (buffer->length)
+         last_callback_us.store(raspistages_now_us(), std::memory_order_relaxed);
+      if (buffer->length && pData->frame % frame_divider != 0) {
+         // Not processed at all, to lower the frame rate (see apply_knobs)
+         pData->frame++;
+      } else if (buffer->length) {
+#if defined(RASPI_COUNT_ALLOCATIONS)
+         const uint32_t allocations = raspiallocs_count();
+#endif
+         // A frame from an earlier capture, sized for it already
+         RASPISTAGES_FRAME_PTR frame = raspistages_acquire(&raw_frames);
+         sensor_msgs::Image& raw_msg = frame->image;
+         frame->frame = pData->frame;
+         frame->contents = RASPISTAGES_RAW;
          raw_msg.header.seq = pData->frame;
-         raw_msg.header.frame_id = tf_prefix;
-         raw_msg.header.frame_id.append("/camera");
+         raw_msg.header.frame_id = camera_frame_id;
          raw_msg.header.stamp = ros::Time::now();
-         raw_msg.is_bigendian = 0;
          mmal_buffer_header_mem_lock(buffer);
-         if (pData->pstate->monochrome > 0) {
-            sensor_msgs::fillImage( raw_msg,
-                                    sensor_msgs::image_encodings::MONO8,
-                                    pData->pstate->height, // height
-                                    pData->pstate->width, // width
-                                    (pData->pstate->width), // stepSize
-                                    buffer->data);
-         } else {
-            sensor_msgs::fillImage( raw_msg,
-                                    sensor_msgs::image_encodings::RGB8,
-                                    pData->pstate->height, // height
-                                    pData->pstate->width, // width
-                                    (pData->pstate->width * 3), // stepSize
-                                    buffer->data);
-         }
+         // Blobs are classified on the camera's own YUV when it is there
+         fill_frame(frame.get(), buffer->data, buffer->length, pData->pstate->width,
+                    pData->pstate->height,
+                    pData->pstate->blobs && blobs_pub.getNumSubscribers() > 0);
          mmal_buffer_header_mem_unlock(buffer);
-         raw_msg.is_bigendian = 0;
-         // image_pub.publish(raw_msg);
-         image_pub_.publish(raw_msg);
-         c_info.header.seq = pData->frame;
-         c_info.header.stamp = raw_msg.header.stamp;
-         c_info.header.frame_id = raw_msg.header.frame_id;
-         camera_info_pub.publish(c_info);
+         // Lines first, on the frame as captured, they are the most latency
+         // sensitive output and only read a few rows. The lines stage
+         // publishes them.
+         if (pData->pstate->lines && !lines_skipped && lines_pub.getNumSubscribers() > 0)
+            scan_lines(frame.get());
+         // Everything else runs on the stage threads, the buffer goes back now
+         raspistages_submit(&stages, frame, capture_time_us(port, buffer));
+#if defined(RASPI_COUNT_ALLOCATIONS)
+         check_allocations("camera", pData, raspiallocs_count() - allocations);
+#endif
          pData->frame++;
          pData->id = 0;
       }
@@ -395,8 +2052,10 @@ static void camera_buffer_callback(MMAL_PORT_T* port,
       if (new_buffer)
          status = mmal_port_send_buffer(port, new_buffer);
 
-      if (!new_buffer || status != MMAL_SUCCESS)
+      if (!new_buffer || status != MMAL_SUCCESS) {
          vcos_log_error("Unable to return a buffer to the encoder port");
+         pData->abort = 1;
+      }
    } else {
 
       ROS_INFO("oups");
@@ -461,13 +2120,8 @@ static MMAL_COMPONENT_T* create_camera_component(RASPIVID_STATE* state) {
    // Set the encode format on the video  port
 
    format = video_port->format;
-   if (state->monochrome) {
-      format->encoding_variant = MMAL_ENCODING_I420;
-      format->encoding = MMAL_ENCODING_I420;
-   } else {
-      format->encoding = MMAL_ENCODING_RGB24;
-      format->encoding_variant = MMAL_ENCODING_RGB24;
-   }
+   format->encoding = frame_format->mmal_encoding;
+   format->encoding_variant = frame_format->mmal_encoding;
 
    format->es->video.width = state->width;
    format->es->video.height = state->height;
@@ -671,6 +2325,11 @@ static MMAL_STATUS_T create_encoder_component(RASPIVID_STATE* state) {
    }
    mmal_port_parameter_set_uint32(encoder_output, MMAL_PARAMETER_VIDEO_BIT_RATE,
                                   state->bitrate);
+   // The larger of the encoder's buffers and the I420 frame the JPEG is
+   // made from, which the JPEG does not outgrow in practice
+   encoded_frame_bytes = std::max((size_t)encoder_output->buffer_size *
+                                  encoder_output->buffer_num,
+                                  (size_t)state->width * state->height * 3 / 2);
 // Set the JPEG quality level
 
    /* status = mmal_port_parameter_set_uint32(encoder_output, MMAL_PARAMETER_JPEG_Q_FACTOR, state->quality);
@@ -757,6 +2416,71 @@ static MMAL_STATUS_T connect_ports(MMAL_PORT_T* output_port,
    return status;
 }
 
+/**
+ * Copy a camera buffer into a frame
+ *
+ * The layout of the frame is only set when it does not match the camera's
+ * already, a frame that was filled before keeps its encoding and storage.
+ *
+ * @param frame Frame to fill
+ * @param data Locked buffer data
+ * @param length Bytes of data in the buffer
+ * @param width Frame width in pixels
+ * @param height Frame height in pixels
+ * @param chroma Set to also copy the chroma planes, if the format has them
+ */
+template <class Format>
+static void fill_frame_as(RASPISTAGES_FRAME* frame, const uint8_t* data,
+                          uint32_t length, int width, int height, int chroma) {
+   sensor_msgs::Image& image = frame->image;
+   const int step = width * Format::bytes_per_pixel;
+   RASPIFORMAT_PLANES planes;
+
+   Format::planes(data, length, width, height, &planes);
+   if (image.width != (uint32_t)width || image.height != (uint32_t)height) {
+      image.width = width;
+      image.height = height;
+      image.step = step;
+      image.encoding = Format::encoding();
+      image.is_bigendian = 0;
+      image.data.resize((size_t)step * height);
+   }
+   if (planes.stride[0] == step) {
+      memcpy(&image.data[0], planes.plane[0], (size_t)step * height);
+   } else {
+      for (int r = 0; r < height; r++)
+         memcpy(&image.data[(size_t)r * step], planes.plane[0] + r * planes.stride[0], step);
+   }
+
+   if (Format::has_chroma && chroma) {
+      const int w = width / 2, h = height / 2;
+      frame->chroma.resize((size_t)w * h * 2);
+      for (int r = 0; r < h; r++) {
+         memcpy(&frame->chroma[(size_t)r * w], planes.plane[1] + r * planes.stride[1], w);
+         memcpy(&frame->chroma[(size_t)(h + r) * w], planes.plane[2] + r * planes.stride[2], w);
+      }
+   } else {
+      // A pooled frame may still hold the planes of an earlier capture
+      frame->chroma.clear();
+   }
+}
+
+/**
+ * Pick the format the camera is captured in, and the instance of the
+ * per-frame code for it
+ *
+ * @param state Pointer to state control struct
+ */
+static void select_format(RASPIVID_STATE* state) {
+   if (state->monochrome) {
+      frame_format = raspiformat_describe<RaspiFormatMono8>();
+      fill_frame = fill_frame_as<RaspiFormatMono8>;
+   } else {
+      frame_format = raspiformat_describe<RaspiFormatRgb8>();
+      fill_frame = fill_frame_as<RaspiFormatRgb8>;
+   }
+}
+
 /**
  * Checks if specified port is valid and enabled, then disables it
  *
@@ -795,9 +2519,75 @@ int init_cam(RASPIVID_STATE* state) {
    MMAL_PORT_T* encoder_output_port = NULL ;
    bcm_host_init();
    get_status(state);
+   if (knobs.resolution_divider > 1) {
+      // Lowered by a degradation ladder
+      state->width = (state->width / knobs.resolution_divider) & ~1;
+      state->height = (state->height / knobs.resolution_divider) & ~1;
+   }
+   capture_divider = knobs.resolution_divider;
+   select_format(state);
    // Register our application with the logging system
    vcos_log_register("RaspiVid", VCOS_LOG_CATEGORY);
 
+   if (state->delta) {
+      if (raspitiledelta_init(&delta_state, state->width, state->height,
+                              frame_format->bytes_per_pixel, state->delta_tile_size,
+                              state->delta_threshold, state->delta_refresh) != 0) {
+         ROS_INFO("%s: Failed to set up the delta output", __func__);
+         raspitiledelta_destroy(&delta_state);
+      }
+      delta_subscribers = 0;
+      delta_sequence = 0;
+   }
+   raspisharpness_gate_init(&sharpness_gate, state->sharpness_threshold,
+                            state->sharpness_best_of);
+   if (state->shading)
+      setup_shading(state);
+   if (state->tone)
+      load_tone_config();
+   if (state->pyramid) {
+      raspipyramid_layout(&pyramid_layout, state->width, state->height,
+                          state->pyramid_levels);
+      pyramid_msg.width.assign(pyramid_layout.width,
+                               pyramid_layout.width + pyramid_layout.levels);
+      pyramid_msg.height.assign(pyramid_layout.height,
+                                pyramid_layout.height + pyramid_layout.levels);
+      pyramid_msg.step.assign(pyramid_layout.step,
+                              pyramid_layout.step + pyramid_layout.levels);
+      pyramid_msg.offset.assign(pyramid_layout.offset,
+                                pyramid_layout.offset + pyramid_layout.levels);
+   }
+   if (state->features &&
+       raspifeatures_init(&features_state, state->width, state->height,
+                          state->features_threshold, state->features_cell_size,
+                          state->features_max) != 0) {
+      ROS_INFO("%s: Failed to set up the feature extraction", __func__);
+      state->features = 0;
+   }
+   if (state->blobs && setup_blobs(state) != 0) {
+      ROS_INFO("%s: Failed to set up the blob tracker", __func__);
+      state->blobs = 0;
+   }
+   if (state->lines && setup_lines(state) != 0) {
+      ROS_INFO("%s: Failed to set up the line detector", __func__);
+      state->lines = 0;
+   }
+   if (state->denoise &&
+       raspidenoise_init(&denoise_state, state->width, state->height,
+                         frame_format->bytes_per_pixel, state->denoise_strength,
+                         state->denoise_motion_threshold) != 0) {
+      ROS_INFO("%s: Failed to set up the temporal filter", __func__);
+      raspidenoise_destroy(&denoise_state);
+   }
+   if (setup_stages(state) != 0) {
+      ROS_INFO("%s: Failed to set up the processing stages", __func__);
+      return 1;
+   }
+   // Enough for every frame the graph can hold, the callback's own and a held one
+   raspistages_pool_init(&raw_frames, raspistages_capacity(&stages) + 2);
+   raspistages_pool_init(&encoded_frames, raspistages_capacity(&stages) + 2);
+   apply_knobs(state);
+
    signal(SIGINT, signal_handler);
 
    // OK, we have a nice set of parameters. Now set up our components
@@ -823,7 +2613,7 @@ int init_cam(RASPIVID_STATE* state) {
    }
 
    //setting up the splitter
-   PORT_USERDATA* callback_data = (PORT_USERDATA*) malloc (sizeof(PORT_USERDATA));
+   PORT_USERDATA* callback_data = &camera_userdata;
    camera_video_port   = state->camera_component->output[MMAL_CAMERA_VIDEO_PORT];
    ROS_INFO("Accessing splitter");
    splitter_input_port   = state->splitter_component->input[0];
@@ -845,8 +2635,8 @@ int init_cam(RASPIVID_STATE* state) {
    ROS_INFO("Initializing callbacks");
    callback_data->pstate = state;
    callback_data->abort = 0;
+   callback_data->first_frame = callback_data->frame;
    callback_data->id = 0;
-   callback_data->frame = 0;
    splitter_output_port->userdata = (struct MMAL_PORT_USERDATA_T*) callback_data;
    status = mmal_port_enable(splitter_output_port, camera_buffer_callback);
    if (status != MMAL_SUCCESS) {
@@ -855,14 +2645,13 @@ int init_cam(RASPIVID_STATE* state) {
    }
 
    //here starts the encoder section
-   PORT_USERDATA* callback_data_enc = (PORT_USERDATA*) malloc (sizeof(
-                                                                  PORT_USERDATA));
+   PORT_USERDATA* callback_data_enc = &encoder_userdata;
    encoder_output_port = state->encoder_component->output[0];
    // Set up our userdata - this is passed though to the callback where we need the information.
    callback_data_enc->pstate = state;
    callback_data_enc->abort = 0;
+   callback_data_enc->first_frame = callback_data_enc->frame;
    callback_data_enc->id = 0;
-   callback_data_enc->frame = 0;
    encoder_output_port->userdata = (struct MMAL_PORT_USERDATA_T*)
                                    callback_data_enc;
    status = mmal_port_enable(encoder_output_port, encoder_buffer_callback);
@@ -872,53 +2661,65 @@ int init_cam(RASPIVID_STATE* state) {
    }
 
    ROS_INFO("Callback memory allocated");
+   if (raspistages_start(&stages) != 0) {
+      ROS_INFO("%s: Failed to start the processing stages", __func__);
+      return 1;
+   }
    state->isInit = 1;
 
    return 0;
 }
 
 
+/**
+ * Send the free buffers of a pool to an output port
+ *
+ * @param port Output port the pool was created for
+ * @param pool Pool of the port
+ *
+ * @return Number of buffers sent
+ */
+static int send_pool_buffers(MMAL_PORT_T* port, MMAL_POOL_T* pool) {
+   int num = mmal_queue_length(pool->queue);
+   int q, sent = 0;
+
+   for (q = 0; q < num; q++) {
+      MMAL_BUFFER_HEADER_T* buffer = mmal_queue_get(pool->queue);
+      if (!buffer) {
+         vcos_log_error("Unable to get a required buffer %d from pool queue", q);
+         break;
+      }
+      if (mmal_port_send_buffer(port, buffer) != MMAL_SUCCESS) {
+         vcos_log_error("Unable to send a buffer to output port %s (%d)", port->name, q);
+         mmal_buffer_header_release(buffer);
+         break;
+      }
+      sent++;
+   }
+   return sent;
+}
+
 int start_capture(RASPIVID_STATE* state) {
-   if (!(state->isInit)) init_cam(state);
+   if (!(state->isInit) && init_cam(state) != 0) {
+      ROS_INFO("%s: Failed to set up the camera", __func__);
+      return 1;
+   }
    MMAL_PORT_T* camera_video_port   =
       state->camera_component->output[MMAL_CAMERA_VIDEO_PORT];
    MMAL_PORT_T* splitter_video_port   =
       state->splitter_component->output[0]; //callback is on the first splitter
    ROS_INFO("Starting video capture (%d, %d, %d, %d)\n", state->width,
             state->height, state->quality, state->framerate);
+   // A capture not started by the watchdog gets a full stall time to start
+   if (watchdog.step == RASPIWATCHDOG_NONE)
+      last_callback_us = raspistages_now_us();
    if (mmal_port_parameter_set_boolean(camera_video_port, MMAL_PARAMETER_CAPTURE,
                                        1) != MMAL_SUCCESS) {
       return 1;
    }
    // Send all the buffers to the splitter output port
-   {
-      int num = mmal_queue_length(state->splitter_pool->queue);
-      int q;
-      for (q = 0; q < num; q++) {
-         MMAL_BUFFER_HEADER_T* buffer = mmal_queue_get(state->splitter_pool->queue);
-         if (!buffer)
-            vcos_log_error("Unable to get a required buffer %d from pool queue", q);
-         if (mmal_port_send_buffer(splitter_video_port, buffer) != MMAL_SUCCESS)
-            vcos_log_error("Unable to send a buffer to splitter output port (%d)", q);
-      }
-   }
-
-   MMAL_PORT_T* encoder_output_port = state->encoder_component->output[0];
-   {
-      int num = mmal_queue_length(state->encoder_pool->queue);
-      int q;
-      for (q = 0; q < num; q++) {
-         MMAL_BUFFER_HEADER_T* buffer = mmal_queue_get(state->encoder_pool->queue);
-
-         if (!buffer)
-            vcos_log_error("Unable to get a required buffer %d from pool queue", q);
-
-         if (mmal_port_send_buffer(encoder_output_port, buffer) != MMAL_SUCCESS)
-            vcos_log_error("Unable to send a buffer to encoder output port (%d)", q);
-
-      }
-   }
-
+   send_pool_buffers(splitter_video_port, state->splitter_pool);
+   send_pool_buffers(state->encoder_component->output[0], state->encoder_pool);
 
    ROS_INFO("Video capture started\n");
    return 0;
@@ -984,24 +2785,156 @@ int close_cam(RASPIVID_STATE* state) {
          mmal_component_destroy(splitter);
          splitter = NULL;
       }
+      // The ports are disabled, no more frames come in
+      raspistages_stop(&stages);
+      held_frame.reset();
+      encoded_frame.reset();
+      raspistages_pool_init(&raw_frames, 0);
+      raspistages_pool_init(&encoded_frames, 0);
+      raspitiledelta_destroy(&delta_state);
+      raspishading_free_lut(&shading_lut);
+      raspidenoise_destroy(&denoise_state);
       ROS_INFO("Camera closed");
       return 0;
    } else return 1;
 }
 
+/**
+ * Carry out a recovery step of the watchdog
+ *
+ * @param state Pointer to state control struct
+ * @param step RASPIWATCHDOG_* step
+ */
+static void recover_capture(RASPIVID_STATE* state, int step) {
+   switch (step) {
+   case RASPIWATCHDOG_REFILL:
+      if (state->isInit) {
+         send_pool_buffers(state->splitter_component->output[0], state->splitter_pool);
+         send_pool_buffers(state->encoder_component->output[0], state->encoder_pool);
+      }
+      break;
+   case RASPIWATCHDOG_RECAPTURE:
+      if (state->isInit) {
+         MMAL_PORT_T* camera_video_port =
+            state->camera_component->output[MMAL_CAMERA_VIDEO_PORT];
+         mmal_port_parameter_set_boolean(camera_video_port, MMAL_PARAMETER_CAPTURE, 0);
+         mmal_port_parameter_set_boolean(camera_video_port, MMAL_PARAMETER_CAPTURE, 1);
+      }
+      break;
+   case RASPIWATCHDOG_REBUILD:
+      close_cam(state);
+      if (init_cam(state) == 0)
+         start_capture(state);
+      break;
+   }
+}
+
+/**
+ * Look for a stall of the capture and take the next recovery step
+ */
+static void watchdog_check(const ros::TimerEvent& event) {
+   // Stopped through camera/stop_capture, a capture that failed to start is recovered
+   if (!state_srv.isInit && capture_stopped)
+      return;
+   if (state_srv.isInit) {
+      // A callback unable to return a buffer to its port leaves it a buffer short
+      PORT_USERDATA* pData = (PORT_USERDATA*)state_srv.splitter_component->output[0]->userdata;
+      PORT_USERDATA* pData_enc = (PORT_USERDATA*)state_srv.encoder_component->output[0]->userdata;
+      if (pData->abort || pData_enc->abort) {
+         pData->abort = 0;
+         pData_enc->abort = 0;
+         recover_capture(&state_srv, RASPIWATCHDOG_REFILL);
+      }
+   }
+
+   const int step = raspiwatchdog_check(&watchdog, last_callback_us, raspistages_now_us());
+   if (step == RASPIWATCHDOG_RECOVERED) {
+      ROS_WARN("Capture back after %s, %.0f ms without frames, %.0f ms to recover",
+               raspiwatchdog_step_name(watchdog.recovered_by),
+               watchdog.outage_us / 1000.0, watchdog.recover_us / 1000.0);
+      recovery_msg.header.stamp = ros::Time::now();
+      recovery_msg.recovered_by = raspiwatchdog_step_name(watchdog.recovered_by);
+      recovery_msg.outage_ms = watchdog.outage_us / 1000.0;
+      recovery_msg.recover_ms = watchdog.recover_us / 1000.0;
+      recovery_msg.stalls = watchdog.stalls;
+      recovery_pub.publish(recovery_msg);
+   } else if (step != RASPIWATCHDOG_NONE) {
+      ROS_WARN("No frame for %.0f ms, trying %s",
+               (raspistages_now_us() - watchdog.last_callback_us) / 1000.0,
+               raspiwatchdog_step_name(step));
+      recover_capture(&state_srv, step);
+      raspiwatchdog_done(&watchdog, raspistages_now_us());
+   }
+}
+
 bool serv_start_cap( std_srvs::Empty::Request&  req,
                      std_srvs::Empty::Response& res ) {
-   start_capture(&state_srv);
-   return true;
+   capture_stopped = 0;
+   return start_capture(&state_srv) == 0;
 }
 
 
 bool serv_stop_cap(  std_srvs::Empty::Request&  req,
                      std_srvs::Empty::Response& res ) {
+   capture_stopped = 1;
    close_cam(&state_srv);
    return true;
 }
 
+bool serv_calibrate_shading( std_srvs::Empty::Request&  req,
+                             std_srvs::Empty::Response& res ) {
+   ROS_INFO("Averaging the next %d frames as a flat field",
+            state_srv.shading_calib_frames);
+   shading_calib_request = state_srv.shading_calib_frames;
+   if (state_srv.isInit && raspistages_find(&stages, "shading") < 0) {
+      // Shading is off, the capture restarts with the stage averaging the frames
+      close_cam(&state_srv);
+      start_capture(&state_srv);
+   }
+   return true;
+}
+
+bool serv_reload_tone( std_srvs::Empty::Request&  req,
+                       std_srvs::Empty::Response& res ) {
+   return load_tone_config() == 0;
+}
+
+bool serv_set_roi( raspicam::SetRoi::Request&  req,
+                   raspicam::SetRoi::Response& res ) {
+   const int index = raspiroi_find(&rois, req.name.c_str());
+   RASPIROI_RECT rect;
+
+   rect.x = req.x;
+   rect.y = req.y;
+   rect.width = req.width;
+   rect.height = req.height;
+   res.success = index >= 0 && rect.width > 0 && rect.height > 0;
+   if (res.success)
+      raspiroi_set(&rois, index, &rect);
+   return true;
+}
+
+/**
+ * Read the rois parameter and advertise camera/roi/<name> for each region
+ *
+ * @param n Node handle the topics are advertised on
+ *
+ * @return 0 if successful, -1 if a region is invalid
+ */
+static int setup_rois(ros::NodeHandle& n) {
+   std::vector<std::string> specs;
+
+   ros::param::get("~rois", specs);
+   if (raspiroi_parse(specs, rois.regions) != 0) {
+      ROS_ERROR("rois are \"NAME X Y WIDTH HEIGHT\", with distinct names of letters, digits and _");
+      rois.regions.clear();
+      return -1;
+   }
+   for (size_t i = 0; i < rois.regions.size(); i++)
+      roi_pubs.push_back(n.advertise<ROI_IMAGE>("camera/roi/" + rois.regions[i].name, 1));
+   return 0;
+}
+
 /**
  * Handler for sigint signals
  *
@@ -1015,12 +2948,15 @@ static void signal_handler(int signal_number) {
 }
 
 
+// Left out by test/test_raspicam_node.cpp, which sets up what the tests need
+#if !defined(RASPICAM_NODE_NO_MAIN)
 int main(int argc, char** argv) {
    ros::init(argc, argv, "raspicam");
    ros::NodeHandle n;
    camera_info_manager::CameraInfoManager c_info_man (n, "camera",
                                                       "package://raspicam/calibrations/camera.yaml");
    get_status(&state_srv);
+   raspiladder_reset(&knobs);
    if (!c_info_man.loadCameraInfo ("package://raspicam/calibrations/camera.yaml")) {
       ROS_INFO("Calibration file missing. Camera not calibrated");
    } else {
@@ -1028,18 +2964,97 @@ int main(int argc, char** argv) {
       ROS_INFO("Camera successfully calibrated");
    }
    image_transport::ImageTransport it_(n);
+   // The software encoding transports of image_transport (compressed,
+   // theora) encode every raw frame on the publish stage as soon as anything
+   // subscribes to them, holding back the raw frame of every other subscriber;
+   // camera/mjpeg is the hardware encoded stream. cpu_transports set to 0
+   // disables them; only image_transport 1.11.11 and later read
+   // disable_pub_plugins.
+   if (!state_srv.cpu_transports && !n.hasParam("camera/image/disable_pub_plugins")) {
+      std::vector<std::string> plugins;
+      plugins.push_back("image_transport/compressed");
+      plugins.push_back("image_transport/compressedDepth");
+      plugins.push_back("image_transport/theora");
+      n.setParam("camera/image/disable_pub_plugins", plugins);
+   }
    image_pub_ = it_.advertise("camera/image", 1);
    // image_pub = n.advertise<sensor_msgs::Image>("camera/image_raw", 1);
-   // compressed_pub =
-   //    n.advertise<sensor_msgs::CompressedImage>("camera/image_compressed", 1);
+   ros::Subscriber compressed_ack_sub;
+   if (state_srv.compressed) {
+      compressed_pub = n.advertise<sensor_msgs::CompressedImage>("camera/mjpeg", 1);
+      compressed_msg.format = "jpeg";
+      compressed_ack_sub = n.subscribe("camera/mjpeg/ack", 10, compressed_ack);
+   }
    camera_info_pub = n.advertise<sensor_msgs::CameraInfo>("camera/camera_info", 1);
+   if (state_srv.delta)
+      delta_pub = n.advertise<raspicam::TileDelta>("camera/image/delta", 1);
+   if (state_srv.sharpness)
+      sharpness_pub = n.advertise<raspicam::Sharpness>("camera/sharpness", 1);
+   if (state_srv.pyramid)
+      pyramid_pub = n.advertise<raspicam::Pyramid>("camera/image/pyramid", 1);
+   if (state_srv.features)
+      features_pub = n.advertise<raspicam::Features>("camera/features", 1);
+   if (state_srv.blobs)
+      blobs_pub = n.advertise<raspicam::Blobs>("camera/blobs", 1);
+   if (state_srv.lines)
+      lines_pub = n.advertise<raspicam::Lines>("camera/lines", 1);
+   setup_rois(n);
+   if (state_srv.udp) {
+      udp_open = raspiudp_sender_open(&udp_sender, udp_address.c_str(), state_srv.udp_port,
+                                      udp_interface.c_str(), state_srv.udp_ttl,
+                                      state_srv.udp_mtu, state_srv.udp_parity) == 0;
+      if (!udp_open)
+         ROS_ERROR("Unable to send to %s:%d from interface \"%s\" (%s)", udp_address.c_str(),
+                   state_srv.udp_port, udp_interface.c_str(), strerror(errno));
+   }
+   stages_pub = n.advertise<raspicam::Stages>("camera/stages", 1);
+   ros::Timer stages_timer = n.createTimer(ros::Duration(1.0), publish_stage_stats);
+   ros::Timer thermal_timer;
+   if (state_srv.thermal && setup_thermal(&state_srv) == 0)
+      thermal_timer = n.createTimer(ros::Duration(state_srv.thermal_period), thermal_check);
+   ros::Timer governor_timer;
+   if (state_srv.cpu_budget > 0.0 && setup_governor(&state_srv) == 0)
+      governor_timer = n.createTimer(ros::Duration(state_srv.cpu_period), governor_check);
+   ros::Timer watchdog_timer;
+   if (state_srv.stall_frames > 0.0) {
+      const double stall = state_srv.stall_frames / state_srv.framerate;
+      raspiwatchdog_init(&watchdog, stall * 1000000, raspistages_now_us());
+      recovery_pub = n.advertise<raspicam::Recovery>("camera/recovery", 1, true);
+      watchdog_timer = n.createTimer(ros::Duration(stall / 2), watchdog_check);
+   }
+   ros::Timer soak_timer;
+   if (state_srv.soak_minutes > 0.0) {
+      raspilatency_reset(&publish_latency);
+      raspilatency_clear(&soak_latency);
+      soak_start_us = raspistages_now_us();
+      soak_timer = n.createTimer(ros::Duration(state_srv.soak_period), soak_sample);
+      ROS_INFO("Soaking for %.0f minutes, report in %s", state_srv.soak_minutes,
+               soak_report.c_str());
+   }
+   degradation_pub = n.advertise<raspicam::Degradation>("camera/degradation", 1, true);
+   publish_degradation();
    ros::ServiceServer start_cam = n.advertiseService("camera/start_capture",
                                                      serv_start_cap);
    ros::ServiceServer stop_cam = n.advertiseService("camera/stop_capture",
                                                     serv_stop_cap);
+   ros::ServiceServer calibrate_shading =
+      n.advertiseService("camera/calibrate_shading", serv_calibrate_shading);
+   ros::ServiceServer reload_tone = n.advertiseService("camera/reload_tone",
+                                                       serv_reload_tone);
+   ros::ServiceServer set_roi = n.advertiseService("camera/set_roi", serv_set_roi);
    start_capture(&state_srv);
    ros::spin();
    close_cam(&state_srv);
-   return 0;
+   if (udp_open)
+      raspiudp_sender_close(&udp_sender);
+#if defined(RASPI_COUNT_ALLOCATIONS)
+   if (steady_allocations > 0) {
+      ROS_ERROR("%u heap allocations on the frame callbacks after warm-up",
+                (uint32_t)steady_allocations);
+      return 1;
+   }
+#endif
+   return soak_failed ? 1 : 0;
 }
+#endif /* RASPICAM_NODE_NO_MAIN */
 
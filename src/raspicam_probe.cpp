@@ -0,0 +1,188 @@
+/**
+ * \file raspicam_probe.cpp
+ * End to end latency of the raw and compressed outputs, read from the pixels
+ *
+ * Description
+ *
+ * Subscribes to camera/image and camera/mjpeg and reads back the probe
+ * (see RaspiProbe.h) the frame source wrote into the corner of each frame:
+ * the fake camera of RASPICAM_FAKE_MMAL with FAKE_MMAL_PROBE=1. The latency
+ * is the age of the probe when the message arrives, so it covers the whole
+ * path from the frame source to a subscriber on the same machine and owes
+ * nothing to the header stamps. Every period the rate, latency percentiles
+ * and the frames duplicated, out of order, skipped and unreadable are
+ * printed for each output; with a duration, the totals of the run are
+ * printed at the end and the exit status is 1 if a frame came twice, out
+ * of order, or no probe was read at all.
+ *
+ * Lens shading, tone and temporal denoising change the pixels of the probe,
+ * a frame they touched is counted unreadable: run the node without them.
+ */
+#include <stdio.h>
+#include <vector>
+
+#include "ros/ros.h"
+#include "sensor_msgs/Image.h"
+#include "sensor_msgs/CompressedImage.h"
+#include <opencv2/highgui/highgui.hpp>
+
+#include "RaspiProbe.h"
+#include "RaspiLatency.h"
+
+/** Counters of one output
+ */
+typedef struct {
+   const char* name;
+   RASPIPROBE_TRACKER tracker;
+   RASPILATENCY_HISTOGRAM latency;
+   RASPILATENCY_SNAPSHOT run;  /// Latencies of the whole run
+   uint32_t unreadable;        /// Frames with no valid probe
+   uint32_t reported;          /// Probes read at the last report
+} PROBE_OUTPUT;
+
+PROBE_OUTPUT raw_output;
+PROBE_OUTPUT compressed_output;
+double report_period;
+
+static void output_init(PROBE_OUTPUT* output, const char* name) {
+   output->name = name;
+   raspiprobe_track_init(&output->tracker);
+   raspilatency_reset(&output->latency);
+   raspilatency_clear(&output->run);
+   output->unreadable = 0;
+   output->reported = 0;
+}
+
+/**
+ * Read the probe of a frame and count it
+ *
+ * @param output Output the frame came from
+ * @param pixels First row of the frame
+ * @param stride Bytes between the starts of two rows
+ * @param bytes_per_pixel Channels of a pixel
+ * @param width Width of the frame
+ * @param height Height of the frame
+ * @param arrived_us Time the message arrived, from raspiprobe_now_us
+ */
+static void count_frame(PROBE_OUTPUT* output, const uint8_t* pixels, int stride,
+                        int bytes_per_pixel, int width, int height, int64_t arrived_us) {
+   RASPIPROBE_STAMP stamp;
+
+   if (raspiprobe_read(pixels, stride, bytes_per_pixel, width, height, &stamp) != 0) {
+      output->unreadable++;
+      return;
+   }
+   const int kind = raspiprobe_track(&output->tracker, stamp.counter);
+   if (kind == RASPIPROBE_DUPLICATE)
+      ROS_WARN("%s: frame %u received twice", output->name, stamp.counter);
+   else if (kind == RASPIPROBE_REORDERED)
+      ROS_WARN("%s: frame %u received after frame %u", output->name, stamp.counter,
+               output->tracker.highest);
+   raspilatency_add(&output->latency, raspiprobe_age_us(&stamp, arrived_us));
+}
+
+void raw_callback(const sensor_msgs::Image::ConstPtr& image) {
+   const int64_t arrived_us = raspiprobe_now_us();
+
+   if (image->width == 0 || image->data.empty())
+      return;
+   count_frame(&raw_output, &image->data[0], image->step, image->step / image->width,
+               image->width, image->height, arrived_us);
+}
+
+void compressed_callback(const sensor_msgs::CompressedImage::ConstPtr& image) {
+   const int64_t arrived_us = raspiprobe_now_us();
+   // The probe is on the luma, decoding it alone is enough
+   cv::Mat luma = cv::imdecode(image->data, cv::IMREAD_GRAYSCALE);
+
+   if (luma.empty() || !luma.isContinuous()) {
+      compressed_output.unreadable++;
+      return;
+   }
+   count_frame(&compressed_output, luma.data, luma.step, 1, luma.cols, luma.rows,
+               arrived_us);
+}
+
+/**
+ * Print the counters of an output
+ *
+ * @param output Output to report on
+ * @param latency Latencies to report
+ * @param frames Probes read over the reported time
+ * @param seconds Length of the reported time
+ */
+static void print_output(const PROBE_OUTPUT* output, const RASPILATENCY_SNAPSHOT* latency,
+                         uint32_t frames, double seconds) {
+   const RASPIPROBE_TRACKER* t = &output->tracker;
+
+   printf("%-10s %6.1f fps  latency p50 %6.1f p99 %6.1f p99.9 %6.1f ms  "
+          "duplicated %u reordered %u skipped %u unreadable %u\n",
+          output->name, frames / seconds,
+          raspilatency_percentile(latency, 50.0) / 1000.0,
+          raspilatency_percentile(latency, 99.0) / 1000.0,
+          raspilatency_percentile(latency, 99.9) / 1000.0,
+          t->duplicated, t->reordered, t->skipped, output->unreadable);
+   fflush(stdout);
+}
+
+static void report_output(PROBE_OUTPUT* output) {
+   RASPILATENCY_SNAPSHOT period;
+
+   raspilatency_take(&output->latency, &period);
+   raspilatency_merge(&output->run, &period);
+   if (output->tracker.received == 0 && output->unreadable == 0)
+      return;
+   print_output(output, &period, output->tracker.received - output->reported,
+                report_period);
+   output->reported = output->tracker.received;
+}
+
+void report(const ros::TimerEvent& event) {
+   report_output(&raw_output);
+   report_output(&compressed_output);
+}
+
+void finish(const ros::TimerEvent& event) {
+   ros::shutdown();
+}
+
+int main(int argc, char** argv) {
+   ros::init(argc, argv, "raspicam_probe");
+   ros::NodeHandle n;
+   ros::NodeHandle private_n("~");
+   bool raw, compressed;
+   double duration;
+
+   private_n.param("raw", raw, true);
+   private_n.param("compressed", compressed, true);
+   private_n.param("period", report_period, 1.0);
+   private_n.param("duration", duration, 0.0);
+   output_init(&raw_output, "raw");
+   output_init(&compressed_output, "compressed");
+
+   ros::Subscriber raw_sub, compressed_sub;
+   if (raw)
+      raw_sub = n.subscribe("camera/image", 5, raw_callback);
+   if (compressed)
+      compressed_sub = n.subscribe("camera/mjpeg", 5, compressed_callback);
+   ros::Timer report_timer = n.createTimer(ros::Duration(report_period), report);
+   ros::Timer finish_timer;
+   if (duration > 0.0)
+      finish_timer = n.createTimer(ros::Duration(duration), finish, true);
+   ros::spin();
+   if (duration <= 0.0)
+      return 0;
+
+   int failed = raw_output.tracker.received + compressed_output.tracker.received == 0;
+   printf("Over %.0f s:\n", duration);
+   PROBE_OUTPUT* outputs[2] = {&raw_output, &compressed_output};
+   for (int i = 0; i < 2; i++) {
+      PROBE_OUTPUT* output = outputs[i];
+      report_output(output);
+      if (output->tracker.received == 0)
+         continue;
+      print_output(output, &output->run, output->tracker.received, duration);
+      failed |= output->tracker.duplicated > 0 || output->tracker.reordered > 0;
+   }
+   return failed ? 1 : 0;
+}
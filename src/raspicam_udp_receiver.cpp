@@ -0,0 +1,91 @@
+/**
+ * \file raspicam_udp_receiver.cpp
+ * Republish the UDP output of raspicam_node as compressed images
+ *
+ * Description
+ *
+ * Joins the multicast group the node sends its encoded frames to (its
+ * udp_address parameter), puts the frames back together and publishes them
+ * as sensor_msgs/CompressedImage on camera/udp. A frame missing a fragment
+ * its parity cannot rebuild is dropped as soon as a newer one completes, so
+ * the stream carries on from the next frame. The counters of the
+ * reassembly are printed every period.
+ *
+ * A datagram claiming a frame larger than max_frame_bytes is counted as
+ * invalid, so a stray or forged header cannot make the receiver allocate
+ * up to 4 GB.
+ *
+ * With loss set, that share of the datagrams is thrown away on arrival, to
+ * try the reassembly over the loopback of the node's own machine.
+ */
+#include <string.h>
+#include <errno.h>
+#include <string>
+
+#include "ros/ros.h"
+#include "sensor_msgs/CompressedImage.h"
+
+#include "RaspiUdp.h"
+
+int main(int argc, char** argv) {
+   ros::init(argc, argv, "raspicam_udp_receiver");
+   ros::NodeHandle n;
+   ros::NodeHandle private_n("~");
+   std::string address, interface, frame_id;
+   int port, max_frame_bytes;
+   double loss, period;
+   RASPIUDP_RECEIVER receiver;
+   RASPIUDP_FRAME frame;
+
+   private_n.param("address", address, std::string("239.255.0.1"));
+   private_n.param("port", port, 5600);
+   private_n.param("interface", interface, std::string(""));
+   private_n.param("frame_id", frame_id, std::string("camera"));
+   private_n.param("max_frame_bytes", max_frame_bytes, RASPIUDP_MAX_FRAME_BYTES);
+   private_n.param("loss", loss, 0.0);
+   private_n.param("period", period, 5.0);
+   if (raspiudp_receiver_open(&receiver, address.c_str(), port, interface.c_str()) != 0) {
+      ROS_ERROR("Unable to receive from %s:%d on interface \"%s\" (%s)", address.c_str(),
+                port, interface.c_str(), strerror(errno));
+      return 1;
+   }
+   if (max_frame_bytes > 0)
+      receiver.max_frame_bytes = max_frame_bytes;
+   receiver.loss = loss;
+
+   ros::Publisher compressed_pub = n.advertise<sensor_msgs::CompressedImage>("camera/udp", 1);
+   sensor_msgs::CompressedImage compressed_msg;
+   compressed_msg.header.frame_id = frame_id;
+   compressed_msg.format = "jpeg";
+   ros::WallTime report = ros::WallTime::now() + ros::WallDuration(period);
+   uint32_t reported = 0;
+   int status = 0;
+
+   while (ros::ok()) {
+      const int received = raspiudp_receive(&receiver, 100, &frame);
+      if (received < 0) {
+         ROS_ERROR("Unable to receive from %s:%d (%s)", address.c_str(), port,
+                   strerror(errno));
+         status = 1;
+         break;
+      }
+      if (received > 0) {
+         compressed_msg.header.seq = frame.frame_id;
+         compressed_msg.header.stamp.fromNSec(frame.stamp_ns);
+         // The buffers go round, the frame takes the one published last
+         compressed_msg.data.swap(frame.data);
+         compressed_pub.publish(compressed_msg);
+      }
+      if (ros::WallTime::now() >= report) {
+         ROS_INFO("%.1f fps, %u frames, %u fragments rebuilt, %u frames dropped, "
+                  "%u datagrams late, %u invalid, %u discarded, %u restarts",
+                  (receiver.frames - reported) / period, receiver.frames, receiver.rebuilt,
+                  receiver.dropped, receiver.late, receiver.invalid, receiver.discarded,
+                  receiver.restarts);
+         reported = receiver.frames;
+         report += ros::WallDuration(period);
+      }
+   }
+   raspiudp_receiver_close(&receiver);
+   return status;
+}
@@ -0,0 +1,141 @@
+/**
+ * \file test_allocations.cpp
+ * The frame callbacks of the node make no heap allocation once warmed up
+ *
+ * Description
+ *
+ * The node is compiled in without its main and with RASPI_COUNT_ALLOCATIONS,
+ * linked with RaspiAllocs.cpp, and runs on the fake MMAL with every output
+ * that does work on a callback subscribed: camera/lines, scanned on the
+ * camera callback, camera/blobs, whose chroma the camera callback copies on
+ * monochrome captures, and camera/mjpeg, gathered on the encoder callback.
+ * Both callbacks run well past ALLOCATION_WARMUP_FRAMES, then the
+ * allocations the node counted after its warm-up must be none. Run by
+ * rostest from test/raspicam_allocations.test.
+ */
+#define RASPICAM_NODE_NO_MAIN
+#include "../src/raspicam_node.cpp"
+
+#include <gtest/gtest.h>
+
+#include "FakeMmal.h"
+
+/// Frames past the warm-up each callback is watched for
+#define STEADY_FRAMES  60
+#define WAIT_SECONDS   30.0
+
+static std::atomic<int> raw_count;
+static std::atomic<int> compressed_count;
+static std::atomic<int> lines_count;
+static std::atomic<int> blobs_count;
+
+static void raw_received(const sensor_msgs::ImageConstPtr& msg) {
+   raw_count++;
+}
+
+static void compressed_received(const sensor_msgs::CompressedImageConstPtr& msg) {
+   compressed_count++;
+}
+
+static void lines_received(const raspicam::LinesConstPtr& msg) {
+   lines_count++;
+}
+
+static void blobs_received(const raspicam::BlobsConstPtr& msg) {
+   blobs_count++;
+}
+
+/**
+ * Wait for both callbacks to get a number of frames into the pipeline built last
+ *
+ * @return 1 if they did, 0 on a timeout
+ */
+static int wait_for_frames(int frames) {
+   const ros::WallTime end = ros::WallTime::now() + ros::WallDuration(WAIT_SECONDS);
+
+   while ((camera_userdata.frame - camera_userdata.first_frame < frames ||
+           encoder_userdata.frame - encoder_userdata.first_frame < frames) &&
+          ros::WallTime::now() < end)
+      ros::WallDuration(0.01).sleep();
+   return camera_userdata.frame - camera_userdata.first_frame >= frames &&
+          encoder_userdata.frame - encoder_userdata.first_frame >= frames;
+}
+
+class AllocationTest : public ::testing::Test {
+protected:
+   virtual void SetUp() {
+      FAKEMMAL_CONFIG config;
+
+      fakemmal_default_config(&config);
+      fakemmal_configure(&config);
+      steady_allocations = 0;
+      raw_count = 0;
+      compressed_count = 0;
+      lines_count = 0;
+      blobs_count = 0;
+   }
+
+   virtual void TearDown() {
+      close_cam(&state_srv);
+      ros::param::del("~monochrome");
+   }
+
+   /// Run the capture past the warm-up and check every output was served
+   void run() {
+      ASSERT_EQ(0, start_capture(&state_srv));
+      ASSERT_TRUE(wait_for_frames(ALLOCATION_WARMUP_FRAMES + STEADY_FRAMES));
+      close_cam(&state_srv);
+      EXPECT_GT(raw_count.load(), 0);
+      EXPECT_GT(compressed_count.load(), 0);
+      EXPECT_GT(lines_count.load(), 0);
+      EXPECT_GT(blobs_count.load(), 0);
+   }
+};
+
+TEST_F(AllocationTest, RgbCallbacksDoNotAllocate) {
+   run();
+   EXPECT_EQ(0u, steady_allocations.load());
+}
+
+TEST_F(AllocationTest, MonochromeCallbacksDoNotAllocate) {
+   ros::param::set("~monochrome", 1);
+   run();
+   EXPECT_TRUE(state_srv.monochrome);
+   EXPECT_EQ(0u, steady_allocations.load());
+}
+
+int main(int argc, char** argv) {
+   testing::InitGoogleTest(&argc, argv);
+   ros::init(argc, argv, "raspicam_allocations_test");
+   ros::NodeHandle n;
+
+   raspiladder_reset(&knobs);
+   get_status(&state_srv);
+   image_transport::ImageTransport it_(n);
+   image_pub_ = it_.advertise("camera/image", 1);
+   camera_info_pub = n.advertise<sensor_msgs::CameraInfo>("camera/camera_info", 1);
+   compressed_pub = n.advertise<sensor_msgs::CompressedImage>("camera/mjpeg", 1);
+   compressed_msg.format = "jpeg";
+   lines_pub = n.advertise<raspicam::Lines>("camera/lines", 1);
+   blobs_pub = n.advertise<raspicam::Blobs>("camera/blobs", 1);
+   stages_pub = n.advertise<raspicam::Stages>("camera/stages", 1);
+   degradation_pub = n.advertise<raspicam::Degradation>("camera/degradation", 1, true);
+   ros::Subscriber raw_sub = n.subscribe("camera/image", 5, raw_received);
+   ros::Subscriber compressed_sub = n.subscribe("camera/mjpeg", 5, compressed_received);
+   ros::Subscriber lines_sub = n.subscribe("camera/lines", 5, lines_received);
+   ros::Subscriber blobs_sub = n.subscribe("camera/blobs", 5, blobs_received);
+   ros::AsyncSpinner spinner(1);
+   spinner.start();
+   // The subscribers are connected before the first frame, so the callbacks
+   // take their paths for them from the start
+   ros::WallTime end = ros::WallTime::now() + ros::WallDuration(WAIT_SECONDS);
+   while ((image_pub_.getNumSubscribers() == 0 || compressed_pub.getNumSubscribers() == 0 ||
+           lines_pub.getNumSubscribers() == 0 || blobs_pub.getNumSubscribers() == 0) &&
+          ros::WallTime::now() < end)
+      ros::WallDuration(0.01).sleep();
+
+   const int status = RUN_ALL_TESTS();
+   spinner.stop();
+   ros::shutdown();
+   return status;
+}
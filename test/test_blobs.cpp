@@ -0,0 +1,123 @@
+/**
+ * \file test_blobs.cpp
+ * Tests of the colour blob tracker, RaspiBlobs.h
+ */
+#include <string.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "RaspiBlobs.h"
+
+#define WIDTH  40
+#define HEIGHT 30
+
+/// I420 frame of a grey background
+class BlobsTest : public ::testing::Test {
+protected:
+   virtual void SetUp() {
+      y.assign(WIDTH * HEIGHT, 100);
+      u.assign(WIDTH * HEIGHT / 4, 128);
+      v.assign(WIDTH * HEIGHT / 4, 128);
+      // Red: high V, blue: high U
+      const RASPIBLOBS_RANGE red = { 0, 255, 0, 255, 200, 255 };
+      const RASPIBLOBS_RANGE blue = { 0, 255, 200, 255, 0, 255 };
+      ranges[0] = red;
+      ranges[1] = blue;
+   }
+
+   /// Paint a rectangle of full resolution pixels, on even bounds
+   void paint(std::vector<uint8_t>& plane, int x0, int y0, int x1, int y1) {
+      for (int r = y0 / 2; r <= y1 / 2; r++)
+         for (int c = x0 / 2; c <= x1 / 2; c++)
+            plane[r * WIDTH / 2 + c] = 230;
+   }
+
+   int find(RASPIBLOBS_STATE* state, std::vector<RASPIBLOBS_BLOB>& blobs) {
+      raspiblobs_classify_i420(state, &y[0], WIDTH, &u[0], &v[0], WIDTH / 2);
+      return raspiblobs_find(state, blobs);
+   }
+
+   std::vector<uint8_t> y, u, v;
+   RASPIBLOBS_RANGE ranges[2];
+};
+
+TEST_F(BlobsTest, RejectsBadArguments) {
+   RASPIBLOBS_STATE state;
+
+   EXPECT_EQ(-1, raspiblobs_init(&state, 1, HEIGHT, ranges, 2, 0));
+   EXPECT_EQ(-1, raspiblobs_init(&state, WIDTH, HEIGHT, ranges, 0, 0));
+   EXPECT_EQ(-1, raspiblobs_init(&state, WIDTH, HEIGHT, ranges, RASPIBLOBS_MAX_COLORS + 1, 0));
+}
+
+TEST_F(BlobsTest, NothingOnTheBackground) {
+   RASPIBLOBS_STATE state;
+   std::vector<RASPIBLOBS_BLOB> blobs;
+
+   ASSERT_EQ(0, raspiblobs_init(&state, WIDTH, HEIGHT, ranges, 2, 0));
+   EXPECT_EQ(0, find(&state, blobs));
+   EXPECT_TRUE(blobs.empty());
+}
+
+TEST_F(BlobsTest, FindsARectangle) {
+   RASPIBLOBS_STATE state;
+   std::vector<RASPIBLOBS_BLOB> blobs;
+
+   ASSERT_EQ(0, raspiblobs_init(&state, WIDTH, HEIGHT, ranges, 2, 0));
+   paint(v, 10, 6, 19, 13);
+   ASSERT_EQ(1, find(&state, blobs));
+   EXPECT_EQ(0, blobs[0].color);
+   EXPECT_EQ(80u, blobs[0].area);
+   EXPECT_FLOAT_EQ(14.5f, blobs[0].x);
+   EXPECT_FLOAT_EQ(9.5f, blobs[0].y);
+   EXPECT_EQ(10, blobs[0].x_min);
+   EXPECT_EQ(19, blobs[0].x_max);
+   EXPECT_EQ(6, blobs[0].y_min);
+   EXPECT_EQ(13, blobs[0].y_max);
+}
+
+TEST_F(BlobsTest, JoinsAShapeAcrossRows) {
+   RASPIBLOBS_STATE state;
+   std::vector<RASPIBLOBS_BLOB> blobs;
+
+   ASSERT_EQ(0, raspiblobs_init(&state, WIDTH, HEIGHT, ranges, 2, 0));
+   // A U, its two arms only meet on the bottom row
+   paint(v, 0, 0, 3, 11);
+   paint(v, 12, 0, 15, 11);
+   paint(v, 0, 12, 15, 13);
+   ASSERT_EQ(1, find(&state, blobs));
+   EXPECT_EQ((uint32_t)(2 * 4 * 12 + 16 * 2), blobs[0].area);
+   EXPECT_EQ(0, blobs[0].x_min);
+   EXPECT_EQ(15, blobs[0].x_max);
+}
+
+TEST_F(BlobsTest, KeepsColoursApartLargestFirst) {
+   RASPIBLOBS_STATE state;
+   std::vector<RASPIBLOBS_BLOB> blobs;
+
+   ASSERT_EQ(0, raspiblobs_init(&state, WIDTH, HEIGHT, ranges, 2, 0));
+   // Side by side, touching
+   paint(v, 0, 0, 3, 3);
+   paint(u, 4, 0, 11, 7);
+   ASSERT_EQ(2, find(&state, blobs));
+   EXPECT_EQ(1, blobs[0].color);
+   EXPECT_EQ(64u, blobs[0].area);
+   EXPECT_EQ(0, blobs[1].color);
+   EXPECT_EQ(16u, blobs[1].area);
+}
+
+TEST_F(BlobsTest, DropsBlobsUnderTheMinimumArea) {
+   RASPIBLOBS_STATE state;
+   std::vector<RASPIBLOBS_BLOB> blobs;
+
+   ASSERT_EQ(0, raspiblobs_init(&state, WIDTH, HEIGHT, ranges, 2, 20));
+   paint(v, 0, 0, 3, 3);
+   paint(v, 20, 20, 29, 29);
+   ASSERT_EQ(1, find(&state, blobs));
+   EXPECT_EQ(100u, blobs[0].area);
+}
+
+int main(int argc, char** argv) {
+   testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,74 @@
+/**
+ * \file test_governor.cpp
+ * Tests of the CPU budget governor, RaspiGovernor.h
+ */
+#include <gtest/gtest.h>
+
+#include "RaspiGovernor.h"
+
+#define PERIOD_US  1000000
+
+/// Governor with a 40% budget over a three step ladder
+class GovernorTest : public ::testing::Test {
+protected:
+   virtual void SetUp() {
+      raspigovernor_init(&governor, 40.0, 3);
+      cpu_us = 0;
+      wall_us = 1;
+      raspigovernor_update(&governor, cpu_us, wall_us);
+   }
+
+   /// Close a one second period in which the node used a percent of a core
+   int period(double percent) {
+      cpu_us += (int64_t)(percent * PERIOD_US / 100.0);
+      wall_us += PERIOD_US;
+      return raspigovernor_update(&governor, cpu_us, wall_us);
+   }
+
+   RASPIGOVERNOR_STATE governor;
+   int64_t cpu_us, wall_us;
+};
+
+TEST_F(GovernorTest, TheFirstUpdateOnlyStartsAPeriod) {
+   EXPECT_EQ(0, governor.level);
+   EXPECT_EQ(0.0, governor.usage);
+}
+
+TEST_F(GovernorTest, StaysPutWithinBudget) {
+   for (int i = 0; i < 10; i++)
+      EXPECT_EQ(0, period(30.0));
+   EXPECT_DOUBLE_EQ(30.0, governor.usage);
+}
+
+TEST_F(GovernorTest, StepsDownOncePerPeriodToTheEndOfTheLadder) {
+   EXPECT_EQ(1, period(80.0));
+   EXPECT_EQ(2, period(80.0));
+   EXPECT_EQ(3, period(80.0));
+   EXPECT_EQ(3, period(80.0));
+}
+
+TEST_F(GovernorTest, MeasuresTheSavingOfAStep) {
+   EXPECT_EQ(1, period(60.0));
+   EXPECT_EQ(1, period(38.0));
+   EXPECT_DOUBLE_EQ(22.0, governor.saved[0]);
+   // 15 + 22 is over 90% of the budget, undoing the step would go over
+   EXPECT_EQ(1, period(15.0));
+   EXPECT_EQ(0, period(10.0));
+}
+
+TEST_F(GovernorTest, AStepThatSavedNothingIsUndoneUnderTheHeadroom) {
+   EXPECT_EQ(1, period(50.0));
+   EXPECT_EQ(2, period(55.0));
+   EXPECT_DOUBLE_EQ(0.0, governor.saved[0]);
+   EXPECT_EQ(2, period(35.0));
+   EXPECT_DOUBLE_EQ(20.0, governor.saved[1]);
+   EXPECT_EQ(1, period(15.0));
+   // Nothing to add for the first step, just the headroom
+   EXPECT_EQ(1, period(36.0));
+   EXPECT_EQ(0, period(35.0));
+}
+
+int main(int argc, char** argv) {
+   testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
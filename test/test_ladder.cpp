@@ -0,0 +1,89 @@
+/**
+ * \file test_ladder.cpp
+ * Tests of the degradation ladders, RaspiLadder.h
+ */
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "RaspiLadder.h"
+
+static std::vector<RASPILADDER_STEP> parse(const char* const* specs, int count) {
+   std::vector<RASPILADDER_STEP> steps;
+
+   EXPECT_EQ(0, raspiladder_parse(std::vector<std::string>(specs, specs + count), steps));
+   return steps;
+}
+
+TEST(LadderTest, ParsesEveryKindOfStep) {
+   const char* const specs[] = { "fps 15", "stage features", "resolution 2" };
+   std::vector<RASPILADDER_STEP> steps = parse(specs, 3);
+
+   ASSERT_EQ(3u, steps.size());
+   EXPECT_EQ(RASPILADDER_FPS, steps[0].type);
+   EXPECT_EQ(15, steps[0].value);
+   EXPECT_EQ(RASPILADDER_STAGE, steps[1].type);
+   EXPECT_EQ("features", steps[1].stage);
+   EXPECT_EQ(RASPILADDER_RESOLUTION, steps[2].type);
+   EXPECT_EQ(2, steps[2].value);
+}
+
+TEST(LadderTest, RejectsUnknownSteps) {
+   std::vector<RASPILADDER_STEP> steps;
+   std::vector<std::string> specs;
+
+   specs.push_back("fps 0");
+   EXPECT_EQ(-1, raspiladder_parse(specs, steps));
+   specs[0] = "resolution -2";
+   EXPECT_EQ(-1, raspiladder_parse(specs, steps));
+   specs[0] = "slower";
+   EXPECT_EQ(-1, raspiladder_parse(specs, steps));
+}
+
+TEST(LadderTest, AppliesTheFirstSteps) {
+   const char* const specs[] = { "fps 15", "stage features", "resolution 2" };
+   std::vector<RASPILADDER_STEP> steps = parse(specs, 3);
+   RASPILADDER_KNOBS knobs;
+
+   raspiladder_reset(&knobs);
+   EXPECT_EQ("none", raspiladder_describe(&knobs));
+   raspiladder_apply(steps, 0, &knobs);
+   EXPECT_EQ(0, knobs.fps);
+
+   raspiladder_apply(steps, 2, &knobs);
+   EXPECT_EQ(15, knobs.fps);
+   EXPECT_EQ(1, knobs.resolution_divider);
+   EXPECT_TRUE(raspiladder_skips(&knobs, "features"));
+   EXPECT_FALSE(raspiladder_skips(&knobs, "blobs"));
+
+   // Past the end of the ladder
+   raspiladder_reset(&knobs);
+   raspiladder_apply(steps, 10, &knobs);
+   EXPECT_EQ("fps 15, resolution 1/2, skip features", raspiladder_describe(&knobs));
+}
+
+TEST(LadderTest, MergesToTheStrictestKnobs) {
+   const char* const thermal[] = { "fps 20", "resolution 2", "stage delta" };
+   const char* const cpu[] = { "fps 10", "stage delta", "resolution 4" };
+   RASPILADDER_KNOBS knobs;
+
+   raspiladder_reset(&knobs);
+   raspiladder_apply(parse(thermal, 3), 3, &knobs);
+   raspiladder_apply(parse(cpu, 3), 3, &knobs);
+   EXPECT_EQ(10, knobs.fps);
+   EXPECT_EQ(4, knobs.resolution_divider);
+   // Skipped once
+   EXPECT_EQ(1u, knobs.skipped_stages.size());
+
+   raspiladder_reset(&knobs);
+   raspiladder_apply(parse(cpu, 3), 1, &knobs);
+   raspiladder_apply(parse(thermal, 3), 2, &knobs);
+   EXPECT_EQ(10, knobs.fps);
+   EXPECT_EQ(2, knobs.resolution_divider);
+}
+
+int main(int argc, char** argv) {
+   testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,105 @@
+/**
+ * \file test_latency.cpp
+ * Tests of the latency histogram, RaspiLatency.h
+ */
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "RaspiLatency.h"
+
+class LatencyTest : public ::testing::Test {
+protected:
+   virtual void SetUp() {
+      raspilatency_reset(&histogram);
+      raspilatency_clear(&snapshot);
+   }
+
+   RASPILATENCY_HISTOGRAM histogram;
+   RASPILATENCY_SNAPSHOT snapshot;
+};
+
+TEST_F(LatencyTest, EmptyHasNoPercentile) {
+   raspilatency_take(&histogram, &snapshot);
+   EXPECT_EQ(0u, snapshot.total);
+   EXPECT_EQ(0, raspilatency_percentile(&snapshot, 50));
+}
+
+TEST_F(LatencyTest, SmallLatenciesAreExact) {
+   raspilatency_add(&histogram, 3);
+   raspilatency_add(&histogram, -5);
+   raspilatency_take(&histogram, &snapshot);
+   EXPECT_EQ(2u, snapshot.total);
+   EXPECT_EQ(0, raspilatency_percentile(&snapshot, 50));
+   EXPECT_EQ(3, raspilatency_percentile(&snapshot, 100));
+}
+
+TEST_F(LatencyTest, PercentilesWithinAQuarter) {
+   for (int i = 0; i < 90; i++)
+      raspilatency_add(&histogram, 1000);
+   for (int i = 0; i < 10; i++)
+      raspilatency_add(&histogram, 40000);
+   raspilatency_take(&histogram, &snapshot);
+
+   const int64_t median = raspilatency_percentile(&snapshot, 50);
+   EXPECT_GE(median, 1000);
+   EXPECT_LT(median, 1250);
+   EXPECT_EQ(median, raspilatency_percentile(&snapshot, 90));
+   const int64_t tail = raspilatency_percentile(&snapshot, 95);
+   EXPECT_GE(tail, 40000);
+   EXPECT_LT(tail, 50000);
+}
+
+TEST_F(LatencyTest, LongLatenciesCountInTheLastBucket) {
+   raspilatency_add(&histogram, 100000000);
+   raspilatency_take(&histogram, &snapshot);
+   EXPECT_GE(raspilatency_percentile(&snapshot, 100), 30000000);
+}
+
+TEST_F(LatencyTest, TakeEmptiesAndMergeAdds) {
+   RASPILATENCY_SNAPSHOT run;
+
+   raspilatency_clear(&run);
+   raspilatency_add(&histogram, 100);
+   raspilatency_take(&histogram, &snapshot);
+   raspilatency_merge(&run, &snapshot);
+   raspilatency_add(&histogram, 200);
+   raspilatency_add(&histogram, 200);
+   raspilatency_take(&histogram, &snapshot);
+   EXPECT_EQ(2u, snapshot.total);
+   raspilatency_merge(&run, &snapshot);
+   EXPECT_EQ(3u, run.total);
+   EXPECT_GE(raspilatency_percentile(&run, 10), 100);
+   EXPECT_LT(raspilatency_percentile(&run, 10), 200);
+
+   raspilatency_take(&histogram, &snapshot);
+   EXPECT_EQ(0u, snapshot.total);
+}
+
+TEST_F(LatencyTest, NoCountLostWhileTaking) {
+   const int threads = 4, adds = 100000;
+   std::vector<std::thread> adders;
+   RASPILATENCY_SNAPSHOT run;
+
+   raspilatency_clear(&run);
+   for (int t = 0; t < threads; t++)
+      adders.push_back(std::thread([this, t]() {
+         for (int i = 0; i < adds; i++)
+            raspilatency_add(&histogram, i % 5000 + t);
+      }));
+   for (int i = 0; i < 100; i++) {
+      raspilatency_take(&histogram, &snapshot);
+      raspilatency_merge(&run, &snapshot);
+   }
+   for (size_t t = 0; t < adders.size(); t++)
+      adders[t].join();
+   raspilatency_take(&histogram, &snapshot);
+   raspilatency_merge(&run, &snapshot);
+   EXPECT_EQ((uint32_t)(threads * adds), run.total);
+}
+
+int main(int argc, char** argv) {
+   testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
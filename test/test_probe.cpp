@@ -0,0 +1,92 @@
+/**
+ * \file test_probe.cpp
+ * Tests of the pixel probe and its tracker, RaspiProbe.h
+ */
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "RaspiProbe.h"
+
+#define WIDTH   160
+#define HEIGHT  64
+
+TEST(ProbeTest, ReadsBackWhatWasWritten) {
+   const int bpp[] = { 1, 3 };
+
+   for (int i = 0; i < 2; i++) {
+      std::vector<uint8_t> frame(WIDTH * HEIGHT * bpp[i], 77);
+      RASPIPROBE_STAMP stamp = { 0xdeadbeefu, 0x123456789abcLL }, read;
+
+      ASSERT_EQ(0, raspiprobe_stamp(&frame[0], WIDTH * bpp[i], bpp[i], WIDTH, HEIGHT,
+                                    &stamp));
+      ASSERT_EQ(0, raspiprobe_read(&frame[0], WIDTH * bpp[i], bpp[i], WIDTH, HEIGHT,
+                                   &read));
+      EXPECT_EQ(stamp.counter, read.counter);
+      EXPECT_EQ(stamp.time_us, read.time_us);
+      // Outside the probe
+      EXPECT_EQ(77, frame[(HEIGHT - 1) * WIDTH * bpp[i]]);
+   }
+}
+
+TEST(ProbeTest, CutsTheTimeTo48Bits) {
+   std::vector<uint8_t> frame(WIDTH * HEIGHT, 0);
+   RASPIPROBE_STAMP stamp = { 1, ((int64_t)5 << 48) | 42 }, read;
+
+   ASSERT_EQ(0, raspiprobe_stamp(&frame[0], WIDTH, 1, WIDTH, HEIGHT, &stamp));
+   ASSERT_EQ(0, raspiprobe_read(&frame[0], WIDTH, 1, WIDTH, HEIGHT, &read));
+   EXPECT_EQ(42, read.time_us);
+   // Across the wrap of the time
+   read.time_us = RASPIPROBE_TIME_MASK - 9;
+   EXPECT_EQ(20, raspiprobe_age_us(&read, ((int64_t)7 << 48) | 10));
+}
+
+TEST(ProbeTest, RejectsAChangedOrMissingProbe) {
+   std::vector<uint8_t> frame(WIDTH * HEIGHT, 0);
+   RASPIPROBE_STAMP stamp = { 1234, 5678 }, read;
+
+   EXPECT_EQ(-1, raspiprobe_stamp(&frame[0], WIDTH, 1, RASPIPROBE_WIDTH - 1, HEIGHT,
+                                  &stamp));
+   ASSERT_EQ(0, raspiprobe_stamp(&frame[0], WIDTH, 1, WIDTH, HEIGHT, &stamp));
+   // Flip one cell
+   for (int r = 0; r < RASPIPROBE_CELL; r++)
+      for (int c = 0; c < RASPIPROBE_CELL; c++)
+         frame[(RASPIPROBE_CELL + r) * WIDTH + 3 * RASPIPROBE_CELL + c] ^= 0xff;
+   EXPECT_EQ(-1, raspiprobe_read(&frame[0], WIDTH, 1, WIDTH, HEIGHT, &read));
+   EXPECT_EQ(-1, raspiprobe_read(&frame[0], WIDTH, 1, WIDTH, RASPIPROBE_HEIGHT - 1, &read));
+}
+
+TEST(ProbeTest, TracksANormalStream) {
+   RASPIPROBE_TRACKER tracker;
+
+   raspiprobe_track_init(&tracker);
+   for (uint32_t c = 100; c < 110; c++)
+      EXPECT_EQ(RASPIPROBE_NEW, raspiprobe_track(&tracker, c));
+   EXPECT_EQ(10u, tracker.received);
+   EXPECT_EQ(0u, tracker.skipped);
+}
+
+TEST(ProbeTest, SortsSkippedDuplicatedAndLateFrames) {
+   RASPIPROBE_TRACKER tracker;
+
+   raspiprobe_track_init(&tracker);
+   EXPECT_EQ(RASPIPROBE_NEW, raspiprobe_track(&tracker, 1));
+   EXPECT_EQ(RASPIPROBE_NEW, raspiprobe_track(&tracker, 5));
+   EXPECT_EQ(3u, tracker.skipped);
+   EXPECT_EQ(RASPIPROBE_DUPLICATE, raspiprobe_track(&tracker, 5));
+   EXPECT_EQ(RASPIPROBE_REORDERED, raspiprobe_track(&tracker, 3));
+   EXPECT_EQ(2u, tracker.skipped);
+   EXPECT_EQ(RASPIPROBE_DUPLICATE, raspiprobe_track(&tracker, 3));
+   EXPECT_EQ(2u, tracker.duplicated);
+   EXPECT_EQ(1u, tracker.reordered);
+   // Over the wrap of the counter
+   raspiprobe_track_init(&tracker);
+   raspiprobe_track(&tracker, 0xffffffffu);
+   EXPECT_EQ(RASPIPROBE_NEW, raspiprobe_track(&tracker, 0));
+   EXPECT_EQ(0u, tracker.skipped);
+}
+
+int main(int argc, char** argv) {
+   testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,160 @@
+/**
+ * \file test_raspicam_node.cpp
+ * The capture lifecycle and the frame callbacks of the node, on the fake MMAL
+ *
+ * Description
+ *
+ * The node is compiled in without its main and driven through init_cam,
+ * start_capture and close_cam as its services and the watchdog drive it,
+ * with the camera and encoder callbacks fed by the fake camera. The test
+ * advertises the outputs main would, subscribes to them and counts the
+ * frames. Run by rostest from test/raspicam_node.test, which starts a
+ * roscore and sets a small capture with the compressed output on.
+ */
+#define RASPICAM_NODE_NO_MAIN
+#include "../src/raspicam_node.cpp"
+
+#include <gtest/gtest.h>
+
+#include "FakeMmal.h"
+
+/// Longest wait for the frames of a test, the fake camera runs at the framerate
+#define WAIT_SECONDS  10.0
+
+static std::atomic<int> raw_count;
+static std::atomic<int> compressed_count;
+static std::atomic<uint32_t> raw_seq;
+
+static void raw_received(const sensor_msgs::ImageConstPtr& msg) {
+   raw_seq = msg->header.seq;
+   raw_count++;
+}
+
+static void compressed_received(const sensor_msgs::CompressedImageConstPtr& msg) {
+   compressed_count++;
+}
+
+/**
+ * Wait for a counter to reach a number of frames
+ *
+ * @return 1 if it did, 0 on a timeout
+ */
+static int wait_for(const std::atomic<int>& count, int frames) {
+   const ros::WallTime end = ros::WallTime::now() + ros::WallDuration(WAIT_SECONDS);
+
+   while (count < frames && ros::WallTime::now() < end)
+      ros::WallDuration(0.01).sleep();
+   return count >= frames;
+}
+
+class CaptureTest : public ::testing::Test {
+protected:
+   virtual void SetUp() {
+      FAKEMMAL_CONFIG config;
+
+      fakemmal_default_config(&config);
+      fakemmal_configure(&config);
+      raw_count = 0;
+      compressed_count = 0;
+   }
+
+   virtual void TearDown() {
+      close_cam(&state_srv);
+   }
+};
+
+TEST_F(CaptureTest, RunsAndCloses) {
+   ASSERT_EQ(0, init_cam(&state_srv));
+   EXPECT_TRUE(state_srv.isInit);
+   ASSERT_EQ(0, start_capture(&state_srv));
+   EXPECT_TRUE(wait_for(raw_count, 5));
+   EXPECT_TRUE(wait_for(compressed_count, 5));
+   EXPECT_GE(camera_userdata.frame, 5);
+   EXPECT_GE(encoder_userdata.frame, 5);
+
+   EXPECT_EQ(0, close_cam(&state_srv));
+   EXPECT_FALSE(state_srv.isInit);
+   // Nothing left to close
+   EXPECT_EQ(1, close_cam(&state_srv));
+   // The frames on their way to the subscriber aside
+   ros::WallDuration(0.3).sleep();
+   const int received = raw_count;
+   ros::WallDuration(0.3).sleep();
+   EXPECT_EQ(received, raw_count.load());
+}
+
+TEST_F(CaptureTest, StartsTheCameraItself) {
+   ASSERT_EQ(0, start_capture(&state_srv));
+   EXPECT_TRUE(state_srv.isInit);
+   EXPECT_TRUE(wait_for(raw_count, 5));
+}
+
+TEST_F(CaptureTest, FrameNumbersCarryOnOverARebuild) {
+   ASSERT_EQ(0, start_capture(&state_srv));
+   ASSERT_TRUE(wait_for(raw_count, 5));
+   close_cam(&state_srv);
+   const uint32_t before = raw_seq;
+
+   raw_count = 0;
+   ASSERT_EQ(0, start_capture(&state_srv));
+   ASSERT_TRUE(wait_for(raw_count, 5));
+   EXPECT_GT(raw_seq.load(), before);
+}
+
+TEST_F(CaptureTest, FailedStartLeavesTheCameraClosed) {
+   FAKEMMAL_CONFIG config;
+
+   fakemmal_default_config(&config);
+   strncpy(config.fail_create, MMAL_COMPONENT_DEFAULT_VIDEO_ENCODER,
+           sizeof(config.fail_create) - 1);
+   fakemmal_configure(&config);
+   EXPECT_NE(0, start_capture(&state_srv));
+   EXPECT_FALSE(state_srv.isInit);
+
+   // The camera can be started again once the component comes back
+   fakemmal_default_config(&config);
+   fakemmal_configure(&config);
+   ASSERT_EQ(0, start_capture(&state_srv));
+   EXPECT_TRUE(wait_for(raw_count, 5));
+}
+
+TEST_F(CaptureTest, NoUdpStageWithoutAnOpenSender) {
+   ros::param::set("~udp_address", std::string("239.255.0.1"));
+   ASSERT_EQ(0, init_cam(&state_srv));
+   ros::param::del("~udp_address");
+   EXPECT_TRUE(state_srv.udp);
+   EXPECT_LT(raspistages_find(&stages, "udp"), 0);
+   EXPECT_GE(raspistages_find(&stages, "compressed"), 0);
+   ASSERT_EQ(0, start_capture(&state_srv));
+   EXPECT_TRUE(wait_for(compressed_count, 5));
+}
+
+int main(int argc, char** argv) {
+   testing::InitGoogleTest(&argc, argv);
+   ros::init(argc, argv, "raspicam_node_test");
+   ros::NodeHandle n;
+
+   raspiladder_reset(&knobs);
+   get_status(&state_srv);
+   image_transport::ImageTransport it_(n);
+   image_pub_ = it_.advertise("camera/image", 1);
+   camera_info_pub = n.advertise<sensor_msgs::CameraInfo>("camera/camera_info", 1);
+   compressed_pub = n.advertise<sensor_msgs::CompressedImage>("camera/mjpeg", 1);
+   compressed_msg.format = "jpeg";
+   stages_pub = n.advertise<raspicam::Stages>("camera/stages", 1);
+   degradation_pub = n.advertise<raspicam::Degradation>("camera/degradation", 1, true);
+   ros::Subscriber raw_sub = n.subscribe("camera/image", 5, raw_received);
+   ros::Subscriber compressed_sub = n.subscribe("camera/mjpeg", 5, compressed_received);
+   ros::AsyncSpinner spinner(1);
+   spinner.start();
+   // The subscribers are connected before the first frame
+   ros::WallTime end = ros::WallTime::now() + ros::WallDuration(WAIT_SECONDS);
+   while ((image_pub_.getNumSubscribers() == 0 || compressed_pub.getNumSubscribers() == 0) &&
+          ros::WallTime::now() < end)
+      ros::WallDuration(0.01).sleep();
+
+   const int status = RUN_ALL_TESTS();
+   spinner.stop();
+   ros::shutdown();
+   return status;
+}
@@ -0,0 +1,91 @@
+/**
+ * \file test_rate.cpp
+ * Tests of the per-client rate tiers, RaspiRate.h
+ */
+#include <gtest/gtest.h>
+
+#include "RaspiRate.h"
+
+#define MAX_BACKLOG     4
+#define UPGRADE_FRAMES  8
+
+/**
+ * Offer frames to a client that acknowledges each frame sent after a lag
+ *
+ * @return Frames sent
+ */
+static int run(RASPIRATE_CLIENT* client, uint32_t* seq, int frames, int lag) {
+   int sent = 0;
+
+   for (int i = 0; i < frames; i++, (*seq)++) {
+      sent += raspirate_offer(client, *seq, MAX_BACKLOG, UPGRADE_FRAMES);
+      if (lag >= 0 && *seq >= (uint32_t)lag)
+         raspirate_ack(client, *seq - lag, 0);
+   }
+   return sent;
+}
+
+TEST(RateTest, KeepsAClientThatKeepsUpAtFullRate) {
+   RASPIRATE_CLIENT client;
+   uint32_t seq = 0;
+
+   raspirate_init(&client, 0);
+   EXPECT_EQ(100, run(&client, &seq, 100, 1));
+   EXPECT_EQ(RASPIRATE_FULL, client.tier);
+   EXPECT_LE(client.in_flight.size(), 2u);
+}
+
+TEST(RateTest, SlowsDownAClientThatStopsAcknowledging) {
+   RASPIRATE_CLIENT client;
+   uint32_t seq = 0;
+
+   raspirate_init(&client, 0);
+   // The backlog fills, then nothing more is sent
+   EXPECT_EQ(MAX_BACKLOG + 1, run(&client, &seq, 100, -1));
+   EXPECT_EQ(RASPIRATE_QUARTER, client.tier);
+   EXPECT_EQ((size_t)MAX_BACKLOG + 1, client.in_flight.size());
+}
+
+TEST(RateTest, SendsEveryFourthFrameAtTheLowestTier) {
+   RASPIRATE_CLIENT client;
+
+   raspirate_init(&client, 0);
+   client.tier = RASPIRATE_QUARTER;
+   // Acknowledged straight away, but too soon to move up
+   for (uint32_t s = 0; s < UPGRADE_FRAMES - 1; s++) {
+      EXPECT_EQ(s % 4 == 0, raspirate_offer(&client, s, MAX_BACKLOG, UPGRADE_FRAMES));
+      raspirate_ack(&client, s, 0);
+   }
+}
+
+TEST(RateTest, MovesBackUpOnceTheBacklogDrains) {
+   RASPIRATE_CLIENT client;
+   uint32_t seq = 0;
+
+   raspirate_init(&client, 0);
+   run(&client, &seq, 50, -1);
+   ASSERT_EQ(RASPIRATE_QUARTER, client.tier);
+   raspirate_ack(&client, seq - 1, 1000);
+   EXPECT_TRUE(client.in_flight.empty());
+   EXPECT_EQ(1000, client.last_ack_us);
+   run(&client, &seq, 4 * UPGRADE_FRAMES, 0);
+   EXPECT_EQ(RASPIRATE_FULL, client.tier);
+}
+
+TEST(RateTest, AcknowledgesOverTheWrapOfTheSequence) {
+   RASPIRATE_CLIENT client;
+
+   raspirate_init(&client, 0);
+   EXPECT_EQ(1, raspirate_offer(&client, 0xfffffffeu, MAX_BACKLOG, UPGRADE_FRAMES));
+   EXPECT_EQ(1, raspirate_offer(&client, 0xffffffffu, MAX_BACKLOG, UPGRADE_FRAMES));
+   EXPECT_EQ(1, raspirate_offer(&client, 0, MAX_BACKLOG, UPGRADE_FRAMES));
+   EXPECT_EQ(1, raspirate_offer(&client, 1, MAX_BACKLOG, UPGRADE_FRAMES));
+   raspirate_ack(&client, 0, 0);
+   ASSERT_EQ(1u, client.in_flight.size());
+   EXPECT_EQ(1u, client.in_flight.front());
+}
+
+int main(int argc, char** argv) {
+   testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
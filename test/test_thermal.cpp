@@ -0,0 +1,136 @@
+/**
+ * \file test_thermal.cpp
+ * Tests of the temperature and throttle monitor, RaspiThermal.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "RaspiThermal.h"
+
+/// Temperature and throttle files standing in for sysfs
+class ThermalTest : public ::testing::Test {
+protected:
+   virtual void SetUp() {
+      char dir[] = "/tmp/raspithermal-XXXXXX";
+      ASSERT_TRUE(mkdtemp(dir) != NULL);
+      temp_path = std::string(dir) + "/temp";
+      throttle_path = std::string(dir) + "/throttled";
+      dir_path = dir;
+   }
+
+   virtual void TearDown() {
+      unlink(temp_path.c_str());
+      unlink(throttle_path.c_str());
+      rmdir(dir_path.c_str());
+   }
+
+   void write(const std::string& path, const char* text) {
+      FILE* f = fopen(path.c_str(), "w");
+      ASSERT_TRUE(f != NULL);
+      fputs(text, f);
+      fclose(f);
+   }
+
+   std::string dir_path, temp_path, throttle_path;
+};
+
+TEST_F(ThermalTest, ReadsMillidegrees) {
+   double celsius = 0.0;
+
+   write(temp_path, "67450\n");
+   ASSERT_EQ(0, raspithermal_read_temperature(temp_path.c_str(), &celsius));
+   EXPECT_DOUBLE_EQ(67.45, celsius);
+   write(temp_path, "-5000\n");
+   ASSERT_EQ(0, raspithermal_read_temperature(temp_path.c_str(), &celsius));
+   EXPECT_DOUBLE_EQ(-5.0, celsius);
+}
+
+TEST_F(ThermalTest, RejectsAMissingOrBadTemperature) {
+   double celsius = 12.0;
+
+   EXPECT_EQ(-1, raspithermal_read_temperature(temp_path.c_str(), &celsius));
+   write(temp_path, "hot\n");
+   EXPECT_EQ(-1, raspithermal_read_temperature(temp_path.c_str(), &celsius));
+   write(temp_path, "");
+   EXPECT_EQ(-1, raspithermal_read_temperature(temp_path.c_str(), &celsius));
+   EXPECT_EQ(12.0, celsius);
+}
+
+TEST_F(ThermalTest, ReadsTheThrottleFlagsWithOrWithoutPrefix) {
+   unsigned int flags = 0;
+
+   write(throttle_path, "throttled=0x50005\n");
+   ASSERT_EQ(0, raspithermal_read_throttled(throttle_path.c_str(), &flags));
+   EXPECT_EQ(0x50005u, flags);
+   write(throttle_path, "0x0\n");
+   ASSERT_EQ(0, raspithermal_read_throttled(throttle_path.c_str(), &flags));
+   EXPECT_EQ(0u, flags);
+   write(throttle_path, "a\n");
+   ASSERT_EQ(0, raspithermal_read_throttled(throttle_path.c_str(), &flags));
+   EXPECT_EQ(0xau, flags);
+}
+
+TEST_F(ThermalTest, RejectsAMissingOrBadThrottleFile) {
+   unsigned int flags = 0;
+
+   EXPECT_EQ(-1, raspithermal_read_throttled(throttle_path.c_str(), &flags));
+   write(throttle_path, "throttled=\n");
+   EXPECT_EQ(-1, raspithermal_read_throttled(throttle_path.c_str(), &flags));
+}
+
+TEST(ThermalUpdateTest, StepsDownAtHighToTheEndOfTheLadder) {
+   RASPITHERMAL_STATE state;
+
+   raspithermal_init(&state, 80.0, 70.0, 2);
+   EXPECT_EQ(0, raspithermal_update(&state, 79.9, 0));
+   EXPECT_EQ(1, raspithermal_update(&state, 80.0, 0));
+   EXPECT_EQ(2, raspithermal_update(&state, 85.0, 0));
+   EXPECT_EQ(2, raspithermal_update(&state, 85.0, 0));
+}
+
+TEST(ThermalUpdateTest, StepsDownWhileTheFirmwareThrottles) {
+   RASPITHERMAL_STATE state;
+
+   raspithermal_init(&state, 80.0, 70.0, 4);
+   EXPECT_EQ(1, raspithermal_update(&state, 50.0, RASPITHERMAL_FREQ_CAPPED));
+   EXPECT_EQ(2, raspithermal_update(&state, 50.0, RASPITHERMAL_THROTTLED));
+   EXPECT_EQ(3, raspithermal_update(&state, 50.0, RASPITHERMAL_SOFT_LIMIT));
+   // Throttling that happened since boot only, not now: steps back up
+   EXPECT_EQ(2, raspithermal_update(&state, 50.0, 0x50000));
+   // Under-voltage is not a thermal flag
+   EXPECT_EQ(1, raspithermal_update(&state, 50.0, 0x1));
+}
+
+TEST(ThermalUpdateTest, HoldsBetweenLowAndHigh) {
+   RASPITHERMAL_STATE state;
+
+   raspithermal_init(&state, 80.0, 70.0, 3);
+   raspithermal_update(&state, 81.0, 0);
+   raspithermal_update(&state, 81.0, 0);
+   ASSERT_EQ(2, state.level);
+   for (double c = 79.9; c >= 70.0; c -= 1.0)
+      EXPECT_EQ(2, raspithermal_update(&state, c, 0));
+   EXPECT_EQ(2, raspithermal_update(&state, 70.0, 0));
+   EXPECT_EQ(1, raspithermal_update(&state, 69.9, 0));
+   EXPECT_EQ(1, raspithermal_update(&state, 75.0, 0));
+   EXPECT_EQ(0, raspithermal_update(&state, 60.0, 0));
+   EXPECT_EQ(0, raspithermal_update(&state, 60.0, 0));
+}
+
+TEST(ThermalUpdateTest, ClampsLowToHigh) {
+   RASPITHERMAL_STATE state;
+
+   raspithermal_init(&state, 70.0, 80.0, 1);
+   EXPECT_EQ(70.0, state.low);
+   EXPECT_EQ(1, raspithermal_update(&state, 70.0, 0));
+   EXPECT_EQ(0, raspithermal_update(&state, 69.9, 0));
+}
+
+int main(int argc, char** argv) {
+   testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
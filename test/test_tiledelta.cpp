@@ -0,0 +1,128 @@
+/**
+ * \file test_tiledelta.cpp
+ * Tests of the tile delta coder, RaspiTileDelta.h
+ */
+#include <string.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "RaspiTileDelta.h"
+
+#define WIDTH  40
+#define HEIGHT 30
+#define BPP    3
+#define TILE   16
+
+class TileDeltaTest : public ::testing::Test {
+protected:
+   virtual void SetUp() {
+      ASSERT_EQ(0, raspitiledelta_init(&state, WIDTH, HEIGHT, BPP, TILE, 2, 0));
+      frame.assign(WIDTH * HEIGHT * BPP, 0);
+      for (size_t i = 0; i < frame.size(); i++)
+         frame[i] = i * 7;
+      received.assign(frame.size(), 0);
+   }
+
+   virtual void TearDown() {
+      raspitiledelta_destroy(&state);
+   }
+
+   /// Encode the frame and apply it to the received image, as the reassembler does
+   int send(int* keyframe) {
+      const int tiles = raspitiledelta_encode(&state, &frame[0], WIDTH * BPP, indices,
+                                              payload, keyframe);
+      EXPECT_EQ(0, raspitiledelta_apply(&received[0], WIDTH, HEIGHT, BPP, TILE,
+                                        indices.empty() ? NULL : &indices[0], tiles,
+                                        payload.empty() ? NULL : &payload[0],
+                                        payload.size()));
+      return tiles;
+   }
+
+   RASPITILEDELTA_STATE state;
+   std::vector<uint8_t> frame;
+   std::vector<uint8_t> received;
+   std::vector<uint32_t> indices;
+   std::vector<uint8_t> payload;
+};
+
+TEST_F(TileDeltaTest, RejectsAnEmptyGeometry) {
+   RASPITILEDELTA_STATE empty;
+
+   EXPECT_EQ(-1, raspitiledelta_init(&empty, 0, HEIGHT, BPP, TILE, 2, 0));
+   EXPECT_EQ(-1, raspitiledelta_init(&empty, WIDTH, HEIGHT, BPP, 0, 2, 0));
+}
+
+TEST_F(TileDeltaTest, FirstFrameSendsEveryTile) {
+   int keyframe = 0;
+
+   // 3 x 2 tiles, the last column and row cut short
+   EXPECT_EQ(6, send(&keyframe));
+   EXPECT_EQ(1, keyframe);
+   EXPECT_EQ(frame.size(), payload.size());
+   EXPECT_EQ(frame, received);
+}
+
+TEST_F(TileDeltaTest, SendsOnlyTheChangedTile) {
+   int keyframe;
+
+   send(&keyframe);
+   EXPECT_EQ(0, send(&keyframe));
+   EXPECT_EQ(0, keyframe);
+
+   // A corner of the last tile, cut to 8 x 14 pixels
+   for (int r = 20; r < 24; r++)
+      for (int i = (r * WIDTH + 34) * BPP; i < (r * WIDTH + 38) * BPP; i++)
+         frame[i] = 255 - frame[i];
+   ASSERT_EQ(1, send(&keyframe));
+   EXPECT_EQ(5u, indices[0]);
+   EXPECT_EQ((size_t)8 * 14 * BPP, payload.size());
+   EXPECT_EQ(frame, received);
+}
+
+TEST_F(TileDeltaTest, ChangesUnderTheThresholdAreNotSent) {
+   int keyframe;
+
+   send(&keyframe);
+   frame[0] += 1;
+   EXPECT_EQ(0, send(&keyframe));
+   // The receiver keeps the copy last sent
+   EXPECT_NE(frame, received);
+}
+
+TEST_F(TileDeltaTest, RefreshesEveryInterval) {
+   int keyframe;
+
+   raspitiledelta_destroy(&state);
+   ASSERT_EQ(0, raspitiledelta_init(&state, WIDTH, HEIGHT, BPP, TILE, 2, 3));
+   send(&keyframe);
+   for (int i = 0; i < 3; i++) {
+      EXPECT_EQ(0, send(&keyframe));
+      EXPECT_EQ(0, keyframe);
+   }
+   EXPECT_EQ(6, send(&keyframe));
+   EXPECT_EQ(1, keyframe);
+
+   state.force_refresh = 1;
+   EXPECT_EQ(6, send(&keyframe));
+}
+
+TEST_F(TileDeltaTest, ApplyRejectsAnInconsistentMessage) {
+   const uint32_t outside = 6;
+   const uint32_t first = 0;
+
+   EXPECT_EQ(-1, raspitiledelta_apply(&received[0], WIDTH, HEIGHT, BPP, TILE, &outside,
+                                      1, &frame[0], TILE * TILE * BPP));
+   // Short and long payloads
+   EXPECT_EQ(-1, raspitiledelta_apply(&received[0], WIDTH, HEIGHT, BPP, TILE, &first, 1,
+                                      &frame[0], TILE * TILE * BPP - 1));
+   EXPECT_EQ(-1, raspitiledelta_apply(&received[0], WIDTH, HEIGHT, BPP, TILE, &first, 1,
+                                      &frame[0], TILE * TILE * BPP + 1));
+   EXPECT_EQ(0, raspitiledelta_apply(&received[0], WIDTH, HEIGHT, BPP, TILE, &first, 1,
+                                     &frame[0], TILE * TILE * BPP));
+}
+
+int main(int argc, char** argv) {
+   testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
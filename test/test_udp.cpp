@@ -0,0 +1,323 @@
+/**
+ * \file test_udp.cpp
+ * Tests of the UDP output and its receiver, RaspiUdp.h
+ *
+ * Description
+ *
+ * The frames go over the loopback to a receiver socket on this machine.
+ * The datagrams are taken off the socket as they are, then lost, reordered
+ * or passed on by the test to the reassembly, and the frames delivered are
+ * compared byte for byte with the frames sent.
+ */
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "RaspiUdp.h"
+
+#define PORT    56000
+/// Fragments of 244 bytes
+#define MTU     300
+#define FRAMES  200
+
+typedef std::vector<std::vector<uint8_t> > DATAGRAMS;
+
+class UdpTest : public ::testing::Test {
+protected:
+   virtual void SetUp() {
+      ASSERT_EQ(0, raspiudp_receiver_open(&receiver, "127.0.0.1", PORT, ""));
+      sender.fd = -1;
+      seed = 7;
+      delivered = 0;
+      mismatched = 0;
+   }
+
+   virtual void TearDown() {
+      raspiudp_sender_close(&sender);
+      raspiudp_receiver_close(&receiver);
+   }
+
+   /// Random frame of 1 to 5000 bytes
+   void make_frame(std::vector<uint8_t>& frame) {
+      frame.resize(1 + rand_r(&seed) % 5000);
+      for (size_t i = 0; i < frame.size(); i++)
+         frame[i] = rand_r(&seed);
+   }
+
+   /// Send a frame and take its datagrams off the receiver's socket
+   void send(uint32_t frame_id, const std::vector<uint8_t>& frame, DATAGRAMS& datagrams) {
+      std::vector<uint8_t> buffer(65536);
+      ssize_t bytes;
+
+      ASSERT_EQ(0, raspiudp_send(&sender, frame_id, frame_id * 1000ull, &frame[0],
+                                 frame.size()));
+      datagrams.clear();
+      while ((bytes = recv(receiver.fd, &buffer[0], buffer.size(), MSG_DONTWAIT)) > 0)
+         datagrams.push_back(std::vector<uint8_t>(buffer.begin(), buffer.begin() + bytes));
+   }
+
+   /// Pass datagrams to the reassembly, comparing the frames delivered
+   void push(const DATAGRAMS& datagrams, uint32_t frame_id,
+             const std::vector<uint8_t>& frame) {
+      RASPIUDP_FRAME out;
+
+      for (size_t i = 0; i < datagrams.size(); i++) {
+         if (!raspiudp_push(&receiver, &datagrams[i][0], datagrams[i].size(), &out))
+            continue;
+         delivered++;
+         if (out.frame_id != frame_id || out.stamp_ns != frame_id * 1000ull ||
+             out.data != frame)
+            mismatched++;
+      }
+   }
+
+   RASPIUDP_SENDER sender;
+   RASPIUDP_RECEIVER receiver;
+   unsigned int seed;
+   int delivered;
+   int mismatched;
+};
+
+TEST_F(UdpTest, HeaderRoundTrip) {
+   RASPIUDP_HEADER header, read;
+   uint8_t datagram[RASPIUDP_HEADER_BYTES + 100];
+
+   header.frame_id = 0x01020304u;
+   header.stamp_ns = 0x0102030405060708ull;
+   header.frame_bytes = 250;
+   header.index = 2;
+   header.fragments = 3;
+   header.fragment_bytes = 100;
+   header.group = 0;
+   header.session = 0xbeef;
+   raspiudp_write_header(&header, datagram);
+   ASSERT_EQ(0, raspiudp_read_header(datagram, RASPIUDP_HEADER_BYTES + 50, &read));
+   EXPECT_EQ(header.frame_id, read.frame_id);
+   EXPECT_EQ(header.stamp_ns, read.stamp_ns);
+   EXPECT_EQ(header.index, read.index);
+   EXPECT_EQ(header.session, read.session);
+   // The last fragment is short, the others full
+   EXPECT_EQ(-1, raspiudp_read_header(datagram, RASPIUDP_HEADER_BYTES + 100, &read));
+   header.index = 1;
+   raspiudp_write_header(&header, datagram);
+   EXPECT_EQ(0, raspiudp_read_header(datagram, RASPIUDP_HEADER_BYTES + 100, &read));
+   // No parity fragment without parity
+   header.index = 3;
+   raspiudp_write_header(&header, datagram);
+   EXPECT_EQ(-1, raspiudp_read_header(datagram, RASPIUDP_HEADER_BYTES + 100, &read));
+   datagram[0] = 0;
+   EXPECT_EQ(-1, raspiudp_read_header(datagram, RASPIUDP_HEADER_BYTES + 100, &read));
+}
+
+TEST_F(UdpTest, RefusesToSendUnopened) {
+   const uint8_t frame[1] = { 0 };
+
+   EXPECT_EQ(-1, raspiudp_sender_open(&sender, "127.0.0.1", PORT, "", 1, 64, 0));
+   EXPECT_EQ(-1, raspiudp_send(&sender, 0, 0, frame, 1));
+   EXPECT_EQ(EBADF, errno);
+   ASSERT_EQ(0, raspiudp_sender_open(&sender, "127.0.0.1", PORT, "", 1, MTU, 0));
+   raspiudp_sender_close(&sender);
+   EXPECT_EQ(-1, raspiudp_send(&sender, 0, 0, frame, 1));
+}
+
+TEST_F(UdpTest, DeliversEveryFrame) {
+   std::vector<uint8_t> frame;
+   DATAGRAMS datagrams;
+
+   ASSERT_EQ(0, raspiudp_sender_open(&sender, "127.0.0.1", PORT, "", 1, MTU, 0));
+   for (uint32_t id = 0; id < FRAMES; id++) {
+      make_frame(frame);
+      send(id, frame, datagrams);
+      EXPECT_EQ((frame.size() + MTU - 57) / (MTU - 56), datagrams.size());
+      push(datagrams, id, frame);
+   }
+   EXPECT_EQ(FRAMES, delivered);
+   EXPECT_EQ(0, mismatched);
+   EXPECT_EQ(0u, sender.errors);
+}
+
+TEST_F(UdpTest, RebuildsOneLostFragmentPerGroup) {
+   const int group = 4;
+   std::vector<uint8_t> frame;
+   DATAGRAMS datagrams, kept;
+
+   ASSERT_EQ(0, raspiudp_sender_open(&sender, "127.0.0.1", PORT, "", 1, MTU, group));
+   for (uint32_t id = 0; id < FRAMES; id++) {
+      RASPIUDP_HEADER header;
+      make_frame(frame);
+      send(id, frame, datagrams);
+      // The datagrams of each group, data and parity, one of them is lost
+      std::vector<std::vector<int> > groups((frame.size() + MTU - 57) / (MTU - 56) / group + 1);
+      for (size_t i = 0; i < datagrams.size(); i++) {
+         ASSERT_EQ(0, raspiudp_read_header(&datagrams[i][0], datagrams[i].size(), &header));
+         groups[header.index < header.fragments ? header.index / group :
+                header.index - header.fragments].push_back(i);
+      }
+      std::vector<uint8_t> lost(datagrams.size(), 0);
+      for (size_t g = 0; g < groups.size(); g++) {
+         if (!groups[g].empty())
+            lost[groups[g][rand_r(&seed) % groups[g].size()]] = 1;
+      }
+      kept.clear();
+      for (size_t i = 0; i < datagrams.size(); i++) {
+         if (!lost[i])
+            kept.push_back(datagrams[i]);
+      }
+      push(kept, id, frame);
+   }
+   EXPECT_EQ(FRAMES, delivered);
+   EXPECT_EQ(0, mismatched);
+   EXPECT_GT(receiver.rebuilt, 0u);
+   EXPECT_EQ(0u, receiver.dropped);
+}
+
+TEST_F(UdpTest, PutsReorderedDatagramsBackTogether) {
+   std::vector<uint8_t> frame;
+   DATAGRAMS datagrams;
+
+   ASSERT_EQ(0, raspiudp_sender_open(&sender, "127.0.0.1", PORT, "", 1, MTU, 8));
+   for (uint32_t id = 0; id < FRAMES; id++) {
+      make_frame(frame);
+      send(id, frame, datagrams);
+      if (id % 2) {
+         std::reverse(datagrams.begin(), datagrams.end());
+      } else {
+         for (size_t i = datagrams.size(); i > 1; i--)
+            std::swap(datagrams[i - 1], datagrams[rand_r(&seed) % i]);
+      }
+      // A duplicate is ignored
+      const std::vector<uint8_t> twice = datagrams[0];
+      datagrams.insert(datagrams.begin() + 1, twice);
+      push(datagrams, id, frame);
+   }
+   EXPECT_EQ(FRAMES, delivered);
+   EXPECT_EQ(0, mismatched);
+   EXPECT_EQ(0u, receiver.late);
+}
+
+TEST_F(UdpTest, DropsFramesLostBeyondParityAndCarriesOn) {
+   std::vector<uint8_t> frame;
+   DATAGRAMS datagrams;
+   RASPIUDP_FRAME out;
+
+   ASSERT_EQ(0, raspiudp_sender_open(&sender, "127.0.0.1", PORT, "", 1, MTU, 0));
+   make_frame(frame);
+   frame.resize(2000);
+   send(0, frame, datagrams);
+   // The first fragment never comes
+   datagrams.erase(datagrams.begin());
+   push(datagrams, 0, frame);
+   EXPECT_EQ(0, delivered);
+   send(1, frame, datagrams);
+   push(datagrams, 1, frame);
+   EXPECT_EQ(1, delivered);
+   EXPECT_EQ(0, mismatched);
+   EXPECT_EQ(1u, receiver.dropped);
+
+   // Frame 0 is over, its datagrams are late
+   send(0, frame, datagrams);
+   EXPECT_EQ(0, raspiudp_push(&receiver, &datagrams[0][0], datagrams[0].size(), &out));
+   EXPECT_EQ(1u, receiver.late);
+}
+
+TEST_F(UdpTest, SurvivesRandomLossOverTheLoopback) {
+   std::vector<std::vector<uint8_t> > frames(FRAMES);
+   RASPIUDP_FRAME out;
+
+   ASSERT_EQ(0, raspiudp_sender_open(&sender, "127.0.0.1", PORT, "", 1, 1500, 8));
+   receiver.loss = 0.02;
+   for (uint32_t id = 0; id < FRAMES; id++) {
+      make_frame(frames[id]);
+      frames[id].resize(20000 + frames[id].size());
+      ASSERT_EQ(0, raspiudp_send(&sender, id, id * 1000ull, &frames[id][0],
+                                 frames[id].size()));
+      while (raspiudp_receive(&receiver, 5, &out) == 1) {
+         ASSERT_LT(out.frame_id, FRAMES);
+         delivered++;
+         if (out.data != frames[out.frame_id] || out.stamp_ns != out.frame_id * 1000ull)
+            mismatched++;
+      }
+   }
+   EXPECT_GT(receiver.discarded, 0u);
+   EXPECT_GT(receiver.rebuilt, 0u);
+   // Most of the losses are rebuilt, a frame lost is dropped, not mangled
+   EXPECT_GT(delivered, FRAMES * 8 / 10);
+   EXPECT_EQ(0, mismatched);
+   EXPECT_EQ(FRAMES, delivered + (int)receiver.dropped + (int)(receiver.slots[0].used +
+             receiver.slots[1].used + receiver.slots[2].used + receiver.slots[3].used));
+}
+
+TEST_F(UdpTest, FollowsARestartedSender) {
+   std::vector<uint8_t> frame;
+   DATAGRAMS datagrams;
+
+   ASSERT_EQ(0, raspiudp_sender_open(&sender, "127.0.0.1", PORT, "", 1, MTU, 0));
+   for (uint32_t id = 1000; id < 1010; id++) {
+      make_frame(frame);
+      send(id, frame, datagrams);
+      push(datagrams, id, frame);
+   }
+   raspiudp_sender_close(&sender);
+   // A new session, the frame ids start again
+   const uint16_t session = sender.session;
+   do {
+      ASSERT_EQ(0, raspiudp_sender_open(&sender, "127.0.0.1", PORT, "", 1, MTU, 0));
+      if (sender.session == session)
+         raspiudp_sender_close(&sender);
+   } while (sender.fd < 0);
+   for (uint32_t id = 0; id < 10; id++) {
+      make_frame(frame);
+      send(id, frame, datagrams);
+      push(datagrams, id, frame);
+   }
+   EXPECT_EQ(20, delivered);
+   EXPECT_EQ(0, mismatched);
+   EXPECT_EQ(0u, receiver.late);
+   EXPECT_EQ(1u, receiver.restarts);
+}
+
+TEST_F(UdpTest, RefusesFramesOverTheMaximumBeforeAllocating) {
+   std::vector<uint8_t> frame, forged(RASPIUDP_HEADER_BYTES + 65535);
+   DATAGRAMS datagrams;
+   RASPIUDP_HEADER header;
+   RASPIUDP_FRAME out;
+
+   // A well formed header claiming a frame of almost 4 GB
+   header.frame_id = 1;
+   header.stamp_ns = 0;
+   header.frame_bytes = 65535u * 65535u;
+   header.index = 0;
+   header.fragments = 65535;
+   header.fragment_bytes = 65535;
+   header.group = 0;
+   header.session = receiver.session + 1;
+   raspiudp_write_header(&header, &forged[0]);
+   EXPECT_EQ(0, raspiudp_push(&receiver, &forged[0], forged.size(), &out));
+   EXPECT_EQ(1u, receiver.invalid);
+   EXPECT_EQ(0, receiver.slots[0].used);
+   EXPECT_TRUE(receiver.slots[0].data.empty());
+   // Nor did it start a session
+   EXPECT_NE(header.session, receiver.session);
+
+   ASSERT_EQ(0, raspiudp_sender_open(&sender, "127.0.0.1", PORT, "", 1, MTU, 0));
+   receiver.max_frame_bytes = 1000;
+   frame.assign(1001, 1);
+   send(0, frame, datagrams);
+   push(datagrams, 0, frame);
+   EXPECT_EQ(0, delivered);
+   EXPECT_EQ(1u + datagrams.size(), receiver.invalid);
+   frame.assign(1000, 2);
+   send(1, frame, datagrams);
+   push(datagrams, 1, frame);
+   EXPECT_EQ(1, delivered);
+   EXPECT_EQ(0, mismatched);
+}
+
+int main(int argc, char** argv) {
+   testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,80 @@
+/**
+ * \file test_watchdog.cpp
+ * Tests of the stall watchdog, RaspiWatchdog.h
+ */
+#include <gtest/gtest.h>
+
+#include "RaspiWatchdog.h"
+
+#define STALL_US  100000
+
+class WatchdogTest : public ::testing::Test {
+protected:
+   virtual void SetUp() {
+      raspiwatchdog_init(&watchdog, STALL_US, 0);
+   }
+
+   /// Check at a time and carry out the step asked for straight away
+   int check(int64_t last_callback_us, int64_t now_us) {
+      const int step = raspiwatchdog_check(&watchdog, last_callback_us, now_us);
+      if (step > RASPIWATCHDOG_NONE)
+         raspiwatchdog_done(&watchdog, now_us);
+      return step;
+   }
+
+   RASPIWATCHDOG_STATE watchdog;
+};
+
+TEST_F(WatchdogTest, QuietWhileFramesCome) {
+   for (int64_t now = 0; now < 10 * STALL_US; now += STALL_US / 3)
+      EXPECT_EQ(RASPIWATCHDOG_NONE, check(now, now + STALL_US / 2));
+   EXPECT_EQ(0u, watchdog.stalls);
+}
+
+TEST_F(WatchdogTest, StepsUpOneStallTimeApart) {
+   EXPECT_EQ(RASPIWATCHDOG_NONE, check(0, STALL_US));
+   EXPECT_EQ(RASPIWATCHDOG_REFILL, check(0, STALL_US + 1));
+   EXPECT_EQ(1u, watchdog.stalls);
+   EXPECT_EQ(RASPIWATCHDOG_NONE, check(0, 2 * STALL_US));
+   EXPECT_EQ(RASPIWATCHDOG_RECAPTURE, check(0, 2 * STALL_US + 2));
+   EXPECT_EQ(RASPIWATCHDOG_REBUILD, check(0, 3 * STALL_US + 3));
+   // Rebuilds again until the frames come back
+   EXPECT_EQ(RASPIWATCHDOG_REBUILD, check(0, 4 * STALL_US + 4));
+   EXPECT_EQ(1u, watchdog.stalls);
+}
+
+TEST_F(WatchdogTest, AStepHasAStallTimeFromWhenItWasDone) {
+   EXPECT_EQ(RASPIWATCHDOG_REFILL, check(0, STALL_US + 1));
+   // A slow step, done long after it was asked for
+   ASSERT_EQ(RASPIWATCHDOG_RECAPTURE, raspiwatchdog_check(&watchdog, 0, 2 * STALL_US + 2));
+   raspiwatchdog_done(&watchdog, 5 * STALL_US);
+   EXPECT_EQ(RASPIWATCHDOG_NONE, check(0, 6 * STALL_US));
+   EXPECT_EQ(RASPIWATCHDOG_REBUILD, check(0, 6 * STALL_US + 1));
+}
+
+TEST_F(WatchdogTest, RecordsTheRecovery) {
+   EXPECT_EQ(RASPIWATCHDOG_REFILL, check(10, STALL_US + 20));
+   EXPECT_EQ(RASPIWATCHDOG_RECAPTURE, check(10, 2 * STALL_US + 30));
+   EXPECT_EQ(RASPIWATCHDOG_RECOVERED, check(2 * STALL_US + 50, 2 * STALL_US + 60));
+   EXPECT_EQ(RASPIWATCHDOG_RECAPTURE, watchdog.recovered_by);
+   EXPECT_EQ(1u, watchdog.recovered[RASPIWATCHDOG_RECAPTURE]);
+   EXPECT_EQ(2 * STALL_US + 40, watchdog.outage_us);
+   EXPECT_EQ(STALL_US + 30, watchdog.recover_us);
+
+   // Running again, the next stall starts from the refill
+   EXPECT_EQ(RASPIWATCHDOG_NONE, check(3 * STALL_US, 3 * STALL_US + 10));
+   EXPECT_EQ(RASPIWATCHDOG_REFILL, check(3 * STALL_US, 4 * STALL_US + 1));
+   EXPECT_EQ(2u, watchdog.stalls);
+}
+
+TEST(WatchdogNameTest, NamesTheSteps) {
+   EXPECT_STREQ("refill", raspiwatchdog_step_name(RASPIWATCHDOG_REFILL));
+   EXPECT_STREQ("recapture", raspiwatchdog_step_name(RASPIWATCHDOG_RECAPTURE));
+   EXPECT_STREQ("rebuild", raspiwatchdog_step_name(RASPIWATCHDOG_REBUILD));
+   EXPECT_STREQ("none", raspiwatchdog_step_name(RASPIWATCHDOG_NONE));
+}
+
+int main(int argc, char** argv) {
+   testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}